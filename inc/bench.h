@@ -0,0 +1,16 @@
+// © 2024 Oskar Arnudd
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+// Micro-benchmarks of the hot paths, timed with TIM2 in timebase cycles
+// (HSI16 periods, see timebase.h). Each case runs BENCH_SAMPLES times with
+// interrupts masked around the timed call only, and the cost of reading
+// the timebase is subtracted.
+#define BENCH_SAMPLES (16)
+
+void bench_command(const char* args);
+
+#endif
@@ -0,0 +1,31 @@
+// © 2024 Oskar Arnudd
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdint.h>
+
+// Timestamps of the boot phases, in the order init() reaches them. Time
+// zero is the timebase starting, the first thing init() does; the startup
+// code before main() runs ahead of any timer and is not covered.
+typedef enum{
+    BOOT_PHASE_START = 0,       // Timebase running
+    BOOT_PHASE_CLOCK = 1,       // Interrupt priorities and clocks set up
+    BOOT_PHASE_STORE = 2,       // Settings loaded, pending update checked
+    BOOT_PHASE_FIRST_FRAME = 3, // First frame latched
+    BOOT_PHASE_CLI = 4,
+    BOOT_PHASE_IRDECODER = 5,
+    BOOT_PHASE_POWER = 6,
+    BOOT_PHASE_BT = 7,
+    BOOT_PHASE_SCHED = 8,       // Scheduler entered
+    BOOT_PHASE_BANNER = 9,      // Deferred banner queued
+    BOOT_PHASE_COUNT = 10,
+} boot_phase_t;
+
+void boot_init(void);
+
+void boot_mark(boot_phase_t phase);
+
+void boot_print(const char* args);
+
+#endif
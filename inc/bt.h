@@ -5,10 +5,26 @@
 
 #include <stdint.h>
 
+#define BT_BAUDRATE (9600)
+
+// The link is open only while something holds it. USART3 cannot wake the
+// core from Stop mode, and its RX pin shares EXTI line 9 with the IR
+// receiver, so an open link keeps the core out of Stop.
+typedef enum{
+    BT_USER_REPL = 1 << 0, // "bt on", kept in the settings store
+    BT_USER_SYNC = 1 << 1, // A sync role, see sync.h
+} bt_user_t;
+
 void bt_init(void);
 
 void bt_deinit(void);
 
+void bt_claim(bt_user_t user);
+
+void bt_release(bt_user_t user);
+
+void bt_command(const char* args);
+
 void bt_send_string(char* string);
 
 void bt_send_byte(uint8_t byte);
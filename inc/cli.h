@@ -7,22 +7,32 @@
 #include <stdbool.h>
 
 // Forward declarations
-typedef struct ring_buffer_t ring_buffer_t;
+typedef struct ring_t ring_t;
 
+#define CLI_BAUDRATE (115200)
+#define CLI_LINE_SIZE (64) // Bytes, power of two
+#define CLI_RAW_CHUNK (64) // Bytes per write of a raw memory dump, on the stack
 #define COMMAND_MAX_LENGTH (16)
 #define COMMAND_MAX_AMOUNT (3)
 
 typedef char command_t[COMMAND_MAX_AMOUNT][COMMAND_MAX_LENGTH];
 
-typedef struct{
-    const char* command;
-    void (*handler)(const char* args);
-} command_entry_t;
+typedef enum{
+    CLI_STATUS_OK = 0,
+    CLI_STATUS_EMPTY = 1,
+    CLI_STATUS_INVALID_COMMAND = 2,
+    CLI_STATUS_MISSING_ARGUMENT = 3,
+    CLI_STATUS_TOO_LONG = 4,
+} cli_status_t;
 
 void cli_init(int (*restart_function)(void));
 
 void cli_deinit(void);
 
+void cli_set_muted(bool mute);
+
+void cli_write_raw(const uint8_t* bytes, uint32_t length);
+
 void cli_clear(void);
 
 void cli_home(void);
@@ -37,34 +47,56 @@ void cli_printline(const char *string);
 
 void cli_print_number(uint32_t number);
 
+void cli_print_hex(uint32_t value, uint8_t digits);
+
+void cli_print_padded(const char* string, uint8_t width);
+
+void cli_print_number_padded(uint32_t number, uint8_t width);
+
 void cli_newline(void);
 
 void cli_backspace(void);
 
-void cli_tokenize(ring_buffer_t* ring_buffer, command_t tokens, char* token_length);
+void cli_tokenize(ring_t* ring, command_t tokens, char* token_length);
 
-void cli_parse_command(command_t tokens, char token_length);
+cli_status_t cli_parse_command(command_t tokens, char token_length);
+
+cli_status_t cli_execute(const uint8_t* line, uint8_t length);
+
+void cli_prompt(void);
+
+void cli_complete(void);
 
 void cli_process_input(void);
 
-bool cli_parse_application_command(command_t tokens, char token_length);
+const char* cli_next_arg(const char* args, char* arg, uint8_t size);
+
+bool cli_parse_number(const char* string, uint32_t* number);
 
 void cli_memdump_bin(const char* args);
 
 void cli_memdump_hex(const char *args);
 
+void cli_memdump_raw(const char *args);
+
 void cli_restart(const char* args);
 
 void cli_print_help(const char* args);
 
-void cli_print_library_help();
-
-void cli_print_application_help();
-
 void cli_print_welcome_message(void);
 
 void cli_dump_hex_from_address(uint32_t address);
 
+void cli_dump_hex_range(uint32_t address, uint32_t length);
+
+void cli_dump_raw_range(uint32_t address, uint32_t length);
+
+uint32_t cli_raw_begin(uint32_t length);
+
+uint32_t cli_raw_write(const uint8_t* bytes, uint32_t length, uint32_t crc);
+
+void cli_raw_end(uint32_t crc);
+
 void cli_dump_bin_from_address(uint32_t address);
 
 void cli_led_config(char* function, char* led);
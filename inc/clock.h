@@ -0,0 +1,39 @@
+// © 2024 Oskar Arnudd
+
+#ifndef CLOCK_H
+#define CLOCK_H
+
+#include <stdint.h>
+
+#define CLOCK_HSI16_HZ (16000000U)
+
+typedef enum{
+    CLOCK_PROFILE_LOW = 0,    // HSI16 / 8, idle and battery use
+    CLOCK_PROFILE_NORMAL = 1, // HSI16, the reset clock
+    CLOCK_PROFILE_FAST = 2,   // PLL from HSI16, for heavy animation modes
+    CLOCK_PROFILE_COUNT = 3,
+} clock_profile_t;
+
+void clock_init(void);
+
+void clock_deinit(void);
+
+clock_profile_t clock_profile(void);
+
+uint32_t clock_hz(void);
+
+uint32_t clock_usart_brr(uint32_t kernel_hz, uint32_t baudrate);
+
+uint16_t clock_timer_psc(uint32_t tick_hz);
+
+uint8_t clock_spi_br(uint32_t max_hz);
+
+void clock_apply_timings(void);
+
+void clock_set_profile(clock_profile_t profile);
+
+void clock_restore(void);
+
+void clock_command(const char* args);
+
+#endif
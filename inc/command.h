@@ -0,0 +1,42 @@
+// © 2024 Oskar Arnudd
+
+#ifndef COMMAND_H
+#define COMMAND_H
+
+#include <stdint.h>
+
+typedef enum{
+    COMMAND_ARGS_NONE = 0,
+    COMMAND_ARGS_OPTIONAL = 1,
+    COMMAND_ARGS_REQUIRED = 2,
+} command_args_t;
+
+typedef struct{
+    const char* name;
+    void (*handler)(const char* args);
+    command_args_t args;
+    uint8_t section;
+    const char* usage;
+    const char* help;
+} command_def_t;
+
+typedef struct{
+    const char* name;
+    uint8_t def;
+} command_name_t;
+
+const command_def_t* command_find(const char* name);
+
+uint8_t command_id(const command_def_t* def);
+
+uint32_t command_name_hash(const char* name);
+
+const command_def_t* command_find_hash(uint32_t hash);
+
+uint8_t command_complete(const char* prefix, uint8_t length, char* completion, uint8_t size);
+
+void command_print_matches(const char* prefix, uint8_t length);
+
+void command_print_help(void);
+
+#endif
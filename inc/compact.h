@@ -0,0 +1,45 @@
+// © 2024 Oskar Arnudd
+
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Single byte control for slow links, where every byte costs about 1 ms at
+// 9600 baud. Opcodes have the top bit set, so they never collide with REPL
+// text on the same link, and are neither echoed nor answered in text.
+//
+// Setters carry their value in the low nibble. Every opcode is answered by
+// the setters for the settings it changed, a state delta, followed by ACK,
+// or by NAK alone. Setters between BEGIN and COMMIT are staged and applied
+// together on the next frame, answered once at COMMIT.
+
+typedef enum{
+    COMPACT_ACK = 0x80,
+    COMPACT_STATE = 0x81,        // Answered by every setter, a full state
+    COMPACT_PATTERN_NEXT = 0x82,
+    COMPACT_PATTERN_PREV = 0x83,
+    COMPACT_FASTER = 0x84,
+    COMPACT_SLOWER = 0x85,
+    COMPACT_TOGGLE = 0x86,
+    COMPACT_BEGIN = 0x88,
+    COMPACT_COMMIT = 0x89,
+    COMPACT_NAK = 0x8F,
+    COMPACT_PATTERN = 0x90,      // | led_pattern_t
+    COMPACT_SPEED = 0xA0,        // | speed level 1 - 5
+    COMPACT_BRIGHTNESS = 0xB0,   // | brightness 1 - 8
+    COMPACT_POWER = 0xC0,        // | 0 off, 1 on
+} compact_opcode_t;
+
+#define COMPACT_OPCODE_MASK (0xF0)
+#define COMPACT_VALUE_MASK (0x0F)
+
+static inline bool compact_is_opcode(uint8_t byte)
+{
+    return byte & 0x80;
+}
+
+void compact_receive(uint8_t byte);
+
+#endif
@@ -0,0 +1,118 @@
+// © 2024 Oskar Arnudd
+
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdint.h>
+
+#ifdef HOST
+
+// The host build hands PRIMASK and WFI to the simulator, see sim/
+#include "sim.h"
+
+#define CPU_RAMFUNC SIM_RAMFUNC
+
+static inline void cpu_irq_enable(void)
+{
+    sim_irq_enable();
+}
+
+static inline void cpu_irq_disable(void)
+{
+    sim_irq_disable();
+}
+
+static inline uint32_t cpu_irq_save(void)
+{
+    return sim_irq_save();
+}
+
+static inline void cpu_irq_restore(uint32_t primask)
+{
+    sim_irq_restore(primask);
+}
+
+static inline void cpu_wait_for_interrupt(void)
+{
+    sim_wait_for_interrupt();
+}
+
+static inline void cpu_set_msp(uint32_t stack)
+{
+    sim_set_msp(stack);
+}
+
+static inline void cpu_barrier(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// The host stack stands in for the target's, see src/stack.c
+static inline uintptr_t cpu_get_sp(void)
+{
+    return (uintptr_t)__builtin_frame_address(0);
+}
+
+#else
+
+// For code that must not fetch from flash, such as while it is erased. The
+// linker script copies .data to RAM, and calls from flash need long_call.
+#define CPU_RAMFUNC __attribute__((section(".data.ramfunc"), noinline, long_call))
+
+static inline void cpu_irq_enable(void)
+{
+    __asm volatile ("cpsie i" ::: "memory");
+}
+
+static inline void cpu_irq_disable(void)
+{
+    __asm volatile ("cpsid i" ::: "memory");
+}
+
+// Masks interrupts and returns the previous PRIMASK, for critical sections
+// that may already run with interrupts masked
+static inline uint32_t cpu_irq_save(void)
+{
+    uint32_t primask;
+
+    __asm volatile ("mrs %0, primask" : "=r" (primask));
+    __asm volatile ("cpsid i" ::: "memory");
+    return primask;
+}
+
+static inline void cpu_irq_restore(uint32_t primask)
+{
+    __asm volatile ("msr primask, %0" :: "r" (primask) : "memory");
+}
+
+// Sleeps until an interrupt is pending, even one masked by PRIMASK
+static inline void cpu_wait_for_interrupt(void)
+{
+    __asm volatile ("wfi" ::: "memory");
+}
+
+// Orders memory accesses for data shared with interrupts. The M0+ does not
+// reorder them, this mostly keeps the compiler from doing so.
+static inline void cpu_barrier(void)
+{
+    __asm volatile ("dmb" ::: "memory");
+}
+
+// Everything runs on MSP, in thread mode as well as in handlers
+static inline uintptr_t cpu_get_sp(void)
+{
+    uintptr_t sp;
+
+    __asm volatile ("mov %0, sp" : "=r" (sp));
+    return sp;
+}
+
+// For handing over to another image, whose reset handler is called next
+static inline void cpu_set_msp(uint32_t stack)
+{
+    __asm volatile ("msr msp, %0" :: "r" (stack));
+}
+
+#endif
+
+#endif
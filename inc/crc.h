@@ -0,0 +1,17 @@
+// © 2024 Oskar Arnudd
+
+#ifndef CRC_H
+#define CRC_H
+
+#include <stdint.h>
+
+#define CRC16_INIT (0xFFFF)
+#define CRC32_INIT (0xFFFFFFFF)
+
+uint16_t crc16(const uint8_t* data, uint32_t length, uint16_t crc);
+
+// CRC-32 as used by zlib, chainable: pass CRC32_INIT first and invert the
+// final value
+uint32_t crc32(const uint8_t* data, uint32_t length, uint32_t crc);
+
+#endif
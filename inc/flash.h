@@ -0,0 +1,29 @@
+// © 2024 Oskar Arnudd
+
+#ifndef FLASH_H
+#define FLASH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Programming and erasing of the main flash. The STM32G071 has a single
+// bank, so the core stalls on every flash fetch until an operation ends:
+// a double word takes ~85 us and a page erase up to 22 ms.
+//
+// A reset in the middle of programming a double word can leave it failing
+// ECC, and reading it then raises an NMI. Data that may have been cut short
+// so is read with flash_read, which reports such a double word instead, and
+// flash_program of all zeros over it, which the flash allows on any double
+// word, turns it into one that reads back cleanly.
+
+#define FLASH_BASE_ADDRESS (0x08000000U)
+#define FLASH_PAGE_SIZE (2048U)
+#define FLASH_PAGE(address) (((address) - FLASH_BASE_ADDRESS) / FLASH_PAGE_SIZE)
+
+bool flash_read(uint32_t address, uint32_t* low, uint32_t* high);
+
+bool flash_program(uint32_t address, uint32_t low, uint32_t high);
+
+bool flash_erase(uint8_t page);
+
+#endif
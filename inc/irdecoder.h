@@ -7,6 +7,21 @@
 
 #define ADDRESS (0x20)
 
+// TIM16 measures the gap between falling and rising edges in 2us ticks
+#define IRDECODER_TICK_HZ (500000U)
+#define IRDECODER_US(us) ((us) / (1000000U / IRDECODER_TICK_HZ))
+#define IRDECODER_BIT_MIN_US (400)   // Shorter gaps are noise
+#define IRDECODER_BIT_MAX_US (2000)  // Longer gaps are the leader
+#define IRDECODER_BIT_ONE_US (1000)  // Gaps from here on are ones
+#define IRDECODER_TIMEOUT_US (7000)  // Silence that ends a frame
+
+// Worst tolerable delay between an edge and its timestamp, a fraction of
+// the 400us noise threshold
+#define IRDECODER_EDGE_BUDGET_US (20)
+
+#define IRDECODER_BUTTONS (20)
+#define IRDECODER_ARG_LENGTH (12) // Longest argument irbind stores
+
 typedef enum{
     IR_KP_0  = 0x10,
     IR_KP_1  = 0x11,
@@ -30,6 +45,12 @@ typedef enum{
     IR_PW    = 0x8,
 }ir_command;
 
+typedef enum{
+    IRDECODER_ACCEPTED,
+    IRDECODER_WRONG_ADDRESS,
+    IRDECODER_BAD_CHECKSUM,
+} irdecoder_result_t;
+
 typedef struct{
     char id;
     char* arg;
@@ -44,4 +65,12 @@ void irdecoder_set_commands(const command_callback_t* commands, uint8_t count);
 
 void irdecoder_process(void);
 
+irdecoder_result_t irdecoder_decode(const uint16_t* times, uint8_t* decoded);
+
+void irdecoder_probe(void);
+
+void irdecoder_bind_command(const char* args);
+
+void irdecoder_restore(void);
+
 #endif
@@ -0,0 +1,40 @@
+// © 2024 Oskar Arnudd
+
+#ifndef IRQ_H
+#define IRQ_H
+
+#include <stdint.h>
+
+// Interrupt numbers on the STM32G071, RM0444 table 54
+typedef enum{
+    IRQ_EXTI4_15 = 7,
+    IRQ_TIM6_DAC_LPTIM1 = 17,
+    IRQ_TIM14 = 19,
+    IRQ_TIM16 = 21,
+    IRQ_USART2 = 28,
+    IRQ_USART3 = 29,
+} irq_t;
+
+// The M0+ has four levels, 0 preempts everything else. IR edges are
+// timestamped in software, so nothing may hold them off; UART RX must drain
+// before the next byte lands; LED frame timing only posts work. PendSV runs
+// the deferred rendering below all of them.
+typedef enum{
+    IRQ_PRIORITY_IR_EDGE = 0,
+    IRQ_PRIORITY_UART = 1,
+    IRQ_PRIORITY_IR_FRAME = 1,
+    IRQ_PRIORITY_FRAME = 2,
+    IRQ_PRIORITY_DEFERRED = 3,
+} irq_priority_t;
+
+void irq_init(void);
+
+void irq_deinit(void);
+
+void irq_set_priority(irq_t irq, irq_priority_t priority);
+
+irq_priority_t irq_get_priority(irq_t irq);
+
+void irq_defer(void);
+
+#endif
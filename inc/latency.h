@@ -0,0 +1,34 @@
+// © 2024 Oskar Arnudd
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stdint.h>
+
+typedef enum{
+    LATENCY_PATH_TEXT = 0,
+    LATENCY_PATH_BINARY = 1,
+    LATENCY_PATH_COMPACT = 2,
+    LATENCY_PATH_COUNT = 3,
+} latency_path_t;
+
+// Command-to-LED latency, from a complete command arriving to the next latch,
+// in microseconds. IR edge latency uses the same fields in timebase cycles.
+typedef struct{
+    uint32_t last;
+    uint32_t min;
+    uint32_t max;
+    uint32_t count;
+} latency_stat_t;
+
+void latency_start(latency_path_t path);
+
+void latency_process(void);
+
+const latency_stat_t* latency_get(latency_path_t path);
+
+void latency_edge(uint32_t cycles);
+
+void latency_print(const char* args);
+
+#endif
@@ -6,14 +6,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-typedef void (*led_message_cb_t)(const char* message);
-
-typedef enum{
-    PATTERN_BINARY = 0,
-    PATTERN_WAVE = 1,
-    PATTERN_ALTERNATING = 2,
-    PATTERN_BOUNCE = 3,
-} led_pattern_t;
+#include "pattern.h"
 
 typedef enum{
     SPEED_SLOWER = 1000,
@@ -25,22 +18,60 @@ typedef enum{
 
 typedef struct{
     bool active;
+    bool blank; // Clearing the LEDs on the next deferred update
+    bool due;   // A frame is to be rendered on the next deferred update
+    bool lit;   // The frame, rather than nothing, is on the LEDs
+    bool lit_target; // Where the duty cycle wants lit to be
+    bool fresh; // The frame has not been shown yet
     uint16_t tick;
-    uint16_t count;
+    pattern_cursor_t cursor;
+    uint16_t frame;
+    uint8_t brightness;
+    uint8_t phase;
     led_pattern_t pattern;
     led_speed_t speed;
 } led_state_t;
 
-#define LED_BOUNCE_RESET 252
+// Settings changed together by led_apply(), speed as level 1-5
+typedef struct{
+    led_pattern_t pattern;
+    uint8_t speed;
+    uint8_t brightness;
+    bool active;
+} led_settings_t;
+
+typedef enum{
+    LED_SET_PATTERN = 1 << 0,
+    LED_SET_SPEED = 1 << 1,
+    LED_SET_BRIGHTNESS = 1 << 2,
+    LED_SET_ACTIVE = 1 << 3,
+    LED_SET_ALL = 0xF,
+} led_set_t;
+
+#define LED_NO_DEADLINE 0xFFFF
+#define LED_TICK_HZ (1000000U)   // TIM14 counter clock
+#define LED_TICK_COUNTS (LED_TICK_HZ / 1000U) // TIM14 counts per 1 ms tick
+#define LED_SPI_MAX_HZ (62500U)  // Shift register clock ceiling
+#define LED_PATTERN_COUNT (6)
+#define LED_USER_FRAMES (32)
+#define LED_SPEED_LEVELS (5)
+// Brightness is a software duty cycle over this many 1 ms steps, 125 Hz
+#define LED_BRIGHTNESS_MAX (8)
 
 void led_init(void);
 
 void led_deinit(void);
 
-void led_set_message_cb(led_message_cb_t led_message_cb);
+bool led_tick(void);
+
+bool led_duty_tick(void);
 
 void led_update(void);
 
+uint16_t led_next_frame_ms(void);
+
+void led_advance(uint32_t ms);
+
 void led_toggle_pattern(const char* args);
 
 void led_set_pattern(const char* args);
@@ -55,8 +86,46 @@ void led_toggle(const char* args);
 
 void led_toggle_verbosity(const char* args);
 
+void led_brightness_set(const char* args);
+
+void led_apply(const led_settings_t* settings, uint8_t mask);
+
+void led_get(led_settings_t* settings);
+
+bool led_pattern_available(uint8_t pattern);
+
+void led_user_pattern(const char* args);
+
+void led_save(void);
+
 void led_reset(void);
 
 void led_state_reset(void);
 
+uint32_t led_latch_count(void);
+
+uint32_t led_latch_time(void);
+
+uint16_t led_frame_ms(void);
+
+bool led_sync_cursor(pattern_cursor_t* cursor);
+
+void led_sync_set(const pattern_cursor_t* cursor);
+
+void led_sync_seek(pattern_cursor_t* cursor, uint16_t count, uint16_t ahead);
+
+void led_sync_shift(int32_t ms);
+
+void led_sync_trim(int32_t value);
+
+void led_bench_begin(void);
+
+void led_bench_end(void);
+
+void led_bench_frame(led_pattern_t pattern);
+
+void led_bench_spi(uint8_t br);
+
+void led_bench_send(uint16_t data);
+
 #endif
@@ -0,0 +1,47 @@
+// © 2024 Oskar Arnudd
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#include "log_messages.h"
+
+// Build with LOG_STRINGS=0 to leave the message texts out of flash. Records
+// are then printed as "#<id>:<arg>@<cycles>" and rendered on the host.
+#ifndef LOG_STRINGS
+#define LOG_STRINGS (1)
+#endif
+
+#define LOG_BUFFER_SIZE (32) // Records, power of two
+
+typedef enum{
+    LOG_ARG_NONE = 0,
+    LOG_ARG_NUMBER = 1,
+    LOG_ARG_PATTERN = 2,
+    LOG_ARG_SPEED = 3,
+} log_arg_t;
+
+#define LOG_MESSAGE(id, text, arg) id,
+typedef enum{
+    LOG_MESSAGES
+    LOG_MESSAGE_COUNT
+} log_id_t;
+#undef LOG_MESSAGE
+
+typedef struct{
+    uint32_t timestamp;
+    uint16_t arg;
+    uint8_t id;
+    uint8_t reserved;
+} log_record_t;
+
+typedef void (*log_sink_t)(const char* line);
+
+void log_event(log_id_t id, uint16_t arg);
+
+void log_set_sink(log_sink_t sink);
+
+void log_process(void);
+
+#endif
@@ -0,0 +1,31 @@
+// © 2024 Oskar Arnudd
+
+#ifndef LOG_MESSAGES_H
+#define LOG_MESSAGES_H
+
+// Every message the firmware can log, as LOG_MESSAGE(id, text, argument).
+// The position in this list is the id sent over the wire in compact mode,
+// so only ever append, and tools/log_render.py reads this file to turn the
+// ids back into text on the host.
+#define LOG_MESSAGES \
+    LOG_MESSAGE(LOG_INVALID_PATTERN, "Invalid pattern: ",            LOG_ARG_NUMBER)  \
+    LOG_MESSAGE(LOG_PATTERN,         "Changing pattern to: ",        LOG_ARG_PATTERN) \
+    LOG_MESSAGE(LOG_SPEED,           "Changing speed to: ",          LOG_ARG_SPEED)   \
+    LOG_MESSAGE(LOG_SPEED_FASTEST,   "Already at fastest speed..",   LOG_ARG_NONE)    \
+    LOG_MESSAGE(LOG_SPEED_SLOWEST,   "Already at slowest speed..",   LOG_ARG_NONE)    \
+    LOG_MESSAGE(LOG_SPEED_BOUNDS,    "Speed not in bounds (1 - 5)",  LOG_ARG_NONE)    \
+    LOG_MESSAGE(LOG_STOP,            "Stopping.",                    LOG_ARG_NONE)    \
+    LOG_MESSAGE(LOG_START,           "Starting.",                    LOG_ARG_NONE)    \
+    LOG_MESSAGE(LOG_SILENT,          "Silent mode.",                 LOG_ARG_NONE)    \
+    LOG_MESSAGE(LOG_VERBOSE,         "Verbose mode.",                LOG_ARG_NONE)    \
+    LOG_MESSAGE(LOG_LOST,            "Log overflow, records lost: ", LOG_ARG_NUMBER)  \
+    LOG_MESSAGE(LOG_BRIGHTNESS,      "Changing brightness to: ",     LOG_ARG_NUMBER)  \
+    LOG_MESSAGE(LOG_BRIGHTNESS_BOUNDS, "Brightness not in bounds (1 - 8)", LOG_ARG_NONE)
+
+// Names for LOG_ARG_PATTERN, indexed by led_pattern_t
+#define LOG_PATTERN_NAMES { "Binary", "Wave", "Alternating", "Bounce", "User", "Fill" }
+
+// Names for LOG_ARG_SPEED, indexed by speed level 1 - 5
+#define LOG_SPEED_NAMES { "", "Slowest", "Slow", "Normal", "Fast", "Fastest" }
+
+#endif
@@ -7,6 +7,8 @@ int main(void);
 
 void init(void);
 
+void jump_to_bootloader(const char* args);
+
 void TIM14_IRQHandler(void);
 
 #endif
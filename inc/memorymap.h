@@ -0,0 +1,18 @@
+// © 2024 Oskar Arnudd
+
+#ifndef MEMORYMAP_H
+#define MEMORYMAP_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MEMORYMAP_FLASH_START (0x08000000)
+#define MEMORYMAP_FLASH_END   (0x08020000)
+#define MEMORYMAP_SRAM_START  (0x20000000)
+#define MEMORYMAP_SRAM_END    (0x20009000)
+
+bool memorymap_is_valid_address(uint32_t address);
+
+bool memorymap_is_valid_range(uint32_t address, uint32_t length);
+
+#endif
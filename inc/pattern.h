@@ -0,0 +1,52 @@
+// © 2024 Oskar Arnudd
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Frame generation for the LED patterns, without hardware or state of its
+// own, so that host tools link the same code the firmware runs. The frame
+// tables are compiled from patterns/ by tools/gen_patterns.py.
+
+typedef enum{
+    PATTERN_BINARY = 0,
+    PATTERN_WAVE = 1,
+    PATTERN_ALTERNATING = 2,
+    PATTERN_BOUNCE = 3,
+    PATTERN_USER = 4, // Frames uploaded with the userpattern command
+    PATTERN_FILL = 5,
+} led_pattern_t;
+
+// Frames uploaded at run time, for PATTERN_USER
+typedef struct{
+    const uint16_t* frames;
+    uint8_t length;
+} pattern_user_t;
+
+// Where a pattern is at, kept by the caller from one frame to the next and
+// cleared with pattern_restart() when the pattern changes
+typedef struct{
+    uint16_t count;  // Frames rendered, wrapping on a whole cycle
+    uint16_t offset; // Next token of a compressed stream
+    uint16_t frame;  // Last decoded frame, which the next delta applies to
+    uint16_t delta;  // Applied for the rest of the run
+    uint8_t run;     // Frames left in the current token
+} pattern_cursor_t;
+
+// Frames compressed by tools/gen_patterns.py, decoded one at a time
+typedef struct{
+    const uint8_t* data;
+    uint16_t size;
+} pattern_stream_t;
+
+void pattern_restart(pattern_cursor_t* cursor);
+
+bool pattern_render(led_pattern_t pattern, pattern_cursor_t* cursor, const pattern_user_t* user, uint16_t* frame);
+
+void pattern_seek(led_pattern_t pattern, pattern_cursor_t* cursor, const pattern_user_t* user, uint16_t count);
+
+uint32_t pattern_length(led_pattern_t pattern, const pattern_user_t* user);
+
+#endif
@@ -0,0 +1,96 @@
+// © 2024 Oskar Arnudd
+
+#ifndef PERF_H
+#define PERF_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+#include "stack.h"
+#include "timebase.h"
+#include "trace.h"
+
+typedef enum{
+    PERF_ISR_TIM14 = 0,
+    PERF_ISR_EXTI = 1,
+    PERF_ISR_TIM16 = 2,
+    PERF_ISR_USART2 = 3,
+    PERF_ISR_USART3 = 4,
+    PERF_ISR_PENDSV = 5,
+    PERF_ISR_COUNT = 6,
+} perf_isr_t;
+
+typedef enum{
+    PERF_SPI_TIMEOUT = 0,
+    PERF_IR_ACCEPTED = 1,
+    PERF_IR_ADDRESS = 2,
+    PERF_IR_CHECKSUM = 3,
+    PERF_USART_OVERRUN = 4,
+    PERF_RX_OVERFLOW = 5,
+    PERF_LINE_OVERFLOW = 6,
+    PERF_IR_EDGE_LATE = 7,
+    PERF_COUNTER_COUNT = 8,
+} perf_counter_t;
+
+// Durations are in TIM2 cycles
+typedef struct{
+    uint32_t count;
+    uint32_t max;
+    uint64_t total;
+    uint32_t stack; // Deepest stack in use on entry, bytes
+} perf_isr_stat_t;
+
+extern perf_isr_stat_t perf_isr[PERF_ISR_COUNT];
+extern uint32_t perf_counters[PERF_COUNTER_COUNT];
+extern uint32_t perf_loops;
+
+// Wrapped around the body of an ISR, also marking it in the trace:
+//     uint32_t start = perf_isr_enter(PERF_ISR_TIM14);
+//     ...
+//     perf_isr_exit(PERF_ISR_TIM14, start);
+static inline uint32_t perf_isr_enter(perf_isr_t isr)
+{
+    uint32_t depth = stack_depth();
+    if(depth > perf_isr[isr].stack){
+	perf_isr[isr].stack = depth;
+    }
+
+    trace_record(TRACE_ISR_ENTER, isr);
+    return timebase_now();
+}
+
+static inline void perf_isr_exit(perf_isr_t isr, uint32_t start)
+{
+    uint32_t cycles = timebase_now() - start;
+    trace_record(TRACE_ISR_EXIT, isr);
+    perf_isr_stat_t* stat = &perf_isr[isr];
+
+    stat->count++;
+    stat->total += cycles;
+    if(cycles > stat->max){
+	stat->max = cycles;
+    }
+}
+
+// Counters are bumped from ISRs and the main loop alike
+static inline void perf_count(perf_counter_t counter)
+{
+    uint32_t primask = cpu_irq_save();
+    perf_counters[counter]++;
+    cpu_irq_restore(primask);
+}
+
+static inline void perf_loop(void)
+{
+    perf_loops++;
+}
+
+void perf_process(void);
+
+void perf_reset(void);
+
+void perf_print(const char* args);
+
+const char* perf_isr_name(perf_isr_t isr);
+
+#endif
@@ -0,0 +1,25 @@
+// © 2024 Oskar Arnudd
+
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Below this many milliseconds to the next frame, plain WFI sleep is used
+#define POWER_STOP_MIN_MS (5)
+
+// How early LPTIM1 wakes the core ahead of a frame deadline
+#define POWER_STOP_MARGIN_MS (2)
+
+void power_init(void);
+
+void power_deinit(void);
+
+void power_idle(void);
+
+void power_note_action(void);
+
+void power_command(const char* args);
+
+#endif
@@ -0,0 +1,58 @@
+// © 2024 Oskar Arnudd
+
+#ifndef PROTO_H
+#define PROTO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Binary machine-control mode sharing a link with the REPL, on one link at
+// a time.
+//
+// The mode is entered by sending PROTO_ENTER_SEQUENCE while in text mode and
+// left by PROTO_EXIT_SEQUENCE or an exit frame. Both are matched byte by byte
+// as they arrive, nothing has to follow them. In between, every frame is
+// COBS encoded and terminated by 0x00, and decodes to:
+//
+//   [seq][type][payload...][crc16 lo][crc16 hi]
+//
+// with the CRC-16/CCITT-FALSE taken over seq, type and payload. A command
+// frame batches several command lines as [length][text] records, all run
+// through the command registry and answered by one ack holding a status per
+// command. Resending the last sequence number repeats its ack without running
+// the commands again. Update frames stream a firmware image, see update.h.
+
+#define PROTO_ENTER_SEQUENCE { 0x00, 0xFF, 'B', 'M' }
+#define PROTO_EXIT_SEQUENCE  { 0x00, 0xFF, 'T', 'M' }
+
+#define PROTO_FRAME_MAX (64)
+#define PROTO_BATCH_MAX (8)
+
+typedef enum{
+    PROTO_TYPE_COMMAND = 0x01,
+    PROTO_TYPE_PING = 0x02,
+    PROTO_TYPE_EXIT = 0x03,
+    PROTO_TYPE_LATENCY = 0x04,
+    PROTO_TYPE_UPDATE_BEGIN = 0x05, // See update.h
+    PROTO_TYPE_UPDATE_DATA = 0x06,
+    PROTO_TYPE_UPDATE_END = 0x07,
+    PROTO_TYPE_ACK = 0x81,
+    PROTO_TYPE_NAK = 0x82,
+} proto_type_t;
+
+typedef enum{
+    PROTO_NAK_CRC = 1,
+    PROTO_NAK_FORMAT = 2,
+    PROTO_NAK_TYPE = 3,
+    PROTO_NAK_OVERFLOW = 4,
+} proto_nak_t;
+
+bool proto_active(void);
+
+// Index holds how much of the enter sequence the link has sent so far, one
+// per link starting at 0, so that bytes of two links do not mix
+bool proto_detect(uint8_t* index, uint8_t byte);
+
+void proto_receive(uint8_t byte);
+
+#endif
@@ -0,0 +1,122 @@
+// © 2024 Oskar Arnudd
+
+#ifndef REGS_H
+#define REGS_H
+
+#include <stdint.h>
+
+// Registers and bits the stm32g071rb library does not cover, from RM0444
+
+#ifdef HOST
+#include "sim.h"
+#define REG32(address) (*sim_reg(address))
+#else
+#define REG32(address) (*(volatile uint32_t*)(address))
+#endif
+
+// Peripherals reached through a stored pointer, the host build has to see
+// these accesses as well
+#ifdef HOST
+#define PERIPH(pointer) ((__typeof__(pointer))sim_reg((uint32_t)(uintptr_t)(pointer)))
+#else
+#define PERIPH(pointer) (pointer)
+#endif
+
+// System control block
+#define SCB_SCR             REG32(0xE000ED10)
+#define SCB_SCR_SLEEPDEEP   (1U << 2)
+#define SCB_ICSR            REG32(0xE000ED04)
+#define SCB_ICSR_PENDSVCLR  (1U << 27)
+#define SCB_ICSR_PENDSVSET  (1U << 28)
+#define SCB_SHPR3           REG32(0xE000ED20)
+#define SCB_SHPR3_PENDSV_POS (16 + 6)
+#define SCB_AIRCR           REG32(0xE000ED0C)
+#define SCB_AIRCR_VECTKEY   (0x05FAU << 16)
+#define SCB_AIRCR_SYSRESETREQ (1U << 2)
+
+// NVIC priorities, four per word and only word accessible on the M0+, two
+// implemented bits at the top of each byte
+#define NVIC_IPR(irqn)      REG32(0xE000E400 + 4 * ((irqn) / 4))
+#define NVIC_IPR_POS(irqn)  (8 * ((irqn) % 4) + 6)
+#define NVIC_IPR_MSK        (0x3U)
+
+// Power control
+#define PWR_CR1             REG32(0x40007000)
+#define PWR_CR1_LPMS_MSK    (0x7U << 0)
+#define PWR_CR1_LPMS_STOP1  (0x1U << 0)
+
+// Flash interface
+#define FLASH_ACR           REG32(0x40022000)
+#define FLASH_ACR_LATENCY_MSK (0x7U << 0)
+#define FLASH_ACR_PRFTEN    (1U << 8)
+#define FLASH_ACR_ICEN      (1U << 9)
+#define FLASH_KEYR          REG32(0x40022008)
+#define FLASH_KEY1          (0x45670123U)
+#define FLASH_KEY2          (0xCDEF89ABU)
+#define FLASH_SR            REG32(0x40022010)
+#define FLASH_SR_EOP        (1U << 0)
+#define FLASH_SR_ERRORS     (0x3FAU) // OPERR, PROGERR to FASTERR
+#define FLASH_SR_BSY1       (1U << 16)
+#define FLASH_SR_CFGBSY     (1U << 18)
+#define FLASH_CR            REG32(0x40022014)
+#define FLASH_CR_PG         (1U << 0)
+#define FLASH_CR_PER        (1U << 1)
+#define FLASH_CR_PNB(page)  ((page) << 3)
+#define FLASH_CR_STRT       (1U << 16)
+#define FLASH_CR_LOCK       (1U << 31)
+#define FLASH_ECCR          REG32(0x40022018)
+#define FLASH_ECCR_ADDR_MSK (0x3FFFU << 0)  // Double word with the error
+#define FLASH_ECCR_ECCD     (1U << 31)      // Double error, raises an NMI
+
+// RCC bits
+#define RCC_CR_PLLON        (1U << 24)
+#define RCC_CR_PLLRDY       (1U << 25)
+#define RCC_CFGR_SW_MSK     (0x7U << 0)
+#define RCC_CFGR_SW_HSISYS  (0x0U << 0)
+#define RCC_CFGR_SW_PLLR    (0x2U << 0)
+#define RCC_CFGR_SWS_MSK    (0x7U << 3)
+#define RCC_CFGR_SWS(sw)    ((sw) << 3)
+#define RCC_CFGR_HPRE_MSK   (0xFU << 8)
+#define RCC_CFGR_HPRE_DIV1  (0x0U << 8)
+#define RCC_CFGR_HPRE_DIV8  (0xAU << 8)
+#define RCC_PLLCFGR_PLLSRC_HSI16 (0x2U << 0)
+#define RCC_PLLCFGR_PLLM(m) (((m) - 1) << 4)
+#define RCC_PLLCFGR_PLLN(n) ((n) << 8)
+#define RCC_PLLCFGR_PLLREN  (1U << 28)
+#define RCC_PLLCFGR_PLLR(r) (((r) - 1) << 29)
+#define RCC_APB1_PWR        (1U << 28)
+#define RCC_APB1_LPTIM1     (1U << 31)
+#define RCC_CSR_LSION       (1U << 0)
+#define RCC_CSR_LSIRDY      (1U << 1)
+#define RCC_CCIPR_USART2SEL_MSK   (0x3U << 2)
+#define RCC_CCIPR_USART2SEL_HSI16 (0x2U << 2)
+#define RCC_CCIPR_LPTIM1SEL_MSK   (0x3U << 18)
+#define RCC_CCIPR_LPTIM1SEL_LSI   (0x1U << 18)
+
+// USART bits
+#define USART_CR1_UESM      (1U << 1)
+#define USART_ISR_BUSY      (1U << 16)
+
+// Low-power timer 1
+#define LPTIM1_ISR          REG32(0x40007C00)
+#define LPTIM1_ICR          REG32(0x40007C04)
+#define LPTIM1_IER          REG32(0x40007C08)
+#define LPTIM1_CFGR         REG32(0x40007C0C)
+#define LPTIM1_CR           REG32(0x40007C10)
+#define LPTIM1_ARR          REG32(0x40007C18)
+#define LPTIM1_CNT          REG32(0x40007C1C)
+#define LPTIM_ISR_ARRM      (1U << 1)
+#define LPTIM_ISR_ARROK     (1U << 4)
+#define LPTIM_CFGR_PRESC_32 (0x5U << 9)
+#define LPTIM_CR_ENABLE     (1U << 0)
+#define LPTIM_CR_SNGSTRT    (1U << 1)
+
+// EXTI direct wakeup lines
+#define EXTI_IMR1_USART2    (1U << 26)
+#define EXTI_IMR1_LPTIM1    (1U << 29)
+#define EXTI_SWIER1_SWI9    (1U << 9)
+
+// NVIC lines
+#define NVIC_TIM6_DAC_LPTIM1 (1U << 17)
+
+#endif
@@ -0,0 +1,62 @@
+// © 2024 Oskar Arnudd
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "timebase.h"
+
+#define REPLAY_SIZE (512) // Entries, recording stops when they run out
+
+// Input the firmware reacts to, recorded so that a run can be played again
+// with the same timing. The UART sources match transport_id_t.
+typedef enum{
+    REPLAY_CONSOLE = 0, // value: byte received on USART2
+    REPLAY_BT = 1,      // value: byte received on USART3
+    REPLAY_IR = 2,      // value: level of PD9 after the edge
+} replay_source_t;
+
+// Timestamps in timebase cycles from the start of the recording,
+// tools/replay2script.py decodes these
+typedef struct{
+    uint32_t timestamp;
+    uint8_t source;
+    uint8_t value;
+    uint16_t reserved;
+} replay_entry_t;
+
+extern replay_entry_t replay_buffer[REPLAY_SIZE];
+extern volatile uint32_t replay_count;
+extern volatile bool replay_recording;
+extern uint32_t replay_start;
+
+static inline void replay_record(replay_source_t source, uint8_t value)
+{
+    if(!replay_recording){
+	return;
+    }
+
+    uint32_t timestamp = timebase_now() - replay_start;
+    uint32_t primask = cpu_irq_save();
+    uint32_t index = replay_count;
+    if(index < REPLAY_SIZE){
+	replay_count = index + 1;
+    }else{
+	replay_recording = false;
+    }
+    cpu_irq_restore(primask);
+
+    if(index < REPLAY_SIZE){
+	replay_buffer[index].timestamp = timestamp;
+	replay_buffer[index].source = source;
+	replay_buffer[index].value = value;
+	replay_buffer[index].reserved = 0;
+    }
+}
+
+void replay_command(const char* args);
+
+#endif
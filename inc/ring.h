@@ -0,0 +1,54 @@
+// © 2024 Oskar Arnudd
+
+#ifndef RING_H
+#define RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Byte queue for one producer and one consumer, each of which may be an
+// interrupt. The producer only moves head and the consumer only tail, both
+// counting freely and wrapping by the mask, and data is published before
+// the index that covers it. Spans expose the contiguous run at either end
+// for bulk copies and in-place parsing, committed once done with.
+typedef struct ring_t{
+    uint8_t* data;
+    uint32_t mask;
+    volatile uint32_t head; // Written by the producer only
+    volatile uint32_t tail; // Written by the consumer only
+} ring_t;
+
+// size must be a power of two
+void ring_init(ring_t* ring, uint8_t* data, uint32_t size);
+
+uint32_t ring_count(const ring_t* ring);
+
+bool ring_empty(const ring_t* ring);
+
+// Producer side
+bool ring_put(ring_t* ring, uint8_t byte);
+
+uint32_t ring_write(ring_t* ring, const uint8_t* bytes, uint32_t length);
+
+uint32_t ring_write_span(ring_t* ring, uint8_t** span);
+
+void ring_write_commit(ring_t* ring, uint32_t length);
+
+// Consumer side
+bool ring_get(ring_t* ring, uint8_t* byte);
+
+uint32_t ring_read(ring_t* ring, uint8_t* bytes, uint32_t length);
+
+uint32_t ring_peek(const ring_t* ring, uint8_t* bytes, uint32_t length);
+
+uint32_t ring_read_span(ring_t* ring, const uint8_t** span);
+
+void ring_read_commit(ring_t* ring, uint32_t length);
+
+void ring_discard(ring_t* ring);
+
+// Takes back the newest byte, only for a queue whose producer and consumer
+// are the same thread, such as a line being edited
+bool ring_unput(ring_t* ring);
+
+#endif
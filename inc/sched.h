@@ -0,0 +1,35 @@
+// © 2024 Oskar Arnudd
+
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stdint.h>
+
+// Run-to-completion tasks in priority order, lowest number first. Interrupts
+// only post tasks, the work itself runs from sched_run() in thread mode, and
+// the core sleeps through power_idle() whenever nothing is pending. Deferred
+// tasks run from PendSV instead, preempting thread mode but no interrupt.
+typedef enum{
+    SCHED_TASK_LED = 0,
+    SCHED_TASK_IR = 1,
+    SCHED_TASK_CLI = 2,
+    SCHED_TASK_LOG = 3,
+    SCHED_TASK_HOUSEKEEPING = 4,
+    SCHED_TASK_COUNT = 5,
+} sched_task_t;
+
+#define SCHED_HOUSEKEEPING_MS (100)
+
+typedef void (*sched_handler_t)(void);
+
+void sched_post(sched_task_t task);
+
+void sched_defer(sched_task_t task);
+
+void sched_tick(void);
+
+uint32_t sched_idle_cycles(void);
+
+void sched_run(const sched_handler_t* handlers) __attribute__((noreturn));
+
+#endif
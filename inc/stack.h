@@ -0,0 +1,32 @@
+// © 2024 Oskar Arnudd
+
+#ifndef STACK_H
+#define STACK_H
+
+#include <stdint.h>
+
+#include "cpu.h"
+
+// Stack usage measured at run time. The free RAM below the stack is painted
+// at startup and the deepest word no longer holding the paint is the high
+// water mark, sampled from housekeeping. The ISRs note how deep the stack
+// is when they are entered, see perf_isr_enter().
+
+#define STACK_PAINT (0xC5C5C5C5U)
+#define STACK_SAMPLE_MS (1000)
+
+extern uintptr_t stack_top;
+
+// Bytes of stack in use at the call
+static inline uint32_t stack_depth(void)
+{
+    return stack_top - cpu_get_sp();
+}
+
+void stack_init(void);
+
+void stack_process(void);
+
+void stack_command(const char* args);
+
+#endif
@@ -0,0 +1,70 @@
+// © 2024 Oskar Arnudd
+
+#ifndef STORE_H
+#define STORE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Settings kept in flash as an append-only log of 8-byte records over two
+// pages, taking turns so that each is erased once per page of changes.
+//
+// Every record is one double word, the flash programming unit:
+//
+//   [key][index][crc16 lo][crc16 hi][value, 32-bit little endian]
+//
+// with the CRC-16/CCITT-FALSE over key, index and value, so a record cut
+// short by a reset is recognised and ignored. One left failing ECC is read
+// without the NMI taking the boot down and cleared to zeros, see flash.h.
+// Slot 0 of a page is its header, holding the page generation, and is
+// written last when a page is filled by compaction, so a half-copied page
+// is never taken as current.
+// A boot scans the current page once into a RAM cache, every get and set
+// after that only touches the cache. Sets are coalesced in RAM and written
+// from housekeeping once no link, IR frame or close LED frame is in the way.
+
+#define STORE_BASE (0x0801F000U) // Last two pages, kept out of the application
+#define STORE_PAGE_FIRST (62)    // Page number of STORE_BASE
+#define STORE_PAGES (2)
+#define STORE_PAGE_SIZE (2048U)
+#define STORE_SLOTS (STORE_PAGE_SIZE / 8)
+#define STORE_VERSION (1)
+
+#define STORE_ENTRIES (128)      // Distinct key and index pairs held
+#define STORE_COALESCE_MS (1000) // Quiet time after a set before writing
+#define STORE_ERASE_MS (25)      // Page erase stall, 22 ms worst case
+#define STORE_ERASE_FORCE_MS (10000) // Erasing regardless after this long
+
+// Append only, the values identify records in flash
+typedef enum{
+    STORE_KEY_HEADER = 0x00,     // value: page generation
+    STORE_KEY_PATTERN = 0x01,    // value: led_pattern_t
+    STORE_KEY_SPEED = 0x02,      // value: speed level 1 - 5
+    STORE_KEY_BRIGHTNESS = 0x03, // value: 1 - LED_BRIGHTNESS_MAX
+    STORE_KEY_ACTIVE = 0x04,     // value: animation running
+    STORE_KEY_VERBOSE = 0x05,    // value: status messages enabled
+    STORE_KEY_IRBIND = 0x06,     // index: button * 4, value: command name
+				 // hash, the next three hold argument characters
+    STORE_KEY_USER_LENGTH = 0x07, // value: user pattern frame count
+    STORE_KEY_USER_FRAME = 0x08, // index: frame, value: LED bits
+    STORE_KEY_UPDATE = 0x09,     // index 0: staged image size, 0 when none,
+				 // index 1: its CRC-32
+    STORE_KEY_BT = 0x0A,         // value: Bluetooth REPL open
+    STORE_KEY_EMPTY = 0xFF,
+} store_key_t;
+
+void store_init(void);
+
+bool store_get(store_key_t key, uint8_t index, uint32_t* value);
+
+void store_set(store_key_t key, uint8_t index, uint32_t value);
+
+bool store_dirty(void);
+
+void store_process(void);
+
+void store_sync(void);
+
+void store_command(const char* args);
+
+#endif
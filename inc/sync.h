@@ -0,0 +1,41 @@
+// © 2024 Oskar Arnudd
+
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdint.h>
+
+// Keeps the animations of boards side by side in step over USART3, the
+// master's TX wired to the RX of every follower. On a frame tick about once
+// a second the master sends a beacon:
+//
+//   [0xA5][pattern | active << 7][speed level][count lo][count hi]
+//   [age lo][age hi][seq][crc16 lo][crc16 hi]
+//
+// count is where the pattern is on that tick and age the microseconds from
+// the tick to the beacon going out. A follower works out when the tick was
+// on its own clock and steers its frame ticks towards it: by whole
+// milliseconds at once, and the rest by trimming the TIM14 period with a
+// PI loop, whose integral ends up holding the rate difference between the
+// two HSI oscillators. Settings or a pattern position that differ are taken
+// over outright. The link carries no REPL while following.
+
+#define SYNC_MAGIC (0xA5)
+#define SYNC_BEACON_LENGTH (10)
+#define SYNC_BEACON_MS (1000)
+#define SYNC_TRIM_MAX (20 * 65536) // 2 % of a 1 ms tick, in 1/65536 TIM14 counts
+#define SYNC_LOCK_US (500)         // Skew within which the follower counts as locked
+
+typedef enum{
+    SYNC_OFF = 0,
+    SYNC_MASTER = 1,
+    SYNC_FOLLOWER = 2,
+} sync_role_t;
+
+void sync_frame(uint32_t time, uint16_t count);
+
+void sync_process(void);
+
+void sync_command(const char* args);
+
+#endif
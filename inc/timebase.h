@@ -0,0 +1,25 @@
+// © 2024 Oskar Arnudd
+
+#ifndef TIMEBASE_H
+#define TIMEBASE_H
+
+#include <stdint.h>
+
+// TIM2 stands in for the cycle counter the Cortex-M0+ lacks. It ticks at
+// 16 MHz in every clock profile, so a "cycle" here is one HSI16 period. It
+// wraps after ~268 s, so only differences between two timestamps are
+// meaningful.
+#define TIMEBASE_HZ (16000000U)
+#define TIMEBASE_CYCLES_PER_US (TIMEBASE_HZ / 1000000U)
+
+void timebase_init(void);
+
+void timebase_deinit(void);
+
+void timebase_set_clock(uint32_t hz);
+
+uint32_t timebase_now(void);
+
+uint32_t timebase_to_us(uint32_t cycles);
+
+#endif
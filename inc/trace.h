@@ -0,0 +1,59 @@
+// © 2024 Oskar Arnudd
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cpu.h"
+#include "timebase.h"
+
+#ifndef TRACE_SIZE
+#define TRACE_SIZE (256) // Entries, power of two
+#endif
+
+// Append only, tools/trace2json.py decodes these by value
+typedef enum{
+    TRACE_ISR_ENTER = 0,     // arg: perf_isr_t
+    TRACE_ISR_EXIT = 1,      // arg: perf_isr_t
+    TRACE_SPI_BEGIN = 2,     // arg: frame data
+    TRACE_LED_FRAME = 3,     // arg: frame data, at the latch pulse
+    TRACE_IR_EDGE = 4,       // arg: TIM16 count, bit 15 set on a rising edge
+    TRACE_IR_DECODE = 5,     // arg: command, 0xFFxx when rejected
+    TRACE_COMMAND = 6,       // arg: index into src/commands.txt
+    TRACE_UART_RX = 7,       // arg: received byte
+    TRACE_UART_TX_BEGIN = 8, // arg: byte count, 0 when unknown up front
+    TRACE_UART_TX_END = 9,   // arg: byte count
+} trace_event_t;
+
+typedef struct{
+    uint32_t timestamp;
+    uint16_t event;
+    uint16_t arg;
+} trace_entry_t;
+
+extern trace_entry_t trace_buffer[TRACE_SIZE];
+extern volatile uint32_t trace_head;
+extern volatile bool trace_enabled;
+
+// Reserving the slot is the only part that needs interrupts masked
+static inline void trace_record(trace_event_t event, uint16_t arg)
+{
+    if(!trace_enabled){
+	return;
+    }
+
+    uint32_t timestamp = timebase_now();
+    uint32_t primask = cpu_irq_save();
+    trace_entry_t* entry = &trace_buffer[trace_head++ & (TRACE_SIZE - 1)];
+    cpu_irq_restore(primask);
+
+    entry->timestamp = timestamp;
+    entry->event = event;
+    entry->arg = arg;
+}
+
+void trace_command(const char* args);
+
+#endif
@@ -0,0 +1,67 @@
+// © 2024 Oskar Arnudd
+
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "ring.h"
+
+// Library headers
+#include "usart.h"
+
+// Interrupt driven byte links the REPL is served over. Received bytes land
+// in a ring buffer and post the CLI task; written bytes are queued and
+// drained by the TXE interrupt, so no interrupt ever waits on the line.
+typedef enum{
+    TRANSPORT_CONSOLE = 0, // USART2, ST-LINK virtual COM port
+    TRANSPORT_BT = 1,      // USART3, HC-05 style Bluetooth module
+    TRANSPORT_COUNT = 2,
+} transport_id_t;
+
+#define TRANSPORT_RX_SIZE (64)  // Bytes, power of two
+#define TRANSPORT_TX_SIZE (256) // Bytes, power of two
+
+// Takes received bytes from the ISR instead of the ring, with the timebase
+// cycle they arrived at
+typedef void (*transport_receiver_t)(uint8_t byte, uint32_t time);
+
+typedef struct{
+    USART_t* usart;
+    bool open;
+    bool wakeup; // Receives while in Stop mode
+    transport_receiver_t receiver;
+    ring_t rx;
+    ring_t tx;
+    uint8_t rx_data[TRANSPORT_RX_SIZE];
+    uint8_t tx_data[TRANSPORT_TX_SIZE];
+} transport_t;
+
+transport_t* transport_get(transport_id_t id);
+
+void transport_open(transport_id_t id, USART_t* usart, bool wakeup);
+
+void transport_close(transport_id_t id);
+
+uint32_t transport_write(transport_t* transport, const uint8_t* bytes, uint32_t length);
+
+void transport_write_all(transport_t* transport, const uint8_t* bytes, uint32_t length);
+
+bool transport_read(transport_t* transport, uint8_t* byte);
+
+uint32_t transport_read_bulk(transport_t* transport, uint8_t* bytes, uint32_t length);
+
+bool transport_pending(transport_t* transport);
+
+void transport_flush(transport_t* transport);
+
+bool transport_idle(transport_t* transport);
+
+void transport_set_receiver(transport_id_t id, transport_receiver_t receiver);
+
+bool transport_busy(void);
+
+bool transport_stop_allowed(void);
+
+#endif
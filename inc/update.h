@@ -0,0 +1,79 @@
+// © 2024 Oskar Arnudd
+
+#ifndef UPDATE_H
+#define UPDATE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Firmware update while the application keeps running. The new image is
+// streamed over the binary protocol (see proto.h) into a staging slot:
+//
+//   begin [size u32][crc32 u32]  starts a transfer
+//   data  [offset u32][bytes]    up to UPDATE_CHUNK bytes, a multiple of 8
+//                                except for the last chunk
+//   end                          checks the CRC-32 and the vector table
+//
+// Chunks must come in order, the ack of one out of order carries the offset
+// expected next, and one at a time: the next is sent once the last is
+// acked. They go into two buffers in turn. A chunk with the other buffer
+// still free is acked at once, the next one then fills that buffer, and
+// with both full the flash is written while the host waits for the second
+// ack, so that no byte arrives while the flash stalls the core. Slot pages
+// are erased as the chunks reach them.
+//
+// A verified image is recorded in the store and copied over the
+// application on the next boot, by a routine that is also written to the
+// resume page. Page 0 of the application is first erased down to one
+// double word, a stack and reset vector pointing at that copy, so that a
+// reset during the copy starts it over from the resume page. Page 0 is
+// rewritten last and its first double word last of all, so only a reset
+// while page 0 is erased finds no vector to run. The record stays until the
+// application checks out against it.
+//
+// Flash map, the bootloader the "flash" command jumps to stays untouched:
+//
+//   0x08000000  bootloader
+//   0x08004000  application        (UPDATE_SLOT_SIZE at most)
+//   0x08011000  resume page
+//   0x08011800  staging slot
+//   0x0801F000  settings store
+
+#define UPDATE_APP_BASE (0x08004000U)
+#define UPDATE_RESUME_BASE (0x08011000U)
+#define UPDATE_SLOT_BASE (0x08011800U)
+#define UPDATE_SLOT_SIZE (UPDATE_RESUME_BASE - UPDATE_APP_BASE)
+#define UPDATE_CHUNK (48)
+#define UPDATE_BUFFERS (2)
+#define UPDATE_STUB_SIZE (1024)  // Bytes of the copy routine put on the resume page
+#define UPDATE_ERASE_MS (25)     // Page erase stall, 22 ms worst case
+#define UPDATE_QUIET_MS (100)    // Waiting at most this long for a quiet moment to erase
+
+typedef enum{
+    UPDATE_OK = 0,
+    UPDATE_ERROR_SIZE = 1,   // Image larger than the slot, or empty
+    UPDATE_ERROR_STATE = 2,  // Data or end without a begin
+    UPDATE_ERROR_OFFSET = 3, // Chunk out of order
+    UPDATE_ERROR_LENGTH = 4, // Chunk too long or not a multiple of 8
+    UPDATE_ERROR_FLASH = 5,  // Erase or programming failed
+    UPDATE_ERROR_CRC = 6,    // Image CRC-32 mismatch
+    UPDATE_ERROR_IMAGE = 7,  // Vector table not linked for UPDATE_APP_BASE
+} update_status_t;
+
+void update_init(void);
+
+bool update_active(void);
+
+update_status_t update_begin(uint32_t size, uint32_t crc);
+
+update_status_t update_data(uint32_t offset, const uint8_t* data, uint8_t length);
+
+uint32_t update_expected(void);
+
+update_status_t update_end(void);
+
+void update_process(void);
+
+void update_command(const char* args);
+
+#endif
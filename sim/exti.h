@@ -0,0 +1,24 @@
+// © 2024 Oskar Arnudd
+
+#ifndef EXTI_H
+#define EXTI_H
+
+#include "lib.h"
+
+typedef struct{
+    __IO uint32_t RTSR1, FTSR1, SWIER1, RPR1, FPR1, RESERVED0[19];
+    __IO uint32_t EXTICR1, EXTICR2, EXTICR3, EXTICR4, RESERVED1[4];
+    __IO uint32_t IMR1, EMR1;
+} EXTI_t;
+
+#define EXTI SIM_PERIPH(EXTI_t, 0x40021800)
+
+#define EXTI_CR3_EXTI1_MSK (0xFFU << 8)
+#define EXTI_CR3_EXTI1(x)  ((x) << 8)
+#define EXTI_RTSR1_RT9     BIT(9)
+#define EXTI_FTSR1_FT9     BIT(9)
+#define EXTI_IMR1_IM9      BIT(9)
+#define EXTI_RPR1_RPIF9    BIT(9)
+#define EXTI_FPR1_FPIF9    BIT(9)
+
+#endif
@@ -0,0 +1,58 @@
+// © 2024 Oskar Arnudd
+
+#ifndef GPIO_H
+#define GPIO_H
+
+#include "lib.h"
+
+typedef struct{
+    __IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFRL, AFRH, BRR;
+} GPIO_t;
+
+#define GPIOA SIM_PERIPH(GPIO_t, 0x50000000)
+#define GPIOB SIM_PERIPH(GPIO_t, 0x50000400)
+#define GPIOC SIM_PERIPH(GPIO_t, 0x50000800)
+#define GPIOD SIM_PERIPH(GPIO_t, 0x50000C00)
+
+typedef enum{
+    GPIO_MODER_INPUT = 0,
+    GPIO_MODER_OUTPUT = 1,
+    GPIO_MODER_AF = 2,
+    GPIO_MODER_ANALOG = 3,
+} gpio_mode_t;
+
+typedef enum{
+    GPIO_OSPEEDR_VERYLOW = 0,
+    GPIO_OSPEEDR_LOW = 1,
+    GPIO_OSPEEDR_HIGH = 2,
+    GPIO_OSPEEDR_VERYHIGH = 3,
+} gpio_speed_t;
+
+typedef enum{
+    GPIO_PUPDR_NONE = 0,
+    GPIO_PUPDR_PULLUP = 1,
+    GPIO_PUPDR_PULLDOWN = 2,
+} gpio_pupd_t;
+
+typedef enum{
+    GPIO_OTYPER_PUSHPULL = 0,
+    GPIO_OTYPER_OPENDRAIN = 1,
+} gpio_type_t;
+
+typedef enum{
+    GPIO_AF0, GPIO_AF1, GPIO_AF2, GPIO_AF3, GPIO_AF4, GPIO_AF5, GPIO_AF6, GPIO_AF7,
+} gpio_af_t;
+
+typedef struct{
+    gpio_mode_t mode;
+    gpio_speed_t speed;
+    gpio_pupd_t pupd;
+    gpio_type_t type;
+    gpio_af_t af;
+} gpio_config_t;
+
+void gpio_config_reset(gpio_config_t* cfg);
+
+void gpio_set(GPIO_t* gpio, gpio_config_t* cfg, uint16_t pins);
+
+#endif
@@ -0,0 +1,165 @@
+// © 2024 Oskar Arnudd
+
+// Host versions of the stm32g071rb library functions the firmware calls.
+// Register writes go through the same simulated peripherals as the
+// firmware's own.
+
+// Simulator headers
+#include "gpio.h"
+#include "rcc.h"
+#include "ringbuffer.h"
+#include "utils.h"
+
+//
+// GPIO and RCC
+//
+
+void gpio_config_reset(gpio_config_t* cfg)
+{
+    cfg->mode = GPIO_MODER_ANALOG;
+    cfg->speed = GPIO_OSPEEDR_VERYLOW;
+    cfg->pupd = GPIO_PUPDR_NONE;
+    cfg->type = GPIO_OTYPER_PUSHPULL;
+    cfg->af = GPIO_AF0;
+}
+
+void gpio_set(GPIO_t* gpio, gpio_config_t* cfg, uint16_t pins)
+{
+    for(uint8_t pin = 0; pin < 16; pin++){
+	if(!(pins & (1U << pin))){
+	    continue;
+	}
+	gpio->MODER = (gpio->MODER & ~(0x3U << (2 * pin))) | ((uint32_t)cfg->mode << (2 * pin));
+	gpio->OTYPER = (gpio->OTYPER & ~(1U << pin)) | ((uint32_t)cfg->type << pin);
+	gpio->OSPEEDR = (gpio->OSPEEDR & ~(0x3U << (2 * pin))) | ((uint32_t)cfg->speed << (2 * pin));
+	gpio->PUPDR = (gpio->PUPDR & ~(0x3U << (2 * pin))) | ((uint32_t)cfg->pupd << (2 * pin));
+	if(pin < 8){
+	    gpio->AFRL = (gpio->AFRL & ~(0xFU << (4 * pin))) | ((uint32_t)cfg->af << (4 * pin));
+	}else{
+	    gpio->AFRH = (gpio->AFRH & ~(0xFU << (4 * (pin - 8)))) | ((uint32_t)cfg->af << (4 * (pin - 8)));
+	}
+    }
+}
+
+void rcc_reset_all(void)
+{
+    RCC->IOPENR = 0;
+    RCC->AHBENR = 0;
+    RCC->APBENR1 = 0;
+    RCC->APBENR2 = 0;
+}
+
+//
+// Ring buffer, size a power of two
+//
+
+void ring_buffer_create(ring_buffer_t* rb, uint8_t* buffer, uint32_t size)
+{
+    rb->buffer = buffer;
+    rb->mask = size - 1;
+    rb->read_index = 0;
+    rb->write_index = 0;
+}
+
+bool ring_buffer_write(ring_buffer_t* rb, uint8_t byte)
+{
+    if(rb->write_index - rb->read_index > rb->mask){
+	return false;
+    }
+    rb->buffer[rb->write_index & rb->mask] = byte;
+    rb->write_index++;
+    return true;
+}
+
+bool ring_buffer_read(ring_buffer_t* rb, uint8_t* byte)
+{
+    if(rb->read_index == rb->write_index){
+	return false;
+    }
+    *byte = rb->buffer[rb->read_index & rb->mask];
+    rb->read_index++;
+    return true;
+}
+
+bool ring_buffer_empty(ring_buffer_t* rb)
+{
+    return rb->read_index == rb->write_index;
+}
+
+// Takes back the byte written last
+bool ring_buffer_delete(ring_buffer_t* rb)
+{
+    if(rb->read_index == rb->write_index){
+	return false;
+    }
+    rb->write_index--;
+    return true;
+}
+
+void ring_buffer_flush(ring_buffer_t* rb)
+{
+    rb->read_index = rb->write_index;
+}
+
+//
+// Strings
+//
+
+bool utils_strings_match(const char* a, const char* b)
+{
+    while(*a && *a == *b){
+	a++;
+	b++;
+    }
+    return *a == *b;
+}
+
+uint32_t utils_strlen(const char* string)
+{
+    uint32_t length = 0;
+
+    while(string[length]){
+	length++;
+    }
+    return length;
+}
+
+uint32_t utils_string_to_number(const char* string)
+{
+    uint32_t number = 0;
+
+    while(*string >= '0' && *string <= '9'){
+	number = number * 10 + (*string++ - '0');
+    }
+    return number;
+}
+
+uint32_t utils_hexstring_to_dec(uint8_t* string)
+{
+    uint32_t number = 0;
+
+    for(; *string; string++){
+	uint8_t c = *string | 0x20; // Lower case
+	if(c >= '0' && c <= '9'){
+	    number = (number << 4) | (c - '0');
+	}else if(c >= 'a' && c <= 'f'){
+	    number = (number << 4) | (c - 'a' + 10);
+	}else{
+	    break;
+	}
+    }
+    return number;
+}
+
+// Most significant bit first, string holds length + 1 characters
+bool utils_dec_to_binarystring(uint32_t value, char* string, uint8_t length)
+{
+    if(length == 0 || length > 32){
+	return false;
+    }
+    for(uint8_t i = 0; i < length; i++){
+	string[i] = (value & (1U << (length - 1 - i))) ? '1' : '0';
+    }
+    string[length] = '\0';
+    return true;
+}
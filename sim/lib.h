@@ -0,0 +1,44 @@
+// © 2024 Oskar Arnudd
+
+#ifndef LIB_H
+#define LIB_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "sim.h"
+
+// Shared by the host stand-ins for the stm32g071rb library headers. Every
+// peripheral pointer goes through sim_reg, so the simulator sees each
+// access before it happens.
+
+#define __IO volatile
+
+#define SIM_PERIPH(type, address) ((type*)sim_reg(address))
+
+#define BIT(n) (1U << (n))
+#define BIT0  BIT(0)
+#define BIT1  BIT(1)
+#define BIT2  BIT(2)
+#define BIT3  BIT(3)
+#define BIT4  BIT(4)
+#define BIT5  BIT(5)
+#define BIT6  BIT(6)
+#define BIT7  BIT(7)
+#define BIT8  BIT(8)
+#define BIT9  BIT(9)
+#define BIT10 BIT(10)
+
+#define PIN0  BIT(0)
+#define PIN1  BIT(1)
+#define PIN2  BIT(2)
+#define PIN3  BIT(3)
+#define PIN4  BIT(4)
+#define PIN5  BIT(5)
+#define PIN6  BIT(6)
+#define PIN7  BIT(7)
+#define PIN8  BIT(8)
+#define PIN9  BIT(9)
+#define PIN10 BIT(10)
+
+#endif
@@ -0,0 +1,26 @@
+// © 2024 Oskar Arnudd
+
+#ifndef NVIC_H
+#define NVIC_H
+
+#include "lib.h"
+
+typedef struct{
+    __IO uint32_t ISER0;
+    uint32_t RESERVED0[31];
+    __IO uint32_t ICER0;
+    uint32_t RESERVED1[31];
+    __IO uint32_t ISPR0;
+    uint32_t RESERVED2[31];
+    __IO uint32_t ICPR0;
+} NVIC_t;
+
+#define NVIC SIM_PERIPH(NVIC_t, 0xE000E100)
+
+#define NVIC_EXTI4_15          BIT(7)
+#define NVIC_TIM14             BIT(19)
+#define NVIC_TIM16_FDCAN_IT0   BIT(21)
+#define NVIC_USART2_LPUART2    BIT(28)
+#define NVIC_USART3_6_LPUART1  BIT(29)
+
+#endif
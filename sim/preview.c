@@ -0,0 +1,304 @@
+// © 2024 Oskar Arnudd
+
+// Renders LED patterns on the host with the firmware's own src/pattern.c,
+// built by "make preview":
+//
+//   build/host/preview [-p pattern] [-n frames] [-s ms] [-u 0xNNNN,...]
+//                      [-o term | csv | gif] [file]
+//   build/host/preview -b [-n frames]
+//
+// term plays the animation in the terminal at the frame period, csv and
+// gif write the frames to the file or stdout. Every output ends with a
+// CRC-32 over the frames, which changes whenever a pattern renders
+// differently. -b times the render path for every pattern.
+
+// Standard library headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+// Firmware headers
+#include "crc.h"
+#include "led.h"
+#include "log_messages.h"
+#include "pattern.h"
+
+#define PREVIEW_CELL (12)      // GIF pixels per LED, with a gap of a quarter
+#define PREVIEW_BENCH_FRAMES (10000000U)
+
+static const char* const pattern_names[] = LOG_PATTERN_NAMES;
+
+static uint16_t user_frames[LED_USER_FRAMES];
+static pattern_user_t user = { user_frames, 0 };
+
+typedef enum{
+    OUTPUT_TERM,
+    OUTPUT_CSV,
+    OUTPUT_GIF,
+} output_t;
+
+static int preview_pattern(const char* name)
+{
+    for(uint8_t i = 0; i < LED_PATTERN_COUNT; i++){
+	if(!strcasecmp(name, pattern_names[i])){
+	    return i;
+	}
+    }
+    return -1;
+}
+
+static void preview_user(const char* list)
+{
+    while(*list && user.length < LED_USER_FRAMES){
+	char* end;
+	user_frames[user.length++] = strtoul(list, &end, 0);
+	if(*end != ','){
+	    break;
+	}
+	list = end + 1;
+    }
+}
+
+static uint32_t preview_crc(uint32_t crc, uint16_t frame)
+{
+    uint8_t bytes[2] = { frame, frame >> 8 };
+    return crc32(bytes, 2, crc);
+}
+
+static void preview_term(led_pattern_t pattern, uint32_t frames, uint32_t ms)
+{
+    pattern_cursor_t cursor = {0};
+    uint32_t crc = CRC32_INIT;
+
+    for(uint32_t i = 0; i < frames; i++){
+	uint16_t frame;
+	pattern_render(pattern, &cursor, &user, &frame);
+	crc = preview_crc(crc, frame);
+
+	printf("\r%6u  ", i);
+	for(int8_t bit = 15; bit >= 0; bit--){
+	    printf((frame & (1U << bit)) ? "\x1B[1;33m#\x1B[0m" : "\x1B[2m.\x1B[0m");
+	}
+	fflush(stdout);
+	usleep(ms * 1000);
+    }
+    printf("\nCRC-32 0x%08X\n", ~crc);
+}
+
+static void preview_csv(FILE* file, led_pattern_t pattern, uint32_t frames, uint32_t ms)
+{
+    pattern_cursor_t cursor = {0};
+    uint32_t crc = CRC32_INIT;
+
+    fprintf(file, "frame,ms,value");
+    for(int8_t bit = 15; bit >= 0; bit--){
+	fprintf(file, ",led%d", bit);
+    }
+    fprintf(file, "\n");
+
+    for(uint32_t i = 0; i < frames; i++){
+	uint16_t frame;
+	pattern_render(pattern, &cursor, &user, &frame);
+	crc = preview_crc(crc, frame);
+
+	fprintf(file, "%u,%u,0x%04X", i, i * ms, frame);
+	for(int8_t bit = 15; bit >= 0; bit--){
+	    fprintf(file, ",%u", (frame >> bit) & 1);
+	}
+	fprintf(file, "\n");
+    }
+    fprintf(stderr, "CRC-32 0x%08X\n", ~crc);
+}
+
+// GIF images go out with LZW codes of 8 bits: 7 bit literals, and a clear
+// code often enough that the code table never grows a ninth bit. Twice the
+// size of real compression, and no encoder to get wrong.
+static void preview_gif_image(FILE* file, const uint8_t* pixels, uint32_t length)
+{
+    uint8_t* codes = malloc(length + length / 120 + 2);
+    uint32_t used = 0;
+
+    for(uint32_t i = 0; i < length; i++){
+	if(i % 120 == 0){
+	    codes[used++] = 0x80;           // Clear
+	}
+	codes[used++] = pixels[i];
+    }
+    codes[used++] = 0x81;                   // End of information
+
+    fputc(7, file);
+    for(uint32_t i = 0; i < used; i += 255){
+	uint8_t size = (used - i < 255) ? used - i : 255;
+	fputc(size, file);
+	fwrite(&codes[i], 1, size, file);
+    }
+    fputc(0, file);
+    free(codes);
+}
+
+static void preview_gif(FILE* file, led_pattern_t pattern, uint32_t frames, uint32_t ms)
+{
+    static const uint8_t palette[4][3] = {
+	{ 0x10, 0x10, 0x10 },   // Board
+	{ 0x40, 0x20, 0x00 },   // LED off
+	{ 0xFF, 0xB0, 0x20 },   // LED on
+	{ 0x10, 0x10, 0x10 },
+    };
+    uint16_t width = 16 * PREVIEW_CELL;
+    uint16_t height = PREVIEW_CELL;
+    uint8_t* pixels = malloc(width * height);
+    pattern_cursor_t cursor = {0};
+    uint32_t crc = CRC32_INIT;
+    uint16_t delay = (ms + 5) / 10;     // In hundredths of a second
+
+    fwrite("GIF89a", 1, 6, file);
+    fputc(width, file);
+    fputc(width >> 8, file);
+    fputc(height, file);
+    fputc(height >> 8, file);
+    fputc(0x81, file);                  // Global palette of four colours
+    fputc(0, file);
+    fputc(0, file);
+    fwrite(palette, 1, sizeof(palette), file);
+
+    // Looping forever
+    fwrite("\x21\xFF\x0BNETSCAPE2.0\x03\x01\x00\x00\x00", 1, 19, file);
+
+    for(uint32_t i = 0; i < frames; i++){
+	uint16_t frame;
+	pattern_render(pattern, &cursor, &user, &frame);
+	crc = preview_crc(crc, frame);
+
+	// LED 15 on the left, as on the board
+	uint8_t gap = PREVIEW_CELL / 4;
+	for(uint16_t y = 0; y < height; y++){
+	    for(uint16_t x = 0; x < width; x++){
+		uint8_t led = 15 - x / PREVIEW_CELL;
+		bool inside = x % PREVIEW_CELL >= gap / 2 && x % PREVIEW_CELL < PREVIEW_CELL - gap / 2
+			   && y >= gap / 2 && y < PREVIEW_CELL - gap / 2;
+		pixels[y * width + x] = !inside ? 0 : (frame & (1U << led)) ? 2 : 1;
+	    }
+	}
+
+	uint8_t control[8] = { 0x21, 0xF9, 4, 0, delay, delay >> 8, 0, 0 };
+	fwrite(control, 1, sizeof(control), file);
+	uint8_t descriptor[10] = { 0x2C, 0, 0, 0, 0, width, width >> 8, height, height >> 8, 0 };
+	fwrite(descriptor, 1, sizeof(descriptor), file);
+	preview_gif_image(file, pixels, width * height);
+    }
+
+    fputc(0x3B, file);
+    free(pixels);
+    fprintf(stderr, "CRC-32 0x%08X\n", ~crc);
+}
+
+static void preview_bench(uint32_t frames)
+{
+    printf("%-12s %12s %10s %12s\n", "Pattern", "Frames/s", "ns/frame", "CRC-32");
+
+    for(uint8_t pattern = 0; pattern < LED_PATTERN_COUNT; pattern++){
+	struct timespec start;
+	struct timespec stop;
+	pattern_cursor_t cursor = {0};
+	uint16_t frame = 0;
+	uint32_t crc = CRC32_INIT;
+
+	// The CRC is taken separately so that it does not count in the time
+	for(uint32_t i = 0; i < 1024; i++){
+	    pattern_render(pattern, &cursor, &user, &frame);
+	    crc = preview_crc(crc, frame);
+	}
+
+	pattern_restart(&cursor);
+	volatile uint16_t sink = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(uint32_t i = 0; i < frames; i++){
+	    pattern_render(pattern, &cursor, &user, &frame);
+	    sink ^= frame;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+	(void)sink;
+
+	double ns = (stop.tv_sec - start.tv_sec) * 1e9 + (stop.tv_nsec - start.tv_nsec);
+	printf("%-12s %12.0f %10.2f   0x%08X\n", pattern_names[pattern],
+	    frames / (ns / 1e9), ns / frames, ~crc);
+    }
+    printf("CRC-32 over the first 1024 frames\n");
+}
+
+int main(int argc, char** argv)
+{
+    int pattern = PATTERN_WAVE;
+    uint32_t frames = 0;
+    uint32_t ms = SPEED_NORMAL;
+    output_t output = OUTPUT_TERM;
+    const char* path = 0;
+    bool bench = false;
+    int option;
+
+    while((option = getopt(argc, argv, "p:n:s:u:o:b")) != -1){
+	switch(option){
+	    case 'p':
+		pattern = preview_pattern(optarg);
+		if(pattern < 0){
+		    fprintf(stderr, "Unknown pattern \"%s\"\n", optarg);
+		    return 1;
+		}
+		break;
+	    case 'n':
+		frames = strtoul(optarg, 0, 0);
+		break;
+	    case 's':
+		ms = strtoul(optarg, 0, 0);
+		break;
+	    case 'u':
+		preview_user(optarg);
+		break;
+	    case 'o':
+		output = !strcmp(optarg, "csv") ? OUTPUT_CSV : !strcmp(optarg, "gif") ? OUTPUT_GIF : OUTPUT_TERM;
+		break;
+	    case 'b':
+		bench = true;
+		break;
+	    default:
+		fprintf(stderr, "usage: %s [-p pattern] [-n frames] [-s ms] [-u 0xNNNN,...] "
+		    "[-o term|csv|gif] [file] | -b [-n frames]\n", argv[0]);
+		return 1;
+	}
+    }
+    if(bench){
+	preview_bench(frames ? frames : PREVIEW_BENCH_FRAMES);
+	return 0;
+    }
+    if(optind < argc){
+	path = argv[optind];
+    }
+    if(!frames){
+	// One cycle, at least 16 frames
+	uint32_t length = pattern_length(pattern, &user);
+	frames = (length >= 16 && length <= 256) ? length : 16;
+    }
+
+    if(output == OUTPUT_TERM){
+	preview_term(pattern, frames, ms);
+	return 0;
+    }
+
+    FILE* file = path ? fopen(path, "wb") : stdout;
+    if(!file){
+	perror(path);
+	return 1;
+    }
+    if(output == OUTPUT_CSV){
+	preview_csv(file, pattern, frames, ms);
+    }else{
+	preview_gif(file, pattern, frames, ms);
+    }
+    if(file != stdout){
+	fclose(file);
+    }
+    return 0;
+}
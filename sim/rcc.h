@@ -0,0 +1,30 @@
+// © 2024 Oskar Arnudd
+
+#ifndef RCC_H
+#define RCC_H
+
+#include "lib.h"
+
+typedef struct{
+    __IO uint32_t CR, ICSCR, CFGR, PLLCFGR, RESERVED0, RESERVED1, CIER, CIFR, CICR;
+    __IO uint32_t IOPRSTR, AHBRSTR, APBRSTR1, APBRSTR2, IOPENR, AHBENR, APBENR1, APBENR2;
+    __IO uint32_t IOPSMENR, AHBSMENR, APBSMENR1, APBSMENR2, CCIPR, CCIPR2, BDCR, CSR;
+} RCC_t;
+
+#define RCC SIM_PERIPH(RCC_t, 0x40021000)
+
+#define RCC_IO_GPIOA     BIT(0)
+#define RCC_IO_GPIOB     BIT(1)
+#define RCC_IO_GPIOC     BIT(2)
+#define RCC_IO_GPIOD     BIT(3)
+#define RCC_APB1_TIM2    BIT(0)
+#define RCC_APB1_USART2  BIT(17)
+#define RCC_APB1_USART3  BIT(18)
+#define RCC_APB2_SYSCFG  BIT(0)
+#define RCC_APB2_SPI1    BIT(12)
+#define RCC_APB2_TIM14   BIT(15)
+#define RCC_APB2_TIM16   BIT(17)
+
+void rcc_reset_all(void);
+
+#endif
@@ -0,0 +1,192 @@
+// © 2024 Oskar Arnudd
+
+// Stress test for src/ring.c on the host, built and run by "make ring-test":
+//
+//   build/host/ring_test [bytes per round]
+//
+// A producer and a consumer thread push a numbered byte stream through
+// small rings, each side picking at random between the single byte, bulk
+// and span calls and committing spans only in part. The consumer checks
+// every byte against the sequence, so a byte lost, repeated or read
+// before it was written fails the run. Every round starts its indices just
+// short of 2^32 so that they wrap early on.
+
+// Standard library headers
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Firmware headers
+#include "ring.h"
+
+#define RING_TEST_BYTES (4000000U)  // Per round unless given
+#define RING_TEST_PERIOD (251)      // Sequence length, prime so it never lines up with a ring
+
+typedef struct{
+    ring_t* ring;
+    uint32_t size;
+    uint32_t bytes;
+    uint32_t seed;
+    uint32_t errors;
+    uint32_t calls[4];
+} ring_test_side_t;
+
+static const uint32_t sizes[] = { 2, 16, 64 };
+
+static uint32_t ring_test_random(uint32_t* state)
+{
+    // xorshift32
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static void* ring_test_produce(void* arg)
+{
+    ring_test_side_t* side = arg;
+    uint8_t chunk[256];
+    uint32_t sent = 0;
+    uint32_t next = 0;
+
+    while(sent < side->bytes){
+	uint32_t choice = ring_test_random(&side->seed) % 3;
+	uint32_t want = 1 + ring_test_random(&side->seed) % (2 * side->size);
+	uint32_t done = 0;
+
+	if(want > side->bytes - sent){
+	    want = side->bytes - sent;
+	}
+
+	if(choice == 0){
+	    if(ring_put(side->ring, next)){
+		done = 1;
+	    }
+	}else if(choice == 1){
+	    for(uint32_t i = 0; i < want; i++){
+		chunk[i] = (next + i) % RING_TEST_PERIOD;
+	    }
+	    done = ring_write(side->ring, chunk, want);
+	}else{
+	    // Fills only part of the span now and then
+	    uint8_t* span;
+	    uint32_t run = ring_write_span(side->ring, &span);
+
+	    done = (run < want) ? run : want;
+	    for(uint32_t i = 0; i < done; i++){
+		span[i] = (next + i) % RING_TEST_PERIOD;
+	    }
+	    ring_write_commit(side->ring, done);
+	}
+
+	side->calls[choice]++;
+	sent += done;
+	next = (next + done) % RING_TEST_PERIOD;
+	if(!done){
+	    sched_yield();
+	}
+    }
+    return 0;
+}
+
+static void* ring_test_consume(void* arg)
+{
+    ring_test_side_t* side = arg;
+    uint8_t chunk[256];
+    uint32_t received = 0;
+    uint32_t next = 0;
+
+    while(received < side->bytes){
+	uint32_t choice = ring_test_random(&side->seed) % 4;
+	uint32_t want = 1 + ring_test_random(&side->seed) % (2 * side->size);
+	uint32_t done = 0;
+
+	if(ring_count(side->ring) > side->size){
+	    side->errors++;
+	}
+
+	if(choice == 0){
+	    done = ring_get(side->ring, chunk) ? 1 : 0;
+	}else if(choice == 1){
+	    done = ring_read(side->ring, chunk, want);
+	}else if(choice == 2){
+	    // Reads only part of the span now and then
+	    const uint8_t* span;
+	    uint32_t run = ring_read_span(side->ring, &span);
+
+	    done = (run < want) ? run : want;
+	    for(uint32_t i = 0; i < done; i++){
+		chunk[i] = span[i];
+	    }
+	    ring_read_commit(side->ring, done);
+	}else{
+	    // A peek sees the same bytes the read after it takes
+	    uint8_t peeked[256];
+	    uint32_t seen = ring_peek(side->ring, peeked, want);
+
+	    done = ring_read(side->ring, chunk, seen);
+	    for(uint32_t i = 0; i < seen; i++){
+		if(peeked[i] != chunk[i]){
+		    side->errors++;
+		}
+	    }
+	}
+
+	for(uint32_t i = 0; i < done; i++){
+	    if(chunk[i] != (next + i) % RING_TEST_PERIOD){
+		side->errors++;
+	    }
+	}
+
+	side->calls[choice]++;
+	received += done;
+	next = (next + done) % RING_TEST_PERIOD;
+	if(!done){
+	    sched_yield();
+	}
+    }
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    uint32_t bytes = (argc > 1) ? strtoul(argv[1], 0, 10) : RING_TEST_BYTES;
+    uint32_t failed = 0;
+
+    for(uint32_t round = 0; round < sizeof(sizes) / sizeof(sizes[0]); round++){
+	uint32_t size = sizes[round];
+	uint8_t data[64];
+	ring_t ring;
+
+	ring_init(&ring, data, size);
+	ring.head = ring.tail = 0U - 1000U * size;
+
+	ring_test_side_t producer = { &ring, size, bytes, 0x2545F491U + round, 0, { 0 } };
+	ring_test_side_t consumer = { &ring, size, bytes, 0x9E3779B9U + round, 0, { 0 } };
+	struct timespec start, stop;
+	pthread_t threads[2];
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pthread_create(&threads[0], 0, ring_test_produce, &producer);
+	pthread_create(&threads[1], 0, ring_test_consume, &consumer);
+	pthread_join(threads[0], 0);
+	pthread_join(threads[1], 0);
+	clock_gettime(CLOCK_MONOTONIC, &stop);
+
+	double seconds = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+	bool empty = ring_empty(&ring) && ring.head == 0U - 1000U * size + bytes;
+
+	printf("%2u byte ring: %u bytes in %.2f s, put/write/span %u/%u/%u, "
+	       "get/read/span/peek %u/%u/%u/%u, %u errors%s\n",
+	       size, bytes, seconds, producer.calls[0], producer.calls[1], producer.calls[2],
+	       consumer.calls[0], consumer.calls[1], consumer.calls[2], consumer.calls[3],
+	       consumer.errors, empty ? "" : ", indices off at the end");
+	failed += consumer.errors || !empty;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+// © 2024 Oskar Arnudd
+
+#ifndef RINGBUFFER_H
+#define RINGBUFFER_H
+
+#include "lib.h"
+
+#define RING_BUFFER_SIZE (64)
+
+typedef struct ring_buffer_t{
+    uint8_t* buffer;
+    uint32_t mask;
+    volatile uint32_t read_index;
+    volatile uint32_t write_index;
+} ring_buffer_t;
+
+void ring_buffer_create(ring_buffer_t* rb, uint8_t* buffer, uint32_t size);
+
+bool ring_buffer_write(ring_buffer_t* rb, uint8_t byte);
+
+bool ring_buffer_read(ring_buffer_t* rb, uint8_t* byte);
+
+bool ring_buffer_empty(ring_buffer_t* rb);
+
+bool ring_buffer_delete(ring_buffer_t* rb);
+
+void ring_buffer_flush(ring_buffer_t* rb);
+
+#endif
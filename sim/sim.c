@@ -0,0 +1,1439 @@
+// © 2024 Oskar Arnudd
+
+// Host simulator for the firmware, built by "make host". The firmware runs
+// unmodified against simulated peripherals at their real addresses: a
+// virtual clock drives TIM2, TIM14, TIM16, LPTIM1, SPI1 and the USARTs,
+// fires their interrupts by NVIC priority, and advances a few core cycles
+// on every register access so that busy-waits and handlers take time.
+//
+//   build/host/blinky_host [-q] [-t ms] [-f flash.bin] [-c ppm] [-p n] [script | -]
+//
+// The script feeds input at given times, one event per line:
+//
+//   # comment
+//   100 console pattern\r       bytes on USART2, C escapes allowed
+//   250 bt \x84                 bytes on USART3
+//   400 ir 0x11                 a NEC frame on PD9, code from ir_command
+//   412.5625 irlevel 0          a single edge on PD9, to the given level
+//   2000 end                    end of the run
+//
+// Without an end line the run stops one second after the last event. The
+// log shows every latched LED frame and the UART traffic with simulated
+// timestamps, followed by interrupt and sleep statistics. -q leaves out
+// the UART traffic, -f keeps the flash contents between runs and -c puts
+// the HSI16 oscillator, and every clock from it, off by the given ppm.
+//
+// -p n cuts the power while the nth double word of the run is programmed.
+// That double word is left half written and failing ECC, so that reading
+// it raises the NMI, and the run ends there. The flash file keeps the
+// double words so torn after the image, for the boot of the next run.
+
+// Standard library headers
+#include <setjmp.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Simulator headers
+#include "sim.h"
+#include "exti.h"
+#include "gpio.h"
+#include "nvic.h"
+#include "rcc.h"
+#include "spi.h"
+#include "tim.h"
+#include "usart.h"
+
+// Firmware headers, for bit definitions and link parameters only. The
+// register macros go through sim_reg and are not used in here.
+#include "bt.h"
+#include "cli.h"
+#include "flash.h"
+#include "irdecoder.h"
+#include "regs.h"
+
+__extension__ typedef unsigned __int128 sim_u128;
+
+#define PS_PER_S   (1000000000000ULL)
+#define PS_PER_MS  (1000000000ULL)
+#define PS_PER_US  (1000000ULL)
+#define SIM_FOREVER (~0ULL)
+
+#define SIM_HSI16_HZ (16000000U)
+#define SIM_LSI_HZ (32000U)
+#define SIM_ACCESS_CYCLES (4)        // Core cycles per register access
+#define SIM_EXCEPTION_CYCLES (16)    // Stacking on entry, unstacking on return
+#define SIM_ERASE_PS (22 * PS_PER_MS)
+#define SIM_PROGRAM_PS (85 * PS_PER_US)
+#define SIM_EMPTY (0xFFFFFFFFU)      // Data registers read back as this once taken
+
+#define RAW(type, address) ((type*)(uintptr_t)(address))
+#define RAW32(address) (*(volatile uint32_t*)(uintptr_t)(address))
+
+// Raw addresses of what regs.h defines through REG32
+#define SIM_SCB_ICSR   (0xE000ED04U)
+#define SIM_SCB_AIRCR  (0xE000ED0CU)
+#define SIM_SCB_SCR    (0xE000ED10U)
+#define SIM_SCB_SHPR3  (0xE000ED20U)
+#define SIM_NVIC_IPR   (0xE000E400U)
+#define SIM_FLASH_KEYR (0x40022008U)
+#define SIM_FLASH_SR   (0x40022010U)
+#define SIM_FLASH_CR   (0x40022014U)
+#define SIM_FLASH_ECCR (0x40022018U)
+#define SIM_LPTIM1     (0x40007C00U)
+#define SIM_RCC        (0x40021000U)
+#define SIM_EXTI       (0x40021800U)
+#define SIM_SPI1       (0x40013000U)
+#define SIM_GPIOB      (0x50000400U)
+#define SIM_GPIOD      (0x50000C00U)
+#define SIM_NVIC       (0xE000E100U)
+
+// Exception numbers, IRQs as on the target and PendSV after them
+#define SIM_IRQ_EXTI4_15 (7)
+#define SIM_IRQ_LPTIM1   (17)
+#define SIM_IRQ_TIM14    (19)
+#define SIM_IRQ_TIM16    (21)
+#define SIM_IRQ_USART2   (28)
+#define SIM_IRQ_USART3   (29)
+#define SIM_PENDSV       (32)
+#define SIM_NMI          (33)
+#define SIM_EXCEPTIONS   (34)
+
+int blinky_main(void);
+void EXTI4_15_IRQHandler(void);
+void TIM6_DAC_LPTIM1_IRQHandler(void);
+void TIM14_IRQHandler(void);
+void TIM16_FDCAN_IT0_IRQHandler(void);
+void USART2_LPUART2_IRQHandler(void);
+void USART3_6_LPUART1_IRQHandler(void);
+void PendSV_Handler(void);
+void NMI_Handler(void);
+
+typedef struct{
+    const char* name;
+    void (*handler)(void);
+    uint32_t count;
+    uint64_t ps;
+} sim_exception_t;
+
+static sim_exception_t exceptions[SIM_EXCEPTIONS] = {
+    [SIM_IRQ_EXTI4_15] = { "EXTI4_15", EXTI4_15_IRQHandler, 0, 0 },
+    [SIM_IRQ_LPTIM1] = { "LPTIM1", TIM6_DAC_LPTIM1_IRQHandler, 0, 0 },
+    [SIM_IRQ_TIM14] = { "TIM14", TIM14_IRQHandler, 0, 0 },
+    [SIM_IRQ_TIM16] = { "TIM16", TIM16_FDCAN_IT0_IRQHandler, 0, 0 },
+    [SIM_IRQ_USART2] = { "USART2", USART2_LPUART2_IRQHandler, 0, 0 },
+    [SIM_IRQ_USART3] = { "USART3", USART3_6_LPUART1_IRQHandler, 0, 0 },
+    [SIM_PENDSV] = { "PendSV", PendSV_Handler, 0, 0 },
+    [SIM_NMI] = { "NMI", NMI_Handler, 0, 0 },
+};
+
+typedef struct{
+    uint32_t address;
+    uint8_t irq;           // 0 when it never interrupts
+    uint32_t mask;         // Counter width
+    bool counting;
+    uint64_t start;        // Time the count below started from
+    uint64_t ticks;        // Ticks counted since start
+    uint64_t hz;           // Tick rate since start
+    uint32_t cnt;          // CNT as last written here
+    uint32_t psc;          // Prescaler in use, PSC is preloaded until an update
+} sim_timer_t;
+
+typedef struct{
+    const char* name;
+    uint32_t address;
+    uint8_t irq;
+    uint32_t baudrate;     // For the script, the firmware sets BRR
+    bool shifting;
+    uint64_t shift_end;
+    bool holding;          // A byte waits in TDR for the shift register
+    uint8_t hold;
+    uint8_t shift;
+    uint32_t tx_count;
+    uint32_t rx_count;
+    uint32_t rx_lost;
+    char text[80];         // TX bytes not logged yet
+    uint8_t text_length;
+    uint64_t text_start;
+    uint64_t text_last;
+} sim_usart_t;
+
+typedef enum{
+    EVENT_RX_CONSOLE,
+    EVENT_RX_BT,
+    EVENT_IR_LEVEL,
+    EVENT_END,
+} sim_event_kind_t;
+
+typedef struct{
+    uint64_t at;
+    sim_event_kind_t kind;
+    uint8_t value;
+} sim_event_t;
+
+static uint64_t now = 0;
+static uint64_t end = SIM_FOREVER;
+static bool quiet = false;
+static const char* flash_file = 0;
+
+static bool primask = false;
+static uint8_t active_priority = 4;     // Thread mode, below every exception
+static uint64_t pending = 0;
+static uint64_t active = 0;             // Exceptions whose handler is running
+static bool stopped = false;            // In Stop mode
+static bool waiting = false;            // In WFI, Stop mode or not
+static uint64_t wait_start = 0;
+static uint64_t sleep_ps = 0;
+static uint64_t stop_ps = 0;
+
+static sim_timer_t timers[] = {
+    { 0x40000000U, 0, 0xFFFFFFFFU, false, 0, 0, 0, 0, 0 }, // TIM2, the timebase
+    { 0x40002000U, SIM_IRQ_TIM14, 0xFFFFU, false, 0, 0, 0, 0, 0 },
+    { 0x40014400U, SIM_IRQ_TIM16, 0xFFFFU, false, 0, 0, 0, 0, 0 },
+};
+#define SIM_TIMERS (sizeof(timers) / sizeof(timers[0]))
+
+static sim_usart_t usarts[] = {
+    { "console", 0x40004400U, SIM_IRQ_USART2, CLI_BAUDRATE },
+    { "bt", 0x40004800U, SIM_IRQ_USART3, BT_BAUDRATE },
+};
+#define SIM_USARTS (sizeof(usarts) / sizeof(usarts[0]))
+
+static uint64_t spi_end = 0;
+static uint16_t spi_shift = 0;          // Last word fully shifted out
+static uint16_t spi_sending = 0;
+static uint32_t frames = 0;
+static uint32_t gpiob_odr = 0;
+
+static uint32_t nvic_enabled = 0;
+static uint32_t flash_key = 0;
+static bool flash_programming = false;
+static uint32_t flash_programs = 0;
+static uint32_t flash_erases = 0;
+static uint32_t power_fail = 0;         // Program the power is cut in, 0 for none
+static uint32_t flash_shadow[0x20000 / 4]; // Flash as of the last erase or program
+static uint32_t torn[16];               // Double words failing ECC
+static uint8_t torn_count = 0;
+
+static bool lptim_running = false;
+static uint64_t lptim_start = 0;
+static uint32_t lptim_arr = 0;
+static bool lptim_arr_written = false;   // ARROK cleared, waiting for a write
+
+static sim_event_t* events = 0;
+static uint32_t event_count = 0;
+static uint32_t event_next = 0;
+static uint8_t ir_level = 1;            // The receiver idles high
+
+static volatile uint64_t watchdog_seen = 0;
+static sigjmp_buf reset_requested;
+
+static void sim_finish(const char* reason) __attribute__((noreturn));
+
+//
+// Clocks
+//
+
+static uint64_t hsi16_hz = SIM_HSI16_HZ; // Off by -c ppm, as another board's may be
+
+static uint64_t sim_hclk(void)
+{
+    uint32_t cr = RAW(RCC_t, SIM_RCC)->CR;
+    uint32_t cfgr = RAW(RCC_t, SIM_RCC)->CFGR;
+    uint64_t sysclk = hsi16_hz >> ((cr >> 11) & 0x7);
+
+    if((cfgr & RCC_CFGR_SW_MSK) == RCC_CFGR_SW_PLLR){
+	uint32_t pll = RAW(RCC_t, SIM_RCC)->PLLCFGR;
+	uint32_t m = ((pll >> 4) & 0x7) + 1;
+	uint32_t n = (pll >> 8) & 0x7F;
+	uint32_t r = ((pll >> 29) & 0x7) + 1;
+	sysclk = hsi16_hz / m * n / r;
+    }
+
+    uint32_t hpre = (cfgr >> 8) & 0xF;
+    uint32_t shift = (hpre < 8) ? 0 : (hpre < 12) ? hpre - 7 : hpre - 6;
+    return sysclk >> shift;
+}
+
+static uint64_t sim_cycles(uint32_t cycles)
+{
+    return (uint64_t)cycles * PS_PER_S / sim_hclk();
+}
+
+static uint32_t sim_usart_kernel_hz(const sim_usart_t* usart)
+{
+    uint32_t ccipr = RAW(RCC_t, SIM_RCC)->CCIPR;
+
+    if(usart->irq == SIM_IRQ_USART2 && (ccipr & RCC_CCIPR_USART2SEL_MSK) == RCC_CCIPR_USART2SEL_HSI16){
+	return hsi16_hz;
+    }
+    return sim_hclk();
+}
+
+// Start, eight data bits and stop
+static uint64_t sim_usart_byte_ps(const sim_usart_t* usart)
+{
+    uint32_t brr = RAW(USART_t, usart->address)->BRR;
+
+    return 10 * (uint64_t)(brr ? brr : 1) * PS_PER_S / sim_usart_kernel_hz(usart);
+}
+
+//
+// Log
+//
+
+static void sim_print_time(uint64_t at)
+{
+    printf("%10llu.%03llu ms  ", (unsigned long long)(at / PS_PER_MS),
+	(unsigned long long)(at % PS_PER_MS / PS_PER_US));
+}
+
+static void sim_flush_text(sim_usart_t* usart)
+{
+    if(!usart->text_length){
+	return;
+    }
+    sim_print_time(usart->text_start);
+    printf("%-8s tx  \"%.*s\"\n", usart->name, usart->text_length, usart->text);
+    usart->text_length = 0;
+}
+
+static void sim_log(uint64_t at, const char* source, const char* format, ...)
+{
+    va_list args;
+
+    for(uint8_t i = 0; i < SIM_USARTS; i++){
+	sim_flush_text(&usarts[i]);
+    }
+
+    sim_print_time(at);
+    printf("%-8s ", source);
+    va_start(args, format);
+    vprintf(format, args);
+    va_end(args);
+    printf("\n");
+}
+
+static void sim_log_tx(sim_usart_t* usart, uint8_t byte)
+{
+    if(quiet){
+	return;
+    }
+
+    // A pause on the line starts a new log entry
+    if(usart->text_length && now - usart->text_last > 2 * sim_usart_byte_ps(usart)){
+	sim_flush_text(usart);
+    }
+    if(!usart->text_length){
+	usart->text_start = now;
+    }
+    usart->text_last = now;
+
+    // Escaped, so that control sequences show up as such
+    char escaped[5];
+    if(byte == '\r'){
+	strcpy(escaped, "\\r");
+    }else if(byte == '\n'){
+	strcpy(escaped, "\\n");
+    }else if(byte == '"' || byte == '\\'){
+	snprintf(escaped, sizeof(escaped), "\\%c", byte);
+    }else if(byte >= 32 && byte < 127){
+	snprintf(escaped, sizeof(escaped), "%c", byte);
+    }else{
+	snprintf(escaped, sizeof(escaped), "\\x%02X", byte);
+    }
+
+    uint8_t length = strlen(escaped);
+    if(usart->text_length + length > sizeof(usart->text)){
+	sim_flush_text(usart);
+	usart->text_start = now;
+    }
+    memcpy(&usart->text[usart->text_length], escaped, length);
+    usart->text_length += length;
+
+    if(byte == '\n'){
+	sim_flush_text(usart);
+    }
+}
+
+//
+// Timers
+//
+
+static uint64_t sim_timer_ticks(const sim_timer_t* timer, uint64_t at)
+{
+    return (sim_u128)(at - timer->start) * timer->hz / PS_PER_S;
+}
+
+static void sim_timer_rebase(sim_timer_t* timer, bool counting)
+{
+    TIM_t* tim = RAW(TIM_t, timer->address);
+
+    timer->counting = counting;
+    timer->start = now;
+    timer->ticks = 0;
+    timer->hz = sim_hclk() / (timer->psc + 1);
+    timer->cnt = tim->CNT & timer->mask;
+}
+
+// Takes in what the firmware wrote since the last look
+static void sim_timer_sync(sim_timer_t* timer)
+{
+    TIM_t* tim = RAW(TIM_t, timer->address);
+    bool counting = (tim->CR1 & TIM_CR1_CEN) && !stopped;
+
+    if(tim->EGR & TIM_EGR_UG){
+	tim->EGR &= ~TIM_EGR_UG;
+	tim->CNT = 0;
+	tim->SR |= TIM_SR_UIF;
+	timer->psc = tim->PSC;
+    }
+
+    if(counting != timer->counting || (tim->CNT & timer->mask) != timer->cnt
+	|| sim_hclk() / (timer->psc + 1) != timer->hz){
+	sim_timer_rebase(timer, counting);
+    }
+}
+
+static void sim_timer_advance(sim_timer_t* timer)
+{
+    TIM_t* tim = RAW(TIM_t, timer->address);
+
+    if(!timer->counting){
+	return;
+    }
+
+    uint64_t ticks = sim_timer_ticks(timer, now);
+    uint64_t count = timer->cnt + (ticks - timer->ticks);
+    uint64_t period = (uint64_t)(tim->ARR & timer->mask) + 1;
+    timer->ticks = ticks;
+
+    bool update = count >= period;
+    if(update){
+	count %= period;
+	tim->SR |= TIM_SR_UIF;
+    }
+    timer->cnt = count;
+    tim->CNT = count;
+
+    // The update loads a new prescaler, for the ticks from here on
+    if(update && timer->psc != tim->PSC){
+	timer->psc = tim->PSC;
+	sim_timer_rebase(timer, true);
+    }
+}
+
+static uint64_t sim_timer_deadline(const sim_timer_t* timer)
+{
+    TIM_t* tim = RAW(TIM_t, timer->address);
+
+    if(!timer->counting || !timer->irq || !(tim->DIER & TIM_DIER_UIE) || !timer->hz){
+	return SIM_FOREVER;
+    }
+
+    uint64_t period = (uint64_t)(tim->ARR & timer->mask) + 1;
+    uint64_t target = timer->ticks + (period - timer->cnt);
+    return timer->start + ((sim_u128)target * PS_PER_S + timer->hz - 1) / timer->hz;
+}
+
+//
+// USARTs
+//
+
+static void sim_usart_shift(sim_usart_t* usart, uint8_t byte, uint64_t at)
+{
+    USART_t* regs = RAW(USART_t, usart->address);
+
+    usart->shifting = true;
+    usart->shift = byte;
+    usart->shift_end = at + sim_usart_byte_ps(usart);
+    regs->ISR &= ~USART_ISR_TC;
+}
+
+static void sim_usart_sync(sim_usart_t* usart)
+{
+    USART_t* regs = RAW(USART_t, usart->address);
+
+    if(regs->ICR){
+	regs->ISR &= ~regs->ICR;
+	regs->ICR = 0;
+    }
+
+    if(regs->TDR == SIM_EMPTY){
+	return;
+    }
+    uint8_t byte = regs->TDR;
+    regs->TDR = SIM_EMPTY;
+
+    if(!(regs->CR1 & USART_CR1_UE) || !(regs->CR1 & USART_CR1_TE)){
+	return;
+    }
+    if(usart->shifting){
+	usart->holding = true;
+	usart->hold = byte;
+	regs->ISR &= ~USART_ISR_TXE;
+    }else{
+	sim_usart_shift(usart, byte, now);
+    }
+}
+
+static void sim_usart_advance(sim_usart_t* usart)
+{
+    USART_t* regs = RAW(USART_t, usart->address);
+
+    while(usart->shifting && usart->shift_end <= now){
+	usart->shifting = false;
+	usart->tx_count++;
+	sim_log_tx(usart, usart->shift);
+
+	if(usart->holding){
+	    usart->holding = false;
+	    regs->ISR |= USART_ISR_TXE;
+	    sim_usart_shift(usart, usart->hold, usart->shift_end);
+	}else{
+	    regs->ISR |= USART_ISR_TC;
+	}
+    }
+}
+
+static void sim_usart_receive(sim_usart_t* usart, uint8_t byte)
+{
+    USART_t* regs = RAW(USART_t, usart->address);
+
+    if(!(regs->CR1 & USART_CR1_UE) || !(regs->CR1 & USART_CR1_RE)){
+	usart->rx_lost++;
+	return;
+    }
+    if(regs->ISR & USART_ISR_RXNE){
+	regs->ISR |= USART_ISR_ORE;
+	usart->rx_lost++;
+	return;
+    }
+    regs->RDR = byte;
+    regs->ISR |= USART_ISR_RXNE;
+    usart->rx_count++;
+}
+
+static bool sim_usart_level(const sim_usart_t* usart)
+{
+    USART_t* regs = RAW(USART_t, usart->address);
+    uint32_t cr1 = regs->CR1;
+    uint32_t isr = regs->ISR;
+
+    return ((cr1 & USART_CR1_TXEIE) && (isr & USART_ISR_TXE))
+	|| ((cr1 & USART_CR1_RXNEIE) && (isr & USART_ISR_RXNE))
+	|| ((cr1 & USART_CR1_TCIE) && (isr & USART_ISR_TC));
+}
+
+//
+// SPI1 and the shift register latch on PB4
+//
+
+static void sim_spi_sync(void)
+{
+    SPI_t* spi = RAW(SPI_t, SIM_SPI1);
+    GPIO_t* gpiob = RAW(GPIO_t, SIM_GPIOB);
+
+    if(spi->DR != SIM_EMPTY){
+	spi_sending = spi->DR;
+	spi->DR = SIM_EMPTY;
+	if(spi->CR1 & SPI_CR1_SPE){
+	    uint32_t br = (spi->CR1 >> 3) & 0x7;
+	    spi->SR |= SPI_SR_BSY;
+	    spi_end = now + 16 * PS_PER_S / (sim_hclk() >> (br + 1));
+	}
+    }
+
+    if(gpiob->BSRR){
+	uint32_t odr = (gpiob->ODR | (gpiob->BSRR & 0xFFFF)) & ~(gpiob->BSRR >> 16);
+	gpiob->BSRR = 0;
+	gpiob->ODR = odr;
+    }
+
+    if((gpiob->ODR & PIN4) && !(gpiob_odr & PIN4)){
+	char bits[17];
+	for(uint8_t i = 0; i < 16; i++){
+	    bits[i] = (spi_shift & (1U << (15 - i))) ? '#' : '.';
+	}
+	bits[16] = '\0';
+	frames++;
+	sim_log(now, "led", "0x%04X  %s", spi_shift, bits);
+    }
+    gpiob_odr = gpiob->ODR;
+}
+
+static void sim_spi_advance(void)
+{
+    SPI_t* spi = RAW(SPI_t, SIM_SPI1);
+
+    if((spi->SR & SPI_SR_BSY) && spi_end <= now){
+	spi->SR &= ~SPI_SR_BSY;
+	spi_shift = spi_sending;
+    }
+}
+
+//
+// IR receiver on PD9, EXTI line 9
+//
+
+static void sim_exti_sync(void)
+{
+    EXTI_t* exti = RAW(EXTI_t, SIM_EXTI);
+
+    if(exti->SWIER1 & EXTI_SWIER1_SWI9){
+	exti->SWIER1 &= ~EXTI_SWIER1_SWI9;
+	if(exti->IMR1 & EXTI_IMR1_IM9){
+	    exti->RPR1 |= EXTI_RPR1_RPIF9;
+	    pending |= 1ULL << SIM_IRQ_EXTI4_15;
+	}
+    }
+}
+
+static void sim_ir_level(uint8_t level)
+{
+    EXTI_t* exti = RAW(EXTI_t, SIM_EXTI);
+    GPIO_t* gpiod = RAW(GPIO_t, SIM_GPIOD);
+
+    if(level == ir_level){
+	return;
+    }
+    ir_level = level;
+    gpiod->IDR = level ? (gpiod->IDR | PIN9) : (gpiod->IDR & ~PIN9);
+
+    if(!(exti->IMR1 & EXTI_IMR1_IM9)){
+	return;
+    }
+    if(level && (exti->RTSR1 & EXTI_RTSR1_RT9)){
+	exti->RPR1 |= EXTI_RPR1_RPIF9;
+	pending |= 1ULL << SIM_IRQ_EXTI4_15;
+    }
+    if(!level && (exti->FTSR1 & EXTI_FTSR1_FT9)){
+	exti->FPR1 |= EXTI_FPR1_FPIF9;
+	pending |= 1ULL << SIM_IRQ_EXTI4_15;
+    }
+}
+
+//
+// LPTIM1, clocked from LSI and running in Stop mode
+//
+
+static uint64_t sim_lptim_hz(void)
+{
+    return SIM_LSI_HZ >> ((RAW32(SIM_LPTIM1 + 0x0C) >> 9) & 0x7);
+}
+
+static void sim_lptim_sync(void)
+{
+    volatile uint32_t* isr = &RAW32(SIM_LPTIM1 + 0x00);
+    volatile uint32_t* icr = &RAW32(SIM_LPTIM1 + 0x04);
+    volatile uint32_t* cr = &RAW32(SIM_LPTIM1 + 0x10);
+    volatile uint32_t* arr = &RAW32(SIM_LPTIM1 + 0x18);
+
+    // A write of the value ARR already holds cannot be told apart from no
+    // write here, so ARROK comes back at the next access after clearing it,
+    // as it does once the write that follows the clear lands
+    if(lptim_arr_written){
+	lptim_arr_written = false;
+	*isr |= LPTIM_ISR_ARROK;
+    }
+    if(*icr){
+	lptim_arr_written = *icr & LPTIM_ISR_ARROK;
+	*isr &= ~*icr;
+	*icr = 0;
+    }
+    if(*arr != lptim_arr){
+	lptim_arr = *arr;
+	*isr |= LPTIM_ISR_ARROK;
+    }
+    if(!(*cr & LPTIM_CR_ENABLE)){
+	lptim_running = false;
+	RAW32(SIM_LPTIM1 + 0x1C) = 0;
+    }else if(*cr & LPTIM_CR_SNGSTRT){
+	*cr &= ~LPTIM_CR_SNGSTRT;
+	lptim_running = true;
+	lptim_start = now;
+    }
+}
+
+static uint64_t sim_lptim_deadline(void)
+{
+    if(!lptim_running){
+	return SIM_FOREVER;
+    }
+    return lptim_start + (uint64_t)lptim_arr * PS_PER_S / sim_lptim_hz();
+}
+
+static void sim_lptim_advance(void)
+{
+    if(!lptim_running){
+	return;
+    }
+
+    uint64_t count = (now - lptim_start) * sim_lptim_hz() / PS_PER_S;
+    if(count >= lptim_arr){
+	count = lptim_arr;
+	lptim_running = false;
+	RAW32(SIM_LPTIM1 + 0x00) |= LPTIM_ISR_ARRM;
+    }
+    RAW32(SIM_LPTIM1 + 0x1C) = count;
+}
+
+//
+// Core: RCC, flash, NVIC and SCB
+//
+
+static void sim_finish(const char* reason)
+{
+    for(uint8_t i = 0; i < SIM_USARTS; i++){
+	sim_flush_text(&usarts[i]);
+    }
+
+    printf("\n");
+    sim_print_time(now);
+    printf("%s\n\n", reason);
+
+    // A run ending in WFI has that wait counted up to the end
+    if(waiting){
+	*(stopped ? &stop_ps : &sleep_ps) += now - wait_start;
+	waiting = false;
+    }
+
+    uint64_t run_ps = now - sleep_ps - stop_ps;
+    printf("%-24s %llu.%03llu ms\n", "Running", (unsigned long long)(run_ps / PS_PER_MS),
+	(unsigned long long)(run_ps % PS_PER_MS / PS_PER_US));
+    printf("%-24s %llu.%03llu ms\n", "Sleeping", (unsigned long long)(sleep_ps / PS_PER_MS),
+	(unsigned long long)(sleep_ps % PS_PER_MS / PS_PER_US));
+    printf("%-24s %llu.%03llu ms\n", "In Stop mode", (unsigned long long)(stop_ps / PS_PER_MS),
+	(unsigned long long)(stop_ps % PS_PER_MS / PS_PER_US));
+    printf("%-24s %u\n", "LED frames latched", frames);
+    for(uint8_t i = 0; i < SIM_USARTS; i++){
+	printf("%-8s %-15s %u tx, %u rx, %u rx lost\n", usarts[i].name, "bytes",
+	    usarts[i].tx_count, usarts[i].rx_count, usarts[i].rx_lost);
+    }
+    printf("%-24s %u programmed, %u pages erased\n", "Flash", flash_programs, flash_erases);
+
+    printf("\n%-12s %10s %12s %10s\n", "Handler", "Count", "Total us", "Mean ns");
+    for(uint8_t i = 0; i < SIM_EXCEPTIONS; i++){
+	if(!exceptions[i].count){
+	    continue;
+	}
+	printf("%-12s %10u %12llu %10llu\n", exceptions[i].name, exceptions[i].count,
+	    (unsigned long long)(exceptions[i].ps / PS_PER_US),
+	    (unsigned long long)(exceptions[i].ps / exceptions[i].count / 1000));
+    }
+
+    if(flash_file){
+	FILE* file = fopen(flash_file, "wb");
+	if(file){
+	    fwrite((const void*)(uintptr_t)FLASH_BASE_ADDRESS, 1, 0x20000, file);
+	    fwrite(torn, sizeof(torn[0]), torn_count, file);
+	    fclose(file);
+	}
+    }
+
+    fflush(stdout);
+    exit(0);
+}
+
+static int8_t sim_torn_find(uint32_t address)
+{
+    for(uint8_t i = 0; i < torn_count; i++){
+	if(torn[i] == address){
+	    return i;
+	}
+    }
+    return -1;
+}
+
+// The firmware stores into flash directly, so the double word it has just
+// programmed is found against the shadow. Zeros over a torn one make it
+// read cleanly again, as they do on the target.
+static void sim_flash_programmed(void)
+{
+    volatile uint32_t* flash = RAW(volatile uint32_t, FLASH_BASE_ADDRESS);
+    uint32_t* shadow = flash_shadow;
+    uint32_t words = sizeof(flash_shadow) / 4;
+    uint32_t i = 0;
+
+    while(i < words && flash[i] == shadow[i]){
+	i++;
+    }
+    if(i == words){
+	return;
+    }
+    i &= ~1U;
+
+    uint32_t address = FLASH_BASE_ADDRESS + i * 4;
+    int8_t index = sim_torn_find(address);
+    if(index >= 0 && !flash[i] && !flash[i + 1]){
+	torn[index] = torn[--torn_count];
+    }
+
+    if(flash_programs == power_fail){
+	static char reason[64];
+
+	// Cut off halfway, the upper bits still erased
+	flash[i + 1] |= 0xFFFF0000U;
+	if(torn_count < sizeof(torn) / sizeof(torn[0])){
+	    torn[torn_count++] = address;
+	}
+	snprintf(reason, sizeof(reason), "Power lost while programming 0x%08X", address);
+	sim_finish(reason);
+    }
+    shadow[i] = flash[i];
+    shadow[i + 1] = flash[i + 1];
+}
+
+static void sim_core_sync(void)
+{
+    volatile uint32_t* rcc_cr = &RAW(RCC_t, SIM_RCC)->CR;
+    volatile uint32_t* rcc_cfgr = &RAW(RCC_t, SIM_RCC)->CFGR;
+    volatile uint32_t* rcc_csr = &RAW(RCC_t, SIM_RCC)->CSR;
+
+    // Oscillators are ready at once and the switch is immediate
+    *rcc_cr = (*rcc_cr & RCC_CR_PLLON) ? (*rcc_cr | RCC_CR_PLLRDY) : (*rcc_cr & ~RCC_CR_PLLRDY);
+    *rcc_cfgr = (*rcc_cfgr & ~RCC_CFGR_SWS_MSK) | RCC_CFGR_SWS(*rcc_cfgr & RCC_CFGR_SW_MSK);
+    if(*rcc_csr & RCC_CSR_LSION){
+	*rcc_csr |= RCC_CSR_LSIRDY;
+    }
+
+    // The NVIC enable registers are write one to set and to clear
+    NVIC_t* nvic = RAW(NVIC_t, SIM_NVIC);
+    if(nvic->ISER0 != nvic_enabled){
+	nvic_enabled |= nvic->ISER0;
+    }
+    if(nvic->ICER0){
+	nvic_enabled &= ~nvic->ICER0;
+	nvic->ICER0 = 0;
+    }
+    // A pending interrupt cleared, which the level pends again if still up
+    if(nvic->ICPR0){
+	pending &= ~(uint64_t)nvic->ICPR0;
+	nvic->ICPR0 = 0;
+    }
+    nvic->ISER0 = nvic_enabled;
+
+    volatile uint32_t* icsr = &RAW32(SIM_SCB_ICSR);
+    if(*icsr & SCB_ICSR_PENDSVSET){
+	pending |= 1ULL << SIM_PENDSV;
+    }
+    if(*icsr & SCB_ICSR_PENDSVCLR){
+	pending &= ~(1ULL << SIM_PENDSV);
+    }
+    *icsr = 0;
+
+    uint32_t aircr = RAW32(SIM_SCB_AIRCR);
+    if((aircr & 0xFFFF0000U) == SCB_AIRCR_VECTKEY && (aircr & SCB_AIRCR_SYSRESETREQ)){
+	sim_finish("System reset requested");
+    }
+
+    // Flash: unlocking, and the stall of each erase and double word. Status
+    // flags are write one to clear and the simulated flash never fails.
+    RAW32(SIM_FLASH_SR) = 0;
+    volatile uint32_t* keyr = &RAW32(SIM_FLASH_KEYR);
+    volatile uint32_t* flash_cr = &RAW32(SIM_FLASH_CR);
+    if(*keyr){
+	if(flash_key == FLASH_KEY1 && *keyr == FLASH_KEY2){
+	    *flash_cr &= ~FLASH_CR_LOCK;
+	}
+	flash_key = *keyr;
+	*keyr = 0;
+    }
+    if((*flash_cr & FLASH_CR_STRT) && (*flash_cr & FLASH_CR_PER)){
+	uint32_t page = (*flash_cr >> 3) & 0x7F;
+	*flash_cr &= ~FLASH_CR_STRT;
+	memset((void*)(uintptr_t)(FLASH_BASE_ADDRESS + page * FLASH_PAGE_SIZE), 0xFF, FLASH_PAGE_SIZE);
+	memset(&flash_shadow[page * FLASH_PAGE_SIZE / 4], 0xFF, FLASH_PAGE_SIZE);
+	for(uint8_t i = torn_count; i-- > 0;){
+	    if(FLASH_PAGE(torn[i]) == page){
+		torn[i] = torn[--torn_count];
+	    }
+	}
+	flash_erases++;
+	now += SIM_ERASE_PS;
+    }
+    if((*flash_cr & FLASH_CR_PG) && !flash_programming){
+	flash_programs++;
+	now += SIM_PROGRAM_PS;
+	sim_flash_programmed();
+    }
+    flash_programming = *flash_cr & FLASH_CR_PG;
+}
+
+// Takes in everything the firmware wrote since the last register access
+static void sim_sync(void)
+{
+    sim_core_sync();
+    for(uint8_t i = 0; i < SIM_TIMERS; i++){
+	sim_timer_sync(&timers[i]);
+    }
+    for(uint8_t i = 0; i < SIM_USARTS; i++){
+	sim_usart_sync(&usarts[i]);
+    }
+    sim_spi_sync();
+    sim_exti_sync();
+    sim_lptim_sync();
+}
+
+// A level still asserted while its handler runs is not latched, as the
+// NVIC does; it pends again when the handler returns with the flag set
+static void sim_pend_levels(void)
+{
+    uint64_t levels = 0;
+
+    for(uint8_t i = 0; i < SIM_TIMERS; i++){
+	TIM_t* tim = RAW(TIM_t, timers[i].address);
+	if(timers[i].irq && (tim->SR & TIM_SR_UIF) && (tim->DIER & TIM_DIER_UIE)){
+	    levels |= 1ULL << timers[i].irq;
+	}
+    }
+    for(uint8_t i = 0; i < SIM_USARTS; i++){
+	if(sim_usart_level(&usarts[i])){
+	    levels |= 1ULL << usarts[i].irq;
+	}
+    }
+    if(RAW32(SIM_LPTIM1 + 0x00) & RAW32(SIM_LPTIM1 + 0x08)){
+	levels |= 1ULL << SIM_IRQ_LPTIM1;
+    }
+    pending |= levels & ~active;
+}
+
+static bool sim_enabled(uint8_t exception)
+{
+    return exception == SIM_PENDSV || (nvic_enabled & (1U << exception));
+}
+
+static uint8_t sim_priority(uint8_t exception)
+{
+    if(exception == SIM_PENDSV){
+	return (RAW32(SIM_SCB_SHPR3) >> SCB_SHPR3_PENDSV_POS) & NVIC_IPR_MSK;
+    }
+    return (RAW32(SIM_NVIC_IPR + 4 * (exception / 4)) >> NVIC_IPR_POS(exception)) & NVIC_IPR_MSK;
+}
+
+static bool sim_wakeup_pending(void)
+{
+    for(uint8_t i = 0; i < SIM_EXCEPTIONS; i++){
+	if((pending & (1ULL << i)) && sim_enabled(i)){
+	    return true;
+	}
+    }
+    return false;
+}
+
+//
+// Time
+//
+
+static void sim_fire_event(const sim_event_t* event)
+{
+    switch(event->kind){
+	case EVENT_RX_CONSOLE:
+	    sim_usart_receive(&usarts[0], event->value);
+	    break;
+	case EVENT_RX_BT:
+	    sim_usart_receive(&usarts[1], event->value);
+	    break;
+	case EVENT_IR_LEVEL:
+	    sim_ir_level(event->value);
+	    break;
+	case EVENT_END:
+	    sim_finish("End of script");
+    }
+}
+
+static uint64_t sim_next_deadline(void)
+{
+    uint64_t next = end;
+
+    if(event_next < event_count && events[event_next].at < next){
+	next = events[event_next].at;
+    }
+    for(uint8_t i = 0; i < SIM_TIMERS; i++){
+	uint64_t at = sim_timer_deadline(&timers[i]);
+	next = (at < next) ? at : next;
+    }
+    for(uint8_t i = 0; i < SIM_USARTS; i++){
+	if(usarts[i].shifting && usarts[i].shift_end < next){
+	    next = usarts[i].shift_end;
+	}
+    }
+    if((RAW(SPI_t, SIM_SPI1)->SR & SPI_SR_BSY) && spi_end < next){
+	next = spi_end;
+    }
+    uint64_t lptim = sim_lptim_deadline();
+    return (lptim < next) ? lptim : next;
+}
+
+// Moves the clock to target, stopping at every deadline on the way so that
+// nothing happens late
+static void sim_advance(uint64_t target)
+{
+    while(1){
+	uint64_t next = sim_next_deadline();
+	if(next > target){
+	    next = target;
+	}
+	if(next > now){
+	    now = next;
+	}
+
+	for(uint8_t i = 0; i < SIM_TIMERS; i++){
+	    sim_timer_advance(&timers[i]);
+	}
+	for(uint8_t i = 0; i < SIM_USARTS; i++){
+	    sim_usart_advance(&usarts[i]);
+	}
+	sim_spi_advance();
+	sim_lptim_advance();
+	while(event_next < event_count && events[event_next].at <= now){
+	    sim_fire_event(&events[event_next++]);
+	}
+
+	if(now >= end){
+	    sim_finish("End of run");
+	}
+	if(now >= target){
+	    return;
+	}
+    }
+}
+
+//
+// Exceptions
+//
+
+static void sim_deliver(void)
+{
+    while(!primask){
+	sim_pend_levels();
+
+	int8_t best = -1;
+	uint8_t best_priority = active_priority;
+	// PendSV has the lowest exception number, it wins ties
+	if((pending & (1ULL << SIM_PENDSV)) && sim_priority(SIM_PENDSV) < best_priority){
+	    best = SIM_PENDSV;
+	    best_priority = sim_priority(SIM_PENDSV);
+	}
+	for(uint8_t i = 0; i < SIM_PENDSV; i++){
+	    if((pending & (1ULL << i)) && sim_enabled(i) && sim_priority(i) < best_priority){
+		best = i;
+		best_priority = sim_priority(i);
+	    }
+	}
+	if(best < 0){
+	    return;
+	}
+
+	sim_exception_t* exception = &exceptions[best];
+	uint8_t previous = active_priority;
+	uint64_t start = now;
+
+	pending &= ~(1ULL << best);
+	active |= 1ULL << best;
+	active_priority = best_priority;
+	sim_advance(now + sim_cycles(SIM_EXCEPTION_CYCLES));
+
+	exception->handler();
+
+	// Flags the handlers acknowledge by reading or writing one to clear
+	if(best == SIM_IRQ_EXTI4_15){
+	    RAW(EXTI_t, SIM_EXTI)->RPR1 = 0;
+	    RAW(EXTI_t, SIM_EXTI)->FPR1 = 0;
+	}
+	if(best == SIM_IRQ_USART2 || best == SIM_IRQ_USART3){
+	    RAW(USART_t, usarts[best - SIM_IRQ_USART2].address)->ISR &= ~USART_ISR_RXNE;
+	}
+
+	sim_sync();
+	sim_advance(now + sim_cycles(SIM_EXCEPTION_CYCLES));
+	exception->count++;
+	exception->ps += now - start;
+	active &= ~(1ULL << best);
+	active_priority = previous;
+    }
+}
+
+// Every read of a torn double word raises the NMI, with the offset of the
+// double word in ECCR for the handler. It writes ECCD back to clear it,
+// which cannot be told from the flag here, so it is cleared afterwards.
+static void sim_flash_read(uint32_t address)
+{
+    if(address < FLASH_BASE_ADDRESS || address >= FLASH_BASE_ADDRESS + sizeof(flash_shadow)
+	|| sim_torn_find(address & ~7U) < 0){
+	return;
+    }
+
+    sim_exception_t* exception = &exceptions[SIM_NMI];
+    uint64_t start = now;
+
+    RAW32(SIM_FLASH_ECCR) = FLASH_ECCR_ECCD | ((address - FLASH_BASE_ADDRESS) / 8);
+    sim_advance(now + sim_cycles(SIM_EXCEPTION_CYCLES));
+    exception->handler();
+    RAW32(SIM_FLASH_ECCR) = 0;
+    sim_sync();
+    sim_advance(now + sim_cycles(SIM_EXCEPTION_CYCLES));
+    exception->count++;
+    exception->ps += now - start;
+}
+
+volatile uint32_t* sim_reg(uint32_t address)
+{
+    sim_sync();
+    sim_advance(now + sim_cycles(SIM_ACCESS_CYCLES));
+    sim_deliver();
+    sim_flash_read(address);
+    return &RAW32(address);
+}
+
+void sim_irq_enable(void)
+{
+    primask = false;
+    sim_sync();
+    sim_deliver();
+}
+
+void sim_irq_disable(void)
+{
+    primask = true;
+}
+
+uint32_t sim_irq_save(void)
+{
+    uint32_t previous = primask;
+    primask = true;
+    return previous;
+}
+
+void sim_irq_restore(uint32_t previous)
+{
+    primask = previous;
+    if(!primask){
+	sim_sync();
+	sim_deliver();
+    }
+}
+
+void sim_set_msp(uint32_t stack)
+{
+    (void)stack;
+    sim_finish("Jump to the bootloader");
+}
+
+// Skips straight to the next deadline until an interrupt is pending. Stop
+// mode also halts the timers and comes back on HSI16 with the PLL off.
+void sim_wait_for_interrupt(void)
+{
+    uint64_t start = now;
+
+    waiting = true;
+    wait_start = now;
+    stopped = RAW32(SIM_SCB_SCR) & SCB_SCR_SLEEPDEEP;
+    sim_sync();
+
+    while(1){
+	sim_pend_levels();
+	if(sim_wakeup_pending()){
+	    break;
+	}
+	uint64_t next = sim_next_deadline();
+	sim_advance(next > now ? next : now + 1);
+	sim_sync();
+    }
+
+    waiting = false;
+    if(stopped){
+	stopped = false;
+	stop_ps += now - start;
+	RAW(RCC_t, SIM_RCC)->CFGR &= ~(RCC_CFGR_SW_MSK | RCC_CFGR_SWS_MSK);
+	RAW(RCC_t, SIM_RCC)->CR &= ~(RCC_CR_PLLON | RCC_CR_PLLRDY);
+    }else{
+	sleep_ps += now - start;
+    }
+    sim_sync();
+    sim_deliver();
+}
+
+//
+// Script
+//
+
+static void sim_add_event(uint64_t at, sim_event_kind_t kind, uint8_t value)
+{
+    static uint32_t capacity = 0;
+
+    if(event_count == capacity){
+	capacity = capacity ? capacity * 2 : 256;
+	events = realloc(events, capacity * sizeof(sim_event_t));
+	if(!events){
+	    fprintf(stderr, "Out of memory\n");
+	    exit(1);
+	}
+    }
+
+    // Kept in time order, equal times in the order given
+    uint32_t i = event_count++;
+    while(i > 0 && events[i - 1].at > at){
+	events[i] = events[i - 1];
+	i--;
+    }
+    events[i] = (sim_event_t){ at, kind, value };
+}
+
+// A NEC frame as the decoder expects it: the address as sent first, and
+// the command with its bits reversed
+static uint64_t sim_add_ir(uint64_t at, uint8_t code)
+{
+    uint8_t command = 0;
+    for(uint8_t i = 0; i < 8; i++){
+	if(code & (1U << i)){
+	    command |= 1U << (7 - i);
+	}
+    }
+    uint32_t frame = ((uint32_t)ADDRESS << 24) | ((uint32_t)(uint8_t)~ADDRESS << 16)
+		   | ((uint32_t)command << 8) | (uint8_t)~command;
+
+    // The receiver output is low during a burst
+    sim_add_event(at, EVENT_IR_LEVEL, 0);
+    at += 9000 * PS_PER_US;
+    sim_add_event(at, EVENT_IR_LEVEL, 1);
+    at += 4500 * PS_PER_US;
+    for(int8_t bit = 31; bit >= -1; bit--){
+	sim_add_event(at, EVENT_IR_LEVEL, 0);
+	at += 562500 * 1000ULL;
+	sim_add_event(at, EVENT_IR_LEVEL, 1);
+	if(bit >= 0){
+	    at += ((frame >> bit) & 1) ? 1687500 * 1000ULL : 562500 * 1000ULL;
+	}
+    }
+    return at;
+}
+
+static uint64_t sim_add_bytes(uint64_t at, sim_event_kind_t kind, const char* text, uint32_t baudrate)
+{
+    uint64_t byte_ps = 10 * PS_PER_S / baudrate;
+
+    while(*text){
+	uint8_t byte = *text++;
+
+	if(byte == '\\' && *text){
+	    char escape = *text++;
+	    switch(escape){
+		case 'r': byte = '\r'; break;
+		case 'n': byte = '\n'; break;
+		case 't': byte = '\t'; break;
+		case 'e': byte = 0x1B; break;
+		case '0': byte = 0; break;
+		case 'x':
+		    byte = strtoul((char[3]){ text[0], text[0] ? text[1] : 0, 0 }, 0, 16);
+		    text += (text[0] && text[1]) ? 2 : (text[0] ? 1 : 0);
+		    break;
+		default: byte = escape; break;
+	    }
+	}
+	sim_add_event(at, kind, byte);
+	at += byte_ps;
+    }
+    return at;
+}
+
+static void sim_load_script(FILE* file)
+{
+    char line[512];
+    uint32_t number = 0;
+    uint64_t last = 0;
+    bool ended = false;
+
+    while(fgets(line, sizeof(line), file)){
+	char target[16];
+	double ms;
+	int offset = 0;
+
+	number++;
+	line[strcspn(line, "\r\n")] = '\0';
+	if(line[0] == '#' || line[strspn(line, " \t")] == '\0'){
+	    continue;
+	}
+	if(sscanf(line, "%lf %15s %n", &ms, target, &offset) < 2){
+	    fprintf(stderr, "Script line %u: expected \"<ms> <target> ...\"\n", number);
+	    exit(1);
+	}
+
+	uint64_t at = (uint64_t)(ms * PS_PER_MS);
+	const char* payload = &line[offset];
+	uint64_t done = at;
+
+	if(!strcmp(target, "console")){
+	    done = sim_add_bytes(at, EVENT_RX_CONSOLE, payload, usarts[0].baudrate);
+	}else if(!strcmp(target, "bt")){
+	    done = sim_add_bytes(at, EVENT_RX_BT, payload, usarts[1].baudrate);
+	}else if(!strcmp(target, "ir")){
+	    done = sim_add_ir(at, strtoul(payload, 0, 0));
+	}else if(!strcmp(target, "irlevel")){
+	    sim_add_event(at, EVENT_IR_LEVEL, strtoul(payload, 0, 0) ? 1 : 0);
+	}else if(!strcmp(target, "end")){
+	    sim_add_event(at, EVENT_END, 0);
+	    ended = true;
+	}else{
+	    fprintf(stderr, "Script line %u: unknown target \"%s\"\n", number, target);
+	    exit(1);
+	}
+	last = (done > last) ? done : last;
+    }
+
+    if(!ended && end == SIM_FOREVER){
+	end = last + 1000 * PS_PER_MS;
+    }
+}
+
+//
+// Memory
+//
+
+typedef struct{
+    uint32_t start;
+    uint32_t size;
+    uint8_t fill;
+} sim_region_t;
+
+static const sim_region_t regions[] = {
+    { 0x08000000U, 0x20000U, 0xFF }, // Flash, erased
+    { 0x1FFF0000U, 0x8000U, 0x00 },  // System memory, OTP and option bytes
+    { 0x20000000U, 0x9000U, 0x00 },  // SRAM
+    { 0x40000000U, 0x16000U, 0x00 }, // APB peripherals
+    { 0x40020000U, 0x7000U, 0x00 },  // AHB peripherals
+    { 0x50000000U, 0x2000U, 0x00 },  // IOPORT
+    { 0xE000E000U, 0x1000U, 0x00 },  // System control space
+};
+
+static void sim_map(void)
+{
+    for(uint8_t i = 0; i < sizeof(regions) / sizeof(regions[0]); i++){
+	void* want = (void*)(uintptr_t)regions[i].start;
+	void* got = mmap(want, regions[i].size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+
+	if(got != want){
+	    fprintf(stderr, "Cannot map 0x%08X, is the host binary position independent?\n",
+		regions[i].start);
+	    exit(1);
+	}
+	memset(got, regions[i].fill, regions[i].size);
+    }
+
+    if(flash_file){
+	FILE* file = fopen(flash_file, "rb");
+	if(file){
+	    if(fread((void*)(uintptr_t)FLASH_BASE_ADDRESS, 1, 0x20000, file) != 0x20000){
+		memset((void*)(uintptr_t)FLASH_BASE_ADDRESS, 0xFF, 0x20000);
+	    }else{
+		torn_count = fread(torn, sizeof(torn[0]), sizeof(torn) / sizeof(torn[0]), file);
+	    }
+	    fclose(file);
+	}
+    }
+    memcpy(flash_shadow, (const void*)(uintptr_t)FLASH_BASE_ADDRESS, sizeof(flash_shadow));
+}
+
+// Reset values that differ from zero
+static void sim_reset(void)
+{
+    RAW(RCC_t, SIM_RCC)->CR = 0x00000500U;          // HSION, HSIRDY
+    RAW32(SIM_FLASH_CR) = FLASH_CR_LOCK;
+    RAW(SPI_t, SIM_SPI1)->SR = SPI_SR_TXE;
+    RAW(SPI_t, SIM_SPI1)->DR = SIM_EMPTY;
+    RAW(GPIO_t, SIM_GPIOD)->IDR = PIN9;
+    for(uint8_t i = 0; i < SIM_TIMERS; i++){
+	RAW(TIM_t, timers[i].address)->ARR = timers[i].mask;
+    }
+    for(uint8_t i = 0; i < SIM_USARTS; i++){
+	USART_t* regs = RAW(USART_t, usarts[i].address);
+	regs->ISR = USART_ISR_TXE | USART_ISR_TC;
+	regs->TDR = SIM_EMPTY;
+    }
+}
+
+// Catches the firmware spinning without touching a register, which the
+// virtual clock cannot see, such as the loop after a reset request
+static void sim_watchdog(int signal)
+{
+    static uint8_t stuck = 0;
+    (void)signal;
+
+    if(watchdog_seen == now){
+	// Out of the handler and the loop after the request, to end the run
+	// as any other, with the statistics and the flash file
+	uint32_t aircr = RAW32(SIM_SCB_AIRCR);
+	if((aircr & 0xFFFF0000U) == SCB_AIRCR_VECTKEY && (aircr & SCB_AIRCR_SYSRESETREQ)){
+	    siglongjmp(reset_requested, 1);
+	}
+	if(++stuck == 8){
+	    const char message[] = "\nFirmware stuck without touching a register\n";
+	    (void)!write(STDOUT_FILENO, message, sizeof(message) - 1);
+	    _exit(1);
+	}
+    }else{
+	stuck = 0;
+    }
+    watchdog_seen = now;
+}
+
+int main(int argc, char** argv)
+{
+    const char* script = 0;
+
+    // Lines out as they happen, for runs cut short
+    setvbuf(stdout, 0, _IOLBF, 0);
+
+    for(int i = 1; i < argc; i++){
+	if(!strcmp(argv[i], "-q")){
+	    quiet = true;
+	}else if(!strcmp(argv[i], "-t") && i + 1 < argc){
+	    end = strtoull(argv[++i], 0, 10) * PS_PER_MS;
+	}else if(!strcmp(argv[i], "-f") && i + 1 < argc){
+	    flash_file = argv[++i];
+	}else if(!strcmp(argv[i], "-c") && i + 1 < argc){
+	    hsi16_hz = SIM_HSI16_HZ + SIM_HSI16_HZ / 1000000U * strtoll(argv[++i], 0, 10);
+	}else if(!strcmp(argv[i], "-p") && i + 1 < argc){
+	    power_fail = strtoul(argv[++i], 0, 10);
+	}else if(argv[i][0] != '-' || !strcmp(argv[i], "-")){
+	    script = argv[i];
+	}else{
+	    fprintf(stderr, "usage: %s [-q] [-t ms] [-f flash.bin] [-c ppm] [-p n] [script | -]\n", argv[0]);
+	    return 1;
+	}
+    }
+
+    if(script){
+	FILE* file = strcmp(script, "-") ? fopen(script, "r") : stdin;
+	if(!file){
+	    perror(script);
+	    return 1;
+	}
+	sim_load_script(file);
+	if(file != stdin){
+	    fclose(file);
+	}
+    }else if(end == SIM_FOREVER){
+	end = 1000 * PS_PER_MS;
+    }
+
+    sim_map();
+    sim_reset();
+
+    signal(SIGALRM, sim_watchdog);
+    struct itimerval interval = { { 0, 250000 }, { 0, 250000 } };
+    setitimer(ITIMER_REAL, &interval, 0);
+
+    if(sigsetjmp(reset_requested, 1)){
+	sim_finish("System reset requested");
+    }
+    blinky_main();
+    sim_finish("Firmware returned from main");
+}
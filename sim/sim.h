@@ -0,0 +1,38 @@
+// © 2024 Oskar Arnudd
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <stdint.h>
+
+// The simulator as seen by the firmware in the host build. Registers live
+// at their real addresses in memory mapped by the simulator, and every
+// access goes through sim_reg first, which lets the peripherals react to
+// the previous access, moves the virtual clock on by a few core cycles and
+// runs any interrupt that is due, as the hardware could between any two
+// instructions.
+
+volatile uint32_t* sim_reg(uint32_t address);
+
+// PRIMASK and WFI, see cpu.h
+void sim_irq_enable(void);
+
+void sim_irq_disable(void);
+
+uint32_t sim_irq_save(void);
+
+void sim_irq_restore(uint32_t primask);
+
+void sim_wait_for_interrupt(void);
+
+// Only the target can hand over to the bootloader, this ends the run
+void sim_set_msp(uint32_t stack) __attribute__((noreturn));
+
+// How much of the host stack below blinky_main src/stack.c paints and
+// counts as reserved, host frames being larger than the target's
+#define SIM_STACK_SIZE (16384)
+
+// Code that must run from RAM on the target runs in place on the host
+#define SIM_RAMFUNC __attribute__((noinline))
+
+#endif
@@ -0,0 +1,24 @@
+// © 2024 Oskar Arnudd
+
+#ifndef SPI_H
+#define SPI_H
+
+#include "lib.h"
+
+typedef struct{
+    __IO uint32_t CR1, CR2, SR, DR, CRCPR, RXCRCR, TXCRCR, I2SCFGR, I2SPR;
+} SPI_t;
+
+#define SPI1 SIM_PERIPH(SPI_t, 0x40013000)
+
+#define SPI_CR1_MSTR     BIT(2)
+#define SPI_CR1_BR(x)    ((x) << 3)
+#define SPI_CR1_SPE      BIT(6)
+#define SPI_CR1_LSBFIRST BIT(7)
+#define SPI_CR1_SSI      BIT(8)
+#define SPI_CR1_SSM      BIT(9)
+#define SPI_CR2_DS(x)    ((x) << 8)
+#define SPI_SR_TXE       BIT(1)
+#define SPI_SR_BSY       BIT(7)
+
+#endif
@@ -0,0 +1,10 @@
+// © 2024 Oskar Arnudd
+
+#ifndef SYSCFG_H
+#define SYSCFG_H
+
+#include "lib.h"
+
+#define SYSCFG_CFGR1 (*sim_reg(0x40010000))
+
+#endif
@@ -0,0 +1,22 @@
+// © 2024 Oskar Arnudd
+
+#ifndef TIM_H
+#define TIM_H
+
+#include "lib.h"
+
+typedef struct{
+    __IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR;
+    __IO uint32_t RCR, CCR1, CCR2, CCR3, CCR4;
+} TIM_t;
+
+#define TIM2  SIM_PERIPH(TIM_t, 0x40000000)
+#define TIM14 SIM_PERIPH(TIM_t, 0x40002000)
+#define TIM16 SIM_PERIPH(TIM_t, 0x40014400)
+
+#define TIM_CR1_CEN  BIT(0)
+#define TIM_DIER_UIE BIT(0)
+#define TIM_EGR_UG   BIT(0)
+#define TIM_SR_UIF   BIT(0)
+
+#endif
@@ -0,0 +1,32 @@
+// © 2024 Oskar Arnudd
+
+#ifndef USART_H
+#define USART_H
+
+#include "lib.h"
+
+typedef struct{
+    __IO uint32_t CR1, CR2, CR3, BRR, GTPR, RTOR, RQR, ISR, ICR, RDR, TDR, PRESC;
+} USART_t;
+
+#define USART2 SIM_PERIPH(USART_t, 0x40004400)
+#define USART3 SIM_PERIPH(USART_t, 0x40004800)
+
+#define USART_CR1_UE     BIT(0)
+#define USART_CR1_RE     BIT(2)
+#define USART_CR1_TE     BIT(3)
+#define USART_CR1_RXNEIE BIT(5)
+#define USART_CR1_TCIE   BIT(6)
+#define USART_CR1_TXEIE  BIT(7)
+#define USART_ISR_ORE    BIT(3)
+#define USART_ISR_RXNE   BIT(5)
+#define USART_ISR_TC     BIT(6)
+#define USART_ISR_TXE    BIT(7)
+
+typedef enum{
+    USART_STATE_IDLE,
+    USART_STATE_ESC,
+    USART_STATE_BRACKET,
+} usart_state_t;
+
+#endif
@@ -0,0 +1,20 @@
+// © 2024 Oskar Arnudd
+
+#ifndef UTILS_H
+#define UTILS_H
+
+#include "lib.h"
+
+#define M32(address) (*(volatile uint32_t*)(uintptr_t)(address))
+
+bool utils_strings_match(const char* a, const char* b);
+
+uint32_t utils_strlen(const char* string);
+
+uint32_t utils_string_to_number(const char* string);
+
+uint32_t utils_hexstring_to_dec(uint8_t* string);
+
+bool utils_dec_to_binarystring(uint32_t value, char* string, uint8_t length);
+
+#endif
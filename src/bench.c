@@ -0,0 +1,229 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "bench.h"
+#include "cli.h"
+#include "clock.h"
+#include "cpu.h"
+#include "irdecoder.h"
+#include "led.h"
+#include "ring.h"
+#include "timebase.h"
+
+// Library headers
+#include "utils.h"
+
+typedef struct{
+    const char* name;
+    const char* variant;
+    uint32_t arg;
+    void (*setup)(uint32_t arg);      // Untimed, before each sample
+    void (*run)(uint32_t arg);        // Timed
+    void (*teardown)(uint32_t arg);   // Untimed, after each sample
+} bench_case_t;
+
+typedef struct{
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+} bench_stat_t;
+
+static ring_t line;
+static uint8_t line_data[CLI_LINE_SIZE];
+static command_t tokens;
+static uint16_t ir_times[32];
+static volatile uint32_t sink;    // Keeps results from being optimised out
+
+static const char* const lines[] = {
+    "pattern",
+    "speed 3",
+    "irbind 12 brightness",
+};
+
+static void bench_nothing(uint32_t arg)
+{
+}
+
+static void bench_frame_setup(uint32_t pattern)
+{
+    led_bench_frame(pattern);
+}
+
+static void bench_frame(uint32_t arg)
+{
+    led_update();
+}
+
+static void bench_spi_setup(uint32_t br)
+{
+    led_bench_spi(br);
+}
+
+static void bench_spi(uint32_t arg)
+{
+    led_bench_send(0xA5A5);
+}
+
+static void bench_line_setup(uint32_t index)
+{
+    ring_discard(&line);
+    ring_write(&line, (const uint8_t*)lines[index], utils_strlen(lines[index]));
+}
+
+static void bench_tokenize(uint32_t arg)
+{
+    char count;
+    cli_tokenize(&line, tokens, &count);
+    sink = count;
+}
+
+// The frame of the remote's OK button, as TIM16 measures it
+static void bench_ir_setup(uint32_t arg)
+{
+    uint32_t msg = ((uint32_t)ADDRESS << 24) | ((uint32_t)(uint8_t)~ADDRESS << 16) | 0x22DD;
+
+    for(uint8_t i = 0; i < 32; i++){
+	ir_times[i] = (msg & (1U << (31 - i))) ? IRDECODER_US(1690) : IRDECODER_US(560);
+    }
+}
+
+static void bench_ir(uint32_t arg)
+{
+    uint8_t decoded;
+    sink = irdecoder_decode(ir_times, &decoded);
+}
+
+// Formatting only, the console is muted while these run
+static void bench_mute(uint32_t arg)
+{
+    cli_set_muted(true);
+}
+
+static void bench_unmute(uint32_t arg)
+{
+    cli_set_muted(false);
+}
+
+static void bench_number(uint32_t number)
+{
+    cli_print_number(number);
+}
+
+static void bench_hex(uint32_t value)
+{
+    cli_print_hex(value, 8);
+}
+
+static const bench_case_t cases[] = {
+    { "led_update", "binary", PATTERN_BINARY, bench_frame_setup, bench_frame, 0 },
+    { "led_update", "wave", PATTERN_WAVE, bench_frame_setup, bench_frame, 0 },
+    { "led_update", "alternating", PATTERN_ALTERNATING, bench_frame_setup, bench_frame, 0 },
+    { "led_update", "bounce", PATTERN_BOUNCE, bench_frame_setup, bench_frame, 0 },
+    { "led_update", "user", PATTERN_USER, bench_frame_setup, bench_frame, 0 },
+    { "led_update", "fill", PATTERN_FILL, bench_frame_setup, bench_frame, 0 },
+    { "sn_send_data", "br0", 0, bench_spi_setup, bench_spi, 0 },
+    { "sn_send_data", "br1", 1, bench_spi_setup, bench_spi, 0 },
+    { "sn_send_data", "br2", 2, bench_spi_setup, bench_spi, 0 },
+    { "sn_send_data", "br3", 3, bench_spi_setup, bench_spi, 0 },
+    { "sn_send_data", "br4", 4, bench_spi_setup, bench_spi, 0 },
+    { "sn_send_data", "br5", 5, bench_spi_setup, bench_spi, 0 },
+    { "sn_send_data", "br6", 6, bench_spi_setup, bench_spi, 0 },
+    { "sn_send_data", "br7", 7, bench_spi_setup, bench_spi, 0 },
+    { "cli_tokenize", "1 token", 0, bench_line_setup, bench_tokenize, 0 },
+    { "cli_tokenize", "2 tokens", 1, bench_line_setup, bench_tokenize, 0 },
+    { "cli_tokenize", "3 tokens", 2, bench_line_setup, bench_tokenize, 0 },
+    { "nec_decode", "ok", 0, bench_ir_setup, bench_ir, 0 },
+    { "cli_print_number", "7", 7, bench_mute, bench_number, bench_unmute },
+    { "cli_print_number", "4294967295", 4294967295U, bench_mute, bench_number, bench_unmute },
+    { "cli_print_hex", "8 digits", 0xDEADBEEF, bench_mute, bench_hex, bench_unmute },
+};
+
+#define BENCH_CASES (sizeof(cases) / sizeof(cases[0]))
+
+static void bench_measure(const bench_case_t* bench, uint32_t overhead, bench_stat_t* stat)
+{
+    stat->min = 0xFFFFFFFF;
+    stat->max = 0;
+    stat->total = 0;
+
+    for(uint8_t i = 0; i < BENCH_SAMPLES; i++){
+	uint32_t primask = cpu_irq_save();
+	if(bench->setup){
+	    bench->setup(bench->arg);
+	}
+	uint32_t start = timebase_now();
+	bench->run(bench->arg);
+	uint32_t cycles = timebase_now() - start;
+	if(bench->teardown){
+	    bench->teardown(bench->arg);
+	}
+	cpu_irq_restore(primask);
+
+	cycles = (cycles > overhead) ? cycles - overhead : 0;
+	stat->total += cycles;
+	stat->min = (cycles < stat->min) ? cycles : stat->min;
+	stat->max = (cycles > stat->max) ? cycles : stat->max;
+    }
+}
+
+// "bench" prints a table, "bench csv" one line per case for tools to diff
+void bench_command(const char* args)
+{
+    bool csv = utils_strings_match(args, "csv");
+    const bench_case_t empty = { "", "", 0, 0, bench_nothing, 0 };
+    bench_stat_t stat;
+
+    ring_init(&line, line_data, CLI_LINE_SIZE);
+
+    // Reading the timebase itself costs a few cycles
+    bench_measure(&empty, 0, &stat);
+    uint32_t overhead = stat.min;
+
+    if(csv){
+	cli_print("name,variant,samples,min,mean,max,clock_hz,overhead");
+    }else{
+	cli_print("Timebase cycles at ");
+	cli_print_number(TIMEBASE_HZ / 1000000);
+	cli_print(" MHz, core at ");
+	cli_print_number(clock_hz() / 1000000);
+	cli_print(" MHz, ");
+	cli_print_number(BENCH_SAMPLES);
+	cli_print(" samples, ");
+	cli_print_number(overhead);
+	cli_print(" cycles overhead taken off");
+	cli_newline();
+	cli_print_padded("Case", 32);
+	cli_print("     min    mean     max");
+    }
+
+    led_bench_begin();
+    for(uint8_t i = 0; i < BENCH_CASES; i++){
+	bench_measure(&cases[i], overhead, &stat);
+	cli_newline();
+
+	if(csv){
+	    cli_print(cases[i].name);
+	    cli_print(",");
+	    cli_print(cases[i].variant);
+	    cli_print(",");
+	    cli_print_number(BENCH_SAMPLES);
+	    cli_print(",");
+	    cli_print_number(stat.min);
+	    cli_print(",");
+	    cli_print_number(stat.total / BENCH_SAMPLES);
+	    cli_print(",");
+	    cli_print_number(stat.max);
+	    cli_print(",");
+	    cli_print_number(clock_hz());
+	    cli_print(",");
+	    cli_print_number(overhead);
+	}else{
+	    cli_print_padded(cases[i].name, 17);
+	    cli_print_padded(cases[i].variant, 15);
+	    cli_print_number_padded(stat.min, 8);
+	    cli_print_number_padded(stat.total / BENCH_SAMPLES, 8);
+	    cli_print_number_padded(stat.max, 8);
+	}
+    }
+    led_bench_end();
+}
@@ -0,0 +1,60 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "boot.h"
+#include "cli.h"
+#include "timebase.h"
+
+static const char* const phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_PHASE_START] = "Timebase",
+    [BOOT_PHASE_CLOCK] = "IRQs and clocks",
+    [BOOT_PHASE_STORE] = "Settings",
+    [BOOT_PHASE_FIRST_FRAME] = "First frame",
+    [BOOT_PHASE_CLI] = "Console",
+    [BOOT_PHASE_IRDECODER] = "IR decoder",
+    [BOOT_PHASE_POWER] = "Power",
+    [BOOT_PHASE_BT] = "Bluetooth",
+    [BOOT_PHASE_SCHED] = "Scheduler",
+    [BOOT_PHASE_BANNER] = "Banner",
+};
+
+static uint32_t marks[BOOT_PHASE_COUNT];
+static uint16_t reached = 0;
+
+// Called right after timebase_init, which restarts the count from zero
+void boot_init(void)
+{
+    reached = 0;
+    boot_mark(BOOT_PHASE_START);
+}
+
+// Only the first time a phase is reached counts
+void boot_mark(boot_phase_t phase)
+{
+    if(reached & (1U << phase)){
+	return;
+    }
+    marks[phase] = timebase_now();
+    reached |= 1U << phase;
+}
+
+void boot_print(const char* args)
+{
+    uint32_t previous = 0;
+
+    for(uint8_t i = 0; i < BOOT_PHASE_COUNT; i++){
+	if(i){
+	    cli_newline();
+	}
+	cli_print_padded(phase_names[i], 24);
+	if(!(reached & (1U << i))){
+	    cli_print("-");
+	    continue;
+	}
+	cli_print_number(timebase_to_us(marks[i]));
+	cli_print(" us (+");
+	cli_print_number(timebase_to_us(marks[i] - previous));
+	cli_print(" us)");
+	previous = marks[i];
+    }
+}
@@ -2,12 +2,19 @@
 
 // Firmware headers
 #include "bt.h"
+#include "cli.h"
+#include "clock.h"
+#include "store.h"
+#include "transport.h"
 
 // Library headers
 #include "rcc.h"
 #include "nvic.h"
 #include "gpio.h"
 #include "usart.h"
+#include "utils.h"
+
+static uint8_t users = 0;
 
 void bt_init(void)
 {
@@ -29,7 +36,7 @@ void bt_init(void)
     gpio_set(GPIOB, &cfg, PIN9 | PIN10);
 
     //
-    // USART2
+    // USART3
     //
     if(!(RCC->APBENR1 & RCC_APB1_USART3)){
 	RCC->APBENR1 |= RCC_APB1_USART3; // Enable USART3 RCC clock if not already enabled
@@ -38,10 +45,8 @@ void bt_init(void)
     USART3->CR1 &= ~USART_CR1_UE; // Disable USART while configuring
     USART3->CR1 |= USART_CR1_RE; // Enable receiving
     USART3->CR1 |= USART_CR1_TE; // Enable transmitting
-    USART3->CR1 |= USART_CR1_RXNEIE; // Enable interrupt on received data
 
-    // BRR USARTDIV = FREQ/BAUDRATE
-    USART3->BRR = 0x683; // 16Mhz / 9600 = ~1667 = 0x683
+    USART3->BRR = clock_usart_brr(clock_hz(), BT_BAUDRATE);
 
     USART3->CR1 |= USART_CR1_UE; // Enable USART
 
@@ -49,39 +54,76 @@ void bt_init(void)
     // NVIC
     //
     NVIC->ISER0 = NVIC_USART3_6_LPUART1; // Enable USART3
+
+    // The REPL serves this link alongside the console once turned on
+    uint32_t value;
+    if(store_get(STORE_KEY_BT, 0, &value) && value){
+	bt_claim(BT_USER_REPL);
+    }
 }
 
 void bt_deinit(void)
 {
+    users = 0;
+    transport_close(TRANSPORT_BT);
+    NVIC->ICER0 = NVIC_USART3_6_LPUART1;
 
+    USART3->CR1 = 0;
+    USART3->BRR = 0;
+    RCC->APBENR1 &= ~RCC_APB1_USART3;
 }
 
-void bt_send_string(char* string)
+// The first user opens the link, the last one to let go closes it
+void bt_claim(bt_user_t user)
 {
-    for(uint32_t i = 0; string[i]; i++){
-	bt_send_byte(string[i]);
+    if(!users){
+	transport_open(TRANSPORT_BT, USART3, false);
     }
+    users |= user;
 }
 
-void bt_send_byte(uint8_t byte)
+void bt_release(bt_user_t user)
 {
-    // Wait for USART2 TDR
-    while(!(USART3->ISR & USART_ISR_TXE));
+    if(!(users & user)){
+	return;
+    }
+    users &= ~user;
+    if(!users){
+	transport_close(TRANSPORT_BT);
+    }
+}
 
-    // Respecting TE minimum period
-    while(!(USART3->ISR & USART_ISR_TEACK));
+// "bt on" opens the link for the REPL and "bt off" closes it again, both
+// kept over a reset; without arguments it prints who holds it
+void bt_command(const char* args)
+{
+    if(utils_strings_match(args, "on")){
+	bt_claim(BT_USER_REPL);
+	store_set(STORE_KEY_BT, 0, 1);
+	cli_print("Bluetooth REPL on, Stop mode is held off while the link is open.");
+    }else if(utils_strings_match(args, "off")){
+	bt_release(BT_USER_REPL);
+	store_set(STORE_KEY_BT, 0, 0);
+	cli_print("Bluetooth REPL off.");
+    }else if(!users){
+	cli_print("Closed");
+    }else{
+	cli_print("Open for");
+	cli_print((users & BT_USER_REPL) ? " the REPL" : "");
+	cli_print((users & BT_USER_SYNC) ? " sync" : "");
+	cli_print(", Stop mode held off");
+    }
+}
 
-    // Writing data to TDR
-    USART3->TDR = byte;
+void bt_send_string(char* string)
+{
+    uint32_t length = 0;
 
-    // Waiting for Transmission Complete Flag
-    while(!(USART3->ISR & USART_ISR_TC));
+    for(; string[length]; length++);
+    transport_write_all(transport_get(TRANSPORT_BT), (uint8_t*)string, length);
 }
 
-void USART3_6_LPUART1_IRQHandler(void)
+void bt_send_byte(uint8_t byte)
 {
-    if(USART3->ISR & USART_ISR_RXNE){
-        uint8_t data = USART3->RDR;
-	bt_send_byte(data);
-    }
+    transport_write_all(transport_get(TRANSPORT_BT), &byte, 1);
 }
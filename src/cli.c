@@ -2,45 +2,85 @@
 
 // Firmware includes
 #include "cli.h"
+#include "clock.h"
+#include "command.h"
+#include "compact.h"
+#include "crc.h"
+#include "latency.h"
+#include "memorymap.h"
+#include "perf.h"
+#include "trace.h"
+#include "proto.h"
+#include "ring.h"
+#include "sched.h"
+#include "transport.h"
 
 // Library includes
 #include "rcc.h"
 #include "nvic.h"
 #include "gpio.h"
-#include "ringbuffer.h"
 #include "usart.h"
 #include "utils.h"
 
-static ring_buffer_t ring_buffer_temp = {0U};
-static uint8_t data_buffer_temp[RING_BUFFER_SIZE] = {0U};
-static ring_buffer_t ring_buffer_data = {0U};
-static uint8_t data_buffer[RING_BUFFER_SIZE] = {0U};
+// One REPL per link, each with its own line and escape state. Output goes
+// to the session whose input is being handled, which stays the last one
+// that spoke between commands, so log messages follow the user.
+typedef struct{
+    transport_t* transport;
+    ring_t line;  // Typed so far, the REPL is both ends
+    uint8_t line_data[CLI_LINE_SIZE];
+    usart_state_t usart_state;
+    bool muted;
+    bool compact; // Takes compact opcodes, see inc/compact.h
+    uint8_t proto_index; // Enter sequence bytes matched, see proto_detect
+} cli_session_t;
+
+static cli_session_t sessions[TRANSPORT_COUNT];
+static cli_session_t* session = &sessions[TRANSPORT_CONSOLE];
+static cli_session_t* binary_session = 0;
 
-static usart_state_t usart_state = USART_STATE_IDLE;
+static int (*restart_handler)(void);
 
-static command_t command_history[10] = {0U};
-static int8_t command_index = 0;
+static void cli_send_bytes(const uint8_t* bytes, uint32_t length)
+{
+    if(!session->muted){
+	transport_write_all(session->transport, bytes, length);
+    }
+}
 
-static int (*restart_handler)(void);
+static void cli_send_byte(uint8_t byte)
+{
+    cli_send_bytes(&byte, 1);
+}
 
-static const command_entry_t command_table[] = {
-    { "rs", cli_restart },
-    { "help", cli_print_help },
-    { "memdump", cli_memdump_hex },
-    { "memdumphex", cli_memdump_hex },
-    { "mdh", cli_memdump_hex },
-    { "memdumpbin", cli_memdump_bin },
-    { "mdb", cli_memdump_bin },
-    { 0, 0 }
-};
+// Bulk output, traced as one transmission
+static void cli_stream(const uint8_t* bytes, uint32_t length)
+{
+    if(session->muted){
+	return;
+    }
+
+    trace_record(TRACE_UART_TX_BEGIN, length);
+    transport_write_all(session->transport, bytes, length);
+    trace_record(TRACE_UART_TX_END, length);
+}
 
 void cli_init(int (*restart_function)(void))
 {
     // Setting the restart_handler, used by the command "rs"
     restart_handler = restart_function;
 
-    ring_buffer_create(&ring_buffer_temp, data_buffer_temp, RING_BUFFER_SIZE);
-    ring_buffer_create(&ring_buffer_data, data_buffer, RING_BUFFER_SIZE);
+    for(uint8_t i = 0; i < TRANSPORT_COUNT; i++){
+	sessions[i].transport = transport_get(i);
+	ring_init(&sessions[i].line, sessions[i].line_data, CLI_LINE_SIZE);
+	sessions[i].usart_state = USART_STATE_IDLE;
+	sessions[i].muted = false;
+	sessions[i].compact = false;
+	sessions[i].proto_index = 0;
+    }
+    sessions[TRANSPORT_BT].compact = true;
+    session = &sessions[TRANSPORT_CONSOLE];
+    binary_session = 0;
 
     RCC->IOPENR |= RCC_IO_GPIOA;
 
@@ -52,18 +92,20 @@ void cli_init(int (*restart_function)(void))
     gpio_set(GPIOA, &cfg, BIT2 | BIT3);
 
     RCC->APBENR1 |= RCC_APB1_USART2;
-    USART2->CR1 |= USART_CR1_RXNEIE;
     USART2->CR1 |= USART_CR1_RE;
     USART2->CR1 |= USART_CR1_TE;
-    // BRR USARTDIV = FREQ/BAUDRATE
-    // 16Mhz / 115200 = 139 = 0x8B
-    USART2->BRR = 0x8B;
+    // Kernel clock is HSI16 in every clock profile
+    USART2->BRR = clock_usart_brr(CLOCK_HSI16_HZ, CLI_BAUDRATE);
     USART2->CR1 |= USART_CR1_UE;
+    transport_open(TRANSPORT_CONSOLE, USART2, true);
     NVIC->ISER0 = NVIC_USART2_LPUART2;
 }
 
 void cli_deinit(void)
 {
+    // Letting queued output reach the terminal first
+    transport_close(TRANSPORT_CONSOLE);
+
     // Reset GPIOA
     RCC->IOPENR |= RCC_IO_GPIOA;
     gpio_config_t cfg;
@@ -78,48 +120,65 @@ void cli_deinit(void)
     NVIC->ICER0 = NVIC_USART2_LPUART2;
 }
 
+// Applies to the active session only
+void cli_set_muted(bool mute)
+{
+    session->muted = mute;
+}
+
+// Unmuted output to the active session, for protocols framing their own
+void cli_write_raw(const uint8_t* bytes, uint32_t length)
+{
+    transport_write_all(session->transport, bytes, length);
+}
+
 void cli_clear(void)
 {
-    usart_send_bytes(USART2, (uint8_t*)"\033[2J", 4);
+    cli_send_bytes((uint8_t*)"\033[2J", 4);
 }
 
 void cli_home(void)
 {
-    usart_send_bytes(USART2, (uint8_t*)"\033[H", 3);
+    cli_send_bytes((uint8_t*)"\033[H", 3);
 }
 
 void cli_cursive(void)
 {
-    usart_send_bytes(USART2, (uint8_t*)"\033[3m", 4);
-    usart_send_bytes(USART2, (uint8_t*)"\033[4m", 4);
+    cli_send_bytes((uint8_t*)"\033[3m", 4);
+    cli_send_bytes((uint8_t*)"\033[4m", 4);
 }
 
 void cli_normal(void)
 {
-    usart_send_bytes(USART2, (uint8_t*)"\033[23m", 5);
-    usart_send_bytes(USART2, (uint8_t*)"\033[24m", 5);
+    cli_send_bytes((uint8_t*)"\033[23m", 5);
+    cli_send_bytes((uint8_t*)"\033[24m", 5);
 }
 
 void cli_print(const char* string)
 {
-    for(uint32_t i = 0; string[i]; i++){
-	usart_send_byte(USART2, string[i]);
-    }
+    uint32_t i = 0;
+
+    trace_record(TRACE_UART_TX_BEGIN, 0);
+    for(; string[i]; i++);
+    cli_send_bytes((const uint8_t*)string, i);
+    trace_record(TRACE_UART_TX_END, i);
 }
 
 void cli_printline(const char* string)
 {
-    for(uint32_t i = 0; string[i]; i++){
-	usart_send_byte(USART2, string[i]);
-    }
-    usart_send_byte(USART2, '\r');
-    usart_send_byte(USART2, '\n');
+    uint32_t i = 0;
+
+    trace_record(TRACE_UART_TX_BEGIN, 0);
+    for(; string[i]; i++);
+    cli_send_bytes((const uint8_t*)string, i);
+    cli_send_bytes((const uint8_t*)"\r\n", 2);
+    trace_record(TRACE_UART_TX_END, i + 2);
 }
 
 void cli_print_number(uint32_t number)
 {
     if(number == 0){
-        usart_send_byte(USART2, 48);
+        cli_send_byte(48);
         return;
     }
 
@@ -133,85 +192,201 @@ void cli_print_number(uint32_t number)
 	arr[index] = remainder + 48; // 48-57 is ascii 0-9
 	index--;
     }
-    usart_send_bytes(USART2, arr, 12);
+    cli_send_bytes(&arr[index + 1], 11 - index);
+}
+
+void cli_print_padded(const char* string, uint8_t width)
+{
+    uint8_t length = 0;
+
+    for(; string[length]; length++);
+    cli_send_bytes((const uint8_t*)string, length);
+    while(length++ < width){
+	cli_send_byte(' ');
+    }
+}
+
+void cli_print_number_padded(uint32_t number, uint8_t width)
+{
+    uint8_t digits = 1;
+
+    for(uint32_t rest = number / 10; rest; rest /= 10){
+	digits++;
+    }
+    while(digits++ < width){
+	cli_send_byte(' ');
+    }
+    cli_print_number(number);
 }
 
 void cli_newline(void)
 {
-    usart_send_byte(USART2, '\n');
-    usart_send_byte(USART2, '\r');
+    cli_send_byte('\n');
+    cli_send_byte('\r');
 }
 
 void cli_backspace(void)
 {
-    if(ring_buffer_delete(&ring_buffer_data)){
-	usart_send_byte(USART2, '\b');
-	usart_send_byte(USART2, 32);
-	usart_send_byte(USART2, '\b');	
+    if(ring_unput(&session->line)){
+	cli_send_byte('\b');
+	cli_send_byte(32);
+	cli_send_byte('\b');	
     }
 }
 
-void cli_tokenize(ring_buffer_t* ring_buffer, command_t tokens, char* token_length)
+// Splits the queued line at spaces, parsing it in place a span at a time
+void cli_tokenize(ring_t* ring, command_t tokens, char* token_length)
 {
+    uint32_t left = ring_count(ring);
     uint8_t token = 0;
     uint8_t symbol = 0;
+    const uint8_t* span;
+    uint32_t length;
 
-    while(!ring_buffer_empty(ring_buffer)){
-        ring_buffer_read(ring_buffer, (uint8_t*)&tokens[token][symbol]);
-        if(symbol == 0 && tokens[token][symbol] == ' '){
-            continue;
-        }
+    *token_length = 0;
+    while(left && (length = ring_read_span(ring, &span))){
+	for(uint32_t i = 0; i < length; i++){
+	    char c = span[i];
 
-        // Right now this ignores the token. Should be an error either way.
-        if(symbol >= COMMAND_MAX_LENGTH-1 || token >= COMMAND_MAX_AMOUNT){
-            cli_newline();
-            cli_print("Invalid command");
+	    left--;
+	    if(symbol == 0 && c == ' '){
+		continue;
+	    }
 
-            // This should flush the ring buffer to avoid relics in next message
-            ring_buffer_flush(ring_buffer);
-            return;
-        }
+	    // Right now this ignores the token. Should be an error either way.
+	    if(symbol >= COMMAND_MAX_LENGTH-1 || token >= COMMAND_MAX_AMOUNT){
+		cli_newline();
+		cli_print("Invalid command");
 
-        if(tokens[token][symbol] == ' ' || ring_buffer_empty(ring_buffer)){
-            // token is complete
-            if(ring_buffer_empty(ring_buffer)){
-                tokens[token][symbol+1] = '\0';
-            }else{
-                tokens[token][symbol] = '\0';
-            }
-            symbol = 0;
-            token++;
-        }
-        else{
-            symbol++;
-        }
+		// Dropping the rest to avoid relics in the next message
+		ring_discard(ring);
+		return;
+	    }
+
+	    tokens[token][symbol] = c;
+	    if(c == ' ' || !left){
+		// token is complete
+		tokens[token][(c == ' ') ? symbol : symbol + 1] = '\0';
+		symbol = 0;
+		token++;
+	    }else{
+		symbol++;
+	    }
+	}
+	ring_read_commit(ring, length);
     }
 
     *token_length = token;
 }
 
-void cli_parse_command(command_t tokens, char token_length)
+cli_status_t cli_parse_command(command_t tokens, char token_length)
 {
     if(token_length < 1){
-	return;
+	return CLI_STATUS_EMPTY;
     }
 
-    char* args = (token_length > 1) ? tokens[1] : 0;
+    const command_def_t* def = command_find(tokens[0]);
 
-    for(int i = 0; command_table[i].command != 0; i++){
-	if(utils_strings_match(tokens[0], command_table[i].command)){
-            cli_newline();
-	    command_table[i].handler(args);
-	    return;
+    cli_newline();
+    if(!def){
+	cli_print("Invalid command.");
+	return CLI_STATUS_INVALID_COMMAND;
+    }
+
+    // Handlers always get a string, empty when no argument was given, with
+    // any further arguments following after a single space
+    char args[COMMAND_MAX_AMOUNT * COMMAND_MAX_LENGTH] = {0U};
+    uint8_t length = 0;
+
+    for(uint8_t i = 1; i < token_length; i++){
+	if(i > 1){
+	    args[length++] = ' ';
+	}
+	for(uint8_t j = 0; tokens[i][j]; j++){
+	    args[length++] = tokens[i][j];
 	}
     }
-    cli_newline();
-    cli_print("Invalid command.");
+
+    if(def->args == COMMAND_ARGS_REQUIRED && !args[0]){
+	cli_print("Usage: ");
+	cli_print(def->name);
+	cli_print(" ");
+	cli_print(def->usage);
+	return CLI_STATUS_MISSING_ARGUMENT;
+    }
+
+    trace_record(TRACE_COMMAND, command_id(def));
+    def->handler(args);
+    return CLI_STATUS_OK;
+}
+
+cli_status_t cli_execute(const uint8_t* line, uint8_t length)
+{
+    static ring_t ring_line;
+    static uint8_t line_data[CLI_LINE_SIZE];
+
+    ring_init(&ring_line, line_data, CLI_LINE_SIZE);
+    if(ring_write(&ring_line, line, length) != length){
+	return CLI_STATUS_TOO_LONG;
+    }
+
+    command_t tokens = {0U};
+    char token_length = 0;
+    cli_tokenize(&ring_line, tokens, &token_length);
+
+    return cli_parse_command(tokens, token_length);
 }
 
-__attribute__((weak)) bool cli_parse_application_command(command_t tokens, char token_length)
+void cli_prompt(void)
 {
-    return false;
+    uint8_t line[CLI_LINE_SIZE];
+    uint32_t length = ring_peek(&session->line, line, sizeof(line));
+
+    cli_print("> ");
+    cli_send_bytes(line, length);
+}
+
+void cli_complete(void)
+{
+    uint8_t line[CLI_LINE_SIZE];
+    uint32_t length = ring_peek(&session->line, line, sizeof(line));
+
+    // Only the command name itself is completed
+    if(length >= COMMAND_MAX_LENGTH){
+	return;
+    }
+    for(uint32_t i = 0; i < length; i++){
+	if(line[i] == ' '){
+	    return;
+	}
+    }
+
+    char completion[COMMAND_MAX_LENGTH];
+    uint8_t matches = command_complete((char*)line, length, completion, COMMAND_MAX_LENGTH);
+
+    if(matches == 0){
+	return;
+    }
+
+    if(matches > 1 && !completion[0]){
+	// Ambiguous, listing the candidates and restoring the prompt
+	cli_newline();
+	command_print_matches((char*)line, length);
+	cli_newline();
+	cli_prompt();
+	return;
+    }
+
+    for(uint8_t i = 0; completion[i]; i++){
+	if(!ring_put(&session->line, completion[i])){
+	    return;
+	}
+	cli_send_byte(completion[i]);
+    }
+
+    if(matches == 1 && ring_put(&session->line, ' ')){
+	cli_send_byte(' ');
+    }
 }
 
 void cli_restart(const char *args)
@@ -219,85 +394,248 @@ void cli_restart(const char *args)
     restart_handler();
 }
 
-void cli_memdump_hex(const char *args)
+const char* cli_next_arg(const char* args, char* arg, uint8_t size)
 {
-    if(args[0] != '0' || args[1] != 'x'){
-        cli_print("Invalid memory format (0xAABBCCDD)");
-        return;
+    uint8_t length = 0;
+
+    while(*args == ' '){
+	args++;
+    }
+    while(*args && *args != ' '){
+	if(length < size - 1){
+	    arg[length++] = *args;
+	}
+	args++;
     }
+    arg[length] = '\0';
 
-    uint32_t dec = utils_hexstring_to_dec((uint8_t *)&args[2]);
+    return args;
+}
+
+bool cli_parse_number(const char* string, uint32_t* number)
+{
+    if(!string[0]){
+	return false;
+    }
 
-    cli_dump_hex_from_address(dec);
+    if(string[0] == '0' && string[1] == 'x'){
+	if(!string[2]){
+	    return false;
+	}
+	*number = utils_hexstring_to_dec((uint8_t*)&string[2]);
+    }else{
+	for(uint8_t i = 0; string[i]; i++){
+	    if(string[i] < '0' || string[i] > '9'){
+		return false;
+	    }
+	}
+	*number = utils_string_to_number(string);
+    }
+    return true;
 }
 
-void cli_memdump_bin(const char *args)
+// Parses "<0xADDRESS> [length]" into a word aligned range that is mapped
+static bool cli_parse_range(const char* args, uint32_t* address, uint32_t* length)
 {
-    if(args[0] != '0' || args[1] != 'x'){
+    char arg[COMMAND_MAX_LENGTH];
+
+    args = cli_next_arg(args, arg, sizeof(arg));
+    if(arg[0] != '0' || arg[1] != 'x' || !cli_parse_number(arg, address)){
         cli_print("Invalid memory format (0xAABBCCDD)");
-        return;
+        return false;
     }
 
-    uint32_t dec = utils_hexstring_to_dec((uint8_t *)&args[2]);
+    *length = 4;
+    cli_next_arg(args, arg, sizeof(arg));
+    if(arg[0] && !cli_parse_number(arg, length)){
+        cli_print("Invalid length");
+        return false;
+    }
 
-    cli_dump_bin_from_address(dec);
+    // Reading whole words keeps peripheral registers happy
+    *length = (*length + 3) & ~3U;
+    if(*address & 3){
+        cli_print("Address must be word aligned");
+        return false;
+    }
+
+    if(!memorymap_is_valid_range(*address, *length)){
+        cli_print("Address outside of mapped memory");
+        return false;
+    }
+    return true;
 }
 
-void cli_print_help(const char *args)
+void cli_memdump_hex(const char *args)
 {
-    cli_print_library_help();
-    cli_print_application_help();
+    uint32_t address;
+    uint32_t length;
+
+    if(cli_parse_range(args, &address, &length)){
+        cli_dump_hex_range(address, length);
+    }
 }
 
-void cli_print_library_help()
+void cli_memdump_raw(const char *args)
+{
+    uint32_t address;
+    uint32_t length;
+
+    if(cli_parse_range(args, &address, &length)){
+        cli_dump_raw_range(address, length);
+    }
+}
+
+void cli_memdump_bin(const char *args)
+{
+    uint32_t address;
+    uint32_t length;
+
+    if(cli_parse_range(args, &address, &length)){
+        cli_dump_bin_from_address(address);
+    }
+}
+
+void cli_print_help(const char *args)
 {
     cli_newline();
-    cli_print("-------------------------------------------");
-    cli_newline();
-    cli_newline();
-    cli_print("**********************");
-    cli_newline();
-    cli_print("** Default commands **");
-    cli_newline();
-    cli_print("**********************");
-    cli_newline();
-    cli_newline();
-    cli_print("rs            - Restarts the program");
-    cli_newline();
-    cli_newline();
-    cli_print("memdump       - Prints the memory at specified address");
-    cli_newline();
-    cli_print("                Example: memdump 0x50000000");
-    cli_newline();
-    cli_print("-------------------------------------------");
-    cli_newline();
-    cli_newline();
+    command_print_help();
 }
 
-__attribute__((weak)) void cli_print_application_help();
+static const uint8_t hex_digits[] = "0123456789abcdef";
+
+// The lowest digits of value in hex, without a prefix
+void cli_print_hex(uint32_t value, uint8_t digits)
+{
+    uint8_t hex[8];
+
+    for(uint8_t i = 0; i < digits; i++){
+	hex[i] = hex_digits[(value >> (4 * (digits - 1 - i))) & 0xF];
+    }
+    cli_stream(hex, digits);
+}
 
 void cli_dump_hex_from_address(uint32_t address)
 {
-    uint8_t hex[9] = {0U};
+    cli_print("0x");
+    cli_print_hex(M32(address), 8);
+}
+
+void cli_dump_hex_range(uint32_t address, uint32_t length)
+{
+    // "aaaaaaaa: xx xx .. xx  |................|\r\n"
+    uint8_t line[8 + 2 + 16 * 3 + 1 + 18 + 2];
+    uint32_t crc = CRC32_INIT;
+
+    for(uint32_t offset = 0; offset < length; offset += 16){
+	uint8_t bytes[16];
+	uint8_t count = (length - offset < 16) ? length - offset : 16;
+	uint8_t index = 0;
+
+	for(uint8_t i = 0; i < count; i += 4){
+	    uint32_t word = M32(address + offset + i);
+	    bytes[i] = word;
+	    bytes[i + 1] = word >> 8;
+	    bytes[i + 2] = word >> 16;
+	    bytes[i + 3] = word >> 24;
+	}
+	crc = crc32(bytes, count, crc);
 
-    // TODO: Implement is_valid_address properly
-    /*if(memorymap_is_valid_address(address)){*/
-        usart_send_byte(USART2, '0');
-        usart_send_byte(USART2, 'x');
+	for(uint8_t i = 0; i < 8; i++){
+	    line[index++] = hex_digits[((address + offset) >> (28 - 4 * i)) & 0xF];
+	}
+	line[index++] = ':';
+	line[index++] = ' ';
 
-        if(utils_dec_to_hexstring(M32(address), hex)){
-            usart_send_bytes(USART2, hex, 8);
-        }
-    /*}else{*/
-    /*    cmd_print("Address outside of mapped memory");*/
-    /*}*/
+	for(uint8_t i = 0; i < 16; i++){
+	    line[index++] = (i < count) ? hex_digits[bytes[i] >> 4] : ' ';
+	    line[index++] = (i < count) ? hex_digits[bytes[i] & 0xF] : ' ';
+	    line[index++] = ' ';
+	}
+
+	line[index++] = ' ';
+	line[index++] = '|';
+	for(uint8_t i = 0; i < count; i++){
+	    line[index++] = (bytes[i] >= 32 && bytes[i] < 127) ? bytes[i] : '.';
+	}
+	line[index++] = '|';
+	line[index++] = '\r';
+	line[index++] = '\n';
+
+	cli_stream(line, index);
+    }
+
+    cli_print("CRC32: 0x");
+    cli_print_hex(~crc, 8);
+}
+
+// The raw format is "RAW <length>\r\n", the bytes themselves and the little
+// endian CRC-32 of them, for a host to capture and verify. The bytes and the
+// CRC are traced as one transmission, however many writes they take.
+static uint32_t raw_length = 0;
+
+uint32_t cli_raw_begin(uint32_t length)
+{
+    cli_print("RAW ");
+    cli_print_number(length);
+    cli_print("\r\n");
+
+    raw_length = length + 4;
+    if(!session->muted){
+	trace_record(TRACE_UART_TX_BEGIN, raw_length);
+    }
+    return CRC32_INIT;
+}
+
+uint32_t cli_raw_write(const uint8_t* bytes, uint32_t length, uint32_t crc)
+{
+    cli_send_bytes(bytes, length);
+    return crc32(bytes, length, crc);
+}
+
+void cli_raw_end(uint32_t crc)
+{
+    crc = ~crc;
+    uint8_t trailer[4] = { crc, crc >> 8, crc >> 16, crc >> 24 };
+    cli_send_bytes(trailer, 4);
+
+    if(!session->muted){
+	trace_record(TRACE_UART_TX_END, raw_length);
+    }
+}
+
+// Words are read one at a time, peripherals may not take other accesses,
+// and sent a buffer at a time
+void cli_dump_raw_range(uint32_t address, uint32_t length)
+{
+    uint8_t bytes[CLI_RAW_CHUNK];
+    uint8_t count = 0;
+    uint32_t crc = cli_raw_begin(length);
+
+    for(uint32_t offset = 0; offset < length; offset += 4){
+	uint32_t word = M32(address + offset);
+
+	bytes[count++] = word;
+	bytes[count++] = word >> 8;
+	bytes[count++] = word >> 16;
+	bytes[count++] = word >> 24;
+	if(count == sizeof(bytes)){
+	    crc = cli_raw_write(bytes, count, crc);
+	    count = 0;
+	}
+    }
+    if(count){
+	crc = cli_raw_write(bytes, count, crc);
+    }
+
+    cli_raw_end(crc);
 }
 
 void cli_dump_bin_from_address(uint32_t address)
 {
     uint8_t bin[33] = {48};
 
-    /*if(memorymap_is_valid_address(address)){*/
+    if(memorymap_is_valid_address(address)){
         if(utils_dec_to_binarystring(M32(address),(char*) bin, 32)){
             cli_print(" -----------------------------------------------");
             cli_newline();
@@ -313,7 +651,7 @@ void cli_dump_bin_from_address(uint32_t address)
                 if(i == 31){
                     cli_print("| ");
                 }
-                usart_send_byte(USART2, bin[31 - i]);
+                cli_send_byte(bin[31 - i]);
                 cli_print("| ");
             }
             cli_newline();
@@ -335,124 +673,122 @@ void cli_dump_bin_from_address(uint32_t address)
                 if(i == 15){
                     cli_print("| ");
                 }
-                usart_send_byte(USART2, bin[31 - i]);
+                cli_send_byte(bin[31 - i]);
                 cli_print("| ");
             }
             cli_newline();
             cli_print(" -----------------------------------------------");
         }
-    /*}else{*/
-    /*    cmd_print("Address outside of mapped memory");*/
-    /*}*/
-}
-
-void cli_process_input(void){
-    // If we received new data from USART
-    uint8_t byte;
-    while(!ring_buffer_empty(&ring_buffer_temp)){
-	if(ring_buffer_read(&ring_buffer_temp, &byte)){
-	    switch(usart_state){
-
-		case USART_STATE_IDLE:
-		    if(byte == 27){
-			usart_state = USART_STATE_ESC;
-		    }
-		    else if(byte == '\r'){
-			// Parse all data and respond
-			command_t tokens = {0U};
-			char token_length;
-			cli_tokenize(&ring_buffer_data, tokens, &token_length);
-
-			// TODO:Do not save repeated commands seperately
-
-			if(tokens[0][0]){ // Not a blank enter press
-			    /*utils_command_cpy(command_history[command_index], tokens);*/
-
-			    if(!cli_parse_application_command(tokens, token_length)){
-				// Only parse default defaults if commands was not found in application implementation
-				cli_parse_command(tokens, token_length);
-			    }
-			}
-			cli_newline();
-			cli_print("> ");
-		    }else if(byte == 127){
-			cli_backspace();
-		    }else if(byte == '\t'){
-			// Ignore tabs
-		    }else{
-			// Save byte
-			if(!ring_buffer_write(&ring_buffer_data, byte)){
-			    ring_buffer_flush(&ring_buffer_data);
-			    return;
-			}
-			// Mirror character to console
-			usart_send_byte(USART2, byte);
-		    }
-		break;
+    }else{
+        cli_print("Address outside of mapped memory");
+    }
+}
 
-		case USART_STATE_ESC:
-		    if(byte == '['){
-			usart_state = USART_STATE_BRACKET;
-		    } else {
-			usart_state = USART_STATE_IDLE;
-		    }
-		break;
+static void cli_process_byte(uint8_t byte)
+{
+    // Binary frames bypass the REPL, which keeps its line for later.
+    // Only one link at a time can be in binary mode.
+    if(binary_session == session){
+	proto_receive(byte);
+	if(!proto_active()){
+	    binary_session = 0;
+	}
+	return;
+    }
+    if(!binary_session && proto_detect(&session->proto_index, byte)){
+	if(proto_active()){
+	    binary_session = session;
+	}
+	return;
+    }
+    if(session->compact && compact_is_opcode(byte)){
+	compact_receive(byte);
+	return;
+    }
+
+    switch(session->usart_state){
+
+	case USART_STATE_IDLE:
+	    if(byte == 27){
+		session->usart_state = USART_STATE_ESC;
+	    }
+	    else if(byte == '\r'){
+		// Parse all data and respond
+		command_t tokens = {0U};
+		char token_length;
+		cli_tokenize(&session->line, tokens, &token_length);
+
+		if(tokens[0][0]){ // Not a blank enter press
+		    latency_start(LATENCY_PATH_TEXT);
+		    cli_parse_command(tokens, token_length);
+		}
+		cli_newline();
+		cli_print("> ");
+	    }else if(byte == 127){
+		cli_backspace();
+	    }else if(byte == '\t'){
+		cli_complete();
+	    }else{
+		// Save byte
+		if(!ring_put(&session->line, byte)){
+		    perf_count(PERF_LINE_OVERFLOW);
+		    ring_discard(&session->line);
+		    return;
+		}
+		// Mirror character to console
+		cli_send_byte(byte);
+	    }
+	break;
 
-		case USART_STATE_BRACKET:
-		    usart_state = USART_STATE_IDLE;
-
-		    switch(byte){
-			case 'A':
-			    if(command_index >= 0){
-				uint8_t len = utils_strlen(command_history[command_index][0]);
-				for(int i = 0; i < len; i++){
-				    cli_backspace();
-				}
-				cli_print(command_history[command_index][0]);
-
-				/*if(command_history[command_index][1] != 0){*/
-				/*    cli_print(" ");*/
-				/*    cli_print(command_history[command_index][1]);*/
-				/*}*/
-
-				for(int i = 0; command_history[command_index][0][i]; i++){
-				    if(!ring_buffer_write(&ring_buffer_data, command_history[command_index][0][i])){
-					ring_buffer_flush(&ring_buffer_data);
-					return;
-					}
-				    }
-			    }
-			    // Up arrow, Previous command
-			break;
-			case 'B':
-			    // Down arrow, Next command
-			break;
-			case 'C':
-			    // Right arrow, no functionality for now
-			break;
-			case 'D':
-			    // Left arrow, no functionality for now
-			break;
-		    }
+	case USART_STATE_ESC:
+	    if(byte == '['){
+		session->usart_state = USART_STATE_BRACKET;
+	    } else {
+		session->usart_state = USART_STATE_IDLE;
+	    }
+	break;
+
+	case USART_STATE_BRACKET:
+	    session->usart_state = USART_STATE_IDLE;
+
+	    switch(byte){
+		case 'A':
+		    // Up arrow, no history kept for now
+		break;
+		case 'B':
+		    // Down arrow, Next command
+		break;
+		case 'C':
+		    // Right arrow, no functionality for now
+		break;
+		case 'D':
+		    // Left arrow, no functionality for now
 		break;
 	    }
-	}
+	break;
     }
 }
 
-void USART2_LPUART2_IRQHandler(void) {
-    // Checking if interupt is due to data being recieved
-    if(USART2->ISR & USART_ISR_RXNE){
+// Takes the received bytes out a queue at a time, which makes room for more
+// while they are handled
+static void cli_process_session(void)
+{
+    uint8_t bytes[TRANSPORT_RX_SIZE];
+    uint32_t length;
 
-	// Reading the byte
-	uint8_t byte = USART2->RDR;
+    while((length = transport_read_bulk(session->transport, bytes, sizeof(bytes)))){
+	for(uint32_t i = 0; i < length; i++){
+	    cli_process_byte(bytes[i]);
+	}
+    }
+}
 
-	// If the overrun flag is set, for now just clear it
-	if(USART2->ISR & USART_ISR_ORE){
-	    USART2->ICR |= USART_ISR_ORE;
-	    return;
+void cli_process_input(void)
+{
+    for(uint8_t i = 0; i < TRANSPORT_COUNT; i++){
+	if(transport_pending(sessions[i].transport)){
+	    session = &sessions[i];
+	    cli_process_session();
 	}
-	
-	ring_buffer_write(&ring_buffer_temp, byte);
     }
 }
@@ -0,0 +1,198 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "clock.h"
+#include "bt.h"
+#include "cli.h"
+#include "cpu.h"
+#include "irdecoder.h"
+#include "led.h"
+#include "regs.h"
+#include "timebase.h"
+
+// Library headers
+#include "nvic.h"
+#include "rcc.h"
+#include "spi.h"
+#include "tim.h"
+#include "usart.h"
+#include "utils.h"
+
+typedef struct{
+    const char* name;
+    uint32_t hz;
+    uint32_t sw;
+    uint32_t hpre;
+    uint8_t latency; // Flash wait states, RM0444 table 14 for range 1
+} clock_config_t;
+
+static const clock_config_t configs[CLOCK_PROFILE_COUNT] = {
+    [CLOCK_PROFILE_LOW]    = { "low",    2000000,  RCC_CFGR_SW_HSISYS, RCC_CFGR_HPRE_DIV8, 0 },
+    [CLOCK_PROFILE_NORMAL] = { "normal", 16000000, RCC_CFGR_SW_HSISYS, RCC_CFGR_HPRE_DIV1, 0 },
+    [CLOCK_PROFILE_FAST]   = { "fast",   64000000, RCC_CFGR_SW_PLLR,   RCC_CFGR_HPRE_DIV1, 2 },
+};
+
+static clock_profile_t profile = CLOCK_PROFILE_NORMAL;
+
+void clock_init(void)
+{
+    // USART2 takes HSI16 directly, keeping the console baud rate the same
+    // in every profile and letting a start bit wake the core from Stop
+    RCC->CCIPR = (RCC->CCIPR & ~RCC_CCIPR_USART2SEL_MSK) | RCC_CCIPR_USART2SEL_HSI16;
+
+    FLASH_ACR |= FLASH_ACR_PRFTEN | FLASH_ACR_ICEN;
+
+    // 16 MHz * 8 / 2 = 64 MHz, VCO at 128 MHz
+    RCC->PLLCFGR = RCC_PLLCFGR_PLLSRC_HSI16 | RCC_PLLCFGR_PLLM(1) | RCC_PLLCFGR_PLLN(8)
+		 | RCC_PLLCFGR_PLLR(2) | RCC_PLLCFGR_PLLREN;
+
+    profile = CLOCK_PROFILE_NORMAL;
+}
+
+void clock_deinit(void)
+{
+    clock_set_profile(CLOCK_PROFILE_NORMAL);
+    RCC->CCIPR &= ~RCC_CCIPR_USART2SEL_MSK;
+    RCC->PLLCFGR = 0;
+}
+
+clock_profile_t clock_profile(void)
+{
+    return profile;
+}
+
+uint32_t clock_hz(void)
+{
+    return configs[profile].hz;
+}
+
+uint32_t clock_usart_brr(uint32_t kernel_hz, uint32_t baudrate)
+{
+    // BRR USARTDIV = FREQ/BAUDRATE, rounded
+    return (kernel_hz + baudrate / 2) / baudrate;
+}
+
+uint16_t clock_timer_psc(uint32_t tick_hz)
+{
+    return clock_hz() / tick_hz - 1;
+}
+
+// Smallest fPCLK/2^(BR+1) prescaler keeping SCK at or below max_hz
+uint8_t clock_spi_br(uint32_t max_hz)
+{
+    uint8_t br = 0;
+
+    while(br < 7 && (clock_hz() >> (br + 1)) > max_hz){
+	br++;
+    }
+    return br;
+}
+
+// Loads a timer prescaler at once. PSC is preloaded, so left alone the
+// period under way would finish at the new clock with the old prescaler and
+// one tick come out the wrong length. The update event that loads it also
+// clears the count, put back to keep the phase, and sets UIF, which is no
+// tick: the flag and what the NVIC latched of it go, unless a real tick was
+// already waiting. Interrupts must be masked.
+static void clock_timer_load(TIM_t* timer, uint32_t irq, uint16_t psc)
+{
+    uint32_t count = PERIPH(timer)->CNT;
+    bool pending = PERIPH(timer)->SR & TIM_SR_UIF;
+
+    PERIPH(timer)->PSC = psc;
+    PERIPH(timer)->EGR = TIM_EGR_UG;
+    PERIPH(timer)->CNT = count;
+    if(!pending){
+	PERIPH(timer)->SR &= ~TIM_SR_UIF;
+	NVIC->ICPR0 = irq;
+    }
+}
+
+// Derives every clock dependent setting from the active profile
+void clock_apply_timings(void)
+{
+    // USART3 runs from PCLK, its BRR can only be written while disabled
+    if(USART3->CR1 & USART_CR1_UE){
+	USART3->CR1 &= ~USART_CR1_UE;
+	USART3->BRR = clock_usart_brr(clock_hz(), BT_BAUDRATE);
+	USART3->CR1 |= USART_CR1_UE;
+    }
+
+    USART2->BRR = clock_usart_brr(CLOCK_HSI16_HZ, CLI_BAUDRATE);
+
+    clock_timer_load(TIM14, NVIC_TIM14, clock_timer_psc(LED_TICK_HZ));
+    clock_timer_load(TIM16, NVIC_TIM16_FDCAN_IT0, clock_timer_psc(IRDECODER_TICK_HZ));
+
+    if(SPI1->CR1 & SPI_CR1_SPE){
+	while(SPI1->SR & SPI_SR_BSY);
+	SPI1->CR1 &= ~SPI_CR1_SPE;
+	SPI1->CR1 = (SPI1->CR1 & ~SPI_CR1_BR(0x7)) | SPI_CR1_BR(clock_spi_br(LED_SPI_MAX_HZ));
+	SPI1->CR1 |= SPI_CR1_SPE;
+    }
+
+    timebase_set_clock(clock_hz());
+}
+
+void clock_set_profile(clock_profile_t next)
+{
+    const clock_config_t* config = &configs[next];
+
+    uint32_t primask = cpu_irq_save();
+
+    // Letting USART3 finish its byte, PCLK changes under it. With interrupts
+    // masked nothing refills TDR, the queue carries on after the switch.
+    if(USART3->CR1 & USART_CR1_UE){
+	while(!(USART3->ISR & USART_ISR_TC));
+    }
+
+    // More wait states before speeding up
+    if(config->latency > (FLASH_ACR & FLASH_ACR_LATENCY_MSK)){
+	FLASH_ACR = (FLASH_ACR & ~FLASH_ACR_LATENCY_MSK) | config->latency;
+	while((FLASH_ACR & FLASH_ACR_LATENCY_MSK) != config->latency);
+    }
+
+    if(config->sw == RCC_CFGR_SW_PLLR){
+	RCC->CR |= RCC_CR_PLLON;
+	while(!(RCC->CR & RCC_CR_PLLRDY));
+    }
+
+    RCC->CFGR = (RCC->CFGR & ~(RCC_CFGR_SW_MSK | RCC_CFGR_HPRE_MSK)) | config->sw | config->hpre;
+    while((RCC->CFGR & RCC_CFGR_SWS_MSK) != RCC_CFGR_SWS(config->sw));
+
+    if(config->sw != RCC_CFGR_SW_PLLR){
+	RCC->CR &= ~RCC_CR_PLLON;
+    }
+
+    // Fewer wait states after slowing down
+    if(config->latency < (FLASH_ACR & FLASH_ACR_LATENCY_MSK)){
+	FLASH_ACR = (FLASH_ACR & ~FLASH_ACR_LATENCY_MSK) | config->latency;
+    }
+
+    profile = next;
+    clock_apply_timings();
+
+    cpu_irq_restore(primask);
+}
+
+// Stop mode always wakes up on HSI16, bringing back the chosen profile
+void clock_restore(void)
+{
+    if(profile != CLOCK_PROFILE_NORMAL){
+	clock_set_profile(profile);
+    }
+}
+
+void clock_command(const char* args)
+{
+    for(uint8_t i = 0; i < CLOCK_PROFILE_COUNT; i++){
+	if(utils_strings_match(args, configs[i].name)){
+	    clock_set_profile(i);
+	}
+    }
+
+    cli_print("Clock profile: ");
+    cli_print(configs[profile].name);
+    cli_print(", ");
+    cli_print_number(clock_hz() / 1000000);
+    cli_print(" MHz");
+}
@@ -0,0 +1,165 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "command.h"
+#include "cli.h"
+#include "commands_gen.h"
+
+// Library headers
+#include "utils.h"
+
+static uint32_t command_fnv(const char* name, uint32_t hash)
+{
+    for(uint8_t i = 0; name[i]; i++){
+	hash ^= (uint8_t)name[i];
+	hash *= 16777619U;
+    }
+    return hash;
+}
+
+static uint32_t command_hash(const char* name)
+{
+    // FNV-1a, seeded by the generator so that no two names share a slot
+    uint32_t hash = command_fnv(name, COMMAND_HASH_SEED);
+    return hash ^ (hash >> 16);
+}
+
+static bool command_has_prefix(const char* name, const char* prefix, uint8_t length)
+{
+    for(uint8_t i = 0; i < length; i++){
+	if(name[i] != prefix[i]){
+	    return false;
+	}
+    }
+    return true;
+}
+
+const command_def_t* command_find(const char* name)
+{
+    uint8_t slot = command_slots[command_hash(name) & (COMMAND_SLOT_COUNT - 1)];
+
+    if(slot == 0 || !utils_strings_match(name, command_names[slot - 1].name)){
+	return 0;
+    }
+    return &command_defs[command_names[slot - 1].def];
+}
+
+// Position of the command in src/commands.txt
+uint8_t command_id(const command_def_t* def)
+{
+    return def - command_defs;
+}
+
+// Plain FNV-1a of a name, which unlike command_id() survives commands being
+// added, for references to commands kept in flash
+uint32_t command_name_hash(const char* name)
+{
+    return command_fnv(name, 0x811C9DC5U);
+}
+
+const command_def_t* command_find_hash(uint32_t hash)
+{
+    for(uint8_t i = 0; i < COMMAND_NAME_COUNT; i++){
+	if(command_name_hash(command_names[i].name) == hash){
+	    return &command_defs[command_names[i].def];
+	}
+    }
+    return 0;
+}
+
+uint8_t command_complete(const char* prefix, uint8_t length, char* completion, uint8_t size)
+{
+    const char* first = 0;
+    uint8_t common = 0;
+    uint8_t matches = 0;
+
+    for(uint8_t i = 0; i < COMMAND_NAME_COUNT; i++){
+	const char* name = command_names[i].name;
+
+	if(!command_has_prefix(name, prefix, length)){
+	    continue;
+	}
+
+	if(!first){
+	    first = name;
+	    common = utils_strlen(name);
+	}else{
+	    uint8_t j = length;
+	    while(j < common && name[j] == first[j]){
+		j++;
+	    }
+	    common = j;
+	}
+	matches++;
+    }
+
+    // Writing the part every match has in common after the prefix
+    uint8_t written = 0;
+    for(uint8_t i = length; first && i < common && written < size - 1; i++){
+	completion[written++] = first[i];
+    }
+    completion[written] = '\0';
+
+    return matches;
+}
+
+void command_print_matches(const char* prefix, uint8_t length)
+{
+    for(uint8_t i = 0; i < COMMAND_NAME_COUNT; i++){
+	if(command_has_prefix(command_names[i].name, prefix, length)){
+	    cli_print(command_names[i].name);
+	    cli_print("  ");
+	}
+    }
+}
+
+void command_print_help(void)
+{
+    for(uint8_t i = 0; i < COMMAND_DEF_COUNT; i++){
+	const command_def_t* def = &command_defs[i];
+
+	if(i == 0 || def->section != command_defs[i - 1].section){
+	    cli_print("-------------------------------------------");
+	    cli_newline();
+	    cli_print("** ");
+	    cli_print(command_sections[def->section]);
+	    cli_print(" **");
+	    cli_newline();
+	    cli_newline();
+	}
+
+	cli_print_padded(def->name, 14);
+	cli_print("- ");
+	cli_print(def->help);
+	cli_newline();
+
+	if(def->usage[0]){
+	    cli_print_padded("", 16);
+	    cli_print("Usage: ");
+	    cli_print(def->name);
+	    cli_print(" ");
+	    cli_print(def->usage);
+	    cli_newline();
+	}
+
+	// Listing the aliases, which follow their command in command_names
+	bool first = true;
+	for(uint8_t j = 0; j < COMMAND_NAME_COUNT; j++){
+	    if(command_names[j].def != i || utils_strings_match(command_names[j].name, def->name)){
+		continue;
+	    }
+	    if(first){
+		cli_print_padded("", 16);
+		cli_print("Aliases:");
+		first = false;
+	    }
+	    cli_print(" ");
+	    cli_print(command_names[j].name);
+	}
+	if(!first){
+	    cli_newline();
+	}
+    }
+    cli_print("-------------------------------------------");
+    cli_newline();
+}
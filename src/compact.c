@@ -0,0 +1,141 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "compact.h"
+#include "cli.h"
+#include "latency.h"
+#include "led.h"
+
+static bool batching = false;
+static led_settings_t staged;
+static uint8_t staged_mask = 0;
+
+// Answers with the setters for everything in mask that differs from before
+static void compact_reply(const led_settings_t* before, const led_settings_t* after, uint8_t mask)
+{
+    uint8_t reply[5];
+    uint8_t length = 0;
+
+    if((mask & LED_SET_PATTERN) && after->pattern != before->pattern){
+	reply[length++] = COMPACT_PATTERN | after->pattern;
+    }
+    if((mask & LED_SET_SPEED) && after->speed != before->speed){
+	reply[length++] = COMPACT_SPEED | after->speed;
+    }
+    if((mask & LED_SET_BRIGHTNESS) && after->brightness != before->brightness){
+	reply[length++] = COMPACT_BRIGHTNESS | after->brightness;
+    }
+    if((mask & LED_SET_ACTIVE) && after->active != before->active){
+	reply[length++] = COMPACT_POWER | after->active;
+    }
+    reply[length++] = COMPACT_ACK;
+
+    cli_write_raw(reply, length);
+}
+
+static void compact_nak(void)
+{
+    uint8_t nak = COMPACT_NAK;
+    cli_write_raw(&nak, 1);
+}
+
+// Turns an opcode into settings, relative ones resolved against current
+static bool compact_decode(uint8_t byte, const led_settings_t* current,
+			   led_settings_t* settings, uint8_t* mask)
+{
+    uint8_t value = byte & COMPACT_VALUE_MASK;
+
+    *settings = *current;
+    switch(byte){
+	case COMPACT_PATTERN_NEXT:
+	    settings->pattern = (current->pattern + 1) % LED_PATTERN_COUNT;
+	    *mask = LED_SET_PATTERN;
+	    return true;
+	case COMPACT_PATTERN_PREV:
+	    settings->pattern = (current->pattern + LED_PATTERN_COUNT - 1) % LED_PATTERN_COUNT;
+	    *mask = LED_SET_PATTERN;
+	    return true;
+	case COMPACT_FASTER:
+	    settings->speed = (current->speed < LED_SPEED_LEVELS) ? current->speed + 1 : current->speed;
+	    *mask = LED_SET_SPEED;
+	    return true;
+	case COMPACT_SLOWER:
+	    settings->speed = (current->speed > 1) ? current->speed - 1 : current->speed;
+	    *mask = LED_SET_SPEED;
+	    return true;
+	case COMPACT_TOGGLE:
+	    settings->active = !current->active;
+	    *mask = LED_SET_ACTIVE;
+	    return true;
+    }
+
+    switch(byte & COMPACT_OPCODE_MASK){
+	case COMPACT_PATTERN:
+	    settings->pattern = value;
+	    *mask = LED_SET_PATTERN;
+	    return value < LED_PATTERN_COUNT;
+	case COMPACT_SPEED:
+	    settings->speed = value;
+	    *mask = LED_SET_SPEED;
+	    return value >= 1 && value <= LED_SPEED_LEVELS;
+	case COMPACT_BRIGHTNESS:
+	    settings->brightness = value;
+	    *mask = LED_SET_BRIGHTNESS;
+	    return value >= 1 && value <= LED_BRIGHTNESS_MAX;
+	case COMPACT_POWER:
+	    settings->active = value;
+	    *mask = LED_SET_ACTIVE;
+	    return value <= 1;
+    }
+    return false;
+}
+
+void compact_receive(uint8_t byte)
+{
+    led_settings_t current;
+    led_get(&current);
+
+    switch(byte){
+	case COMPACT_STATE:
+	{
+	    // Compared against nothing, so every setting is answered
+	    led_settings_t none = { LED_PATTERN_COUNT, 0, 0, !current.active };
+	    compact_reply(&none, &current, LED_SET_ALL);
+	    return;
+	}
+	case COMPACT_BEGIN:
+	    batching = true;
+	    staged = current;
+	    staged_mask = 0;
+	    return;
+	case COMPACT_COMMIT:
+	    if(!batching){
+		compact_nak();
+		return;
+	    }
+	    batching = false;
+	    latency_start(LATENCY_PATH_COMPACT);
+	    led_apply(&staged, staged_mask);
+	    compact_reply(&current, &staged, staged_mask);
+	    return;
+    }
+
+    led_settings_t settings;
+    uint8_t mask;
+
+    // Relative opcodes in a batch build on what is staged so far
+    if(!compact_decode(byte, batching ? &staged : &current, &settings, &mask)){
+	compact_nak();
+	return;
+    }
+
+    if(batching){
+	staged = settings;
+	staged_mask |= mask;
+	return;
+    }
+
+    latency_start(LATENCY_PATH_COMPACT);
+    led_apply(&settings, mask);
+    compact_reply(&current, &settings, mask);
+}
@@ -0,0 +1,81 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "flash.h"
+#include "regs.h"
+
+static volatile bool reading = false;
+static volatile bool ecc_failed = false;
+
+// A double ECC error raises the NMI. One met by flash_read is noted and
+// cleared for it to report, anywhere else there is no going on.
+void NMI_Handler(void)
+{
+    if(reading && (FLASH_ECCR & FLASH_ECCR_ECCD)){
+	FLASH_ECCR = FLASH_ECCR_ECCD;
+	ecc_failed = true;
+	return;
+    }
+    while(1);
+}
+
+static void flash_unlock(void)
+{
+    while(FLASH_SR & FLASH_SR_BSY1);
+    if(FLASH_CR & FLASH_CR_LOCK){
+	FLASH_KEYR = FLASH_KEY1;
+	FLASH_KEYR = FLASH_KEY2;
+    }
+    FLASH_SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+}
+
+static void flash_lock(void)
+{
+    FLASH_CR |= FLASH_CR_LOCK;
+}
+
+// Reads one double word, address must be 8-byte aligned. False when it
+// fails ECC, as one torn by a reset while programming it does.
+bool flash_read(uint32_t address, uint32_t* low, uint32_t* high)
+{
+    reading = true;
+    ecc_failed = false;
+    *low = REG32(address);
+    *high = REG32(address + 4);
+    reading = false;
+
+    return !ecc_failed;
+}
+
+// Programs one double word, address must be 8-byte aligned and erased, or
+// the words both zero
+bool flash_program(uint32_t address, uint32_t low, uint32_t high)
+{
+    volatile uint32_t* words = (volatile uint32_t*)address;
+
+    flash_unlock();
+    FLASH_CR |= FLASH_CR_PG;
+    words[0] = low;
+    words[1] = high;
+    while(FLASH_SR & (FLASH_SR_BSY1 | FLASH_SR_CFGBSY));
+    FLASH_CR &= ~FLASH_CR_PG;
+
+    bool ok = !(FLASH_SR & FLASH_SR_ERRORS);
+    flash_lock();
+
+    return ok;
+}
+
+bool flash_erase(uint8_t page)
+{
+    flash_unlock();
+    FLASH_CR = (FLASH_CR & ~FLASH_CR_PNB(0x7F)) | FLASH_CR_PER | FLASH_CR_PNB(page);
+    FLASH_CR |= FLASH_CR_STRT;
+    while(FLASH_SR & (FLASH_SR_BSY1 | FLASH_SR_CFGBSY));
+    FLASH_CR &= ~(FLASH_CR_PER | FLASH_CR_PNB(0x7F));
+
+    bool ok = !(FLASH_SR & FLASH_SR_ERRORS);
+    flash_lock();
+
+    return ok;
+}
@@ -2,6 +2,17 @@
 
 // Firmware headers
 #include "irdecoder.h"
+#include "cli.h"
+#include "clock.h"
+#include "command.h"
+#include "latency.h"
+#include "regs.h"
+#include "perf.h"
+#include "replay.h"
+#include "sched.h"
+#include "store.h"
+#include "timebase.h"
+#include "trace.h"
 
 // Library headers
 #include "rcc.h"
@@ -9,13 +20,16 @@
 #include "gpio.h"
 #include "tim.h"
 #include "exti.h"
+#include "utils.h"
 
 static uint8_t command = 0xFF;
-static uint32_t bit_times[32] = {0};
+static uint16_t bit_times[32] = {0}; // TIM16 ticks, the counter is 16 bits
 static uint8_t bit_time_index = 0;
+static volatile bool probe_pending = false;
+static uint32_t probe_time = 0;
 
-// TODO: Waste of space and time, make better
-static uint8_t ir_to_command[70] = {
+// Remote code to button, codes the remote does not send are button 0
+static const uint8_t ir_to_command[70] = {
     [IR_KP_0] = 0,
     [IR_KP_1] = 1,
     [IR_KP_2] = 2,
@@ -38,26 +52,172 @@ static uint8_t ir_to_command[70] = {
     [IR_DP_OK] = 19,
 };
 
-static command_callback_t ir_commands[20];
+// The built-in table stays in flash, irbind only keeps what it changed
+static const command_callback_t* builtin = 0;
+static uint8_t builtin_count = 0;
+static uint32_t rebound = 0; // Buttons irbind has taken over
+static const command_def_t* bound[IRDECODER_BUTTONS];
+static char bound_args[IRDECODER_BUTTONS][IRDECODER_ARG_LENGTH + 1];
 
 void irdecoder_set_commands(const command_callback_t* commands, uint8_t count)
 {
-    for(uint8_t i = 0; i < count; i++){
-	ir_commands[i] = commands[i];
+    builtin = commands;
+    builtin_count = count;
+}
+
+// What a button runs and with which argument, either of them 0. Bound
+// commands always get a string, as they would from the command line.
+static command_callback_t irdecoder_button(uint8_t button)
+{
+    command_callback_t callback = {button, 0, 0};
+
+    if(rebound & (1U << button)){
+	callback.arg = bound_args[button];
+	callback.command = bound[button] ? bound[button]->handler : 0;
+    }else if(button < builtin_count){
+	callback = builtin[button];
     }
+    return callback;
 }
 
 void irdecoder_process(void)
 {
     if(command != 0xFF){
-	uint8_t i = ir_to_command[command];
-	if(ir_commands[i].command){
-	    ir_commands[i].command(ir_commands[i].arg);
+	// Codes past the table are from other remotes
+	if(command < sizeof(ir_to_command)){
+	    command_callback_t callback = irdecoder_button(ir_to_command[command]);
+	    if(callback.command){
+		callback.command(callback.arg);
+	    }
 	}
 	command = 0xFF;
     }
 }
 
+static void irdecoder_bind(uint8_t button, const command_def_t* def, const char* arg)
+{
+    uint8_t i = 0;
+
+    rebound &= ~(1U << button);
+    for(; def && arg[i] && i < IRDECODER_ARG_LENGTH; i++){
+	bound_args[button][i] = arg[i];
+    }
+    bound_args[button][i] = '\0';
+    bound[button] = def;
+    rebound |= 1U << button;
+}
+
+static void irdecoder_bind_save(uint8_t button)
+{
+    const command_def_t* def = bound[button];
+    uint32_t words[3] = {0};
+
+    for(uint8_t i = 0; bound_args[button][i]; i++){
+	words[i / 4] |= (uint32_t)(uint8_t)bound_args[button][i] << (8 * (i % 4));
+    }
+    store_set(STORE_KEY_IRBIND, button * 4, def ? command_name_hash(def->name) : 0);
+    for(uint8_t i = 0; i < 3; i++){
+	store_set(STORE_KEY_IRBIND, button * 4 + 1 + i, words[i]);
+    }
+}
+
+// Applies bindings saved by irbind on top of the built-in ones
+void irdecoder_restore(void)
+{
+    for(uint8_t button = 0; button < IRDECODER_BUTTONS; button++){
+	uint32_t hash;
+	char arg[IRDECODER_ARG_LENGTH + 1] = {0};
+
+	if(!store_get(STORE_KEY_IRBIND, button * 4, &hash)){
+	    continue;
+	}
+	for(uint8_t i = 0; i < 3; i++){
+	    uint32_t word = 0;
+	    store_get(STORE_KEY_IRBIND, button * 4 + 1 + i, &word);
+	    for(uint8_t j = 0; j < 4; j++){
+		arg[i * 4 + j] = (word >> (8 * j)) & 0xFF;
+	    }
+	}
+	// A hash that no longer names a command leaves the button unbound
+	irdecoder_bind(button, hash ? command_find_hash(hash) : 0, arg);
+    }
+}
+
+// "irbind" lists the buttons, "irbind 5 speed 3" binds button 5
+// and "irbind 5 none" unbinds it
+void irdecoder_bind_command(const char* args)
+{
+    char arg[COMMAND_MAX_LENGTH];
+    uint32_t button;
+
+    if(!args[0]){
+	for(uint8_t i = 0; i < IRDECODER_BUTTONS; i++){
+	    command_callback_t callback = irdecoder_button(i);
+
+	    cli_print("\r\n");
+	    cli_print_number(i);
+	    cli_print(": ");
+	    if(bound[i]){
+		cli_print(bound[i]->name);
+	    }else{
+		cli_print(callback.command ? "(built-in)" : "-");
+	    }
+	    if(callback.arg && callback.arg[0]){
+		cli_print(" ");
+		cli_print(callback.arg);
+	    }
+	}
+	return;
+    }
+
+    args = cli_next_arg(args, arg, sizeof(arg));
+    if(!cli_parse_number(arg, &button) || button >= IRDECODER_BUTTONS){
+	cli_print("Invalid button (0 - 19)");
+	return;
+    }
+
+    args = cli_next_arg(args, arg, sizeof(arg));
+    const command_def_t* def = 0;
+    if(!arg[0]){
+	cli_print("Usage: irbind <button> <command>|none [arg]");
+	return;
+    }
+    if(!utils_strings_match(arg, "none")){
+	def = command_find(arg);
+	if(!def){
+	    cli_print("Unknown command: ");
+	    cli_print(arg);
+	    return;
+	}
+    }
+
+    // The rest of the line is the argument, as typed
+    while(*args == ' '){
+	args++;
+    }
+    irdecoder_bind(button, def, args);
+    irdecoder_bind_save(button);
+    cli_print(def ? "Bound." : "Unbound.");
+}
+
+// Raises a software rising edge on the IR line and lets the EXTI handler
+// time how long it took to get there. Only fired between frames, where a
+// rising edge would otherwise start a measurement.
+void irdecoder_probe(void)
+{
+    uint32_t primask = cpu_irq_save();
+    bool busy = probe_pending || (TIM16->CR1 & TIM_CR1_CEN);
+    if(!busy){
+	probe_pending = true;
+	probe_time = timebase_now();
+    }
+    cpu_irq_restore(primask);
+
+    if(!busy){
+	EXTI->SWIER1 = EXTI_SWIER1_SWI9;
+    }
+}
+
 void irdecoder_init(void)
 {
     RCC->IOPENR |= RCC_IO_GPIOD;
@@ -78,8 +238,8 @@ void irdecoder_init(void)
     // TIMER
     RCC->APBENR2 |= RCC_APB2_TIM16;
     TIM16->CR1 = 0;
-    TIM16->PSC = 0x1F;
-    TIM16->ARR = 3500;
+    TIM16->PSC = clock_timer_psc(IRDECODER_TICK_HZ);
+    TIM16->ARR = IRDECODER_US(IRDECODER_TIMEOUT_US);
     TIM16->DIER |= TIM_DIER_UIE;
     TIM16->EGR |= TIM_EGR_UG;
     TIM16->SR = 0;
@@ -111,14 +271,49 @@ void irdecoder_deinit(void)
     NVIC->ICER0 = NVIC_TIM16_FDCAN_IT0;
 }
 
+// Turns the 32 gaps of a NEC frame, in TIM16 ticks, into the command the
+// remote sent. The command byte arrives LSB first.
+irdecoder_result_t irdecoder_decode(const uint16_t* times, uint8_t* decoded)
+{
+    uint32_t msg = 0;
+    for(uint8_t i = 0; i < 32; i++){
+	msg |= ((times[i] < IRDECODER_US(IRDECODER_BIT_ONE_US)) ? 0 : 1) << (31 - i);
+    }
+
+    uint8_t addr = 0xFF & (msg >> 24);
+    uint8_t addr_inv = 0xFF & (msg >> 16);
+    uint8_t cmnd = 0xFF & (msg >> 8);
+    uint8_t cmnd_inv = 0xFF & msg;
+
+    if(addr != ADDRESS){
+	return IRDECODER_WRONG_ADDRESS;
+    }
+    if(((addr ^ addr_inv) != 0xFF) || ((cmnd ^ cmnd_inv) != 0xFF)){
+	return IRDECODER_BAD_CHECKSUM;
+    }
+
+    *decoded = 0;
+    for (uint8_t i = 0; i < 8; i++) {
+	if (cmnd & (1 << i)) {
+	    *decoded |= (1 << (7 - i));
+	}
+    }
+    return IRDECODER_ACCEPTED;
+}
+
 void EXTI4_15_IRQHandler(void)
 {
+    uint32_t start = perf_isr_enter(PERF_ISR_EXTI);
+
     if(EXTI->FPR1 & EXTI_FPR1_FPIF9){
 	EXTI->FPR1 = EXTI_FPR1_FPIF9;
 
 	uint32_t count = TIM16->CNT;
+	trace_record(TRACE_IR_EDGE, count & 0x7FFF);
+	replay_record(REPLAY_IR, 0);
 
-	if(count > 200 && count < 1000 && bit_time_index < 32){
+	if(count > IRDECODER_US(IRDECODER_BIT_MIN_US) && count < IRDECODER_US(IRDECODER_BIT_MAX_US)
+	    && bit_time_index < 32){
 	    bit_times[bit_time_index++] = count;
 	}
     }
@@ -126,44 +321,51 @@ void EXTI4_15_IRQHandler(void)
     if(EXTI->RPR1 & EXTI_RPR1_RPIF9){
 	EXTI->RPR1 = EXTI_RPR1_RPIF9;
 
-	TIM16->CR1 |= TIM_CR1_CEN;
-	*(uint16_t*)&TIM16->CNT = 0;
+	if(probe_pending){
+	    probe_pending = false;
+	    latency_edge(start - probe_time);
+	}else{
+	    trace_record(TRACE_IR_EDGE, 0x8000 | (TIM16->CNT & 0x7FFF));
+	    replay_record(REPLAY_IR, 1);
+	    TIM16->CR1 |= TIM_CR1_CEN;
+	    *(uint16_t*)&TIM16->CNT = 0;
+	}
     }
+
+    perf_isr_exit(PERF_ISR_EXTI, start);
 }
 
 void TIM16_FDCAN_IT0_IRQHandler(void)
 {
+    uint32_t start = perf_isr_enter(PERF_ISR_TIM16);
+
     if(TIM16->SR & TIM_SR_UIF){
 	TIM16->SR &= ~TIM_SR_UIF;
 	*(uint16_t*)&TIM16->CNT = 0;
 	TIM16->CR1 &= ~TIM_CR1_CEN;
 
-	uint32_t msg = 0;
-	for(uint8_t i = 0; i < 32; i++){
-	    msg |= ((bit_times[i] < 500) ? 0 : 1) << (31 - i);
-	}
+	uint8_t decoded;
+	irdecoder_result_t result = irdecoder_decode(bit_times, &decoded);
 
 	for(uint8_t i = 0; i < 32; i++){
 	    bit_times[i] = 0;
 	}
 	bit_time_index = 0;
 
-	uint8_t addr = 0xFF & (msg >> 24);
-	if(addr != ADDRESS){
+	if(result == IRDECODER_WRONG_ADDRESS){
 	    command = 0xFF;
-	    return;
-	}
-	uint8_t addr_inv = 0xFF & (msg >> 16);
-	uint8_t cmnd = 0xFF & (msg >> 8);
-	uint8_t cmnd_inv = 0xFF & msg;
-
-	if(((addr ^ addr_inv) == 0xFF) && ((cmnd ^ cmnd_inv) == 0xFF)){
-	    command = 0;
-	    for (uint8_t i = 0; i < 8; i++) {
-		if (cmnd & (1 << i)) {
-		    command |= (1 << (7 - i));
-		}
-	    }
+	    perf_count(PERF_IR_ADDRESS);
+	    trace_record(TRACE_IR_DECODE, 0xFF01);
+	}else if(result == IRDECODER_ACCEPTED){
+	    command = decoded;
+	    perf_count(PERF_IR_ACCEPTED);
+	    trace_record(TRACE_IR_DECODE, command);
+	    sched_post(SCHED_TASK_IR);
+	}else{
+	    perf_count(PERF_IR_CHECKSUM);
+	    trace_record(TRACE_IR_DECODE, 0xFF02);
 	}
     }
+
+    perf_isr_exit(PERF_ISR_TIM16, start);
 }
@@ -0,0 +1,61 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "irq.h"
+#include "cpu.h"
+#include "regs.h"
+
+typedef struct{
+    irq_t irq;
+    irq_priority_t priority;
+} irq_plan_t;
+
+static const irq_plan_t plan[] = {
+    { IRQ_EXTI4_15,        IRQ_PRIORITY_IR_EDGE },
+    { IRQ_USART2,          IRQ_PRIORITY_UART },
+    { IRQ_USART3,          IRQ_PRIORITY_UART },
+    { IRQ_TIM16,           IRQ_PRIORITY_IR_FRAME },
+    { IRQ_TIM14,           IRQ_PRIORITY_FRAME },
+    { IRQ_TIM6_DAC_LPTIM1, IRQ_PRIORITY_FRAME },
+};
+
+void irq_init(void)
+{
+    for(uint8_t i = 0; i < sizeof(plan) / sizeof(plan[0]); i++){
+	irq_set_priority(plan[i].irq, plan[i].priority);
+    }
+
+    SCB_SHPR3 = (SCB_SHPR3 & ~(NVIC_IPR_MSK << SCB_SHPR3_PENDSV_POS))
+	      | ((uint32_t)IRQ_PRIORITY_DEFERRED << SCB_SHPR3_PENDSV_POS);
+}
+
+// Back to the reset state for the bootloader, which must not inherit a
+// pending PendSV
+void irq_deinit(void)
+{
+    SCB_ICSR = SCB_ICSR_PENDSVCLR;
+    SCB_SHPR3 &= ~(NVIC_IPR_MSK << SCB_SHPR3_PENDSV_POS);
+
+    for(uint8_t i = 0; i < sizeof(plan) / sizeof(plan[0]); i++){
+	irq_set_priority(plan[i].irq, 0);
+    }
+}
+
+void irq_set_priority(irq_t irq, irq_priority_t priority)
+{
+    uint32_t primask = cpu_irq_save();
+    NVIC_IPR(irq) = (NVIC_IPR(irq) & ~(NVIC_IPR_MSK << NVIC_IPR_POS(irq)))
+		  | ((uint32_t)priority << NVIC_IPR_POS(irq));
+    cpu_irq_restore(primask);
+}
+
+irq_priority_t irq_get_priority(irq_t irq)
+{
+    return (NVIC_IPR(irq) >> NVIC_IPR_POS(irq)) & NVIC_IPR_MSK;
+}
+
+// Pends PendSV, which runs once no other interrupt is active
+void irq_defer(void)
+{
+    SCB_ICSR = SCB_ICSR_PENDSVSET;
+}
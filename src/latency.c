@@ -0,0 +1,116 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "latency.h"
+#include "cli.h"
+#include "irdecoder.h"
+#include "led.h"
+#include "perf.h"
+#include "timebase.h"
+
+// Library headers
+#include "utils.h"
+
+static latency_stat_t stats[LATENCY_PATH_COUNT];
+static latency_stat_t edge;
+static latency_path_t pending_path;
+static bool pending = false;
+static uint32_t start_time;
+static uint32_t start_latch;
+
+void latency_start(latency_path_t path)
+{
+    pending_path = path;
+    start_time = timebase_now();
+    start_latch = led_latch_count();
+    pending = true;
+}
+
+void latency_process(void)
+{
+    if(!pending || led_latch_count() == start_latch){
+	return;
+    }
+    pending = false;
+
+    latency_stat_t* stat = &stats[pending_path];
+    uint32_t us = timebase_to_us(led_latch_time() - start_time);
+
+    stat->last = us;
+    if(stat->count == 0 || us < stat->min){
+	stat->min = us;
+    }
+    if(us > stat->max){
+	stat->max = us;
+    }
+    stat->count++;
+}
+
+const latency_stat_t* latency_get(latency_path_t path)
+{
+    return &stats[path];
+}
+
+// Called from the EXTI handler with the cycles from a probe edge pending to
+// it being timestamped
+void latency_edge(uint32_t cycles)
+{
+    edge.last = cycles;
+    if(edge.count == 0 || cycles < edge.min){
+	edge.min = cycles;
+    }
+    if(cycles > edge.max){
+	edge.max = cycles;
+    }
+    edge.count++;
+
+    if(cycles > IRDECODER_EDGE_BUDGET_US * TIMEBASE_CYCLES_PER_US){
+	perf_count(PERF_IR_EDGE_LATE);
+    }
+}
+
+static void latency_print_path(const char* name, latency_path_t path)
+{
+    cli_print(name);
+    cli_print(" last ");
+    cli_print_number(stats[path].last);
+    cli_print(" us, min ");
+    cli_print_number(stats[path].min);
+    cli_print(" us, max ");
+    cli_print_number(stats[path].max);
+    cli_print(" us (");
+    cli_print_number(stats[path].count);
+    cli_print(" samples)");
+    cli_newline();
+}
+
+void latency_print(const char* args)
+{
+    if(utils_strings_match(args, "reset")){
+	for(uint8_t i = 0; i < LATENCY_PATH_COUNT; i++){
+	    stats[i] = (latency_stat_t){0};
+	}
+	uint32_t primask = cpu_irq_save();
+	edge = (latency_stat_t){0};
+	cpu_irq_restore(primask);
+	cli_print("Latency statistics cleared.");
+	return;
+    }
+
+    latency_print_path("Text:  ", LATENCY_PATH_TEXT);
+    latency_print_path("Binary:", LATENCY_PATH_BINARY);
+    latency_print_path("Compact:", LATENCY_PATH_COMPACT);
+
+    // Cycles are 62.5 ns
+    cli_print("IR edge: last ");
+    cli_print_number(edge.last * 1000 / TIMEBASE_CYCLES_PER_US);
+    cli_print(" ns, min ");
+    cli_print_number(edge.min * 1000 / TIMEBASE_CYCLES_PER_US);
+    cli_print(" ns, max ");
+    cli_print_number(edge.max * 1000 / TIMEBASE_CYCLES_PER_US);
+    cli_print(" ns (");
+    cli_print_number(edge.count);
+    cli_print(" probes, budget ");
+    cli_print_number(IRDECODER_EDGE_BUDGET_US);
+    cli_print(" us)");
+}
@@ -2,6 +2,18 @@
 
 // Firmware headers
 #include "led.h"
+#include "boot.h"
+#include "cli.h"
+#include "clock.h"
+#include "cpu.h"
+#include "log.h"
+#include "pattern.h"
+#include "perf.h"
+#include "sched.h"
+#include "store.h"
+#include "sync.h"
+#include "trace.h"
+#include "timebase.h"
 
 // Library headers
 #include "rcc.h"
@@ -12,30 +24,30 @@
 #include "utils.h"
 
 static led_state_t led_state = {0};
-static led_message_cb_t message_cb;
 static bool verbose = true;
+static volatile uint32_t latch_count = 0;
+static volatile uint32_t latch_time = 0;
+static led_settings_t pending;
+static uint16_t user_frames[LED_USER_FRAMES];
+static uint8_t user_length = 0;
+static volatile uint8_t pending_mask = 0;
+static int32_t trim = 0;            // Added to the TIM14 period, 1/65536 counts
+static uint32_t trim_fraction = 0;  // Carried over to the next tick
+
+static const led_speed_t speed_levels[LED_SPEED_LEVELS] = {
+    SPEED_SLOWER, SPEED_SLOW, SPEED_NORMAL, SPEED_FAST, SPEED_FASTER
+};
 
 static void sn_send_data(uint16_t data);
-static void led_binary(uint16_t count);
-static void led_wave(uint16_t count);
-static void led_alternating(uint16_t count);
-static void led_bounce(uint16_t count);
+static void led_blank(void);
+static void led_show(uint16_t data);
+static void led_output(void);
+static void led_apply_pending(void);
+static void led_restore(void);
 static void led_refresh_speed(void);
 static void led_stop(const char* args);
 static void led_start(const char* args);
 
-// Animations
-static const uint16_t wave_pattern[8] = {
-    0x0707, 0x0E0E, 0x1C1C, 0x3838, 0x7070, 0xE0E0, 0xC1C1, 0x8383
-};
-
-static const uint16_t bounce_pattern[28] = {
-    0x3, 0x6, 0xC, 0x18, 0x30, 0x60, 0xC0, 0x180, 0x300,
-    0x600, 0xC00, 0x1800, 0x3000, 0x6000, 0xC000, 0x6000,
-    0x3000, 0x1800, 0xC00, 0x600, 0x300, 0x180, 0xC0,
-    0x60, 0x30, 0x18, 0xC, 0x6
-};
-
 void led_init(void)
 {
     if(!(RCC->IOPENR & RCC_IO_GPIOB)){
@@ -69,30 +81,44 @@ void led_init(void)
     SPI1->CR1 = 0;
     SPI1->CR2 = 0;
     SPI1->CR1 |= SPI_CR1_MSTR | SPI_CR1_LSBFIRST | SPI_CR1_SSI | SPI_CR1_SSM;
-    SPI1->CR1 |= SPI_CR1_BR(0x7); // fPCLK/256 = 62500Hz
+    SPI1->CR1 |= SPI_CR1_BR(clock_spi_br(LED_SPI_MAX_HZ)); // 62500Hz at most
     SPI1->CR2 |= SPI_CR2_DS(0xF); // 16-bit data size
 
     SPI1->CR1 |= SPI_CR1_SPE;
 
     led_state_reset();
-    led_reset();
+
+    // The first frame goes out right away rather than a whole frame period
+    // after boot. Masked, as after "rs" TIM14 and PendSV are still live and
+    // could interleave a send of their own.
+    uint32_t primask = cpu_irq_save();
+    if(led_state.active){
+	led_state.due = true;
+	led_update();
+    }else{
+	led_blank();
+    }
+    cpu_irq_restore(primask);
+    boot_mark(BOOT_PHASE_FIRST_FRAME);
 
     // Enabling TIM14 clock
     if(!(RCC->APBENR2 & RCC_APB2_TIM14)){
         RCC->APBENR2 |= RCC_APB2_TIM14;
     }
 
-    // Update interrupt enabled
-    TIM14->DIER |= TIM_DIER_UIE;
+    // Prescaler for a 1MHz counter clock
+    TIM14->PSC = clock_timer_psc(LED_TICK_HZ);
 
-    // Re-initialize counter
-    TIM14->EGR |= TIM_EGR_UG;
+    // Auto-reload value set to 999, making it fire the interrupt every millisecond
+    TIM14->ARR = LED_TICK_COUNTS - 1;
 
-    // Prescaler set to 15999 (16MHz / 1MHz)-1
-    TIM14->PSC = 0x0F;
+    // Re-initialize counter, loading the preloaded prescaler. The update
+    // flag this sets is no tick.
+    TIM14->EGR |= TIM_EGR_UG;
+    TIM14->SR &= ~TIM_SR_UIF;
 
-    // Auto-reload value set to 999, making it fire the interrupt every millisecond
-    TIM14->ARR = 999;
+    // Update interrupt enabled
+    TIM14->DIER |= TIM_DIER_UIE;
 
     // Counter enabled
     TIM14->CR1 |= TIM_CR1_CEN;
@@ -103,7 +129,8 @@ void led_init(void)
 
 void led_deinit(void)
 {
-    led_reset();
+    // Interrupts are masked on the way out, so not deferring this
+    led_blank();
 
     if(!(RCC->IOPENR & RCC_IO_GPIOB)){
 	RCC->IOPENR |= RCC_IO_GPIOB;
@@ -134,87 +161,169 @@ void led_deinit(void)
     NVIC->ICER0 = NVIC_TIM14;
 }
 
-void led_set_message_cb(led_message_cb_t led_message_cb)
+// Counts down the frame period from the 1 ms interrupt, returning true
+// when the next frame is due
+bool led_tick(void)
 {
-    message_cb = led_message_cb;
+    if(!led_state.active){
+	return false;
+    }
+
+    if (--led_state.tick > 0){
+	return false;
+    }
+
+    // Resetting tick
+    led_state.tick = led_state.speed;
+    led_state.due = true;
+    return true;
+}
+
+// Steps the brightness duty cycle from the 1 ms interrupt, returning true
+// when the LEDs are to be switched on or off
+bool led_duty_tick(void)
+{
+    led_state.phase = (led_state.phase + 1) % LED_BRIGHTNESS_MAX;
+
+    bool lit = led_state.phase < led_state.brightness;
+    bool changed = lit != led_state.lit_target;
+
+    led_state.lit_target = lit;
+    return changed && led_state.active;
 }
 
+// Milliseconds until the next frame or duty cycle edge, for the power manager
+uint16_t led_next_frame_ms(void)
+{
+    if(!led_state.active){
+	return LED_NO_DEADLINE;
+    }
+    if(led_state.brightness >= LED_BRIGHTNESS_MAX){
+	return led_state.tick;
+    }
+
+    uint16_t edge = led_state.lit_target ? led_state.brightness - led_state.phase
+					 : LED_BRIGHTNESS_MAX - led_state.phase;
+    return (edge < led_state.tick) ? edge : led_state.tick;
+}
+
+// Catching up on time TIM14 did not count, such as spent in Stop mode,
+// leaving the frame itself to the next tick
+void led_advance(uint32_t ms)
+{
+    if(!led_state.active){
+	return;
+    }
+    led_state.tick = (ms < led_state.tick) ? led_state.tick - ms : 1;
+    led_state.phase = (led_state.phase + ms) % LED_BRIGHTNESS_MAX;
+}
+
+// Renders and latches the next frame, deferred to PendSV rather than run in
+// the ISR so that IR edges and UART bytes are never held up by the SPI send
 void led_update(void)
 {
+    if(led_state.blank){
+	led_state.blank = false;
+	led_blank();
+	return;
+    }
+
+    // Batched settings land together, before the frame showing them
+    if(pending_mask){
+	led_apply_pending();
+    }
+
     if(!led_state.active){
 	return;
     }
 
-    if (--led_state.tick > 0){
+    if(!led_state.due){
+	// Only the duty cycle moved
+	if(led_state.lit != led_state.lit_target){
+	    led_output();
+	}
 	return;
     }
+    led_state.due = false;
 
-    // Resetting tick
-    led_state.tick = led_state.speed;
+    // Read once, the userpattern command may clear it meanwhile
+    pattern_user_t user = { user_frames, user_length };
+    uint16_t frame;
 
-    switch (led_state.pattern) {
-	case PATTERN_BINARY:
-	    led_binary(led_state.count++);
-	    break;
-	case PATTERN_WAVE:
-	    led_wave(led_state.count++ % 8);
-	    break;
-	case PATTERN_ALTERNATING:
-	    led_alternating(led_state.count++);
-	    break;
-	case PATTERN_BOUNCE:
-	    led_bounce(led_state.count++ % 28);
-	    if (led_state.count >= LED_BOUNCE_RESET) {
-		led_state.count = 0; // Resetting led counter on a multiple of 11 to avoid
-				     // "jumping" when led_counter overflows
-	    }
-	    break;
-	default:
-	    if(message_cb && verbose) message_cb("Invalid pattern");
-	    break;
+    if(!pattern_render(led_state.pattern, &led_state.cursor, &user, &frame)){
+	if(verbose) log_event(LOG_INVALID_PATTERN, led_state.pattern);
+    }else{
+	led_show(frame);
     }
+
+    // Letting the latency measurement see the new frame
+    sched_post(SCHED_TASK_HOUSEKEEPING);
 }
 
 void led_toggle_pattern(const char* args)
 {
     led_reset();
-    led_state.count = 0;
+    pattern_restart(&led_state.cursor);
 
     switch (led_state.pattern) {
 	case PATTERN_BINARY:
-	    if(args[0] == '-'){
-		led_state.pattern = PATTERN_BOUNCE;
-		if(message_cb && verbose) message_cb("Changing pattern to: Bounce");
+	    if(args[0] == '-' && user_length){
+		led_state.pattern = PATTERN_USER;
+		if(verbose) log_event(LOG_PATTERN, PATTERN_USER);
+	    }else if(args[0] == '-'){
+		led_state.pattern = PATTERN_FILL;
+		if(verbose) log_event(LOG_PATTERN, PATTERN_FILL);
 	    }else{
 		led_state.pattern = PATTERN_WAVE;
-		if(message_cb && verbose) message_cb("Changing pattern to: Wave");
+		if(verbose) log_event(LOG_PATTERN, PATTERN_WAVE);
 	    }
 	    break;
 	case PATTERN_WAVE:
 	    if(args[0] == '-'){
 		led_state.pattern = PATTERN_BINARY;
-		if(message_cb && verbose) message_cb("Changing pattern to: Binary");
+		if(verbose) log_event(LOG_PATTERN, PATTERN_BINARY);
 	    }else{
 		led_state.pattern = PATTERN_ALTERNATING;
-		if(message_cb && verbose) message_cb("Changing pattern to: Alternating");
+		if(verbose) log_event(LOG_PATTERN, PATTERN_ALTERNATING);
 	    }
 	    break;
 	case PATTERN_ALTERNATING:
 	    if(args[0] == '-'){
 		led_state.pattern = PATTERN_WAVE;
-		if(message_cb && verbose) message_cb("Changing pattern to: Wave");
+		if(verbose) log_event(LOG_PATTERN, PATTERN_WAVE);
 	    }else{
 		led_state.pattern = PATTERN_BOUNCE;
-		if(message_cb && verbose) message_cb("Changing pattern to: Bounce");
+		if(verbose) log_event(LOG_PATTERN, PATTERN_BOUNCE);
 	    }
 	    break;
 	case PATTERN_BOUNCE:
 	    if(args[0] == '-'){
 		led_state.pattern = PATTERN_ALTERNATING;
-		if(message_cb && verbose) message_cb("Changing pattern to: Alternating");
+		if(verbose) log_event(LOG_PATTERN, PATTERN_ALTERNATING);
+	    }else{
+		led_state.pattern = PATTERN_FILL;
+		if(verbose) log_event(LOG_PATTERN, PATTERN_FILL);
+	    }
+	    break;
+	case PATTERN_FILL:
+	    if(args[0] == '-'){
+		led_state.pattern = PATTERN_BOUNCE;
+		if(verbose) log_event(LOG_PATTERN, PATTERN_BOUNCE);
+	    }else if(user_length){
+		led_state.pattern = PATTERN_USER;
+		if(verbose) log_event(LOG_PATTERN, PATTERN_USER);
 	    }else{
 		led_state.pattern = PATTERN_BINARY;
-		if(message_cb && verbose) message_cb("Changing pattern to: Binary");
+		if(verbose) log_event(LOG_PATTERN, PATTERN_BINARY);
+	    }
+	    break;
+	case PATTERN_USER:
+	    if(args[0] == '-'){
+		led_state.pattern = PATTERN_FILL;
+		if(verbose) log_event(LOG_PATTERN, PATTERN_FILL);
+	    }else{
+		led_state.pattern = PATTERN_BINARY;
+		if(verbose) log_event(LOG_PATTERN, PATTERN_BINARY);
 	    }
 	    break;
     }
@@ -224,21 +333,27 @@ void led_set_pattern(const char* args)
 {
     if(utils_strings_match(args, "wave") && led_state.pattern != PATTERN_WAVE){
 	led_state.pattern = PATTERN_WAVE;
-	if(message_cb && verbose) message_cb("Changing pattern to: Wave");
+	if(verbose) log_event(LOG_PATTERN, PATTERN_WAVE);
     }else if(utils_strings_match(args, "alternating") && led_state.pattern != PATTERN_ALTERNATING){
 	led_state.pattern = PATTERN_ALTERNATING;
-	if(message_cb && verbose) message_cb("Changing pattern to: Alternating");
+	if(verbose) log_event(LOG_PATTERN, PATTERN_ALTERNATING);
     }else if(utils_strings_match(args, "bounce") && led_state.pattern != PATTERN_BOUNCE){
 	led_state.pattern = PATTERN_BOUNCE;
-	if(message_cb && verbose) message_cb("Changing pattern to: Bounce");
+	if(verbose) log_event(LOG_PATTERN, PATTERN_BOUNCE);
+    }else if(utils_strings_match(args, "fill") && led_state.pattern != PATTERN_FILL){
+	led_state.pattern = PATTERN_FILL;
+	if(verbose) log_event(LOG_PATTERN, PATTERN_FILL);
     }else if(utils_strings_match(args, "binary") && led_state.pattern != PATTERN_BINARY){
 	led_state.pattern = PATTERN_BINARY;
-	if(message_cb && verbose) message_cb("Changing pattern to: Binary");
+	if(verbose) log_event(LOG_PATTERN, PATTERN_BINARY);
+    }else if(utils_strings_match(args, "user") && user_length && led_state.pattern != PATTERN_USER){
+	led_state.pattern = PATTERN_USER;
+	if(verbose) log_event(LOG_PATTERN, PATTERN_USER);
     }else{
 	return;
     }
     led_reset();
-    led_state.count = 0;
+    pattern_restart(&led_state.cursor);
 }
 
 void led_speed_increase(const char* args)
@@ -246,22 +361,22 @@ void led_speed_increase(const char* args)
     switch (led_state.speed) {
 	case SPEED_SLOWER:
 	    led_state.speed = SPEED_SLOW;
-	    if(message_cb && verbose) message_cb("Changing speed to: Slow");
+	    if(verbose) log_event(LOG_SPEED, 2);
 	    break;
 	case SPEED_SLOW:
 	    led_state.speed = SPEED_NORMAL;
-	    if(message_cb && verbose) message_cb("Changing speed to: Normal");
+	    if(verbose) log_event(LOG_SPEED, 3);
 	    break;
 	case SPEED_NORMAL:
 	    led_state.speed = SPEED_FAST;
-	    if(message_cb && verbose) message_cb("Changing speed to: Fast");
+	    if(verbose) log_event(LOG_SPEED, 4);
 	    break;
 	case SPEED_FAST:
 	    led_state.speed = SPEED_FASTER;
-	    if(message_cb && verbose) message_cb("Changing speed to: Fastest");
+	    if(verbose) log_event(LOG_SPEED, 5);
 	    break;
 	case SPEED_FASTER:
-	    if(message_cb && verbose) message_cb("Already at fastest speed..");
+	    if(verbose) log_event(LOG_SPEED_FASTEST, 0);
 	    return;
 	    break;
     }
@@ -272,24 +387,24 @@ void led_speed_decrease(const char* args)
 {
     switch (led_state.speed){
 	case SPEED_SLOWER:
-	    if(message_cb && verbose) message_cb("Already at slowest speed..");
+	    if(verbose) log_event(LOG_SPEED_SLOWEST, 0);
 	    return;
 	break;
 	case SPEED_SLOW:
 	    led_state.speed = SPEED_SLOWER;
-	    if(message_cb && verbose) message_cb("Changing speed to: Slowest");
+	    if(verbose) log_event(LOG_SPEED, 1);
 	break;
 	case SPEED_NORMAL:
 	    led_state.speed = SPEED_SLOW;
-	    if(message_cb && verbose) message_cb("Changing speed to: Slow");
+	    if(verbose) log_event(LOG_SPEED, 2);
 	break;
 	case SPEED_FAST:
 	    led_state.speed = SPEED_NORMAL;
-	    if(message_cb && verbose) message_cb("Changing speed to: Normal");
+	    if(verbose) log_event(LOG_SPEED, 3);
 	break;
 	case SPEED_FASTER:
 	    led_state.speed = SPEED_FAST;
-	    if(message_cb && verbose) message_cb("Changing speed to: Fast");
+	    if(verbose) log_event(LOG_SPEED, 4);
 	break;
     }
     led_refresh_speed();
@@ -299,31 +414,31 @@ void led_speed_set(const char* args)
 {
     uint32_t speed = utils_string_to_number(args);
 
-    if(speed < 0 || speed > 5){
-	if(message_cb && verbose) message_cb("Speed not in bounds (1 - 5)");
+    if(speed < 1 || speed > 5){
+	if(verbose) log_event(LOG_SPEED_BOUNDS, 0);
 	return;
     }
 
     switch(speed){
 	case 1:
 	    led_state.speed = SPEED_SLOWER;
-	    if(message_cb && verbose) message_cb("Changing speed to: Slowest");
+	    if(verbose) log_event(LOG_SPEED, 1);
 	break;
 	case 2:
 	    led_state.speed = SPEED_SLOW;
-	    if(message_cb && verbose) message_cb("Changing speed to: Slow");
+	    if(verbose) log_event(LOG_SPEED, 2);
 	break;
 	case 3:
 	    led_state.speed = SPEED_NORMAL;
-	    if(message_cb && verbose) message_cb("Changing speed to: Normal");
+	    if(verbose) log_event(LOG_SPEED, 3);
 	break;
 	case 4:
 	    led_state.speed = SPEED_FAST;
-	    if(message_cb && verbose) message_cb("Changing speed to: Fast");
+	    if(verbose) log_event(LOG_SPEED, 4);
 	break;
 	case 5:
 	    led_state.speed = SPEED_FASTER;
-	    if(message_cb && verbose) message_cb("Changing speed to: Faster");
+	    if(verbose) log_event(LOG_SPEED, 5);
 	break;
     }
     led_refresh_speed();
@@ -338,14 +453,14 @@ static void led_refresh_speed(void)
 
 static void led_stop(const char* args)
 {
-    if(message_cb && verbose) message_cb("Stopping.");
+    if(verbose) log_event(LOG_STOP, 0);
     led_state.active = false;
     led_reset();
 }
 
 static void led_start(const char* args)
 {
-    if(message_cb && verbose) message_cb("Starting.");
+    if(verbose) log_event(LOG_START, 0);
     led_state.active = true;
 }
 
@@ -361,46 +476,162 @@ void led_toggle(const char* args)
 void led_toggle_verbosity(const char* args)
 {
     if(verbose){
-	if(message_cb) message_cb("Silent mode.");
+	log_event(LOG_SILENT, 0);
 	verbose = false;
     }else{
-	if(message_cb) message_cb("Verbose mode.");
+	log_event(LOG_VERBOSE, 0);
 	verbose = true;
     }
 }
 
-static void led_binary(uint16_t count)
+void led_brightness_set(const char* args)
 {
-    sn_send_data(count);
+    uint32_t brightness = utils_string_to_number(args);
+
+    if(brightness < 1 || brightness > LED_BRIGHTNESS_MAX){
+	if(verbose) log_event(LOG_BRIGHTNESS_BOUNDS, 0);
+	return;
+    }
+
+    led_settings_t settings = { .brightness = brightness };
+    led_apply(&settings, LED_SET_BRIGHTNESS);
+    if(verbose) log_event(LOG_BRIGHTNESS, brightness);
 }
 
-static void led_wave(uint16_t count)
+// Stages settings for the next deferred update, which applies everything
+// staged so far at once and renders a frame with it straight away
+void led_apply(const led_settings_t* settings, uint8_t mask)
 {
-    sn_send_data(wave_pattern[count]);
+    uint32_t primask = cpu_irq_save();
+
+    if(mask & LED_SET_PATTERN){
+	pending.pattern = settings->pattern;
+    }
+    if(mask & LED_SET_SPEED){
+	pending.speed = settings->speed;
+    }
+    if(mask & LED_SET_BRIGHTNESS){
+	pending.brightness = settings->brightness;
+    }
+    if(mask & LED_SET_ACTIVE){
+	pending.active = settings->active;
+    }
+    pending_mask |= mask;
+
+    cpu_irq_restore(primask);
+    sched_defer(SCHED_TASK_LED);
 }
 
-static void led_alternating(uint16_t count)
+// The current settings, including any staged ones
+void led_get(led_settings_t* settings)
 {
-    sn_send_data((count % 2) ? 0xF0F0 : 0x0F0F);
+    uint32_t primask = cpu_irq_save();
+
+    settings->pattern = (pending_mask & LED_SET_PATTERN) ? pending.pattern : led_state.pattern;
+    settings->brightness = (pending_mask & LED_SET_BRIGHTNESS) ? pending.brightness : led_state.brightness;
+    settings->active = (pending_mask & LED_SET_ACTIVE) ? pending.active : led_state.active;
+    settings->speed = 1;
+    if(pending_mask & LED_SET_SPEED){
+	settings->speed = pending.speed;
+    }else{
+	for(uint8_t i = 0; i < LED_SPEED_LEVELS; i++){
+	    if(speed_levels[i] == led_state.speed){
+		settings->speed = i + 1;
+	    }
+	}
+    }
+
+    cpu_irq_restore(primask);
+}
+
+// Whether led_apply takes the pattern, the user pattern needs frames
+bool led_pattern_available(uint8_t pattern)
+{
+    return pattern < LED_PATTERN_COUNT && (pattern != PATTERN_USER || user_length);
 }
 
-static void led_bounce(uint16_t count)
+// Runs in PendSV, so no frame is ever rendered with half of a batch
+static void led_apply_pending(void)
 {
-    sn_send_data(bounce_pattern[count]);
+    uint32_t primask = cpu_irq_save();
+    led_settings_t settings = pending;
+    uint8_t mask = pending_mask;
+    pending_mask = 0;
+    cpu_irq_restore(primask);
+
+    if((mask & LED_SET_PATTERN) && led_pattern_available(settings.pattern)
+	&& settings.pattern != led_state.pattern){
+	led_state.pattern = settings.pattern;
+	pattern_restart(&led_state.cursor);
+    }
+    if((mask & LED_SET_SPEED) && settings.speed >= 1 && settings.speed <= LED_SPEED_LEVELS){
+	led_state.speed = speed_levels[settings.speed - 1];
+	led_state.tick = led_state.speed;
+    }
+    if((mask & LED_SET_BRIGHTNESS) && settings.brightness >= 1
+	&& settings.brightness <= LED_BRIGHTNESS_MAX){
+	led_state.brightness = settings.brightness;
+    }
+    if(mask & LED_SET_ACTIVE){
+	if(led_state.active && !settings.active){
+	    led_blank();
+	}
+	led_state.active = settings.active;
+    }
+
+    led_state.due = true;
 }
 
+static void led_show(uint16_t data)
+{
+    led_state.frame = data;
+    led_state.fresh = true;
+    led_output();
+}
+
+// Puts the frame, or nothing in the dark part of the duty cycle, on the LEDs
+static void led_output(void)
+{
+    bool lit = led_state.lit_target;
+
+    if(lit){
+	sn_send_data(led_state.frame);
+	if(led_state.fresh){
+	    // Counting the latch that first shows this frame
+	    led_state.fresh = false;
+	    latch_time = timebase_now();
+	    latch_count++;
+	}
+    }else if(led_state.lit){
+	sn_send_data(0);
+    }
+    led_state.lit = lit;
+}
+
+// All SPI traffic goes through led_update, a send from thread mode could be
+// preempted halfway by a frame
 void led_reset(void)
 {
     led_state.tick = 1;
+    led_state.blank = true;
+    sched_defer(SCHED_TASK_LED);
+}
+
+static void led_blank(void)
+{
     sn_send_data(0);
+    led_state.lit = false;
 }
 
 static void sn_send_data(uint16_t data)
 {
     uint32_t timeout = 100000;
+
+    trace_record(TRACE_SPI_BEGIN, data);
     while (!(SPI1->SR & SPI_SR_TXE) && timeout--) {
         if (!timeout) {
             // SPI not ready
+            perf_count(PERF_SPI_TIMEOUT);
             SPI1->CR1 &= ~SPI_CR1_SPE; // Disable
             SPI1->CR1 |= SPI_CR1_SPE; // Re-enable
             return;
@@ -409,11 +640,26 @@ static void sn_send_data(uint16_t data)
     SPI1->DR = data;
     timeout = 100000;
     while (SPI1->SR & SPI_SR_BSY && timeout--) {
-        if (!timeout) return;
+        if (!timeout) {
+            perf_count(PERF_SPI_TIMEOUT);
+            return;
+        }
     }
     // Pulse latch
     GPIOB->BSRR = BIT4;
     GPIOB->BSRR = BIT4 << 16;
+
+    trace_record(TRACE_LED_FRAME, data);
+}
+
+uint32_t led_latch_count(void)
+{
+    return latch_count;
+}
+
+uint32_t led_latch_time(void)
+{
+    return latch_time;
 }
 
 void led_state_reset(void)
@@ -421,15 +667,247 @@ void led_state_reset(void)
     led_state.pattern = PATTERN_BINARY;
     led_state.speed = SPEED_SLOW;
     led_state.tick = led_state.speed;
-    led_state.count = 0;
+    pattern_restart(&led_state.cursor);
     led_state.active = true;
+    led_state.blank = false;
+    led_state.due = false;
+    led_state.lit = false;
+    led_state.lit_target = true;
+    led_state.fresh = false;
+    led_state.brightness = LED_BRIGHTNESS_MAX;
+    led_state.phase = 0;
+
+    // Whatever was saved last wins over the defaults
+    led_restore();
+}
+
+static void led_restore(void)
+{
+    uint32_t value;
+
+    user_length = 0;
+    if(store_get(STORE_KEY_USER_LENGTH, 0, &value) && value <= LED_USER_FRAMES){
+	for(uint8_t i = 0; i < value; i++){
+	    uint32_t frame;
+	    if(!store_get(STORE_KEY_USER_FRAME, i, &frame)){
+		break;
+	    }
+	    user_frames[i] = frame;
+	    user_length = i + 1;
+	}
+    }
+
+    if(store_get(STORE_KEY_PATTERN, 0, &value) && led_pattern_available(value)){
+	led_state.pattern = value;
+    }
+    if(store_get(STORE_KEY_SPEED, 0, &value) && value >= 1 && value <= LED_SPEED_LEVELS){
+	led_state.speed = speed_levels[value - 1];
+	led_state.tick = led_state.speed;
+    }
+    if(store_get(STORE_KEY_BRIGHTNESS, 0, &value) && value >= 1 && value <= LED_BRIGHTNESS_MAX){
+	led_state.brightness = value;
+    }
+    if(store_get(STORE_KEY_ACTIVE, 0, &value)){
+	led_state.active = value;
+    }
+    if(store_get(STORE_KEY_VERBOSE, 0, &value)){
+	verbose = value;
+    }
+}
+
+// Called from housekeeping, the store only writes what changed
+void led_save(void)
+{
+    led_settings_t settings;
+    led_get(&settings);
+
+    store_set(STORE_KEY_PATTERN, 0, settings.pattern);
+    store_set(STORE_KEY_SPEED, 0, settings.speed);
+    store_set(STORE_KEY_BRIGHTNESS, 0, settings.brightness);
+    store_set(STORE_KEY_ACTIVE, 0, settings.active);
+    store_set(STORE_KEY_VERBOSE, 0, verbose);
+}
+
+// "userpattern" lists the frames, "userpattern clear" removes them and
+// "userpattern 0x0F0F 0xF0F0" appends frames
+void led_user_pattern(const char* args)
+{
+    char arg[COMMAND_MAX_LENGTH];
+
+    if(utils_strings_match(args, "clear")){
+	if(led_state.pattern == PATTERN_USER){
+	    led_settings_t settings = { .pattern = PATTERN_BINARY };
+	    led_apply(&settings, LED_SET_PATTERN);
+	}
+	user_length = 0;
+	store_set(STORE_KEY_USER_LENGTH, 0, 0);
+	cli_print("User pattern cleared.");
+	return;
+    }
+
+    while(args[0]){
+	uint32_t frame;
+
+	args = cli_next_arg(args, arg, sizeof(arg));
+	if(!arg[0]){
+	    break;
+	}
+	if(!cli_parse_number(arg, &frame) || frame > 0xFFFF){
+	    cli_print("Invalid frame (0x0000 - 0xFFFF)");
+	    return;
+	}
+	if(user_length >= LED_USER_FRAMES){
+	    cli_print("User pattern full.");
+	    return;
+	}
+
+	// The frame is in place before the length lets the renderer see it
+	user_frames[user_length] = frame;
+	store_set(STORE_KEY_USER_FRAME, user_length, frame);
+	user_length++;
+	store_set(STORE_KEY_USER_LENGTH, 0, user_length);
+    }
+
+    cli_print("User pattern, ");
+    cli_print_number(user_length);
+    cli_print(" frames:");
+    for(uint8_t i = 0; i < user_length; i++){
+	cli_print(i % 8 ? " 0x" : "\r\n0x");
+	cli_print_hex(user_frames[i], 4);
+    }
+}
+
+uint16_t led_frame_ms(void)
+{
+    return led_state.speed;
+}
+
+// For sync.c, which steers the frames towards another board's. The cursor
+// is read and replaced with interrupts masked by the caller; a frame that
+// is due already renders it before the next tick does.
+bool led_sync_cursor(pattern_cursor_t* cursor)
+{
+    *cursor = led_state.cursor;
+    return led_state.due;
+}
+
+void led_sync_set(const pattern_cursor_t* cursor)
+{
+    led_state.cursor = *cursor;
+}
+
+// Where the cursor of the current pattern is count frames in and then
+// ahead frames on
+void led_sync_seek(pattern_cursor_t* cursor, uint16_t count, uint16_t ahead)
+{
+    pattern_user_t user = { user_frames, user_length };
+    uint16_t frame;
+
+    pattern_seek(led_state.pattern, cursor, &user, count);
+    while(ahead--){
+	pattern_render(led_state.pattern, cursor, &user, &frame);
+    }
+}
+
+// Moves the next frame tick by whole milliseconds, earlier when negative
+void led_sync_shift(int32_t ms)
+{
+    uint32_t primask = cpu_irq_save();
+    int32_t tick = (int32_t)led_state.tick + ms;
+
+    led_state.tick = (tick < 1) ? 1 : (tick > 0xFFFF) ? 0xFFFF : tick;
+    cpu_irq_restore(primask);
+}
+
+// Lengthens the 1 ms tick by value / 65536 TIM14 counts, or shortens it
+void led_sync_trim(int32_t value)
+{
+    uint32_t primask = cpu_irq_save();
+
+    trim = value;
+    if(!trim){
+	trim_fraction = 0;
+	TIM14->ARR = LED_TICK_COUNTS - 1;
+    }
+    cpu_irq_restore(primask);
+}
+
+// For bench.c: TIM14 stays off between led_bench_begin and led_bench_end,
+// so that nothing renders in between, and the state is put back after
+static led_state_t bench_state;
+static uint32_t bench_cr1;
+static uint32_t bench_latch_count;
+
+void led_bench_begin(void)
+{
+    NVIC->ICER0 = NVIC_TIM14;
+    bench_state = led_state;
+    bench_cr1 = SPI1->CR1;
+    bench_latch_count = latch_count;
+}
+
+void led_bench_end(void)
+{
+    uint32_t primask = cpu_irq_save();
+    SPI1->CR1 &= ~SPI_CR1_SPE;
+    SPI1->CR1 = bench_cr1;
+    led_state = bench_state;
+    latch_count = bench_latch_count;
+    sn_send_data(led_state.lit ? led_state.frame : 0);
+    cpu_irq_restore(primask);
+
+    NVIC->ISER0 = NVIC_TIM14;
+}
+
+// Makes the next led_update render and send a frame of the pattern
+void led_bench_frame(led_pattern_t pattern)
+{
+    if(led_state.pattern != pattern){
+	pattern_restart(&led_state.cursor);
+    }
+    led_state.pattern = pattern;
+    led_state.active = true;
+    led_state.blank = false;
+    led_state.due = true;
+    led_state.lit_target = true;
+}
+
+// The prescaler only changes with SPI disabled
+void led_bench_spi(uint8_t br)
+{
+    SPI1->CR1 &= ~SPI_CR1_SPE;
+    SPI1->CR1 = (SPI1->CR1 & ~SPI_CR1_BR(0x7)) | SPI_CR1_BR(br);
+    SPI1->CR1 |= SPI_CR1_SPE;
+}
+
+void led_bench_send(uint16_t data)
+{
+    sn_send_data(data);
 }
 
 // This interrupt fires every millisecond
 void TIM14_IRQHandler(void)
 {
+    uint32_t start = perf_isr_enter(PERF_ISR_TIM14);
+
     // Clearing update interrupt flag
     TIM14->SR &= ~TIM_SR_UIF;
 
-    led_update();
+    // The fraction of a count sync asks for, spread over the ticks
+    if(trim){
+	uint32_t period = (LED_TICK_COUNTS << 16) + trim + trim_fraction;
+	TIM14->ARR = (period >> 16) - 1;
+	trim_fraction = period & 0xFFFF;
+    }
+
+    bool frame = led_tick();
+    if(frame){
+	sync_frame(start, led_state.cursor.count);
+    }
+    if(led_duty_tick() || frame){
+	sched_defer(SCHED_TASK_LED);
+    }
+    sched_tick();
+
+    perf_isr_exit(PERF_ISR_TIM14, start);
 }
@@ -0,0 +1,145 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "log.h"
+#include "cpu.h"
+#include "sched.h"
+#include "timebase.h"
+
+static log_record_t records[LOG_BUFFER_SIZE];
+static volatile uint32_t write_index = 0;
+static volatile uint32_t read_index = 0;
+static volatile uint16_t lost = 0;
+static log_sink_t log_sink;
+
+#if LOG_STRINGS
+#define LOG_MESSAGE(id, text, arg) { text, arg },
+static const struct{
+    const char* text;
+    log_arg_t arg;
+} messages[LOG_MESSAGE_COUNT] = {
+    LOG_MESSAGES
+};
+#undef LOG_MESSAGE
+
+static const char* const pattern_names[] = LOG_PATTERN_NAMES;
+static const char* const speed_names[] = LOG_SPEED_NAMES;
+#endif
+
+// Callable from any context, costs a critical section of a few stores
+void log_event(log_id_t id, uint16_t arg)
+{
+    uint32_t timestamp = timebase_now();
+    uint32_t primask = cpu_irq_save();
+
+    if(write_index - read_index >= LOG_BUFFER_SIZE){
+	lost++;
+    }else{
+	log_record_t* record = &records[write_index & (LOG_BUFFER_SIZE - 1)];
+	record->timestamp = timestamp;
+	record->arg = arg;
+	record->id = id;
+	write_index++;
+    }
+
+    cpu_irq_restore(primask);
+    sched_post(SCHED_TASK_LOG);
+}
+
+void log_set_sink(log_sink_t sink)
+{
+    log_sink = sink;
+}
+
+static uint8_t log_append(char* line, uint8_t index, const char* string)
+{
+    while(*string && index < 47){
+	line[index++] = *string++;
+    }
+    return index;
+}
+
+static uint8_t log_append_number(char* line, uint8_t index, uint32_t number)
+{
+    char digits[10];
+    uint8_t count = 0;
+
+    do{
+	digits[count++] = '0' + number % 10;
+	number /= 10;
+    }while(number);
+
+    while(count && index < 47){
+	line[index++] = digits[--count];
+    }
+    return index;
+}
+
+static void log_render(const log_record_t* record)
+{
+    char line[48];
+    uint8_t index = 0;
+
+#if LOG_STRINGS
+    const char* const* names = 0;
+    uint8_t name_count = 0;
+
+    index = log_append(line, index, messages[record->id].text);
+
+    switch(messages[record->id].arg){
+	case LOG_ARG_NONE:
+	    break;
+	case LOG_ARG_NUMBER:
+	    index = log_append_number(line, index, record->arg);
+	    break;
+	case LOG_ARG_PATTERN:
+	    names = pattern_names;
+	    name_count = sizeof(pattern_names) / sizeof(pattern_names[0]);
+	    break;
+	case LOG_ARG_SPEED:
+	    names = speed_names;
+	    name_count = sizeof(speed_names) / sizeof(speed_names[0]);
+	    break;
+    }
+
+    if(names){
+	if(record->arg < name_count){
+	    index = log_append(line, index, names[record->arg]);
+	}else{
+	    index = log_append_number(line, index, record->arg);
+	}
+    }
+#else
+    index = log_append(line, index, "#");
+    index = log_append_number(line, index, record->id);
+    index = log_append(line, index, ":");
+    index = log_append_number(line, index, record->arg);
+    index = log_append(line, index, "@");
+    index = log_append_number(line, index, record->timestamp);
+#endif
+
+    line[index] = '\0';
+    log_sink(line);
+}
+
+// Renders the pending records from the main loop, never from an ISR
+void log_process(void)
+{
+    while(read_index != write_index){
+	log_record_t record = records[read_index & (LOG_BUFFER_SIZE - 1)];
+	read_index++;
+
+	if(log_sink){
+	    log_render(&record);
+	}
+    }
+
+    if(lost){
+	uint32_t primask = cpu_irq_save();
+	uint16_t count = lost;
+	lost = 0;
+	cpu_irq_restore(primask);
+
+	log_event(LOG_LOST, count);
+    }
+}
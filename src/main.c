@@ -2,8 +2,23 @@
 
 // Firmware headers
 #include "main.h"
+#include "boot.h"
+#include "bt.h"
+#include "clock.h"
 #include "led.h"
 #include "irdecoder.h"
+#include "cpu.h"
+#include "irq.h"
+#include "latency.h"
+#include "log.h"
+#include "perf.h"
+#include "power.h"
+#include "sched.h"
+#include "stack.h"
+#include "store.h"
+#include "sync.h"
+#include "timebase.h"
+#include "update.h"
 
 // Library headers
 #include "syscfg.h"
@@ -16,16 +31,19 @@
 #include <stdint.h>
 #include <stdbool.h>
 
-static void jump_to_bootloader(const char* args);
 static void deinit(void);
+static void housekeeping(void);
+static void banner(void);
 
-static command_callback_t ir_commands[] = {
+static bool banner_pending = false;
+
+static const command_callback_t ir_commands[] = {
     { 0, 0, led_toggle_verbosity},
     { 1, "binary", led_set_pattern},
     { 2, "wave", led_set_pattern},
     { 3, "alternating", led_set_pattern},
     { 4, "bounce", led_set_pattern},
-    { 5, 0, 0},
+    { 5, "fill", led_set_pattern},
     { 6, 0, 0},
     { 7, 0, 0},
     { 8, 0, 0},
@@ -42,40 +60,59 @@ static command_callback_t ir_commands[] = {
     { 19, 0, 0},
 };
 
-static const command_entry_t command_table[] = {
-    { "pattern", led_toggle_pattern },
-    { "faster", led_speed_increase },
-    { "slower", led_speed_decrease },
-    { "speed", led_speed_set },
-    { "power", led_toggle },
-    { "print", led_toggle_verbosity },
-    { "flash", jump_to_bootloader },
-    { 0, 0 }
+static const sched_handler_t tasks[SCHED_TASK_COUNT] = {
+    [SCHED_TASK_LED] = led_update,
+    [SCHED_TASK_IR] = irdecoder_process,
+    [SCHED_TASK_CLI] = cli_process_input,
+    [SCHED_TASK_LOG] = log_process,
+    [SCHED_TASK_HOUSEKEEPING] = housekeeping,
 };
 
 int main(void)
 {
+    stack_init();
     init();
 
     irdecoder_set_commands(ir_commands, 20);
+    irdecoder_restore();
 
-    while(1){
-	cli_process_input();
-	irdecoder_process();
-    }
+    boot_mark(BOOT_PHASE_SCHED);
+    sched_run(tasks);
 }
 
 void init(void)
 {
     // Enable IRQs
-    __asm volatile ("cpsie i");
-
-    cli_init(main);
+    cpu_irq_enable();
+
+    // Everything on the way to the first frame comes first, the rest of
+    // the peripherals and the banner after it
+    timebase_init();
+    boot_init();
+    irq_init();
+    clock_init();
+    boot_mark(BOOT_PHASE_CLOCK);
+    store_init();
+    update_init();
+    boot_mark(BOOT_PHASE_STORE);
     led_init();
-    led_set_message_cb(cli_printline);
+    cli_init(main);
+    log_set_sink(cli_printline);
+    boot_mark(BOOT_PHASE_CLI);
     irdecoder_init();
-    /*bt_init();*/
+    boot_mark(BOOT_PHASE_IRDECODER);
+    power_init();
+    boot_mark(BOOT_PHASE_POWER);
+    bt_init();
+    boot_mark(BOOT_PHASE_BT);
+
+    banner_pending = true;
+    sched_post(SCHED_TASK_HOUSEKEEPING);
+}
 
+// Printed from the first housekeeping run, once the scheduler is going
+static void banner(void)
+{
     cli_clear();
     cli_home();
     cli_cursive();
@@ -86,19 +123,41 @@ void init(void)
     cli_print("> ");
 }
 
+static void housekeeping(void)
+{
+    if(banner_pending){
+	banner_pending = false;
+	banner();
+	boot_mark(BOOT_PHASE_BANNER);
+    }
+    latency_process();
+    perf_process();
+    stack_process();
+    sync_process();
+    irdecoder_probe();
+    led_save();
+    store_process();
+    update_process();
+}
+
 static void deinit(void)
 {
+    store_sync();
+    clock_deinit();
+    power_deinit();
     led_deinit();
     irdecoder_deinit();
-    /*bt_deinit();*/
+    bt_deinit();
     cli_deinit();
+    timebase_deinit();
+    irq_deinit();
     rcc_reset_all();
 }
 
-static void jump_to_bootloader(const char* args)
+void jump_to_bootloader(const char* args)
 {
     // Disable IRQs
-    __asm volatile ("cpsid i");
+    cpu_irq_disable();
 
     uint32_t* bl_vector = (uint32_t*)(0x08000000);
     uint32_t* sram_vector = (uint32_t*)(0x20000000);
@@ -130,50 +189,9 @@ static void jump_to_bootloader(const char* args)
     deinit();
 
     // Set MSP to applications stack
-    __asm volatile ("msr msp, %0" :: "r" (bl_stack));
+    cpu_set_msp(bl_stack);
 
     // Jump to bootloader reset handler
     void (*bl_reset_handler)(void) = (void (*)(void)) bl_reset;
     bl_reset_handler();
 }
-
-bool cli_parse_application_command(command_t tokens, char token_length)
-{
-    if(token_length < 1){
-	return false;
-    }
-
-    char* args = (token_length > 1) ? tokens[1] : 0;
-
-    for(int i = 0; command_table[i].command != 0; i++){
-	if(utils_strings_match(tokens[0], command_table[i].command)){
-	    cli_newline();
-	    cli_newline();
-	    command_table[i].handler(args);
-	    return true;
-	}
-    }
-    return false;
-}
-
-void cli_print_application_help(void)
-{
-    cli_print("**************************");
-    cli_newline();
-    cli_print("** Application commands **");
-    cli_newline();
-    cli_print("**************************");
-    cli_newline();
-    cli_newline();
-    cli_print("speed+        - Increases the speed");
-    cli_newline();
-    cli_newline();
-    cli_print("speed-        - Decreases the speed");
-    cli_newline();
-    cli_newline();
-    cli_print("mode          - Changes the mode");
-    cli_newline();
-    cli_print("-------------------------------------------");
-    cli_newline();
-    cli_newline();
-}
@@ -0,0 +1,43 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "memorymap.h"
+
+typedef struct{
+    uint32_t start;
+    uint32_t end; // Exclusive
+} memorymap_region_t;
+
+// Readable regions of the STM32G071RB (RM0444, memory map). Accessing
+// anything outside of these ends in a HardFault.
+static const memorymap_region_t regions[] = {
+    { MEMORYMAP_FLASH_START, MEMORYMAP_FLASH_END }, // Main flash, 128 KB
+    { 0x1FFF0000, 0x1FFF7000 }, // System memory (bootloader)
+    { 0x1FFF7000, 0x1FFF7400 }, // OTP
+    { 0x1FFF7500, 0x1FFF7800 }, // Engineering bytes, UID and flash size
+    { 0x1FFF7800, 0x1FFF7880 }, // Option bytes
+    { MEMORYMAP_SRAM_START, MEMORYMAP_SRAM_END }, // SRAM, 36 KB
+    { 0x40000000, 0x40015C00 }, // APB peripherals
+    { 0x40020000, 0x40026400 }, // AHB peripherals
+    { 0x50000000, 0x50001800 }, // IOPORT, GPIOA to GPIOF
+    { 0xE000E000, 0xE000F000 }, // System control space
+};
+
+bool memorymap_is_valid_address(uint32_t address)
+{
+    return memorymap_is_valid_range(address, 4);
+}
+
+bool memorymap_is_valid_range(uint32_t address, uint32_t length)
+{
+    if(length == 0 || address + length < address){
+	return false;
+    }
+
+    for(uint8_t i = 0; i < sizeof(regions) / sizeof(regions[0]); i++){
+	if(address >= regions[i].start && address + length <= regions[i].end){
+	    return true;
+	}
+    }
+    return false;
+}
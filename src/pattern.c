@@ -0,0 +1,139 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "pattern.h"
+#include "patterns_gen.h"
+
+// Steps through a compiled table. The count wraps where patterns_gen.h
+// says, on a whole number of cycles so that the animation never jumps.
+static uint16_t pattern_step(pattern_cursor_t* cursor, uint16_t frames, uint16_t reset)
+{
+    uint16_t step = cursor->count % frames;
+
+    if(++cursor->count >= reset){
+	cursor->count = 0;
+    }
+    return step;
+}
+
+// Compressed streams are XOR deltas against the previous frame, starting
+// from a blank one, each applied for a run of frames:
+//
+//   00rrrrrr           no change for r + 1 frames
+//   01rrbbbb           LED b toggling for r + 1 frames
+//   10rrrrrr hi lo     the delta for r + 1 frames
+//
+// A frame costs at most one token of three bytes, and the stream starts
+// over once it runs out.
+static uint16_t pattern_decode(const pattern_stream_t* stream, pattern_cursor_t* cursor,
+			       uint16_t frames, uint16_t reset)
+{
+    if(!cursor->run){
+	if(cursor->offset >= stream->size){
+	    cursor->offset = 0;
+	    cursor->frame = 0;
+	}
+
+	uint8_t token = stream->data[cursor->offset++];
+	if(token < 0x40){
+	    cursor->run = token + 1;
+	    cursor->delta = 0;
+	}else if(token < 0x80){
+	    cursor->run = ((token >> 4) & 0x3) + 1;
+	    cursor->delta = 1U << (token & 0xF);
+	}else{
+	    cursor->run = (token & 0x3F) + 1;
+	    cursor->delta = (stream->data[cursor->offset] << 8) | stream->data[cursor->offset + 1];
+	    cursor->offset += 2;
+	}
+    }
+
+    cursor->run--;
+    cursor->frame ^= cursor->delta;
+    pattern_step(cursor, frames, reset);
+    return cursor->frame;
+}
+
+void pattern_restart(pattern_cursor_t* cursor)
+{
+    cursor->count = 0;
+    cursor->offset = 0;
+    cursor->frame = 0;
+    cursor->delta = 0;
+    cursor->run = 0;
+}
+
+// Renders the next frame of a pattern and moves the cursor on. Returns
+// false for an unknown pattern, leaving both untouched.
+bool pattern_render(led_pattern_t pattern, pattern_cursor_t* cursor, const pattern_user_t* user, uint16_t* frame)
+{
+    switch (pattern) {
+	case PATTERN_BINARY:
+	    *frame = cursor->count++;
+	    break;
+	case PATTERN_WAVE:
+	    *frame = PATTERN_WAVE_NEXT(cursor);
+	    break;
+	case PATTERN_ALTERNATING:
+	    *frame = (cursor->count++ % 2) ? 0xF0F0 : 0x0F0F;
+	    break;
+	case PATTERN_BOUNCE:
+	    *frame = PATTERN_BOUNCE_NEXT(cursor);
+	    break;
+	case PATTERN_USER:
+	    *frame = user->length ? user->frames[pattern_step(cursor, user->length, user->length)] : 0;
+	    break;
+	case PATTERN_FILL:
+	    *frame = PATTERN_FILL_NEXT(cursor);
+	    break;
+	default:
+	    return false;
+    }
+    return true;
+}
+
+// Puts the cursor where it is once count frames in, as another board's
+// is. The compressed patterns can only get there by decoding the frames on
+// the way, and every cycle of them ends where the next starts, so only the
+// frames into the last cycle are decoded, whatever count comes in.
+void pattern_seek(led_pattern_t pattern, pattern_cursor_t* cursor, const pattern_user_t* user, uint16_t count)
+{
+    uint32_t length = pattern_length(pattern, user);
+    uint16_t frame;
+
+    pattern_restart(cursor);
+    if(pattern == PATTERN_BINARY || pattern == PATTERN_ALTERNATING){
+	cursor->count = count;
+	return;
+    }
+    if(pattern == PATTERN_USER){
+	cursor->count = user->length ? count % user->length : 0;
+	return;
+    }
+    if(!length){
+	return;
+    }
+    for(uint32_t i = 0; i < count % length; i++){
+	pattern_render(pattern, cursor, user, &frame);
+    }
+    cursor->count = count;
+}
+
+// Frames before the pattern repeats, 0 for binary which counts through
+uint32_t pattern_length(led_pattern_t pattern, const pattern_user_t* user)
+{
+    switch (pattern) {
+	case PATTERN_WAVE:
+	    return PATTERN_WAVE_FRAMES;
+	case PATTERN_ALTERNATING:
+	    return 2;
+	case PATTERN_BOUNCE:
+	    return PATTERN_BOUNCE_FRAMES;
+	case PATTERN_USER:
+	    return user->length;
+	case PATTERN_FILL:
+	    return PATTERN_FILL_FRAMES;
+	default:
+	    return 0;
+    }
+}
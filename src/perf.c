@@ -0,0 +1,113 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "perf.h"
+#include "cli.h"
+#include "sched.h"
+
+// Library headers
+#include "utils.h"
+
+#define PERF_WINDOW (TIMEBASE_CYCLES_PER_US * 1000000U) // One second
+
+perf_isr_stat_t perf_isr[PERF_ISR_COUNT];
+uint32_t perf_counters[PERF_COUNTER_COUNT];
+uint32_t perf_loops;
+
+static uint32_t window_start;
+static uint32_t window_loops;
+static uint32_t loops_per_second;
+static uint32_t window_idle;
+static uint32_t idle_percent;
+
+static const char* const isr_names[PERF_ISR_COUNT] = {
+    "TIM14", "EXTI4_15", "TIM16", "USART2", "USART3", "PendSV"
+};
+
+static const char* const counter_names[PERF_COUNTER_COUNT] = {
+    "SPI timeouts",
+    "IR frames accepted",
+    "IR address mismatches",
+    "IR checksum failures",
+    "USART overruns",
+    "RX buffer overflows",
+    "Line buffer overflows",
+    "IR edges over budget",
+};
+
+void perf_process(void)
+{
+    uint32_t now = timebase_now();
+
+    if(now - window_start >= PERF_WINDOW){
+	uint32_t idle = sched_idle_cycles();
+
+	loops_per_second = perf_loops - window_loops;
+	idle_percent = (uint64_t)(idle - window_idle) * 100 / (now - window_start);
+	window_loops = perf_loops;
+	window_idle = idle;
+	window_start = now;
+    }
+}
+
+const char* perf_isr_name(perf_isr_t isr)
+{
+    return isr_names[isr];
+}
+
+void perf_reset(void)
+{
+    uint32_t primask = cpu_irq_save();
+
+    for(uint8_t i = 0; i < PERF_ISR_COUNT; i++){
+	perf_isr[i] = (perf_isr_stat_t){0};
+    }
+    for(uint8_t i = 0; i < PERF_COUNTER_COUNT; i++){
+	perf_counters[i] = 0;
+    }
+
+    cpu_irq_restore(primask);
+}
+
+void perf_print(const char* args)
+{
+    if(utils_strings_match(args, "reset")){
+	perf_reset();
+	cli_print("Statistics cleared.");
+	return;
+    }
+
+    // Copying first so that the numbers printed belong together
+    uint32_t primask = cpu_irq_save();
+    perf_isr_stat_t isr[PERF_ISR_COUNT];
+    for(uint8_t i = 0; i < PERF_ISR_COUNT; i++){
+	isr[i] = perf_isr[i];
+    }
+    cpu_irq_restore(primask);
+
+    cli_print_padded("ISR", 10);
+    cli_print("     count   avg us   max us");
+    cli_newline();
+    for(uint8_t i = 0; i < PERF_ISR_COUNT; i++){
+	uint32_t average = isr[i].count ? isr[i].total / isr[i].count : 0;
+
+	cli_print_padded(isr_names[i], 10);
+	cli_print_number_padded(isr[i].count, 10);
+	cli_print_number_padded(timebase_to_us(average), 9);
+	cli_print_number_padded(timebase_to_us(isr[i].max), 9);
+	cli_newline();
+    }
+    cli_newline();
+
+    cli_print_padded("Main loop iterations/s", 24);
+    cli_print_number(loops_per_second);
+    cli_newline();
+    cli_print_padded("Idle %", 24);
+    cli_print_number(idle_percent);
+    cli_newline();
+    for(uint8_t i = 0; i < PERF_COUNTER_COUNT; i++){
+	cli_print_padded(counter_names[i], 24);
+	cli_print_number(perf_counters[i]);
+	cli_newline();
+    }
+}
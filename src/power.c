@@ -0,0 +1,177 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "power.h"
+#include "clock.h"
+#include "cli.h"
+#include "cpu.h"
+#include "led.h"
+#include "regs.h"
+#include "store.h"
+#include "timebase.h"
+#include "transport.h"
+
+// Library headers
+#include "rcc.h"
+#include "nvic.h"
+#include "tim.h"
+#include "exti.h"
+#include "usart.h"
+#include "utils.h"
+
+static bool enabled = true;
+static bool woken = false;
+static uint32_t wake_time;
+
+static uint32_t stop_count = 0;
+static uint32_t sleep_count = 0;
+static uint32_t stopped_ms = 0;
+static uint32_t latency_last = 0;
+static uint32_t latency_max = 0;
+
+void power_init(void)
+{
+    RCC->APBENR1 |= RCC_APB1_PWR | RCC_APB1_LPTIM1;
+
+    // LSI clocks LPTIM1, which keeps counting in Stop mode
+    RCC->CSR |= RCC_CSR_LSION;
+    while(!(RCC->CSR & RCC_CSR_LSIRDY));
+    RCC->CCIPR = (RCC->CCIPR & ~RCC_CCIPR_LPTIM1SEL_MSK) | RCC_CCIPR_LPTIM1SEL_LSI;
+
+    // USART2 runs from HSI16 (see clock_init) so a start bit can wake it
+    USART2->CR1 |= USART_CR1_UESM;
+
+    // 32 kHz / 32, one LPTIM1 tick per millisecond
+    LPTIM1_CR = 0;
+    LPTIM1_CFGR = LPTIM_CFGR_PRESC_32;
+    LPTIM1_IER = LPTIM_ISR_ARRM;
+
+    EXTI->IMR1 |= EXTI_IMR1_USART2 | EXTI_IMR1_LPTIM1;
+    NVIC->ISER0 = NVIC_TIM6_DAC_LPTIM1;
+
+    PWR_CR1 = (PWR_CR1 & ~PWR_CR1_LPMS_MSK) | PWR_CR1_LPMS_STOP1;
+}
+
+void power_deinit(void)
+{
+    NVIC->ICER0 = NVIC_TIM6_DAC_LPTIM1;
+    LPTIM1_CR = 0;
+    SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
+    USART2->CR1 &= ~USART_CR1_UESM;
+    RCC->CCIPR &= ~RCC_CCIPR_LPTIM1SEL_MSK;
+    RCC->CSR &= ~RCC_CSR_LSION;
+}
+
+// Anything in flight that Stop mode would cut off or stall
+static bool power_busy(void)
+{
+    return transport_busy()                  // Transmitting or receiving
+	|| !transport_stop_allowed()           // A link that cannot wake us
+	|| (TIM16->CR1 & TIM_CR1_CEN)          // Measuring an IR frame
+	|| store_dirty();                      // Settings waiting for flash
+}
+
+static uint32_t power_lptim_count(void)
+{
+    // LPTIM1 counts asynchronously, two equal reads make a valid one
+    uint32_t count;
+    do{
+	count = LPTIM1_CNT;
+    }while(count != LPTIM1_CNT);
+    return count;
+}
+
+// Called by the scheduler with interrupts masked and nothing pending
+void power_idle(void)
+{
+    uint16_t deadline = led_next_frame_ms();
+
+    if(!enabled || deadline < POWER_STOP_MIN_MS || power_busy()){
+	sleep_count++;
+	cpu_wait_for_interrupt();
+	return;
+    }
+
+    bool timed = deadline != LED_NO_DEADLINE;
+    if(timed){
+	// LPTIM1 ignores writes other than CR while disabled
+	LPTIM1_CR = LPTIM_CR_ENABLE;
+	LPTIM1_ICR = LPTIM_ISR_ARRM | LPTIM_ISR_ARROK;
+	LPTIM1_ARR = deadline - POWER_STOP_MARGIN_MS;
+	while(!(LPTIM1_ISR & LPTIM_ISR_ARROK));
+	LPTIM1_CR |= LPTIM_CR_SNGSTRT;
+    }
+
+    SCB_SCR |= SCB_SCR_SLEEPDEEP;
+    cpu_wait_for_interrupt();
+    SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
+
+    // Stop mode resumes on HSI16, switching back to any other profile
+    clock_restore();
+    wake_time = timebase_now();
+    woken = true;
+    stop_count++;
+
+    if(timed){
+	// ARRM sets as the count reaches ARR, ARR ticks after the start
+	uint32_t elapsed = (LPTIM1_ISR & LPTIM_ISR_ARRM) ? LPTIM1_ARR : power_lptim_count();
+	LPTIM1_ICR = LPTIM_ISR_ARRM;
+	LPTIM1_CR = 0;
+
+	// TIM14 was stopped as well, so the frame countdown catches up here
+	led_advance(elapsed);
+	stopped_ms += elapsed;
+    }
+}
+
+// Called after every task, closing the wake-to-first-action measurement
+void power_note_action(void)
+{
+    if(!woken){
+	return;
+    }
+    woken = false;
+
+    latency_last = timebase_to_us(timebase_now() - wake_time);
+    if(latency_last > latency_max){
+	latency_max = latency_last;
+    }
+}
+
+void power_command(const char* args)
+{
+    if(utils_strings_match(args, "on")){
+	enabled = true;
+	cli_print("Stop mode enabled.");
+	return;
+    }
+    if(utils_strings_match(args, "off")){
+	enabled = false;
+	cli_print("Stop mode disabled.");
+	return;
+    }
+
+    cli_print_padded("Stop mode", 24);
+    cli_print(enabled ? "enabled" : "disabled");
+    cli_newline();
+    cli_print_padded("Stop entries", 24);
+    cli_print_number(stop_count);
+    cli_newline();
+    cli_print_padded("Sleep entries", 24);
+    cli_print_number(sleep_count);
+    cli_newline();
+    cli_print_padded("Timed stop ms", 24);
+    cli_print_number(stopped_ms);
+    cli_newline();
+    cli_print_padded("Wake to action last us", 24);
+    cli_print_number(latency_last);
+    cli_newline();
+    cli_print_padded("Wake to action max us", 24);
+    cli_print_number(latency_max);
+}
+
+void TIM6_DAC_LPTIM1_IRQHandler(void)
+{
+    // Only here to end Stop mode, the elapsed time is read in power_idle
+    LPTIM1_ICR = LPTIM_ISR_ARRM;
+}
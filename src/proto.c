@@ -0,0 +1,300 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "proto.h"
+#include "cli.h"
+#include "crc.h"
+#include "latency.h"
+#include "update.h"
+
+static const uint8_t enter_sequence[] = PROTO_ENTER_SEQUENCE;
+static const uint8_t exit_sequence[] = PROTO_EXIT_SEQUENCE;
+
+static bool active = false;
+static uint8_t exit_index = 0;
+
+static uint8_t rx_frame[PROTO_FRAME_MAX];
+static uint8_t rx_length = 0;
+static bool rx_overflow = false;
+
+static int16_t last_seq = -1;
+static uint8_t last_ack[PROTO_FRAME_MAX + 2];
+static uint8_t last_ack_length = 0;
+
+static void proto_enter(void);
+static void proto_exit(void);
+
+bool proto_active(void)
+{
+    return active;
+}
+
+bool proto_detect(uint8_t* index, uint8_t byte)
+{
+    if(byte != enter_sequence[*index]){
+	// A restarted sequence, otherwise the byte belongs to the REPL
+	*index = (byte == enter_sequence[0]) ? 1 : 0;
+	return *index != 0;
+    }
+
+    if(++*index == sizeof(enter_sequence)){
+	*index = 0;
+	proto_enter();
+    }
+    return true;
+}
+
+// Encodes into out, which needs one byte more per 254 input bytes, and
+// returns the encoded length without the trailing delimiter
+static uint8_t cobs_encode(const uint8_t* in, uint8_t length, uint8_t* out)
+{
+    uint8_t code_index = 0;
+    uint8_t out_index = 1;
+    uint8_t code = 1;
+
+    for(uint8_t i = 0; i < length; i++){
+	if(in[i] == 0){
+	    out[code_index] = code;
+	    code_index = out_index++;
+	    code = 1;
+	}else{
+	    out[out_index++] = in[i];
+	    if(++code == 0xFF){
+		out[code_index] = code;
+		code_index = out_index++;
+		code = 1;
+	    }
+	}
+    }
+    out[code_index] = code;
+    return out_index;
+}
+
+// Decodes in place, returns the decoded length or -1 on a malformed frame
+static int16_t cobs_decode(uint8_t* data, uint8_t length)
+{
+    uint8_t in = 0;
+    uint8_t out = 0;
+
+    while(in < length){
+	uint8_t code = data[in++];
+
+	if(code == 0 || in + code - 1 > length){
+	    return -1;
+	}
+	for(uint8_t i = 1; i < code; i++){
+	    data[out++] = data[in++];
+	}
+	if(code != 0xFF && in < length){
+	    data[out++] = 0;
+	}
+    }
+    return out;
+}
+
+static void proto_send(uint8_t seq, proto_type_t type, const uint8_t* payload, uint8_t length)
+{
+    uint8_t frame[PROTO_FRAME_MAX];
+    uint8_t encoded[PROTO_FRAME_MAX + 2];
+
+    if(length > PROTO_FRAME_MAX - 4){
+	return;
+    }
+
+    frame[0] = seq;
+    frame[1] = type;
+    for(uint8_t i = 0; i < length; i++){
+	frame[2 + i] = payload[i];
+    }
+    uint16_t crc = crc16(frame, length + 2, CRC16_INIT);
+    frame[length + 2] = crc & 0xFF;
+    frame[length + 3] = crc >> 8;
+
+    uint8_t encoded_length = cobs_encode(frame, length + 4, encoded);
+    encoded[encoded_length++] = 0;
+
+    cli_write_raw(encoded, encoded_length);
+
+    // Acks are kept so that a retransmitted frame can be answered again
+    if(type == PROTO_TYPE_ACK){
+	for(uint8_t i = 0; i < encoded_length; i++){
+	    last_ack[i] = encoded[i];
+	}
+	last_ack_length = encoded_length;
+    }
+}
+
+static void proto_nak(uint8_t seq, proto_nak_t reason)
+{
+    uint8_t payload = reason;
+    proto_send(seq, PROTO_TYPE_NAK, &payload, 1);
+}
+
+static void proto_command(uint8_t seq, const uint8_t* payload, uint8_t length)
+{
+    uint8_t status[PROTO_BATCH_MAX];
+    uint8_t count = 0;
+
+    // Validating the whole batch before running any of it
+    for(uint8_t i = 0; i < length; i += payload[i] + 1){
+	if(i + payload[i] + 1 > length || ++count > PROTO_BATCH_MAX){
+	    proto_nak(seq, PROTO_NAK_FORMAT);
+	    return;
+	}
+    }
+
+    latency_start(LATENCY_PATH_BINARY);
+
+    count = 0;
+    for(uint8_t i = 0; i < length; i += payload[i] + 1){
+	status[count++] = cli_execute(&payload[i + 1], payload[i]);
+    }
+
+    proto_send(seq, PROTO_TYPE_ACK, status, count);
+}
+
+static void proto_latency(uint8_t seq)
+{
+    uint8_t payload[LATENCY_PATH_COUNT * 12];
+    uint8_t index = 0;
+
+    for(uint8_t i = 0; i < LATENCY_PATH_COUNT; i++){
+	const latency_stat_t* stat = latency_get(i);
+	uint32_t values[3] = { stat->last, stat->min, stat->max };
+
+	for(uint8_t j = 0; j < 3; j++){
+	    payload[index++] = values[j];
+	    payload[index++] = values[j] >> 8;
+	    payload[index++] = values[j] >> 16;
+	    payload[index++] = values[j] >> 24;
+	}
+    }
+    proto_send(seq, PROTO_TYPE_ACK, payload, index);
+}
+
+static uint32_t proto_u32(const uint8_t* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+// Every update frame is answered by [status][offset expected next u32]
+static void proto_update(uint8_t seq, uint8_t type, const uint8_t* payload, uint8_t length)
+{
+    update_status_t status;
+
+    if(type == PROTO_TYPE_UPDATE_BEGIN && length == 8){
+	status = update_begin(proto_u32(payload), proto_u32(&payload[4]));
+    }else if(type == PROTO_TYPE_UPDATE_DATA && length > 4){
+	status = update_data(proto_u32(payload), &payload[4], length - 4);
+    }else if(type == PROTO_TYPE_UPDATE_END && length == 0){
+	status = update_end();
+    }else{
+	proto_nak(seq, PROTO_NAK_FORMAT);
+	return;
+    }
+
+    uint32_t expected = update_expected();
+    uint8_t reply[5] = { status, expected, expected >> 8, expected >> 16, expected >> 24 };
+    proto_send(seq, PROTO_TYPE_ACK, reply, sizeof(reply));
+}
+
+static void proto_frame(void)
+{
+    int16_t length = cobs_decode(rx_frame, rx_length);
+
+    if(length < 4){
+	proto_nak(length > 0 ? rx_frame[0] : 0, PROTO_NAK_FORMAT);
+	return;
+    }
+
+    uint8_t seq = rx_frame[0];
+    uint16_t crc = rx_frame[length - 2] | (rx_frame[length - 1] << 8);
+
+    if(crc16(rx_frame, length - 2, CRC16_INIT) != crc){
+	proto_nak(seq, PROTO_NAK_CRC);
+	return;
+    }
+
+    if(seq == last_seq && last_ack_length){
+	cli_write_raw(last_ack, last_ack_length);
+	return;
+    }
+
+    switch(rx_frame[1]){
+	case PROTO_TYPE_COMMAND:
+	    proto_command(seq, &rx_frame[2], length - 4);
+	    break;
+	case PROTO_TYPE_PING:
+	    proto_send(seq, PROTO_TYPE_ACK, 0, 0);
+	    break;
+	case PROTO_TYPE_EXIT:
+	    proto_send(seq, PROTO_TYPE_ACK, 0, 0);
+	    proto_exit();
+	    return;
+	case PROTO_TYPE_LATENCY:
+	    proto_latency(seq);
+	    break;
+	case PROTO_TYPE_UPDATE_BEGIN:
+	case PROTO_TYPE_UPDATE_DATA:
+	case PROTO_TYPE_UPDATE_END:
+	    proto_update(seq, rx_frame[1], &rx_frame[2], length - 4);
+	    break;
+	default:
+	    proto_nak(seq, PROTO_NAK_TYPE);
+	    return;
+    }
+    last_seq = seq;
+}
+
+void proto_receive(uint8_t byte)
+{
+    // A frame of PROTO_FRAME_MAX bytes cannot start with the 0xFF after the
+    // delimiter, so the exit sequence is never part of one
+    if(byte == exit_sequence[exit_index]){
+	if(++exit_index == sizeof(exit_sequence)){
+	    proto_exit();
+	    return;
+	}
+    }else{
+	exit_index = (byte == exit_sequence[0]) ? 1 : 0;
+    }
+
+    if(byte != 0){
+	if(rx_length < PROTO_FRAME_MAX){
+	    rx_frame[rx_length++] = byte;
+	}else{
+	    rx_overflow = true;
+	}
+	return;
+    }
+
+    if(rx_overflow){
+	proto_nak(0, PROTO_NAK_OVERFLOW);
+    }else if(rx_length){
+	proto_frame();
+    }
+    rx_length = 0;
+    rx_overflow = false;
+}
+
+static void proto_enter(void)
+{
+    active = true;
+    exit_index = 0;
+    rx_length = 0;
+    rx_overflow = false;
+    last_seq = -1;
+    last_ack_length = 0;
+
+    // Text output would corrupt the framing, so the REPL stays quiet until exit
+    cli_set_muted(true);
+    proto_send(0, PROTO_TYPE_ACK, 0, 0);
+}
+
+static void proto_exit(void)
+{
+    active = false;
+    cli_set_muted(false);
+    cli_newline();
+    cli_prompt();
+}
@@ -0,0 +1,53 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "replay.h"
+#include "cli.h"
+
+// Library headers
+#include "utils.h"
+
+replay_entry_t replay_buffer[REPLAY_SIZE];
+volatile uint32_t replay_count = 0;
+volatile bool replay_recording = false;
+uint32_t replay_start = 0;
+
+// Streams the recording in the memdumpraw format. The entries are written
+// once and never move, so this does not have to stop a recording.
+static void replay_dump(void)
+{
+    uint32_t count = replay_count;
+
+    uint32_t crc = cli_raw_begin(count * sizeof(replay_entry_t));
+    crc = cli_raw_write((const uint8_t*)replay_buffer, count * sizeof(replay_entry_t), crc);
+    cli_raw_end(crc);
+}
+
+// "replay record" starts over, "replay stop" ends the recording and
+// "replay dump" streams it for tools/replay2script.py
+void replay_command(const char* args)
+{
+    if(utils_strings_match(args, "record")){
+	replay_recording = false;
+	replay_count = 0;
+	replay_start = timebase_now();
+	replay_recording = true;
+	cli_print("Recording.");
+    }else if(utils_strings_match(args, "stop")){
+	replay_recording = false;
+	cli_print("Recording stopped.");
+    }else if(utils_strings_match(args, "dump")){
+	replay_dump();
+    }else{
+	uint32_t count = replay_count;
+	uint32_t last = count ? replay_buffer[count - 1].timestamp : 0;
+
+	cli_print(replay_recording ? "Recording, " : "Stopped, ");
+	cli_print_number(count);
+	cli_print(" of ");
+	cli_print_number(REPLAY_SIZE);
+	cli_print(" entries used over ");
+	cli_print_number(timebase_to_us(last) / 1000);
+	cli_print(" ms");
+    }
+}
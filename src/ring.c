@@ -0,0 +1,162 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "ring.h"
+#include "cpu.h"
+
+void ring_init(ring_t* ring, uint8_t* data, uint32_t size)
+{
+    ring->data = data;
+    ring->mask = size - 1;
+    ring->head = 0;
+    ring->tail = 0;
+}
+
+uint32_t ring_count(const ring_t* ring)
+{
+    return ring->head - ring->tail;
+}
+
+bool ring_empty(const ring_t* ring)
+{
+    return ring->head == ring->tail;
+}
+
+// The free run from head up to the end of the buffer or the tail,
+// whichever comes first
+uint32_t ring_write_span(ring_t* ring, uint8_t** span)
+{
+    uint32_t head = ring->head;
+    uint32_t free = ring->mask + 1 - (head - ring->tail);
+    uint32_t offset = head & ring->mask;
+    uint32_t run = ring->mask + 1 - offset;
+
+    // The tail is read before the bytes it frees are written over
+    cpu_barrier();
+    *span = &ring->data[offset];
+    return (free < run) ? free : run;
+}
+
+void ring_write_commit(ring_t* ring, uint32_t length)
+{
+    // The bytes land before the consumer can see them
+    cpu_barrier();
+    ring->head += length;
+}
+
+bool ring_put(ring_t* ring, uint8_t byte)
+{
+    uint8_t* span;
+
+    if(!ring_write_span(ring, &span)){
+	return false;
+    }
+    *span = byte;
+    ring_write_commit(ring, 1);
+    return true;
+}
+
+// Copies in as much as fits, at most two spans
+uint32_t ring_write(ring_t* ring, const uint8_t* bytes, uint32_t length)
+{
+    uint32_t written = 0;
+
+    for(uint8_t pass = 0; pass < 2 && written < length; pass++){
+	uint8_t* span;
+	uint32_t run = ring_write_span(ring, &span);
+
+	if(run > length - written){
+	    run = length - written;
+	}
+	for(uint32_t i = 0; i < run; i++){
+	    span[i] = bytes[written + i];
+	}
+	ring_write_commit(ring, run);
+	written += run;
+    }
+    return written;
+}
+
+// The queued run from tail up to the end of the buffer or the head
+uint32_t ring_read_span(ring_t* ring, const uint8_t** span)
+{
+    uint32_t tail = ring->tail;
+    uint32_t count = ring->head - tail;
+    uint32_t offset = tail & ring->mask;
+    uint32_t run = ring->mask + 1 - offset;
+
+    // The head is read before the bytes it covers
+    cpu_barrier();
+    *span = &ring->data[offset];
+    return (count < run) ? count : run;
+}
+
+void ring_read_commit(ring_t* ring, uint32_t length)
+{
+    // The bytes are read before the producer may reuse them
+    cpu_barrier();
+    ring->tail += length;
+}
+
+bool ring_get(ring_t* ring, uint8_t* byte)
+{
+    const uint8_t* span;
+
+    if(!ring_read_span(ring, &span)){
+	return false;
+    }
+    *byte = *span;
+    ring_read_commit(ring, 1);
+    return true;
+}
+
+// Copies out as much as is queued and fits, at most two spans
+uint32_t ring_read(ring_t* ring, uint8_t* bytes, uint32_t length)
+{
+    uint32_t copied = 0;
+
+    for(uint8_t pass = 0; pass < 2 && copied < length; pass++){
+	const uint8_t* span;
+	uint32_t run = ring_read_span(ring, &span);
+
+	if(run > length - copied){
+	    run = length - copied;
+	}
+	for(uint32_t i = 0; i < run; i++){
+	    bytes[copied + i] = span[i];
+	}
+	ring_read_commit(ring, run);
+	copied += run;
+    }
+    return copied;
+}
+
+// Copies out the oldest bytes and leaves them queued
+uint32_t ring_peek(const ring_t* ring, uint8_t* bytes, uint32_t length)
+{
+    uint32_t tail = ring->tail;
+    uint32_t count = ring->head - tail;
+
+    cpu_barrier();
+    if(length > count){
+	length = count;
+    }
+    for(uint32_t i = 0; i < length; i++){
+	bytes[i] = ring->data[(tail + i) & ring->mask];
+    }
+    return length;
+}
+
+void ring_discard(ring_t* ring)
+{
+    ring->tail = ring->head;
+}
+
+bool ring_unput(ring_t* ring)
+{
+    if(ring_empty(ring)){
+	return false;
+    }
+    ring->head--;
+    return true;
+}
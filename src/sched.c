@@ -0,0 +1,111 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "sched.h"
+#include "cpu.h"
+#include "irq.h"
+#include "perf.h"
+#include "power.h"
+#include "timebase.h"
+
+static const sched_handler_t* task_handlers = 0;
+static volatile uint32_t pending = 0;
+static volatile uint32_t deferred = 0;
+static volatile uint32_t idle_cycles = 0;
+static uint16_t housekeeping_ms = 0;
+
+// Safe from any context
+void sched_post(sched_task_t task)
+{
+    uint32_t primask = cpu_irq_save();
+    pending |= 1U << task;
+    cpu_irq_restore(primask);
+}
+
+// Runs the task from PendSV, so a long command in thread mode cannot hold
+// it back. Safe from any context.
+void sched_defer(sched_task_t task)
+{
+    uint32_t primask = cpu_irq_save();
+    deferred |= 1U << task;
+    cpu_irq_restore(primask);
+    irq_defer();
+}
+
+// Called from the 1 ms TIM14 interrupt
+void sched_tick(void)
+{
+    if(++housekeeping_ms >= SCHED_HOUSEKEEPING_MS){
+	housekeeping_ms = 0;
+	sched_post(SCHED_TASK_HOUSEKEEPING);
+    }
+}
+
+uint32_t sched_idle_cycles(void)
+{
+    return idle_cycles;
+}
+
+void sched_run(const sched_handler_t* handlers)
+{
+    task_handlers = handlers;
+
+    // Anything deferred before the handlers were known
+    if(deferred){
+	irq_defer();
+    }
+
+    while(1){
+	perf_loop();
+
+	// Checking for work with interrupts masked, so that a post landing
+	// between the check and WFI still wakes the core
+	cpu_irq_disable();
+	if(!pending){
+	    uint32_t start = timebase_now();
+	    power_idle();
+	    idle_cycles += timebase_now() - start;
+	}
+	cpu_irq_enable();
+
+	// Running the most important ready task, then looking again
+	for(uint8_t task = 0; task < SCHED_TASK_COUNT; task++){
+	    if(!(pending & (1U << task))){
+		continue;
+	    }
+
+	    uint32_t primask = cpu_irq_save();
+	    pending &= ~(1U << task);
+	    cpu_irq_restore(primask);
+
+	    if(handlers[task]){
+		handlers[task]();
+	    }
+	    power_note_action();
+	    break;
+	}
+    }
+}
+
+void PendSV_Handler(void)
+{
+    if(!task_handlers){
+	return;
+    }
+
+    uint32_t start = perf_isr_enter(PERF_ISR_PENDSV);
+
+    uint32_t primask = cpu_irq_save();
+    uint32_t tasks = deferred;
+    deferred = 0;
+    cpu_irq_restore(primask);
+
+    for(uint8_t task = 0; task < SCHED_TASK_COUNT; task++){
+	if((tasks & (1U << task)) && task_handlers[task]){
+	    task_handlers[task]();
+	}
+    }
+    power_note_action();
+
+    perf_isr_exit(PERF_ISR_PENDSV, start);
+}
@@ -0,0 +1,113 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "stack.h"
+#include "cli.h"
+#include "perf.h"
+#include "timebase.h"
+
+#define STACK_MARGIN (256) // Bytes below the painting frame left alone
+
+#ifdef HOST
+#define STACK_RESERVED (SIM_STACK_SIZE)
+#else
+// From the linker script. _Min_Stack_Size is absolute, its address is the
+// reservation; anything between the end of .bss and the stack is free too.
+extern uint32_t _end;
+extern uint32_t _estack;
+extern uint32_t _Min_Stack_Size;
+#define STACK_RESERVED ((uint32_t)&_Min_Stack_Size)
+#endif
+
+uintptr_t stack_top = 0;
+
+static uint32_t* bottom;
+static uint32_t* lowest; // Deepest word found written, only moves down
+static uint32_t sample_time;
+
+// Paints from the bottom up to just below the caller, so main must be the
+// one calling this, before anything else uses the stack in earnest
+void stack_init(void)
+{
+    uint32_t primask = cpu_irq_save();
+
+#ifdef HOST
+    stack_top = cpu_get_sp();
+    bottom = (uint32_t*)((stack_top - STACK_RESERVED) & ~(uintptr_t)3);
+#else
+    stack_top = (uintptr_t)&_estack;
+    bottom = &_end;
+#endif
+    lowest = (uint32_t*)((cpu_get_sp() - STACK_MARGIN) & ~(uintptr_t)3);
+    for(uint32_t* word = bottom; word < lowest; word++){
+	*word = STACK_PAINT;
+    }
+
+    cpu_irq_restore(primask);
+    sample_time = timebase_now();
+}
+
+// Scans up to the previous mark only, a word from the bottom on that still
+// holds the paint was never reached
+static void stack_sample(void)
+{
+    uint32_t* word = bottom;
+
+    while(word < lowest && *word == STACK_PAINT){
+	word++;
+    }
+    lowest = word;
+}
+
+void stack_process(void)
+{
+    uint32_t now = timebase_now();
+
+    if(now - sample_time >= TIMEBASE_CYCLES_PER_US * 1000U * STACK_SAMPLE_MS){
+	sample_time = now;
+	stack_sample();
+    }
+}
+
+// Deepest use against the reservation, overall and on entry to each ISR
+void stack_command(const char* args)
+{
+    stack_sample();
+
+    uint32_t used = stack_top - (uintptr_t)lowest;
+
+    cli_print("Deepest ");
+    cli_print_number(used);
+    cli_print(" of ");
+    cli_print_number(STACK_RESERVED);
+    cli_print(" bytes reserved, ");
+    if(lowest == bottom){
+	cli_print("overflowed");
+    }else if(used > STACK_RESERVED){
+	cli_print_number(used - STACK_RESERVED);
+	cli_print(" over, into free RAM");
+    }else{
+	cli_print_number(STACK_RESERVED - used);
+	cli_print(" headroom");
+    }
+    cli_newline();
+    cli_print_number((uintptr_t)lowest - (uintptr_t)bottom);
+    cli_print(" bytes above .bss never reached");
+    cli_newline();
+    cli_newline();
+
+    cli_print_padded("ISR", 10);
+    cli_print(" at entry  headroom");
+    for(uint8_t i = 0; i < PERF_ISR_COUNT; i++){
+	uint32_t depth = perf_isr[i].stack;
+
+	cli_newline();
+	cli_print_padded(perf_isr_name(i), 10);
+	cli_print_number_padded(depth, 9);
+	if(depth > STACK_RESERVED){
+	    cli_print("      over");
+	}else{
+	    cli_print_number_padded(STACK_RESERVED - depth, 10);
+	}
+    }
+}
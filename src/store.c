@@ -0,0 +1,367 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "store.h"
+#include "cli.h"
+#include "crc.h"
+#include "flash.h"
+#include "led.h"
+#include "timebase.h"
+#include "transport.h"
+#include "update.h"
+
+// Library headers
+#include "tim.h"
+#include "utils.h"
+
+typedef struct{
+    uint8_t key;
+    uint8_t index;
+    uint16_t check;
+    uint32_t value;
+} store_record_t;
+
+typedef struct{
+    uint8_t key;
+    uint8_t index;
+    bool dirty;
+    uint32_t value;
+} store_entry_t;
+
+#define STORE_PAGE(page) ((const store_record_t*)(STORE_BASE + (page) * STORE_PAGE_SIZE))
+#define STORE_NONE (-1)
+
+static store_entry_t entries[STORE_ENTRIES];
+static uint8_t entry_count = 0;
+static uint8_t dirty_count = 0;
+
+static int8_t active = STORE_NONE;  // Page holding the current log
+static uint8_t spare = 0;           // Page the next compaction fills
+static bool spare_erased = false;
+static uint32_t generation = 0;
+static uint16_t write_slot = 0;     // Next free slot in the active page
+
+static uint32_t last_set = 0;       // Timebase at the latest set
+static uint32_t records_written = 0;
+static uint32_t erase_count = 0;
+static uint32_t dropped = 0;
+static uint32_t torn = 0;           // Records found failing ECC at boot
+
+static uint16_t store_check(uint8_t key, uint8_t index, uint32_t value)
+{
+    uint8_t bytes[6] = { key, index, value, value >> 8, value >> 16, value >> 24 };
+    return crc16(bytes, 6, CRC16_INIT);
+}
+
+static bool store_record_valid(const store_record_t* record)
+{
+    return record->key != STORE_KEY_EMPTY
+	&& record->check == store_check(record->key, record->index, record->value);
+}
+
+static bool store_record_empty(const store_record_t* record)
+{
+    return record->key == 0xFF && record->index == 0xFF
+	&& record->check == 0xFFFF && record->value == 0xFFFFFFFF;
+}
+
+// Copies a record out of flash, false when it fails ECC
+static bool store_read(uint8_t page, uint16_t slot, store_record_t* record)
+{
+    uint32_t low;
+    uint32_t high;
+    bool ok = flash_read((uint32_t)&STORE_PAGE(page)[slot], &low, &high);
+
+    record->key = low;
+    record->index = low >> 8;
+    record->check = low >> 16;
+    record->value = high;
+    return ok;
+}
+
+// As store_read, but a record torn by a reset is programmed to zeros, which
+// fail the CRC, so that the next boot reads it without an NMI
+static void store_load(uint8_t page, uint16_t slot, store_record_t* record)
+{
+    if(!store_read(page, slot, record)){
+	flash_program((uint32_t)&STORE_PAGE(page)[slot], 0, 0);
+	*record = (store_record_t){ 0 };
+	torn++;
+    }
+}
+
+static bool store_page_blank(uint8_t page)
+{
+    store_record_t record;
+
+    for(uint16_t slot = 0; slot < STORE_SLOTS; slot++){
+	if(!store_read(page, slot, &record) || !store_record_empty(&record)){
+	    return false;
+	}
+    }
+    return true;
+}
+
+static store_entry_t* store_find(uint8_t key, uint8_t index)
+{
+    for(uint8_t i = 0; i < entry_count; i++){
+	if(entries[i].key == key && entries[i].index == index){
+	    return &entries[i];
+	}
+    }
+    return 0;
+}
+
+// Records are programmed as one double word, the flash programming unit
+static bool store_program(uint8_t page, uint16_t slot, uint8_t key, uint8_t index, uint32_t value)
+{
+    uint16_t check = store_check(key, index, value);
+
+    records_written++;
+    return flash_program((uint32_t)&STORE_PAGE(page)[slot],
+	key | (index << 8) | ((uint32_t)check << 16), value);
+}
+
+static void store_erase(uint8_t page)
+{
+    flash_erase(STORE_PAGE_FIRST + page);
+    erase_count++;
+}
+
+//
+// Log
+//
+
+void store_init(void)
+{
+    entry_count = 0;
+    dirty_count = 0;
+    active = STORE_NONE;
+    generation = 0;
+
+    // The current page is the one with the newest valid header
+    for(uint8_t page = 0; page < STORE_PAGES; page++){
+	store_record_t header;
+
+	store_load(page, 0, &header);
+	if(store_record_valid(&header) && header.key == STORE_KEY_HEADER
+	    && header.index == STORE_VERSION && (active == STORE_NONE || header.value > generation)){
+	    active = page;
+	    generation = header.value;
+	}
+    }
+
+    spare = (active == STORE_NONE) ? 0 : 1 - active;
+    spare_erased = store_page_blank(spare);
+
+    if(active == STORE_NONE){
+	return;
+    }
+
+    // Later records override earlier ones, the log ends at the first blank
+    for(write_slot = 1; write_slot < STORE_SLOTS; write_slot++){
+	store_record_t record;
+
+	store_load(active, write_slot, &record);
+	if(store_record_empty(&record)){
+	    break;
+	}
+	if(!store_record_valid(&record) || record.key == STORE_KEY_HEADER){
+	    continue;
+	}
+
+	store_entry_t* entry = store_find(record.key, record.index);
+	if(!entry && entry_count < STORE_ENTRIES){
+	    entry = &entries[entry_count++];
+	    entry->key = record.key;
+	    entry->index = record.index;
+	}
+	if(entry){
+	    entry->value = record.value;
+	    entry->dirty = false;
+	}
+    }
+}
+
+bool store_get(store_key_t key, uint8_t index, uint32_t* value)
+{
+    store_entry_t* entry = store_find(key, index);
+
+    if(!entry){
+	return false;
+    }
+    *value = entry->value;
+    return true;
+}
+
+void store_set(store_key_t key, uint8_t index, uint32_t value)
+{
+    store_entry_t* entry = store_find(key, index);
+
+    if(entry && entry->value == value){
+	return;
+    }
+    if(!entry){
+	if(entry_count >= STORE_ENTRIES){
+	    dropped++;
+	    return;
+	}
+	entry = &entries[entry_count++];
+	entry->key = key;
+	entry->index = index;
+	entry->dirty = false;
+    }
+
+    entry->value = value;
+    if(!entry->dirty){
+	entry->dirty = true;
+	dirty_count++;
+    }
+    last_set = timebase_now();
+}
+
+bool store_dirty(void)
+{
+    return dirty_count != 0;
+}
+
+// Copies every entry into the erased spare page and makes it the current one
+static void store_compact(void)
+{
+    uint16_t slot = 1;
+
+    for(uint8_t i = 0; i < entry_count; i++){
+	store_program(spare, slot++, entries[i].key, entries[i].index, entries[i].value);
+	entries[i].dirty = false;
+    }
+    dirty_count = 0;
+
+    generation++;
+    store_program(spare, 0, STORE_KEY_HEADER, STORE_VERSION, generation);
+
+    int8_t previous = active;
+    active = spare;
+    write_slot = slot;
+    spare = (previous == STORE_NONE) ? 1 - active : previous;
+    spare_erased = store_page_blank(spare);
+}
+
+static void store_append(void)
+{
+    if(active == STORE_NONE){
+	return;
+    }
+
+    for(uint8_t i = 0; i < entry_count && write_slot < STORE_SLOTS; i++){
+	store_entry_t* entry = &entries[i];
+
+	if(!entry->dirty){
+	    continue;
+	}
+	store_program(active, write_slot++, entry->key, entry->index, entry->value);
+	entry->dirty = false;
+	dirty_count--;
+    }
+}
+
+// Writes everything pending, compacting when the current page is full
+static void store_write(void)
+{
+    store_append();
+
+    if(dirty_count && spare_erased){
+	store_compact();
+    }
+}
+
+// Flash operations stall the core, so they wait for a moment nothing is on
+// the wire, no IR frame is being timed, no firmware image is streaming in
+// and the next LED frame is far enough
+static bool store_busy(uint16_t stall_ms)
+{
+    return transport_busy()
+	|| update_active()
+	|| (TIM16->CR1 & TIM_CR1_CEN)
+	|| led_next_frame_ms() < stall_ms + 2;
+}
+
+// Called from housekeeping, doing at most one stalling step per call
+void store_process(void)
+{
+    uint32_t waited = timebase_now() - last_set;
+
+    // The spare page is erased ahead of time when it is quiet. Only when
+    // pending sets have nowhere else to go does it happen regardless.
+    if(!spare_erased){
+	bool needed = dirty_count && (active == STORE_NONE || write_slot >= STORE_SLOTS);
+	bool overdue = needed && waited >= STORE_ERASE_FORCE_MS * 1000U * TIMEBASE_CYCLES_PER_US;
+
+	if(!store_busy(STORE_ERASE_MS) || (overdue && !(TIM16->CR1 & TIM_CR1_CEN))){
+	    store_erase(spare);
+	    spare_erased = true;
+	    return;
+	}
+    }
+
+    if(dirty_count && waited >= STORE_COALESCE_MS * 1000U * TIMEBASE_CYCLES_PER_US
+	&& !store_busy(1)){
+	store_write();
+    }
+}
+
+// Writes everything pending right away, before a reset
+void store_sync(void)
+{
+    if(!dirty_count){
+	return;
+    }
+    if((active == STORE_NONE || write_slot + dirty_count > STORE_SLOTS) && !spare_erased){
+	store_erase(spare);
+	spare_erased = true;
+    }
+    store_write();
+}
+
+void store_command(const char* args)
+{
+    if(utils_strings_match(args, "sync")){
+	store_sync();
+	cli_print("Settings written.");
+	return;
+    }
+
+    cli_print_padded("Page", 24);
+    if(active == STORE_NONE){
+	cli_print("none");
+    }else{
+	cli_print_number(active);
+	cli_print(", generation ");
+	cli_print_number(generation);
+    }
+    cli_newline();
+    cli_print_padded("Slots used", 24);
+    cli_print_number(active == STORE_NONE ? 0 : write_slot);
+    cli_print(" / ");
+    cli_print_number(STORE_SLOTS);
+    cli_newline();
+    cli_print_padded("Entries", 24);
+    cli_print_number(entry_count);
+    cli_print(", ");
+    cli_print_number(dirty_count);
+    cli_print(" pending");
+    cli_newline();
+    cli_print_padded("Spare page", 24);
+    cli_print(spare_erased ? "erased" : "to erase");
+    cli_newline();
+    cli_print_padded("Records written", 24);
+    cli_print_number(records_written);
+    cli_newline();
+    cli_print_padded("Page erases", 24);
+    cli_print_number(erase_count);
+    cli_newline();
+    cli_print_padded("Entries dropped", 24);
+    cli_print_number(dropped);
+    cli_newline();
+    cli_print_padded("Torn records cleared", 24);
+    cli_print_number(torn);
+}
@@ -0,0 +1,385 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "sync.h"
+#include "bt.h"
+#include "cli.h"
+#include "cpu.h"
+#include "crc.h"
+#include "led.h"
+#include "pattern.h"
+#include "sched.h"
+#include "timebase.h"
+#include "transport.h"
+
+// Library headers
+#include "utils.h"
+
+#define SYNC_CYCLES_PER_MS (TIMEBASE_CYCLES_PER_US * 1000U)
+// A frame tick a little early sends the beacon rather than one a frame late
+#define SYNC_BEACON_CYCLES (SYNC_BEACON_MS * SYNC_CYCLES_PER_MS / 8U * 7U)
+// From the start bit of the first byte to the middle of the stop bit of the
+// last, where RXNE sets and the receiving ISR stamps the beacon
+#define SYNC_WIRE_CYCLES ((SYNC_BEACON_LENGTH * 20U - 1U) * TIMEBASE_HZ / (2U * BT_BAUDRATE))
+// A silence of three byte times starts the next beacon over
+#define SYNC_GAP_CYCLES (3U * 10U * TIMEBASE_HZ / BT_BAUDRATE)
+#define SYNC_ERROR_MAX (8 * (int32_t)SYNC_CYCLES_PER_MS) // Fed to the loop at most
+#define SYNC_AHEAD_MAX (255) // Frames a position is worked out forward at most
+
+static volatile sync_role_t role = SYNC_OFF;
+
+// Set by the frame ticks, in the TIM14 ISR
+static volatile uint32_t frame_time;
+static volatile uint32_t frame_ticks;
+
+// Master
+static volatile bool beacon_due = false;
+static volatile uint32_t beacon_time;
+static volatile uint16_t beacon_count;
+static uint32_t last_sent;
+static uint8_t seq;
+static uint32_t sent;
+
+// Follower, collecting in the USART3 ISR
+static uint8_t rx_frame[SYNC_BEACON_LENGTH];
+static uint8_t rx_length;
+static uint32_t rx_last;
+static uint8_t rx_beacon[SYNC_BEACON_LENGTH];
+static volatile uint32_t rx_time;
+static volatile bool rx_pending = false;
+
+// Follower, steering
+static bool have_last;
+static uint32_t last_master;
+static int32_t integral;
+static int32_t trim;
+static int32_t skew;
+static int32_t skew_worst;
+static bool locked;
+static uint32_t beacons;
+static uint32_t rejected;
+static uint32_t refused; // Beacons with a pattern this board lacks
+static bool missing;     // The last of them so
+static uint32_t jumps;
+static uint32_t steps;
+
+static int32_t sync_div_round(int32_t a, int32_t b)
+{
+    return (a >= 0) ? (a + b / 2) / b : -((-a + b / 2) / b);
+}
+
+static int32_t sync_clamp(int32_t value, int32_t limit)
+{
+    return (value > limit) ? limit : (value < -limit) ? -limit : value;
+}
+
+// Called on every frame tick with the cycle it fired at and the position
+// of the frame it makes due
+void sync_frame(uint32_t time, uint16_t count)
+{
+    frame_time = time;
+    frame_ticks++;
+
+    if(role == SYNC_MASTER && !beacon_due && time - last_sent >= SYNC_BEACON_CYCLES){
+	beacon_time = time;
+	beacon_count = count;
+	beacon_due = true;
+	sched_post(SCHED_TASK_HOUSEKEEPING);
+    }
+}
+
+// Goes out only onto an idle line, so that the age is all the follower
+// has to account for besides the fixed time on the wire. One that cannot
+// go within the 16 bit age is dropped for the next tick.
+static void sync_send(void)
+{
+    transport_t* link = transport_get(TRANSPORT_BT);
+
+    if(!transport_idle(link)){
+	return;
+    }
+
+    led_settings_t settings;
+    led_get(&settings);
+
+    uint8_t beacon[SYNC_BEACON_LENGTH];
+    beacon[0] = SYNC_MAGIC;
+    beacon[1] = settings.pattern | (settings.active << 7);
+    beacon[2] = settings.speed;
+    beacon[3] = beacon_count & 0xFF;
+    beacon[4] = beacon_count >> 8;
+    beacon[7] = seq;
+
+    uint32_t age = timebase_to_us(timebase_now() - beacon_time);
+    beacon_due = false;
+    if(age > 0xFFFF){
+	return;
+    }
+    beacon[5] = age & 0xFF;
+    beacon[6] = age >> 8;
+
+    uint16_t crc = crc16(beacon, SYNC_BEACON_LENGTH - 2, CRC16_INIT);
+    beacon[8] = crc & 0xFF;
+    beacon[9] = crc >> 8;
+
+    transport_write(link, beacon, SYNC_BEACON_LENGTH);
+    last_sent = beacon_time;
+    seq++;
+    sent++;
+}
+
+// Receiver for the USART3 ISR while following. Hunts for the magic byte
+// and hands a whole beacon to housekeeping with the time its last byte
+// came in; one arriving while the last is still pending is dropped.
+static void sync_receive(uint8_t byte, uint32_t time)
+{
+    if(time - rx_last > SYNC_GAP_CYCLES){
+	rx_length = 0;
+    }
+    rx_last = time;
+
+    if(!rx_length && byte != SYNC_MAGIC){
+	return;
+    }
+    rx_frame[rx_length++] = byte;
+    if(rx_length < SYNC_BEACON_LENGTH){
+	return;
+    }
+    rx_length = 0;
+
+    if(!rx_pending){
+	for(uint8_t i = 0; i < SYNC_BEACON_LENGTH; i++){
+	    rx_beacon[i] = rx_frame[i];
+	}
+	rx_time = time;
+	rx_pending = true;
+	sched_post(SCHED_TASK_HOUSEKEEPING);
+    }
+}
+
+static void sync_unlock(void)
+{
+    locked = false;
+    have_last = false;
+    skew_worst = 0;
+}
+
+// Takes the master's settings and position over where they differ, then
+// steers the phase of the frame ticks: whole milliseconds by moving the
+// next tick, the rest with the trim. The integral sees the whole error, so
+// that it learns the rate even while steps take out most of it.
+static void sync_follow(const uint8_t* beacon, uint32_t received)
+{
+    if(crc16(beacon, SYNC_BEACON_LENGTH - 2, CRC16_INIT) != (beacon[8] | (beacon[9] << 8))){
+	rejected++;
+	return;
+    }
+    beacons++;
+
+    led_settings_t settings;
+    led_get(&settings);
+
+    led_settings_t master = {
+	.pattern = beacon[1] & 0x7F,
+	.speed = beacon[2],
+	.brightness = settings.brightness,
+	.active = beacon[1] >> 7,
+    };
+
+    // Such as the user pattern with no frames recorded here. led_apply
+    // would drop it and every beacon after would take another jump.
+    missing = !led_pattern_available(master.pattern);
+    if(missing){
+	refused++;
+	sync_unlock();
+	return;
+    }
+    if(master.pattern != settings.pattern || master.speed != settings.speed || master.active != settings.active){
+	led_apply(&master, LED_SET_PATTERN | LED_SET_SPEED | LED_SET_ACTIVE);
+	sync_unlock();
+	jumps++;
+	return;
+    }
+    if(!settings.active){
+	return;
+    }
+
+    // When the master's tick was, on this clock
+    uint32_t age = beacon[5] | (beacon[6] << 8);
+    uint32_t tick_master = received - age * TIMEBASE_CYCLES_PER_US - SYNC_WIRE_CYCLES;
+    int32_t period = led_frame_ms() * SYNC_CYCLES_PER_MS;
+
+    pattern_cursor_t cursor;
+    uint32_t primask = cpu_irq_save();
+    uint32_t tick = frame_time;
+    uint32_t ticks = frame_ticks;
+    bool due = led_sync_cursor(&cursor);
+    cpu_irq_restore(primask);
+
+    // The last tick here is some whole frames on from the master's, give or
+    // take the error, positive when running late
+    int32_t offset = (int32_t)(tick - tick_master);
+    int32_t frames = sync_div_round(offset, period);
+    int32_t error = offset - frames * period;
+    bool moved = false;
+
+    // The frame the last tick made due, unless already rendered
+    int32_t ahead = frames + (due ? 0 : 1);
+    if(ahead >= 0 && ahead <= SYNC_AHEAD_MAX){
+	uint16_t count = beacon[3] | (beacon[4] << 8);
+	pattern_cursor_t target;
+
+	led_sync_seek(&target, count, ahead);
+
+	primask = cpu_irq_save();
+	if(frame_ticks == ticks && led_sync_cursor(&cursor) == due && cursor.count != target.count){
+	    led_sync_set(&target);
+	    moved = true;
+	}
+	cpu_irq_restore(primask);
+	if(moved){
+	    jumps++;
+	}
+    }
+
+    skew = error / (int32_t)TIMEBASE_CYCLES_PER_US;
+
+    int32_t ms = sync_div_round(error, SYNC_CYCLES_PER_MS);
+    int32_t remainder = error - ms * (int32_t)SYNC_CYCLES_PER_MS;
+    if(ms){
+	led_sync_shift(-ms);
+	moved = true;
+	steps++;
+    }
+
+    // Trim counts that take an error out over one interval, per cycle of it:
+    // 65536 * 1000 counts per ms over 16000 cycles per ms
+    if(have_last){
+	int32_t interval = (tick_master - last_master) / SYNC_CYCLES_PER_MS;
+
+	if(interval > 0){
+	    int32_t correction = sync_clamp(error, SYNC_ERROR_MAX) * 4096 / interval;
+	    int32_t proportional = remainder * 4096 / interval;
+
+	    integral = sync_clamp(integral - correction / 4, SYNC_TRIM_MAX);
+	    trim = sync_clamp(integral - proportional / 2, SYNC_TRIM_MAX);
+	    led_sync_trim(trim);
+	}
+    }
+    have_last = true;
+    last_master = tick_master;
+
+    int32_t magnitude = (skew < 0) ? -skew : skew;
+    if(moved || magnitude >= SYNC_LOCK_US){
+	locked = false;
+	skew_worst = 0;
+    }else{
+	locked = true;
+	if(magnitude > skew_worst){
+	    skew_worst = magnitude;
+	}
+    }
+}
+
+// From housekeeping
+void sync_process(void)
+{
+    if(role == SYNC_MASTER && beacon_due){
+	sync_send();
+    }else if(role == SYNC_FOLLOWER && rx_pending){
+	uint8_t beacon[SYNC_BEACON_LENGTH];
+
+	uint32_t primask = cpu_irq_save();
+	for(uint8_t i = 0; i < SYNC_BEACON_LENGTH; i++){
+	    beacon[i] = rx_beacon[i];
+	}
+	uint32_t received = rx_time;
+	rx_pending = false;
+	cpu_irq_restore(primask);
+
+	sync_follow(beacon, received);
+    }
+}
+
+static void sync_start(sync_role_t new_role)
+{
+    uint32_t primask = cpu_irq_save();
+    role = new_role;
+    beacon_due = false;
+    rx_pending = false;
+    rx_length = 0;
+    cpu_irq_restore(primask);
+
+    if(new_role != SYNC_OFF){
+	bt_claim(BT_USER_SYNC);
+    }
+    transport_set_receiver(TRANSPORT_BT, (new_role == SYNC_FOLLOWER) ? sync_receive : 0);
+    if(new_role == SYNC_OFF){
+	bt_release(BT_USER_SYNC);
+    }
+    led_sync_trim(0);
+
+    sync_unlock();
+    integral = 0;
+    trim = 0;
+    skew = 0;
+    sent = 0;
+    beacons = 0;
+    rejected = 0;
+    refused = 0;
+    missing = false;
+    jumps = 0;
+    steps = 0;
+}
+
+static void sync_print_signed(int32_t value)
+{
+    if(value < 0){
+	cli_print("-");
+	value = -value;
+    }
+    cli_print_number(value);
+}
+
+// "sync master" sends beacons, "sync follow" steers by them and "sync off"
+// stops both; without arguments it prints how it is going
+void sync_command(const char* args)
+{
+    if(utils_strings_match(args, "master")){
+	sync_start(SYNC_MASTER);
+	cli_print("Sending beacons on USART3.");
+    }else if(utils_strings_match(args, "follow")){
+	sync_start(SYNC_FOLLOWER);
+	cli_print("Following beacons on USART3.");
+    }else if(utils_strings_match(args, "off")){
+	sync_start(SYNC_OFF);
+	cli_print("Sync off.");
+    }else if(role == SYNC_MASTER){
+	cli_print("Master, ");
+	cli_print_number(sent);
+	cli_print(" beacons sent");
+    }else if(role == SYNC_FOLLOWER){
+	cli_print(missing ? "Following, pattern missing here, "
+	    : locked ? "Following, locked, " : "Following, searching, ");
+	cli_print_number(beacons);
+	cli_print(" beacons, ");
+	cli_print_number(rejected);
+	cli_print(" rejected, ");
+	cli_print_number(refused);
+	cli_print(" refused, ");
+	cli_print_number(jumps);
+	cli_print(" jumps, ");
+	cli_print_number(steps);
+	cli_print(" steps");
+	cli_newline();
+	cli_print("Skew ");
+	sync_print_signed(skew);
+	cli_print(" us, worst ");
+	cli_print_number(skew_worst);
+	cli_print(" us locked, trim ");
+	sync_print_signed(trim * 1000 / 65536);
+	cli_print(" ppm");
+    }else{
+	cli_print("Off");
+    }
+}
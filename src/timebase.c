@@ -0,0 +1,66 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "timebase.h"
+
+// Library headers
+#include "rcc.h"
+#include "tim.h"
+
+static uint32_t base = 0;
+static uint8_t shift = 0;
+
+void timebase_init(void)
+{
+    if(!(RCC->APBENR1 & RCC_APB1_TIM2)){
+	RCC->APBENR1 |= RCC_APB1_TIM2;
+    }
+
+    // Free-running 32-bit counter at the core clock
+    base = 0;
+    shift = 0;
+    TIM2->CR1 = 0;
+    TIM2->PSC = 0;
+    TIM2->ARR = 0xFFFFFFFF;
+    TIM2->EGR |= TIM_EGR_UG;
+    TIM2->CR1 |= TIM_CR1_CEN;
+}
+
+void timebase_deinit(void)
+{
+    TIM2->CR1 = 0;
+    TIM2->PSC = 0;
+    TIM2->ARR = 0xFFFFFFFF;
+    TIM2->CNT = 0;
+}
+
+// Keeps the tick at 16 MHz whatever the core runs at, dividing faster
+// clocks with the prescaler and scaling slower ones up with a shift. The
+// count so far is folded into base so that time never jumps backwards.
+void timebase_set_clock(uint32_t hz)
+{
+    base = timebase_now();
+
+    shift = 0;
+    uint32_t psc = 0;
+    if(hz >= TIMEBASE_HZ){
+	psc = hz / TIMEBASE_HZ - 1;
+    }else{
+	while((hz << shift) < TIMEBASE_HZ){
+	    shift++;
+	}
+    }
+
+    TIM2->PSC = psc;
+    TIM2->EGR |= TIM_EGR_UG; // Loads the prescaler and clears the count
+}
+
+uint32_t timebase_now(void)
+{
+    return base + (TIM2->CNT << shift);
+}
+
+uint32_t timebase_to_us(uint32_t cycles)
+{
+    return cycles / TIMEBASE_CYCLES_PER_US;
+}
@@ -0,0 +1,56 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "trace.h"
+#include "cli.h"
+
+// Library headers
+#include "utils.h"
+
+trace_entry_t trace_buffer[TRACE_SIZE];
+volatile uint32_t trace_head = 0;
+volatile bool trace_enabled = true;
+
+// Streams the entries oldest first in the memdumpraw format, with recording
+// paused so that the export does not trace itself
+static void trace_dump(void)
+{
+    bool enabled = trace_enabled;
+    trace_enabled = false;
+
+    uint32_t count = (trace_head < TRACE_SIZE) ? trace_head : TRACE_SIZE;
+    uint32_t first = trace_head - count;
+
+    uint32_t crc = cli_raw_begin(count * sizeof(trace_entry_t));
+    for(uint32_t i = 0; i < count; i++){
+	crc = cli_raw_write((const uint8_t*)&trace_buffer[(first + i) & (TRACE_SIZE - 1)],
+			    sizeof(trace_entry_t), crc);
+    }
+    cli_raw_end(crc);
+
+    trace_enabled = enabled;
+}
+
+void trace_command(const char* args)
+{
+    if(utils_strings_match(args, "dump")){
+	trace_dump();
+    }else if(utils_strings_match(args, "clear")){
+	trace_head = 0;
+	cli_print("Trace cleared.");
+    }else if(utils_strings_match(args, "on")){
+	trace_enabled = true;
+	cli_print("Tracing.");
+    }else if(utils_strings_match(args, "off")){
+	trace_enabled = false;
+	cli_print("Tracing stopped.");
+    }else{
+	cli_print(trace_enabled ? "Tracing, " : "Stopped, ");
+	cli_print_number((trace_head < TRACE_SIZE) ? trace_head : TRACE_SIZE);
+	cli_print(" of ");
+	cli_print_number(TRACE_SIZE);
+	cli_print(" entries used, ");
+	cli_print_number(trace_head);
+	cli_print(" recorded in total");
+    }
+}
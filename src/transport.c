@@ -0,0 +1,207 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "transport.h"
+#include "cpu.h"
+#include "perf.h"
+#include "regs.h"
+#include "replay.h"
+#include "sched.h"
+#include "timebase.h"
+#include "trace.h"
+
+static transport_t transports[TRANSPORT_COUNT];
+
+transport_t* transport_get(transport_id_t id)
+{
+    return &transports[id];
+}
+
+// The USART is expected to be configured, only interrupts are set up here
+void transport_open(transport_id_t id, USART_t* usart, bool wakeup)
+{
+    transport_t* transport = &transports[id];
+
+    transport->usart = usart;
+    transport->wakeup = wakeup;
+    ring_init(&transport->rx, transport->rx_data, TRANSPORT_RX_SIZE);
+    ring_init(&transport->tx, transport->tx_data, TRANSPORT_TX_SIZE);
+    transport->open = true;
+
+    PERIPH(usart)->CR1 |= USART_CR1_RXNEIE;
+}
+
+void transport_close(transport_id_t id)
+{
+    transport_t* transport = &transports[id];
+
+    if(!transport->open){
+	return;
+    }
+    transport_flush(transport);
+    PERIPH(transport->usart)->CR1 &= ~(USART_CR1_RXNEIE | USART_CR1_TXEIE);
+    transport->open = false;
+}
+
+// Queues as much as fits and returns how much that was, never waiting
+uint32_t transport_write(transport_t* transport, const uint8_t* bytes, uint32_t length)
+{
+    // A closed link swallows everything, so writers never wait on it
+    if(!transport->open){
+	return length;
+    }
+
+    uint32_t written = ring_write(&transport->tx, bytes, length);
+
+    if(written){
+	uint32_t primask = cpu_irq_save();
+	PERIPH(transport->usart)->CR1 |= USART_CR1_TXEIE;
+	cpu_irq_restore(primask);
+    }
+    return written;
+}
+
+// Moves one queued byte into an empty TDR, for waiting with interrupts masked
+static void transport_pump(transport_t* transport)
+{
+    uint32_t primask = cpu_irq_save();
+    uint8_t byte;
+
+    if((PERIPH(transport->usart)->ISR & USART_ISR_TXE) && ring_get(&transport->tx, &byte)){
+	PERIPH(transport->usart)->TDR = byte;
+    }
+    cpu_irq_restore(primask);
+}
+
+// Thread mode only, waits for room whenever the queue is full
+void transport_write_all(transport_t* transport, const uint8_t* bytes, uint32_t length)
+{
+    while(length){
+	uint32_t written = transport_write(transport, bytes, length);
+
+	if(!written){
+	    transport_pump(transport);
+	}
+	bytes += written;
+	length -= written;
+    }
+}
+
+bool transport_read(transport_t* transport, uint8_t* byte)
+{
+    return ring_get(&transport->rx, byte);
+}
+
+// Everything received so far that fits, in at most two copies
+uint32_t transport_read_bulk(transport_t* transport, uint8_t* bytes, uint32_t length)
+{
+    return ring_read(&transport->rx, bytes, length);
+}
+
+bool transport_pending(transport_t* transport)
+{
+    return transport->open && !ring_empty(&transport->rx);
+}
+
+// Thread mode only, returns once the last byte has left the shift register
+void transport_flush(transport_t* transport)
+{
+    if(!transport->open){
+	return;
+    }
+
+    while(!ring_empty(&transport->tx)){
+	transport_pump(transport);
+    }
+    while(!(PERIPH(transport->usart)->ISR & USART_ISR_TC));
+}
+
+// Nothing queued or on the line, so that a write starts going out at once
+bool transport_idle(transport_t* transport)
+{
+    return transport->open && ring_empty(&transport->tx)
+	&& (PERIPH(transport->usart)->ISR & USART_ISR_TC);
+}
+
+// Hands the link's input to receiver, away from the REPL, or back with 0
+void transport_set_receiver(transport_id_t id, transport_receiver_t receiver)
+{
+    uint32_t primask = cpu_irq_save();
+    transports[id].receiver = receiver;
+    cpu_irq_restore(primask);
+}
+
+// Anything in flight that Stop mode would cut off or stall
+bool transport_busy(void)
+{
+    for(uint8_t i = 0; i < TRANSPORT_COUNT; i++){
+	transport_t* transport = &transports[i];
+
+	if(!transport->open){
+	    continue;
+	}
+	if(!ring_empty(&transport->tx)
+	    || !(PERIPH(transport->usart)->ISR & USART_ISR_TC)  // Transmitting
+	    || (PERIPH(transport->usart)->ISR & USART_ISR_BUSY)){ // Receiving
+	    return true;
+	}
+    }
+    return false;
+}
+
+// Stop mode halts links that cannot wake the core, which would lose input
+bool transport_stop_allowed(void)
+{
+    for(uint8_t i = 0; i < TRANSPORT_COUNT; i++){
+	if(transports[i].open && !transports[i].wakeup){
+	    return false;
+	}
+    }
+    return true;
+}
+
+static void transport_isr(transport_t* transport)
+{
+    USART_t* usart = transport->usart;
+
+    if(PERIPH(usart)->ISR & USART_ISR_RXNE){
+	uint8_t byte = PERIPH(usart)->RDR;
+	trace_record(TRACE_UART_RX, byte);
+	replay_record((replay_source_t)(transport - transports), byte);
+
+	// If the overrun flag is set, for now just clear it
+	if(PERIPH(usart)->ISR & USART_ISR_ORE){
+	    PERIPH(usart)->ICR |= USART_ISR_ORE;
+	    perf_count(PERF_USART_OVERRUN);
+	}else if(transport->receiver){
+	    transport->receiver(byte, timebase_now());
+	}else if(!ring_put(&transport->rx, byte)){
+	    perf_count(PERF_RX_OVERFLOW);
+	}
+	sched_post(SCHED_TASK_CLI);
+    }
+
+    if((PERIPH(usart)->CR1 & USART_CR1_TXEIE) && (PERIPH(usart)->ISR & USART_ISR_TXE)){
+	uint8_t byte;
+
+	if(ring_get(&transport->tx, &byte)){
+	    PERIPH(usart)->TDR = byte;
+	}else{
+	    PERIPH(usart)->CR1 &= ~USART_CR1_TXEIE;
+	}
+    }
+}
+
+void USART2_LPUART2_IRQHandler(void)
+{
+    uint32_t start = perf_isr_enter(PERF_ISR_USART2);
+    transport_isr(&transports[TRANSPORT_CONSOLE]);
+    perf_isr_exit(PERF_ISR_USART2, start);
+}
+
+void USART3_6_LPUART1_IRQHandler(void)
+{
+    uint32_t start = perf_isr_enter(PERF_ISR_USART3);
+    transport_isr(&transports[TRANSPORT_BT]);
+    perf_isr_exit(PERF_ISR_USART3, start);
+}
@@ -0,0 +1,398 @@
+// © 2024 Oskar Arnudd
+
+// Firmware headers
+#include "update.h"
+#include "cli.h"
+#include "cpu.h"
+#include "crc.h"
+#include "flash.h"
+#include "led.h"
+#include "memorymap.h"
+#include "regs.h"
+#include "store.h"
+#include "timebase.h"
+#include "transport.h"
+
+// Library headers
+#include "tim.h"
+#include "utils.h"
+
+// The way into the copy on the resume page, for page 0 of the application
+// while it runs: the stack at the top of SRAM and the routine after the
+// image size, in Thumb state
+#define UPDATE_STUB_STACK (MEMORYMAP_SRAM_END)
+#define UPDATE_STUB_ENTRY ((UPDATE_RESUME_BASE + 8) | 1)
+
+typedef struct{
+    uint32_t words[UPDATE_CHUNK / 4];
+    uint32_t offset;
+    uint8_t length;
+} update_chunk_t;
+
+static bool receiving = false;
+static bool installed = false;       // This boot finished a switch
+static bool reboot_pending = false;
+static update_status_t error = UPDATE_OK;
+
+static uint32_t image_size = 0;
+static uint32_t image_crc = 0;
+static uint32_t received = 0;        // Next offset expected
+
+// Chunks acknowledged but not yet programmed, filled in turn
+static update_chunk_t chunks[UPDATE_BUFFERS];
+static uint8_t chunk_next = 0;       // Buffer the next chunk goes into
+static uint8_t chunk_count = 0;      // Buffers holding a chunk
+static uint32_t erased = 0;          // Slot bytes erased, from its base
+
+static uint32_t begin_time = 0;
+static uint32_t erase_cycles = 0;
+static uint32_t program_cycles = 0;
+static uint32_t transfer_cycles = 0;
+static uint32_t resyncs = 0;
+
+static CPU_RAMFUNC void update_copy(void);
+
+static uint32_t update_crc(uint32_t base, uint32_t size)
+{
+    return ~crc32((const uint8_t*)base, size, CRC32_INIT);
+}
+
+static bool update_staged(uint32_t* size, uint32_t* crc)
+{
+    return store_get(STORE_KEY_UPDATE, 0, size) && *size
+	&& store_get(STORE_KEY_UPDATE, 1, crc);
+}
+
+// Flash steps for update_copy, which cannot make calls
+static inline __attribute__((always_inline)) void update_copy_erase(uint32_t address)
+{
+    FLASH_CR = (FLASH_CR & ~FLASH_CR_PNB(0x7F)) | FLASH_CR_PER | FLASH_CR_PNB(FLASH_PAGE(address));
+    FLASH_CR |= FLASH_CR_STRT;
+    while(FLASH_SR & (FLASH_SR_BSY1 | FLASH_SR_CFGBSY));
+    FLASH_CR &= ~(FLASH_CR_PER | FLASH_CR_PNB(0x7F));
+}
+
+static inline __attribute__((always_inline)) void update_copy_program(volatile uint32_t* to, uint32_t low, uint32_t high)
+{
+    FLASH_CR |= FLASH_CR_PG;
+    to[0] = low;
+    to[1] = high;
+    while(FLASH_SR & (FLASH_SR_BSY1 | FLASH_SR_CFGBSY));
+    FLASH_CR &= ~FLASH_CR_PG;
+}
+
+// Overwrites the application with the staged image of the size on the
+// resume page and resets. Runs from RAM with interrupts off, as every flash
+// fetch would hit a page being erased, and after a reset in the middle of
+// it from the resume page, so it cannot call anything and must not depend
+// on where it runs: no helpers and no loops the compiler could turn into a
+// memcpy call. Starting over is always safe, the slot is only read.
+static void update_copy(void)
+{
+    volatile const uint32_t* from = (volatile const uint32_t*)UPDATE_SLOT_BASE;
+    volatile uint32_t* to = (volatile uint32_t*)UPDATE_APP_BASE;
+    uint32_t size = *(volatile const uint32_t*)UPDATE_RESUME_BASE;
+
+    while(FLASH_SR & FLASH_SR_BSY1);
+    if(FLASH_CR & FLASH_CR_LOCK){
+	FLASH_KEYR = FLASH_KEY1;
+	FLASH_KEYR = FLASH_KEY2;
+    }
+    FLASH_SR = FLASH_SR_ERRORS | FLASH_SR_EOP;
+
+    // From here on a reset comes back into this copy on the resume page
+    update_copy_erase(UPDATE_APP_BASE);
+    update_copy_program(to, UPDATE_STUB_STACK, UPDATE_STUB_ENTRY);
+
+    for(uint32_t offset = FLASH_PAGE_SIZE; offset < size; offset += 8){
+	if(offset % FLASH_PAGE_SIZE == 0){
+	    update_copy_erase(UPDATE_APP_BASE + offset);
+	}
+	update_copy_program(&to[offset / 4], from[offset / 4], from[offset / 4 + 1]);
+    }
+
+    update_copy_erase(UPDATE_APP_BASE);
+    for(uint32_t offset = 8; offset < size && offset < FLASH_PAGE_SIZE; offset += 8){
+	update_copy_program(&to[offset / 4], from[offset / 4], from[offset / 4 + 1]);
+    }
+    update_copy_program(to, from[0], from[1]);
+
+    FLASH_CR |= FLASH_CR_LOCK;
+    SCB_AIRCR = SCB_AIRCR_VECTKEY | SCB_AIRCR_SYSRESETREQ;
+    while(1);
+}
+
+// Puts the image size and the copy routine, as it sits in RAM, on the
+// resume page. UPDATE_STUB_SIZE leaves room to spare past its end.
+static bool update_stub(uint32_t size)
+{
+    const uint32_t* code = (const uint32_t*)((uintptr_t)update_copy & ~(uintptr_t)1);
+    bool ok = flash_erase(FLASH_PAGE(UPDATE_RESUME_BASE))
+	&& flash_program(UPDATE_RESUME_BASE, size, ~size);
+
+    for(uint32_t i = 0; ok && i < UPDATE_STUB_SIZE / 4; i += 2){
+	ok = flash_program(UPDATE_RESUME_BASE + 8 + i * 4, code[i], code[i + 1]);
+    }
+    return ok;
+}
+
+// Finishes a switch staged before the reset. An application that already
+// matches the staged image means the copy is done, so this is also where
+// the record of the staged image goes away.
+void update_init(void)
+{
+    uint32_t size;
+    uint32_t crc;
+
+    if(!update_staged(&size, &crc)){
+	return;
+    }
+
+    if(update_crc(UPDATE_APP_BASE, size) == crc){
+	installed = true;
+    }else if(update_crc(UPDATE_SLOT_BASE, size) == crc && update_stub(size)){
+	cpu_irq_disable();
+	update_copy();
+    }
+    store_set(STORE_KEY_UPDATE, 0, 0);
+}
+
+bool update_active(void)
+{
+    return receiving;
+}
+
+update_status_t update_begin(uint32_t size, uint32_t crc)
+{
+    if(size == 0 || size > UPDATE_SLOT_SIZE){
+	return UPDATE_ERROR_SIZE;
+    }
+
+    // Whatever was staged is about to be erased
+    store_set(STORE_KEY_UPDATE, 0, 0);
+
+    receiving = true;
+    error = UPDATE_OK;
+    image_size = size;
+    image_crc = crc;
+    received = 0;
+    chunk_next = 0;
+    chunk_count = 0;
+    erased = 0;
+    erase_cycles = 0;
+    program_cycles = 0;
+    transfer_cycles = 0;
+    resyncs = 0;
+    begin_time = timebase_now();
+
+    return UPDATE_OK;
+}
+
+// An erase stalls the core for up to 22 ms, so it waits a little for no IR
+// frame being timed and no LED frame or edge coming up meanwhile
+static void update_erase(uint32_t address)
+{
+    uint32_t start = timebase_now();
+
+    while(((TIM16->CR1 & TIM_CR1_CEN) || led_next_frame_ms() < UPDATE_ERASE_MS + 2)
+	&& timebase_now() - start < UPDATE_QUIET_MS * 1000U * TIMEBASE_CYCLES_PER_US){
+	cpu_wait_for_interrupt();
+    }
+
+    start = timebase_now();
+    if(!flash_erase(FLASH_PAGE(address))){
+	error = UPDATE_ERROR_FLASH;
+    }
+    erase_cycles += timebase_now() - start;
+}
+
+// Writes the buffered chunks, oldest first, erasing slot pages as they are
+// reached
+static void update_program(void)
+{
+    while(chunk_count && !error){
+	update_chunk_t* chunk = &chunks[(chunk_next + UPDATE_BUFFERS - chunk_count) % UPDATE_BUFFERS];
+	uint32_t end = chunk->offset + chunk->length;
+
+	while(erased < end && !error){
+	    update_erase(UPDATE_SLOT_BASE + erased);
+	    erased += FLASH_PAGE_SIZE;
+	}
+
+	uint32_t start = timebase_now();
+	for(uint8_t i = 0; i < chunk->length && !error; i += 8){
+	    if(!flash_program(UPDATE_SLOT_BASE + chunk->offset + i, chunk->words[i / 4], chunk->words[i / 4 + 1])){
+		error = UPDATE_ERROR_FLASH;
+	    }
+	}
+	program_cycles += timebase_now() - start;
+	chunk_count--;
+    }
+    chunk_count = 0;
+}
+
+// Takes a chunk into the next buffer, update_program writes it to flash
+update_status_t update_data(uint32_t offset, const uint8_t* data, uint8_t length)
+{
+    if(!receiving){
+	return UPDATE_ERROR_STATE;
+    }
+    if(error){
+	return error;
+    }
+
+    // A retransmission of a chunk that was already taken
+    if(offset < received && offset + length <= received){
+	return UPDATE_OK;
+    }
+    if(offset != received){
+	resyncs++;
+	return UPDATE_ERROR_OFFSET;
+    }
+    if(length == 0 || length > UPDATE_CHUNK || offset + length > image_size
+	|| (length % 8 && offset + length != image_size)){
+	return UPDATE_ERROR_LENGTH;
+    }
+
+    // The tail of the last chunk is padded as if erased
+    update_chunk_t* chunk = &chunks[chunk_next];
+    uint8_t* bytes = (uint8_t*)chunk->words;
+    for(uint8_t i = 0; i < UPDATE_CHUNK; i++){
+	bytes[i] = (i < length) ? data[i] : 0xFF;
+    }
+    chunk->offset = offset;
+    chunk->length = length;
+    chunk_next = (chunk_next + 1) % UPDATE_BUFFERS;
+    chunk_count++;
+    received += length;
+
+    // With both buffers full, or the image complete, the host sends nothing
+    // more until this chunk is acked, so the flash can stall the core now
+    if(chunk_count == UPDATE_BUFFERS || received == image_size){
+	update_program();
+    }
+    return error;
+}
+
+uint32_t update_expected(void)
+{
+    return received;
+}
+
+update_status_t update_end(void)
+{
+    if(!receiving){
+	return UPDATE_ERROR_STATE;
+    }
+    update_program();
+    receiving = false;
+    transfer_cycles = timebase_now() - begin_time;
+
+    if(error){
+	return error;
+    }
+    if(received != image_size){
+	return UPDATE_ERROR_SIZE;
+    }
+    if(update_crc(UPDATE_SLOT_BASE, image_size) != image_crc){
+	return UPDATE_ERROR_CRC;
+    }
+
+    // The image has to be linked to run from the application base
+    uint32_t stack = M32(UPDATE_SLOT_BASE);
+    uint32_t reset = M32(UPDATE_SLOT_BASE + 4);
+    if(stack < MEMORYMAP_SRAM_START || stack > MEMORYMAP_SRAM_END
+	|| reset < UPDATE_APP_BASE || reset >= UPDATE_APP_BASE + image_size){
+	return UPDATE_ERROR_IMAGE;
+    }
+
+    store_set(STORE_KEY_UPDATE, 0, image_size);
+    store_set(STORE_KEY_UPDATE, 1, image_crc);
+    store_sync();
+
+    return UPDATE_OK;
+}
+
+// Called from housekeeping, resets once the reply to "update reboot" is out
+void update_process(void)
+{
+    if(!reboot_pending || transport_busy()){
+	return;
+    }
+
+    store_sync();
+    cpu_irq_disable();
+    SCB_AIRCR = SCB_AIRCR_VECTKEY | SCB_AIRCR_SYSRESETREQ;
+    while(1);
+}
+
+static void update_print_ms(const char* label, uint32_t cycles)
+{
+    uint32_t us = timebase_to_us(cycles);
+
+    cli_print_padded(label, 24);
+    cli_print_number(us / 1000);
+    cli_print(".");
+    cli_print_number(us / 100 % 10);
+    cli_print(" ms");
+    cli_newline();
+}
+
+// "update" prints the slot and the last transfer, "update reboot" resets
+// into a staged image and "update abort" drops a transfer or staged image
+void update_command(const char* args)
+{
+    uint32_t size;
+    uint32_t crc;
+
+    if(utils_strings_match(args, "reboot")){
+	cli_print(update_staged(&size, &crc) ? "Rebooting into the new image..." : "Rebooting...");
+	reboot_pending = true;
+	return;
+    }
+    if(utils_strings_match(args, "abort")){
+	receiving = false;
+	chunk_count = 0;
+	store_set(STORE_KEY_UPDATE, 0, 0);
+	cli_print("Update aborted.");
+	return;
+    }
+
+    cli_print_padded("Slot", 24);
+    if(receiving){
+	cli_print("receiving ");
+	cli_print_number(received);
+	cli_print(" / ");
+	cli_print_number(image_size);
+	cli_print(" bytes");
+    }else if(update_staged(&size, &crc)){
+	cli_print_number(size);
+	cli_print(" bytes, CRC32 0x");
+	cli_print_hex(crc, 8);
+	cli_print(", switches on reboot");
+    }else{
+	cli_print(installed ? "empty, installed at boot" : "empty");
+    }
+    cli_newline();
+
+    if(!transfer_cycles){
+	cli_print_padded("Last transfer", 24);
+	cli_print("none");
+	return;
+    }
+
+    // The bootloader keeps the device offline for the whole transfer, here
+    // only the copy at reboot does, which repeats the erase and programming
+    update_print_ms("Last transfer", transfer_cycles);
+    update_print_ms("  erase", erase_cycles);
+    update_print_ms("  programming", program_cycles);
+    cli_print_padded("  throughput", 24);
+    cli_print_number(image_size * 1000 / (timebase_to_us(transfer_cycles) / 1000 + 1));
+    cli_print(" B/s");
+    cli_newline();
+    cli_print_padded("  resyncs", 24);
+    cli_print_number(resyncs);
+    cli_newline();
+    update_print_ms("Offline, in-app", erase_cycles + program_cycles);
+    update_print_ms("Offline, bootloader", transfer_cycles);
+}
@@ -0,0 +1,151 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Round-trip latency of the text REPL against compact opcodes (see
+# inc/compact.h) on the 9600 baud Bluetooth link. Works over the module or
+# a USB-UART wired straight to PB9/PB10 in its place.
+#
+#   bt_latency.py /dev/ttyUSB0 [rounds]
+#   bt_latency.py --sim [rounds]
+#
+# --sim runs the same rounds through the host simulator from "make host",
+# timed in simulated time from the start bit of the first byte sent.
+
+import ast
+import re
+import statistics
+import subprocess
+import sys
+import time
+
+COMPACT_ACK = 0x80
+COMPACT_NAK = 0x8F
+COMPACT_BEGIN = 0x88
+COMPACT_COMMIT = 0x89
+COMPACT_PATTERN = 0x90
+COMPACT_SPEED = 0xA0
+COMPACT_BRIGHTNESS = 0xB0
+COMPACT_POWER = 0xC0
+
+SIM_HOST = "build/host/blinky_host"
+SIM_BAUDRATE = 9600
+SIM_GAP_MS = 400
+
+
+def text_command(speed):
+    return b"speed %d\r" % speed
+
+
+def compact_batch(speed):
+    # Pattern, speed, brightness and power in one batch, answered by a delta
+    return bytes([COMPACT_BEGIN, COMPACT_PATTERN | 1, COMPACT_SPEED | speed,
+                  COMPACT_BRIGHTNESS | 8, COMPACT_POWER | 1, COMPACT_COMMIT])
+
+
+def text_round(port, speed):
+    # The line is echoed, answered and closed by the next prompt
+    start = time.perf_counter()
+    port.write(text_command(speed))
+    reply = port.read_until(b"> ")
+    elapsed = time.perf_counter() - start
+    if not reply.endswith(b"> "):
+        raise IOError("no prompt after text command")
+
+    # Status messages are rendered after the prompt, counted but not timed
+    time.sleep(0.1)
+    reply += port.read(port.in_waiting)
+    return elapsed, len(reply)
+
+
+def compact_round(port, speed):
+    batch = compact_batch(speed)
+    start = time.perf_counter()
+    port.write(batch)
+    reply = b""
+    while not reply or reply[-1] not in (COMPACT_ACK, COMPACT_NAK):
+        byte = port.read(1)
+        if not byte:
+            raise IOError("no ack after compact batch")
+        reply += byte
+    elapsed = time.perf_counter() - start
+    if reply[-1] == COMPACT_NAK:
+        raise IOError("compact batch refused")
+    return elapsed, len(reply)
+
+
+def report(name, samples):
+    times = [t * 1000 for t, _ in samples]
+    print("%-8s median %6.1f ms  max %6.1f ms  %4.1f bytes back" % (
+        name, statistics.median(times), max(times),
+        statistics.mean(n for _, n in samples)))
+
+
+# What the simulator sent on the link, one (ms the byte was done, byte) per
+# byte, spreading the bytes of an entry at the line rate
+def sim_link(log):
+    line = re.compile(r'^\s*(\d+\.\d+) ms  bt\s+tx  (".*")$')
+    byte_ms = 10000.0 / SIM_BAUDRATE
+    out = []
+    for match in filter(None, map(line.match, log)):
+        data = ast.literal_eval(match.group(2)).encode("latin-1")
+        out += [(float(match.group(1)) + i * byte_ms, b) for i, b in enumerate(data)]
+    return out
+
+
+# Round trips end as on a board: text at the prompt, compact at the ack.
+# Bytes are counted up to the next round, status messages included.
+def sim(rounds):
+    byte_ms = 10000.0 / SIM_BAUDRATE
+    sends = [text_command(2 + i % 2) for i in range(rounds)]
+    sends += [compact_batch(2 + i % 2) for i in range(rounds)]
+    script = ["50 console bt on\\r"]
+    for i, data in enumerate(sends):
+        script.append("%d bt %s" % (200 + i * SIM_GAP_MS, "".join("\\x%02X" % b for b in data)))
+    script.append("%d end" % (200 + len(sends) * SIM_GAP_MS))
+
+    result = subprocess.run([SIM_HOST, "-"], input="\n".join(script) + "\n",
+                            capture_output=True, text=True, check=True)
+    sent = sim_link(result.stdout.splitlines())
+
+    samples = []
+    for i in range(len(sends)):
+        start = 200 + i * SIM_GAP_MS
+        reply = [(t, b) for t, b in sent if start < t <= start + SIM_GAP_MS]
+        done = None
+        for j, (t, b) in enumerate(reply):
+            if i < rounds and j and reply[j - 1][1] == ord(">") and b == ord(" "):
+                done = t
+                break
+            if i >= rounds and b in (COMPACT_ACK, COMPACT_NAK):
+                done = t
+                break
+        if done is None:
+            sys.exit("no reply to round %d" % i)
+        samples.append(((done - start + byte_ms) / 1000, len(reply)))
+
+    report("text", samples[:rounds])
+    report("compact", samples[rounds:])
+
+
+def main():
+    if len(sys.argv) >= 2 and sys.argv[1] == "--sim":
+        sim(int(sys.argv[2]) if len(sys.argv) == 3 else 20)
+        return
+    if len(sys.argv) not in (2, 3):
+        sys.exit("usage: bt_latency.py <port> [rounds], or bt_latency.py --sim [rounds]")
+    rounds = int(sys.argv[2]) if len(sys.argv) == 3 else 20
+
+    import serial  # Only needed with a board, not for --sim
+    port = serial.Serial(sys.argv[1], 9600, timeout=2)
+    port.reset_input_buffer()
+
+    # Alternating speeds so every round changes something
+    text = [text_round(port, 2 + i % 2) for i in range(rounds)]
+    compact = [compact_round(port, 2 + i % 2) for i in range(rounds)]
+
+    report("text", text)
+    report("compact", compact)
+
+
+if __name__ == "__main__":
+    main()
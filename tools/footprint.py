@@ -0,0 +1,349 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Reports where the firmware's flash and RAM go, per module and per symbol,
+# and the deepest the stack can get, from what the build leaves behind: the
+# linker map, the objects, and the -fstack-usage (.su) and
+# -fcallgraph-info=su (.ci) files next to them. Exits non-zero when a
+# budget is given and exceeded, so that make fails the build.
+#
+#   footprint.py --map blinky.map --flash-budget 55296 build/*.o
+#
+# The stack depth is main's deepest call chain, plus the deepest chain of
+# each interrupt handler that could be nested on top of it. The M0+ has
+# four priority levels and a handler never preempts its own level, so at
+# most four are stacked, each with its 32 byte exception frame. Calls
+# through pointers are taken to reach the deepest of the functions that
+# nothing calls directly, which is what the command and task tables hold.
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+
+PRIORITY_LEVELS = 4
+EXCEPTION_FRAME = 32  # r0-r3, r12, lr, pc, xPSR
+INDIRECT = "__indirect_call"
+
+NOT_LOADED = (".debug", ".comment", ".note", ".stab", ".ARM.attributes", ".gnu.attributes",
+              ".gnu_debug", ".discard")
+RAM_ONLY = (".bss", ".tbss", ".noinit", "COMMON", "._user_heap_stack", ".heap", ".stack")
+RAM_LOADED = (".data", ".tdata", ".got", ".init_array", ".fini_array")
+
+INPUT = re.compile(r"^ (\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+INPUT_WRAPPED = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s+(\S.*)$")
+OUTPUT = re.compile(r"^(\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)(?:\s+load address 0x([0-9a-f]+))?")
+OUTPUT_WRAPPED = re.compile(r"^\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)(?:\s+load address 0x([0-9a-f]+))?\s*$")
+REGION = re.compile(r"^(\S+)\s+0x([0-9a-f]+)\s+0x([0-9a-f]+)\s*(\S*)")
+CI_NODE = re.compile(r'^node: \{ title: "([^"]+)" label: "[^"]*\\n\d+ bytes')
+CI_EDGE = re.compile(r'^edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+
+
+def module_name(path):
+    path = path.strip()
+    match = re.match(r"(.*)\((.*)\)$", path)
+    if match:
+        return "%s(%s)" % (os.path.basename(match.group(1)), match.group(2))
+    return os.path.basename(path)
+
+
+def starts(name, prefixes):
+    return any(name == p or name.startswith(p + ".") or name.startswith(p + "_") for p in prefixes)
+
+
+class Placement:
+    """Decides what an output section costs, from the memory regions if the
+    linker script has them and from its name otherwise (host builds)."""
+
+    def __init__(self, regions):
+        self.flash = [r for r in regions if "x" in r[2] and "w" not in r[2]]
+        self.ram = [r for r in regions if "w" in r[2]]
+
+    @staticmethod
+    def inside(regions, address):
+        return any(origin <= address < origin + length for origin, length, _ in regions)
+
+    def classify(self, name, address, load):
+        if starts(name, NOT_LOADED) or address == 0 and not starts(name, RAM_ONLY + RAM_LOADED):
+            return False, False
+        if self.ram or self.flash:
+            in_ram = self.inside(self.ram, address)
+            in_flash = self.inside(self.flash, address) or (load is not None and self.inside(self.flash, load))
+            return in_flash, in_ram
+        if starts(name, RAM_ONLY):
+            return False, True
+        if starts(name, RAM_LOADED):
+            return True, True
+        return True, False
+
+
+def parse_map(path):
+    """Returns the output sections as (name, size, flash, ram) and the input
+    sections as (module, size, flash, ram)."""
+    with open(path) as f:
+        lines = f.read().splitlines()
+
+    regions = []
+    i = 0
+    while i < len(lines) and lines[i] != "Memory Configuration":
+        i += 1
+    for line in lines[i + 2:]:
+        if line.startswith("Linker script and memory map"):
+            break
+        match = REGION.match(line)
+        if match and match.group(1) not in ("Name", "*default*"):
+            regions.append((int(match.group(2), 16), int(match.group(3), 16), match.group(4)))
+    placement = Placement(regions)
+
+    while i < len(lines) and not lines[i].startswith("Linker script and memory map"):
+        i += 1
+
+    outputs = []
+    inputs = []
+    flash = ram = False
+    pending = None
+    for line in lines[i + 1:]:
+        if pending is not None:
+            kind, name = pending
+            pending = None
+            wrapped = (OUTPUT_WRAPPED if kind == "output" else INPUT_WRAPPED).match(line)
+            if wrapped and kind == "output":
+                address, size = int(wrapped.group(1), 16), int(wrapped.group(2), 16)
+                load = int(wrapped.group(3), 16) if wrapped.group(3) else None
+                flash, ram = placement.classify(name, address, load)
+                outputs.append((name, size, flash, ram))
+                continue
+            if wrapped and kind == "input":
+                if flash or ram:
+                    inputs.append((module_name(wrapped.group(3)), int(wrapped.group(2), 16), flash, ram))
+                continue
+
+        if line and not line[0].isspace():
+            match = OUTPUT.match(line)
+            if match:
+                address, size = int(match.group(2), 16), int(match.group(3), 16)
+                load = int(match.group(4), 16) if match.group(4) else None
+                flash, ram = placement.classify(match.group(1), address, load)
+                outputs.append((match.group(1), size, flash, ram))
+            elif re.match(r"^\S+$", line) and not line.startswith("LOAD") and not line.startswith("OUTPUT("):
+                pending = ("output", line)
+            continue
+
+        match = INPUT.match(line)
+        if match:
+            if (flash or ram) and match.group(1) != "*fill*" and not match.group(4).startswith("0x"):
+                inputs.append((module_name(match.group(4)), int(match.group(3), 16), flash, ram))
+        elif re.match(r"^ (\S+)$", line) and line.strip() != "*fill*":
+            pending = ("input", line.strip())
+
+    return outputs, inputs
+
+
+def parse_symbols(nm, objects):
+    """Returns (module, symbol, size, flash, ram) for every sized symbol."""
+    symbols = []
+    for path in objects:
+        output = subprocess.run([nm, "-S", path], capture_output=True, text=True, check=True).stdout
+        module = module_name(path)
+        archive = path.endswith(".a")
+        for line in output.splitlines():
+            if archive and line.endswith(":"):
+                module = "%s(%s)" % (os.path.basename(path), line[:-1])
+                continue
+            fields = line.split()
+            if len(fields) != 4:
+                continue
+            size, kind, name = int(fields[1], 16), fields[2].lower(), fields[3]
+            if kind in "tw":
+                symbols.append((module, name, size, True, False))
+            elif kind == "r":
+                symbols.append((module, name, size, True, False))
+            elif kind in "dg":
+                symbols.append((module, name, size, True, True))
+            elif kind in "bcs":
+                symbols.append((module, name, size, False, True))
+    return symbols
+
+
+def parse_stack(objects):
+    """Reads the frames from the .su files and the calls from the .ci files
+    beside each object. Functions are keyed by name, prefixed with their
+    module when they are static to it."""
+    frames = {}
+    dynamic = set()
+    calls = {}
+    for path in objects:
+        base = os.path.splitext(path)[0]
+        module = os.path.basename(base)
+        if not os.path.exists(base + ".su"):
+            continue
+
+        local = set()
+        if os.path.exists(base + ".ci"):
+            with open(base + ".ci") as f:
+                for line in f:
+                    node = CI_NODE.match(line)
+                    edge = CI_EDGE.match(line)
+                    if node and ":" in node.group(1):
+                        local.add(node.group(1).rsplit(":", 1)[1])
+                    elif edge:
+                        source, target = (module + ":" + n.rsplit(":", 1)[1] if ":" in n else n
+                                          for n in edge.groups())
+                        calls.setdefault(source, set()).add(target)
+
+        with open(base + ".su") as f:
+            for line in f:
+                location, size, qualifier = line.rstrip("\n").split("\t")
+                name = location.rsplit(":", 1)[1]
+                key = module + ":" + name if name in local else name
+                frames[key] = int(size)
+                if "dynamic" in qualifier and "bounded" not in qualifier:
+                    dynamic.add(key)
+    return frames, dynamic, calls
+
+
+class CallGraph:
+    def __init__(self, frames, dynamic, calls):
+        self.frames = frames
+        self.dynamic = dynamic
+        self.calls = calls
+        self.depths = {}
+        self.recursive = set()
+        self.unknown = set()
+
+        called = {t for targets in calls.values() for t in targets}
+        self.roots = [f for f in frames if f.split(":")[-1] == "main" or self.is_handler(f)]
+        self.indirect = [f for f in frames if f not in called and f not in self.roots]
+
+    @staticmethod
+    def is_handler(key):
+        return key.endswith("_Handler") or key.endswith("_IRQHandler")
+
+    def depth(self, key, path=()):
+        """Deepest stack below and including key, with the chain that gets there."""
+        if key in self.depths:
+            return self.depths[key]
+        if key in path:
+            self.recursive.add(key)
+            return 0, []
+
+        if key == INDIRECT:
+            targets = self.indirect
+            frame = 0
+        else:
+            if key not in self.frames:
+                self.unknown.add(key)
+            targets = self.calls.get(key, ())
+            frame = self.frames.get(key, 0)
+
+        deepest, chain = 0, []
+        for target in sorted(targets):
+            if key == INDIRECT and target in path:
+                continue
+            depth, below = self.depth(target, path + (key,))
+            if depth > deepest:
+                deepest, chain = depth, below
+
+        result = (frame + deepest, ([key] if key != INDIRECT else []) + chain)
+        if key != INDIRECT and key not in self.recursive:
+            self.depths[key] = result
+        return result
+
+
+def report_sizes(outputs, inputs, symbols, count):
+    flash = sum(size for _, size, f, _ in outputs if f)
+    ram = sum(size for _, size, _, r in outputs if r)
+
+    modules = {}
+    for module, size, f, r in inputs:
+        entry = modules.setdefault(module, [0, 0])
+        entry[0] += size if f else 0
+        entry[1] += size if r else 0
+
+    print("Section                     Flash      RAM")
+    for name, size, f, r in outputs:
+        if size and (f or r):
+            print("  %-24s %7s  %7s" % (name, size if f else "", size if r else ""))
+    print("  %-24s %7d  %7d" % ("total", flash, ram))
+
+    print("\nModule                      Flash      RAM")
+    listed = [0, 0]
+    for module, (f, r) in sorted(modules.items(), key=lambda m: -(m[1][0] + m[1][1])):
+        if f or r:
+            print("  %-24s %7d  %7d" % (module, f, r))
+            listed[0] += f
+            listed[1] += r
+    print("  %-24s %7d  %7d" % ("(alignment, stack, heap)", flash - listed[0], ram - listed[1]))
+
+    if count:
+        print("\nSymbol                      Flash      RAM  Module")
+        for module, name, size, f, r in sorted(symbols, key=lambda s: -s[2])[:count]:
+            print("  %-24s %7s  %7s  %s" % (name, size if f else "", size if r else "", module))
+
+    return flash, ram
+
+
+def report_stack(graph):
+    main = [r for r in graph.roots if not graph.is_handler(r)]
+    handlers = sorted((graph.depth(r) + (r,) for r in graph.roots if graph.is_handler(r)),
+                      key=lambda h: -h[0])
+
+    print("\nStack                       Bytes  Deepest chain")
+    total = 0
+    for root in main:
+        depth, chain = graph.depth(root)
+        total = max(total, depth)
+        print("  %-24s %7d  %s" % (root, depth, " > ".join(c.split(":")[-1] for c in chain)))
+    for depth, chain, root in handlers:
+        print("  %-24s %7d  %s" % (root.split(":")[-1], depth + EXCEPTION_FRAME,
+                                   " > ".join(c.split(":")[-1] for c in chain[1:]) or "-"))
+    nested = sum(depth + EXCEPTION_FRAME for depth, _, _ in handlers[:PRIORITY_LEVELS])
+    total += nested
+    print("  %-24s %7d  main with the %d deepest handlers nested" %
+          ("worst case", total, min(PRIORITY_LEVELS, len(handlers))))
+
+    for key in sorted(graph.recursive - {INDIRECT}):
+        print("  warning: %s is recursive, its depth is not bounded" % key)
+    for key in sorted(graph.dynamic):
+        print("  warning: %s allocates a dynamic frame" % key)
+    unknown = sorted(k for k in graph.unknown if not k.startswith("sim_"))
+    if unknown:
+        print("  without stack usage, counted as 0: %s" % ", ".join(unknown))
+    return total
+
+
+def check(name, used, budget):
+    if budget is None:
+        return True
+    state = "ok" if used <= budget else "OVER BUDGET"
+    print("%-5s %6d of %6d bytes, %s" % (name, used, budget, state))
+    return used <= budget
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Flash, RAM and stack footprint of a build")
+    parser.add_argument("--map", required=True, help="linker map, -Wl,-Map=")
+    parser.add_argument("--nm", default="arm-none-eabi-nm")
+    parser.add_argument("--symbols", type=int, default=20, metavar="N",
+                        help="list the N largest symbols, 0 for none")
+    parser.add_argument("--flash-budget", type=int, metavar="BYTES")
+    parser.add_argument("--ram-budget", type=int, metavar="BYTES")
+    parser.add_argument("--stack-budget", type=int, metavar="BYTES")
+    parser.add_argument("objects", nargs="+", help="objects and archives that were linked")
+    args = parser.parse_args()
+
+    outputs, inputs = parse_map(args.map)
+    symbols = parse_symbols(args.nm, [o for o in args.objects if os.path.exists(o)])
+    flash, ram = report_sizes(outputs, inputs, symbols, args.symbols)
+    stack = report_stack(CallGraph(*parse_stack(args.objects)))
+
+    print()
+    ok = all([check("Flash", flash, args.flash_budget),
+              check("RAM", ram, args.ram_budget),
+              check("Stack", stack, args.stack_budget)])
+    sys.exit(0 if ok else 1)
+
+
+if __name__ == "__main__":
+    main()
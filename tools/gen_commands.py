@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Compiles the command registry (src/commands.txt) into a C header holding
+# the command definitions and a collision-free hash table over every name
+# and alias, so that dispatch costs one hash and one string compare.
+
+import sys
+
+FNV_PRIME = 16777619
+FIRST_SEED = 0x811C9DC5
+ARGS = {"none": "COMMAND_ARGS_NONE",
+        "optional": "COMMAND_ARGS_OPTIONAL",
+        "required": "COMMAND_ARGS_REQUIRED"}
+
+
+def fnv1a(name, seed):
+    h = seed
+    for c in name.encode("ascii"):
+        h ^= c
+        h = (h * FNV_PRIME) & 0xFFFFFFFF
+    # The low bits of FNV-1a only depend on the low bits of the seed, fold in
+    # the high half so that every seed yields a different slot layout
+    return h ^ (h >> 16)
+
+
+def find_seed(names):
+    slots = 1
+    while slots < len(names):
+        slots *= 2
+
+    # Prefer the smallest table, only growing it when no seed fits
+    while True:
+        for seed in range(FIRST_SEED, FIRST_SEED + 20000):
+            used = {fnv1a(n, seed) & (slots - 1) for n in names}
+            if len(used) == len(names):
+                return seed, slots
+        slots *= 2
+
+
+def c_string(text):
+    return '"' + text.replace("\\", "\\\\").replace('"', '\\"') + '"'
+
+
+def parse(path):
+    includes, sections, defs = [], [], []
+    section = 0
+
+    with open(path) as f:
+        for number, line in enumerate(f, 1):
+            line = line.strip()
+            if not line or line.startswith("#"):
+                continue
+            if line.startswith("@include"):
+                includes.append(line.split()[1])
+                continue
+            if line.startswith("[") and line.endswith("]"):
+                sections.append(line[1:-1])
+                section = len(sections) - 1
+                continue
+
+            fields = [x.strip() for x in line.split("|")]
+            if len(fields) != 6 or fields[3] not in ARGS:
+                sys.exit("%s:%d: malformed command" % (path, number))
+
+            name, aliases, handler, args, usage, text = fields
+            aliases = [a.strip() for a in aliases.split(",") if a.strip()]
+            defs.append(dict(name=name, aliases=aliases, handler=handler,
+                             args=args, usage=usage, help=text,
+                             section=section))
+
+    if not sections:
+        sections.append("Commands")
+    return includes, sections, defs
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit("usage: gen_commands.py <commands.txt> <output.h>")
+
+    includes, sections, defs = parse(sys.argv[1])
+
+    names = []
+    for index, d in enumerate(defs):
+        for name in [d["name"]] + d["aliases"]:
+            if len(name) >= 16:
+                sys.exit("command name too long: " + name)
+            if any(name == n for n, _ in names):
+                sys.exit("duplicate command name: " + name)
+            names.append((name, index))
+
+    if len(names) > 255:
+        sys.exit("too many command names")
+
+    seed, slot_count = find_seed([n for n, _ in names])
+    slots = [0] * slot_count
+    for i, (name, _) in enumerate(names):
+        slots[fnv1a(name, seed) & (slot_count - 1)] = i + 1
+
+    out = []
+    out.append("// Generated by tools/gen_commands.py from %s, do not edit" % sys.argv[1])
+    out.append("")
+    out.append("#ifndef COMMANDS_GEN_H")
+    out.append("#define COMMANDS_GEN_H")
+    out.append("")
+    for inc in includes:
+        out.append('#include "%s"' % inc)
+    out.append("")
+    out.append("#define COMMAND_HASH_SEED (0x%08XU)" % seed)
+    out.append("#define COMMAND_SLOT_COUNT (%d)" % slot_count)
+    out.append("#define COMMAND_DEF_COUNT (%d)" % len(defs))
+    out.append("#define COMMAND_NAME_COUNT (%d)" % len(names))
+    out.append("")
+    out.append("static const char* const command_sections[] = {")
+    for s in sections:
+        out.append("    %s," % c_string(s))
+    out.append("};")
+    out.append("")
+    out.append("static const command_def_t command_defs[COMMAND_DEF_COUNT] = {")
+    for d in defs:
+        out.append("    { %s, %s, %s, %d, %s, %s }," % (
+            c_string(d["name"]), d["handler"], ARGS[d["args"]], d["section"],
+            c_string(d["usage"]), c_string(d["help"])))
+    out.append("};")
+    out.append("")
+    out.append("static const command_name_t command_names[COMMAND_NAME_COUNT] = {")
+    for name, index in names:
+        out.append("    { %s, %d }," % (c_string(name), index))
+    out.append("};")
+    out.append("")
+    out.append("// Index into command_names plus one, zero marks an empty slot")
+    out.append("static const uint8_t command_slots[COMMAND_SLOT_COUNT] = {")
+    for i in range(0, slot_count, 16):
+        out.append("    " + ", ".join(str(s) for s in slots[i:i + 16]) + ",")
+    out.append("};")
+    out.append("")
+    out.append("#endif")
+
+    with open(sys.argv[2], "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
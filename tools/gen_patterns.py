@@ -0,0 +1,220 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Compiles the pattern sources in patterns/ into a C header of const frame
+# tables for src/pattern.c. Every file is one pattern named after the file,
+# in one of these formats, with LED 15 as the leftmost bit as on the board:
+#
+#   .txt  frame values such as 0x0707, or bitmap rows of 16 '#' and '.',
+#         with '#' starting a comment anywhere else
+#   .csv  a "value" column, or led15 to led0 columns, as preview -o csv writes
+#   .pbm  a netpbm bitmap 16 pixels wide, one row per frame, black is lit
+#
+# Frames are stored in the narrowest type that holds them, once each behind
+# an index when repeats make that smaller, or as a stream of XOR deltas with
+# run lengths when that is smaller still (see pattern_decode() in
+# src/pattern.c). The frame count and the point where the step counter
+# wraps are emitted with the frames.
+#
+#   gen_patterns.py build/patterns_gen.h patterns/*
+#   gen_patterns.py --report patterns/*
+#
+# --report compares the layouts for every source instead of writing the
+# header.
+
+import csv
+import os
+import re
+import sys
+
+BITMAP_ROW = re.compile(r"^[.#]{16}$")
+COUNTER_SPAN = 256  # Steps the counter covers before wrapping on a whole cycle
+
+
+def read_txt(path):
+    frames = []
+    for number, line in enumerate(open(path), 1):
+        line = line.strip()
+        if BITMAP_ROW.match(line):
+            frames.append(int(line.replace("#", "1").replace(".", "0"), 2))
+            continue
+        for token in re.split(r"[\s,]+", line.split("#")[0]):
+            if token:
+                try:
+                    frames.append(int(token, 0))
+                except ValueError:
+                    sys.exit("%s:%d: bad frame \"%s\"" % (path, number, token))
+    return frames
+
+
+def read_csv(path):
+    frames = []
+    for row in csv.DictReader(open(path)):
+        if "value" in row:
+            frames.append(int(row["value"], 0))
+        else:
+            frames.append(sum(int(row["led%d" % bit]) << bit for bit in range(16)))
+    return frames
+
+
+def read_pbm(path):
+    data = open(path, "rb").read()
+    # Header fields, skipping comments, then the raster
+    fields, pos = [], 0
+    while len(fields) < 3:
+        match = re.compile(rb"\s*(#[^\n]*\n\s*)*(\S+)").match(data, pos)
+        if not match:
+            sys.exit("%s: truncated header" % path)
+        fields.append(match.group(2))
+        pos = match.end()
+    magic, width, height = fields[0], int(fields[1]), int(fields[2])
+    if width != 16:
+        sys.exit("%s: strips are 16 pixels wide, not %d" % (path, width))
+
+    if magic == b"P4":
+        raster = data[pos + 1:]
+        return [raster[2 * y] << 8 | raster[2 * y + 1] for y in range(height)]
+    if magic == b"P1":
+        bits = re.sub(rb"#[^\n]*|\s", b"", data[pos:])
+        return [int(bits[16 * y:16 * y + 16], 2) for y in range(height)]
+    sys.exit("%s: not a P1 or P4 bitmap" % path)
+
+
+READERS = {".txt": read_txt, ".csv": read_csv, ".pbm": read_pbm}
+
+HOLD, TOGGLE, DELTA = 0x00, 0x40, 0x80
+HOLD_RUN, TOGGLE_RUN, DELTA_RUN = 64, 4, 64
+
+
+def compress(frames):
+    """Tokens of XOR deltas against the previous frame, from a blank one"""
+    deltas = [f ^ p for f, p in zip(frames, [0] + frames[:-1])]
+    runs = []
+    for delta in deltas:
+        if runs and runs[-1][0] == delta:
+            runs[-1][1] += 1
+        else:
+            runs.append([delta, 1])
+
+    out = bytearray()
+    for delta, length in runs:
+        single = delta and not delta & (delta - 1)
+        # A bit toggling costs a byte per four frames, a delta three per 64
+        if single and (length + TOGGLE_RUN - 1) // TOGGLE_RUN <= 3 * ((length + DELTA_RUN - 1) // DELTA_RUN):
+            while length:
+                run = min(length, TOGGLE_RUN)
+                out.append(TOGGLE | (run - 1) << 4 | (delta.bit_length() - 1))
+                length -= run
+        elif not delta:
+            while length:
+                run = min(length, HOLD_RUN)
+                out.append(HOLD | (run - 1))
+                length -= run
+        else:
+            while length:
+                run = min(length, DELTA_RUN)
+                out += bytes([DELTA | (run - 1), delta >> 8, delta & 0xFF])
+                length -= run
+    return bytes(out)
+
+
+def compile_pattern(path):
+    name, ext = os.path.splitext(os.path.basename(path))
+    if ext not in READERS:
+        sys.exit("%s: unknown pattern format" % path)
+    if not re.match(r"^[a-z][a-z0-9_]*$", name):
+        sys.exit("%s: pattern names are lowercase C identifiers" % path)
+
+    frames = READERS[ext](path)
+    if not frames:
+        sys.exit("%s: no frames" % path)
+    if len(frames) > 0xFFFF or any(f < 0 or f > 0xFFFF for f in frames):
+        sys.exit("%s: frames are 16 bits, at most 65535 of them" % path)
+
+    width = 1 if max(frames) <= 0xFF else 2
+    unique = sorted(set(frames))
+    stream = compress(frames)
+    sizes = {"table": len(frames) * width, "stream": len(stream)}
+    if len(unique) <= 256:
+        sizes["indexed"] = len(unique) * width + len(frames)
+    # Ties go to the table, which is the quickest to read
+    layout = min(("table", "indexed", "stream"), key=lambda l: sizes.get(l, 1 << 32))
+    reset = max(len(frames), COUNTER_SPAN // len(frames) * len(frames))
+    return dict(name=name, path=path, frames=frames, width=width, unique=unique,
+                stream=stream, sizes=sizes, layout=layout, reset=reset)
+
+
+def c_array(ctype, name, values, digits):
+    out = ["static const %s %s[%d] = {" % (ctype, name, len(values))]
+    for i in range(0, len(values), 8):
+        out.append("    " + ", ".join("0x%0*X" % (digits, v) for v in values[i:i + 8]) + ",")
+    out.append("};")
+    return out
+
+
+def report(patterns):
+    print("%-12s %7s %7s %8s %7s %7s  %s" % ("Pattern", "Frames", "Table", "Indexed",
+                                           "Stream", "Ratio", "Layout"))
+    for p in patterns:
+        sizes = p["sizes"]
+        print("%-12s %7d %7d %8s %7d %6.2fx  %s" % (
+            p["name"], len(p["frames"]), sizes["table"],
+            sizes.get("indexed", "-"), sizes["stream"],
+            2.0 * len(p["frames"]) / sizes[p["layout"]], p["layout"]))
+    print("Sizes in bytes, the ratio against 16 bits a frame")
+
+
+def main():
+    if len(sys.argv) < 2:
+        sys.exit("usage: gen_patterns.py <output.h> | --report <pattern files...>")
+
+    patterns = [compile_pattern(p) for p in sorted(sys.argv[2:])]
+    if sys.argv[1] == "--report":
+        report(patterns)
+        return
+
+    out = []
+    out.append("// Generated by tools/gen_patterns.py from patterns/, do not edit")
+    out.append("")
+    out.append("#ifndef PATTERNS_GEN_H")
+    out.append("#define PATTERNS_GEN_H")
+    out.append("")
+    out.append('#include "pattern.h"')
+    for p in patterns:
+        upper = p["name"].upper()
+        ctype = "uint8_t" if p["width"] == 1 else "uint16_t"
+        digits = 2 * p["width"]
+        table = "pattern_%s_frames" % p["name"]
+        counts = "PATTERN_%s_FRAMES, PATTERN_%s_RESET" % (upper, upper)
+
+        out.append("")
+        out.append("// %s, %d frames in %d bytes" % (p["path"], len(p["frames"]),
+                                                     p["sizes"][p["layout"]]))
+        out.append("#define PATTERN_%s_FRAMES (%d)" % (upper, len(p["frames"])))
+        out.append("#define PATTERN_%s_RESET (%d)" % (upper, p["reset"]))
+        if p["layout"] == "stream":
+            data = "pattern_%s_data" % p["name"]
+            out += c_array("uint8_t", data, p["stream"], 2)
+            out.append("static const pattern_stream_t pattern_%s_stream = { %s, %d };"
+                       % (p["name"], data, len(p["stream"])))
+            out.append("#define PATTERN_%s_NEXT(cursor) (pattern_decode(&pattern_%s_stream, (cursor), %s))"
+                       % (upper, p["name"], counts))
+        elif p["layout"] == "indexed":
+            steps = "pattern_%s_steps" % p["name"]
+            out += c_array(ctype, table, p["unique"], digits)
+            out += c_array("uint8_t", steps, [p["unique"].index(f) for f in p["frames"]], 2)
+            out.append("#define PATTERN_%s_NEXT(cursor) (%s[%s[pattern_step((cursor), %s)]])"
+                       % (upper, table, steps, counts))
+        else:
+            out += c_array(ctype, table, p["frames"], digits)
+            out.append("#define PATTERN_%s_NEXT(cursor) (%s[pattern_step((cursor), %s)])"
+                       % (upper, table, counts))
+    out.append("")
+    out.append("#endif")
+
+    with open(sys.argv[1], "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
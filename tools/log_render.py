@@ -0,0 +1,59 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Renders the compact log records of a LOG_STRINGS=0 build. Reads the
+# console from stdin (or a serial port) and replaces every "#id:arg@cycles"
+# line with the message text from inc/log_messages.h and a timestamp.
+#
+#   log_render.py < console.txt
+#   log_render.py /dev/ttyACM0
+
+import os
+import re
+import sys
+
+CYCLES_PER_US = 16
+MESSAGES_H = os.path.join(os.path.dirname(__file__), "..", "inc", "log_messages.h")
+RECORD = re.compile(r"#(\d+):(\d+)@(\d+)")
+
+
+def load_messages(path):
+    source = open(path).read()
+    messages = re.findall(r'LOG_MESSAGE\((\w+),\s*"((?:[^"\\]|\\.)*)",\s*(\w+)\)', source)
+    names = {}
+    for kind in ("PATTERN", "SPEED"):
+        match = re.search(r"LOG_%s_NAMES\s*\{([^}]*)\}" % kind, source)
+        names["LOG_ARG_" + kind] = re.findall(r'"([^"]*)"', match.group(1))
+    return messages, names
+
+
+def render(match, messages, names):
+    index, arg, cycles = (int(x) for x in match.groups())
+    if index >= len(messages):
+        return match.group(0)
+
+    _, text, kind = messages[index]
+    if kind == "LOG_ARG_NUMBER":
+        text += str(arg)
+    elif kind in names:
+        text += names[kind][arg] if arg < len(names[kind]) else str(arg)
+    return "[%12.3f ms] %s" % (cycles / CYCLES_PER_US / 1000.0, text)
+
+
+def main():
+    messages, names = load_messages(MESSAGES_H)
+
+    if len(sys.argv) > 1:
+        import serial
+        source = serial.Serial(sys.argv[1], 115200)
+        lines = (raw.decode(errors="replace") for raw in iter(source.readline, b""))
+    else:
+        lines = sys.stdin
+
+    for line in lines:
+        sys.stdout.write(RECORD.sub(lambda m: render(m, messages, names), line))
+        sys.stdout.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,45 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Pulls a memory range off a board through the memdumpraw command and checks
+# it against the CRC-32 the firmware sends after the data.
+#
+#   memdump.py /dev/ttyACM0 0x20000000 36864 ram.bin
+
+import struct
+import sys
+import zlib
+
+import serial
+
+
+def main():
+    if len(sys.argv) != 5:
+        sys.exit("usage: memdump.py <port> <0xaddress> <length> <output>")
+
+    port = serial.Serial(sys.argv[1], 115200, timeout=5)
+    port.reset_input_buffer()
+    port.write(("memdumpraw %s %s\r" % (sys.argv[2], sys.argv[3])).encode())
+
+    # Skipping the echoed command line up to the header
+    port.read_until(b"RAW ")
+    header = port.read_until(b"\r\n")
+    if not header.endswith(b"\r\n"):
+        sys.exit("no response, is the address mapped?")
+
+    length = int(header[:-2])
+    data = port.read(length)
+    trailer = port.read(4)
+    if len(data) != length or len(trailer) != 4:
+        sys.exit("transfer cut short after %d bytes" % len(data))
+
+    if zlib.crc32(data) != struct.unpack("<I", trailer)[0]:
+        sys.exit("CRC mismatch, discarding dump")
+
+    with open(sys.argv[4], "wb") as f:
+        f.write(data)
+    print("%d bytes written to %s" % (length, sys.argv[4]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Host side of the binary control mode (see inc/proto.h). Sends batches of
+# commands over a serial port and prints the command-to-LED latency the
+# firmware measured for the text, binary and compact paths.
+#
+#   proto.py /dev/ttyACM0 "pattern" "speed 3"
+#   proto.py /dev/ttyACM0 --latency
+#   proto.py --sim [command]...
+#
+# --sim runs the host simulator from "make host" instead of a board: the
+# same commands go in as text lines and as binary frames, and it prints the
+# round trips in simulated time along with the latencies the firmware
+# measured. Without commands it steps the pattern on.
+
+import ast
+import re
+import statistics
+import struct
+import subprocess
+import sys
+
+ENTER = b"\x00\xffBM"
+EXIT = b"\x00\xffTM"
+
+TYPE_COMMAND = 0x01
+TYPE_EXIT = 0x03
+TYPE_LATENCY = 0x04
+TYPE_ACK = 0x81
+
+
+def crc16(data, crc=0xFFFF):
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_encode(data):
+    out, block = bytearray(), bytearray()
+    for byte in data:
+        if byte == 0:
+            out += bytes([len(block) + 1]) + block
+            block = bytearray()
+        else:
+            block.append(byte)
+            if len(block) == 254:
+                out += b"\xff" + block
+                block = bytearray()
+    out += bytes([len(block) + 1]) + block
+    return bytes(out)
+
+
+def cobs_decode(data):
+    out, i = bytearray(), 0
+    while i < len(data):
+        code = data[i]
+        out += data[i + 1:i + code]
+        i += code
+        if code != 0xFF and i < len(data):
+            out.append(0)
+    return bytes(out)
+
+
+SIM_HOST = "build/host/blinky_host"
+SIM_BAUDRATE = 115200
+SIM_ROUNDS = 20
+SIM_GAP_MS = 300
+
+
+class Link:
+    def __init__(self, port):
+        import serial  # Only needed with a board, not for --sim
+        self.port = serial.Serial(port, 115200, timeout=1)
+        self.seq = 0
+        self.port.write(ENTER)
+        self.read_frame()
+
+    def read_frame(self):
+        frame = self.port.read_until(b"\x00")[:-1]
+        data = cobs_decode(frame)
+        if len(data) < 4 or crc16(data[:-2]) != struct.unpack("<H", data[-2:])[0]:
+            raise IOError("bad frame from device")
+        return data[0], data[1], data[2:-2]
+
+    def request(self, frame_type, payload=b""):
+        self.seq = (self.seq + 1) & 0xFF
+        self.port.write(frame(self.seq, frame_type, payload))
+        seq, reply_type, reply = self.read_frame()
+        if seq != self.seq or reply_type != TYPE_ACK:
+            raise IOError("request %d not acknowledged" % self.seq)
+        return reply
+
+    def close(self):
+        self.request(TYPE_EXIT)
+
+
+def frame(seq, frame_type, payload=b""):
+    body = bytes([seq, frame_type]) + payload
+    return cobs_encode(body + struct.pack("<H", crc16(body))) + b"\x00"
+
+
+def print_latency(values):
+    for name, (last, low, high) in zip(("text", "binary", "compact"),
+                                       (values[:3], values[3:6], values[6:])):
+        print("%-7s last %6d us  min %6d us  max %6d us" % (name, last, low, high))
+
+
+# What the simulator sent on the console, one (ms the byte was done, byte)
+# per byte, spreading the bytes of an entry at the line rate
+def sim_console(log):
+    line = re.compile(r'^\s*(\d+\.\d+) ms  console\s+tx  (".*")$')
+    byte_ms = 10000.0 / SIM_BAUDRATE
+    out = []
+    for match in filter(None, map(line.match, log)):
+        data = ast.literal_eval(match.group(2)).encode("latin-1")
+        out += [(float(match.group(1)) + i * byte_ms, b) for i, b in enumerate(data)]
+    return out
+
+
+def sim_line(at, data):
+    return "%.3f console %s" % (at, "".join("\\x%02X" % b for b in data))
+
+
+# Rounds of text lines first, then the same as binary frames. A round trip
+# runs from the start bit of the first byte sent, a byte time before the
+# simulator delivers it, to the end of the prompt or the ack.
+def sim(commands):
+    byte_ms = 10000.0 / SIM_BAUDRATE
+    script, text_at, binary_at = [], [], []
+    at = 200.0
+
+    for i in range(SIM_ROUNDS):
+        line = commands[i % len(commands)]
+        script.append(sim_line(at, line.encode() + b"\r"))
+        text_at.append(at)
+        at += SIM_GAP_MS
+
+    script.append(sim_line(at, ENTER))
+    at += SIM_GAP_MS
+    payload = b"".join(bytes([len(c)]) + c.encode() for c in commands)
+    for i in range(SIM_ROUNDS):
+        script.append(sim_line(at, frame(i + 1, TYPE_COMMAND, payload)))
+        binary_at.append(at)
+        at += SIM_GAP_MS
+    script.append(sim_line(at, frame(SIM_ROUNDS + 1, TYPE_LATENCY)))
+    script.append(sim_line(at + SIM_GAP_MS, EXIT))
+    script.append("%d end" % (at + 2 * SIM_GAP_MS))
+
+    result = subprocess.run([SIM_HOST, "-"], input="\n".join(script) + "\n",
+                            capture_output=True, text=True, check=True)
+    sent = sim_console(result.stdout.splitlines())
+
+    # Text, up to the first prompt after the line
+    text = []
+    for start in text_at:
+        after = [(t, b) for t, b in sent if t > start]
+        for i in range(1, len(after)):
+            if after[i - 1][1] == ord(">") and after[i][1] == ord(" "):
+                text.append(after[i][0] - start + byte_ms)
+                break
+
+    # Binary, frames split at the terminating zeros and told apart by seq
+    acks, data = {}, bytearray()
+    for t, b in (x for x in sent if x[0] > binary_at[0]):
+        if b:
+            data.append(b)
+            continue
+        body = cobs_decode(bytes(data))
+        data = bytearray()
+        if len(body) >= 4 and crc16(body[:-2]) == struct.unpack("<H", body[-2:])[0]:
+            acks.setdefault(body[0], (t, body[2:-2]))
+    binary = [acks[i + 1][0] - start + byte_ms for i, start in enumerate(binary_at) if i + 1 in acks]
+
+    for name, times in (("text", text), ("binary", binary)):
+        if times:
+            print("%-7s round trip median %6.3f ms  max %6.3f ms  (%d of %d)"
+                  % (name, statistics.median(times), max(times), len(times), SIM_ROUNDS))
+    if SIM_ROUNDS + 1 in acks:
+        print_latency(struct.unpack("<9I", acks[SIM_ROUNDS + 1][1]))
+
+
+def main():
+    if len(sys.argv) >= 2 and sys.argv[1] == "--sim":
+        sim(sys.argv[2:] or ["pattern"])
+        return
+    if len(sys.argv) < 3:
+        sys.exit("usage: proto.py <port> <command>... | --latency, or proto.py --sim [command]...")
+
+    link = Link(sys.argv[1])
+
+    if sys.argv[2] == "--latency":
+        print_latency(struct.unpack("<9I", link.request(TYPE_LATENCY)))
+    else:
+        payload = b"".join(bytes([len(c)]) + c.encode() for c in sys.argv[2:])
+        status = link.request(TYPE_COMMAND, payload)
+        for command, code in zip(sys.argv[2:], status):
+            print("%-16s %s" % (command, "ok" if code == 0 else "error %d" % code))
+
+    link.close()
+
+
+if __name__ == "__main__":
+    main()
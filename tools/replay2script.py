@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Turns an input recording (inc/replay.h) into a script for the host
+# simulator, which then replays the UART bytes and IR edges at the recorded
+# times. The recording is either pulled from a board with "replay dump" or
+# read from a file saved earlier, e.g. with --save.
+#
+#   replay2script.py --port /dev/ttyACM0 --save input.bin > input.txt
+#   build/host/blinky_host input.txt > run.log
+#
+# The simulator is deterministic, so two runs of one script log the same
+# LED frames and CLI output, and a change to the firmware shows up as a
+# diff between the logs. The firmware should start out as it was when the
+# recording began: record right after a reset, or pass the flash contents
+# to the simulator with -f.
+
+import argparse
+import struct
+import sys
+import zlib
+
+CYCLES_PER_MS = 16000
+ENTRY = struct.Struct("<IBBH")
+CONSOLE, BT, IR = range(3)
+TARGETS = {CONSOLE: "console", BT: "bt"}
+
+
+def capture(port_name):
+    import serial
+
+    port = serial.Serial(port_name, 115200, timeout=5)
+    port.reset_input_buffer()
+    port.write(b"replay dump\r")
+    port.read_until(b"RAW ")
+    length = int(port.read_until(b"\r\n")[:-2])
+    data = port.read(length)
+    crc = struct.unpack("<I", port.read(4))[0]
+    if len(data) != length or zlib.crc32(data) != crc:
+        sys.exit("recording transfer corrupted")
+    return data
+
+
+def escape(byte):
+    if byte == ord("\\"):
+        return "\\\\"
+    if 0x20 < byte < 0x7F:
+        return chr(byte)
+    return "\\x%02x" % byte
+
+
+def convert(data, offset_ms, tail_ms):
+    lines = ["# %d recorded inputs, replayed from %g ms" % (len(data) // ENTRY.size, offset_ms)]
+    last, wrap, ms = None, 0, offset_ms
+
+    for timestamp, source, value, _ in ENTRY.iter_unpack(data):
+        # Unwrapping the 32-bit cycle counter
+        if last is not None and timestamp < last:
+            wrap += 1 << 32
+        last = timestamp
+        ms = offset_ms + (timestamp + wrap) / CYCLES_PER_MS
+
+        # One byte per line, the simulator would space several by the baud rate
+        if source in TARGETS:
+            lines.append("%.7f %s %s" % (ms, TARGETS[source], escape(value)))
+        elif source == IR:
+            lines.append("%.7f irlevel %d" % (ms, value))
+        else:
+            sys.exit("unknown source %d at %.3f ms" % (source, ms))
+
+    lines.append("%.7f end" % (ms + tail_ms))
+    return "\n".join(lines) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("file", nargs="?", help="raw recording saved earlier")
+    parser.add_argument("--port", help="serial port to pull the recording from")
+    parser.add_argument("--save", help="also store the raw recording here")
+    parser.add_argument("--offset", type=float, default=100,
+                        help="simulated ms at which the recording starts, after boot")
+    parser.add_argument("--tail", type=float, default=1000,
+                        help="ms to keep running after the last input")
+    args = parser.parse_args()
+
+    if args.port:
+        data = capture(args.port)
+    elif args.file:
+        data = open(args.file, "rb").read()
+    else:
+        parser.error("either a file or --port is needed")
+
+    if len(data) % ENTRY.size:
+        sys.exit("recording is not a whole number of entries")
+    if args.save:
+        with open(args.save, "wb") as f:
+            f.write(data)
+
+    sys.stdout.write(convert(data, args.offset, args.tail))
+
+
+if __name__ == "__main__":
+    main()
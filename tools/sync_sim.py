@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Runs two boards in the host simulator, one as the sync master and one
+# following it with its HSI16 off by some ppm (see inc/sync.h), and reports
+# how far apart their LED frames latch. The master runs first; what it sends
+# on USART3 is fed to the follower at the same simulated times.
+#
+#   sync_sim.py --ppm 500 --speed 4 --time 30000
+#
+# --no-sync runs the follower without "sync follow" but with the same
+# settings, for the drift the loop takes out.
+
+import argparse
+import ast
+import re
+import statistics
+import subprocess
+import sys
+
+LED_LINE = re.compile(r"^\s*(\d+\.\d+) ms  led\s+0x([0-9A-F]{4})")
+BT_LINE = re.compile(r'^\s*(\d+\.\d+) ms  bt\s+tx  (".*")$')
+CONSOLE_LINE = re.compile(r'^\s*\d+\.\d+ ms  console\s+tx  (".*")$')
+
+
+def run(host, script, ppm=0):
+    command = [host, "-c", str(ppm), "-"] if ppm else [host, "-"]
+    result = subprocess.run(command, input=script, capture_output=True, text=True, check=True)
+    return result.stdout.splitlines()
+
+
+def frames(log):
+    return [(float(m.group(1)), int(m.group(2), 16)) for m in map(LED_LINE.match, log) if m]
+
+
+# Every entry starts with the first byte done shifting, as the script
+# delivers its first byte
+def beacons(log):
+    lines = []
+    for match in filter(None, map(BT_LINE.match, log)):
+        data = ast.literal_eval(match.group(2)).encode("latin-1")
+        lines.append("%s bt %s" % (match.group(1), "".join("\\x%02X" % b for b in data)))
+    return lines
+
+
+def console(log):
+    return "".join(ast.literal_eval(m.group(1)) for m in map(CONSOLE_LINE.match, log) if m)
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--host", default="build/host/blinky_host", help="simulator from make host")
+    parser.add_argument("--ppm", type=int, default=200, help="follower clock offset")
+    parser.add_argument("--speed", type=int, default=3, help="speed level 1-5 on the master")
+    parser.add_argument("--pattern", type=int, default=0, help="times to step the master's pattern on")
+    parser.add_argument("--time", type=float, default=20000, help="simulated ms to run")
+    parser.add_argument("--settle", type=float, default=5000, help="ms left out before comparing")
+    parser.add_argument("--no-sync", action="store_true", help="follower left free running")
+    args = parser.parse_args()
+
+    settings = ["100 console brightness 8\\r", "150 console speed %d\\r" % args.speed]
+    settings += ["%d console pattern\\r" % (160 + 10 * i) for i in range(args.pattern)]
+    end = "%d end" % args.time
+
+    master_log = run(args.host, "\n".join(settings + ["300 console sync master\\r", end]) + "\n")
+    master = frames(master_log)
+
+    follower_script = settings if args.no_sync else settings[:1] + ["300 console sync follow\\r"]
+    follower_script = follower_script + beacons(master_log)
+    follower_script += ["%d console sync\\r" % (args.time - 100), end]
+    follower_log = run(args.host, "\n".join(follower_script) + "\n", args.ppm)
+    follower = frames(follower_log)
+
+    # Each master frame against the nearest follower frame
+    skews = []
+    mismatches = 0
+    j = 0
+    for time, value in master:
+        if time < args.settle:
+            continue
+        while j + 1 < len(follower) and abs(follower[j + 1][0] - time) <= abs(follower[j][0] - time):
+            j += 1
+        if not follower:
+            break
+        skews.append((follower[j][0] - time) * 1000)
+        mismatches += follower[j][1] != value
+
+    if not skews:
+        sys.exit("no frames after %g ms" % args.settle)
+
+    print("%d frames compared from %g ms, follower at %+d ppm" % (len(skews), args.settle, args.ppm))
+    print("skew mean %+.0f us, max %.0f us, stdev %.0f us"
+          % (statistics.mean(skews), max(map(abs, skews)), statistics.pstdev(skews)))
+    print("%d frames showed a different value" % mismatches)
+    status = console(follower_log).split("sync\n")[-1].strip("\r\n> ")
+    if not args.no_sync:
+        print(status.replace("\r", ""))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,129 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Converts the firmware event trace (inc/trace.h) into Chrome trace JSON,
+# which chrome://tracing and ui.perfetto.dev open directly. The trace is
+# either pulled from a board with "trace dump" or read from a file saved
+# earlier, e.g. with --save.
+#
+#   trace2json.py --port /dev/ttyACM0 --save trace.bin > trace.json
+#   trace2json.py trace.bin > trace.json
+
+import argparse
+import json
+import os
+import struct
+import sys
+import zlib
+
+CYCLES_PER_US = 16
+ENTRY = struct.Struct("<IHH")
+COMMANDS_TXT = os.path.join(os.path.dirname(__file__), "..", "src", "commands.txt")
+
+ISR_NAMES = ["TIM14", "EXTI4_15", "TIM16", "USART2", "USART3", "PendSV"]
+(ISR_ENTER, ISR_EXIT, SPI_BEGIN, LED_FRAME, IR_EDGE, IR_DECODE, COMMAND,
+ UART_RX, UART_TX_BEGIN, UART_TX_END) = range(10)
+
+
+def capture(port_name):
+    import serial
+
+    port = serial.Serial(port_name, 115200, timeout=5)
+    port.reset_input_buffer()
+    port.write(b"trace dump\r")
+    port.read_until(b"RAW ")
+    length = int(port.read_until(b"\r\n")[:-2])
+    data = port.read(length)
+    crc = struct.unpack("<I", port.read(4))[0]
+    if len(data) != length or zlib.crc32(data) != crc:
+        sys.exit("trace transfer corrupted")
+    return data
+
+
+def command_names():
+    names = []
+    for line in open(COMMANDS_TXT):
+        if "|" in line and not line.startswith("#"):
+            names.append(line.split("|")[0].strip())
+    return names
+
+
+def convert(data):
+    commands = command_names()
+    events = []
+    last, offset = None, 0
+
+    def meta(tid, name):
+        events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": tid,
+                       "args": {"name": name}})
+
+    for tid, name in enumerate(ISR_NAMES):
+        meta(tid, name)
+    meta(10, "SPI / LEDs")
+    meta(11, "IR")
+    meta(12, "UART")
+    meta(13, "Main")
+
+    for timestamp, event, arg in ENTRY.iter_unpack(data):
+        # Unwrapping the 32-bit cycle counter
+        if last is not None and timestamp < last:
+            offset += 1 << 32
+        last = timestamp
+        ts = (timestamp + offset) / CYCLES_PER_US
+
+        if event in (ISR_ENTER, ISR_EXIT):
+            name = ISR_NAMES[arg] if arg < len(ISR_NAMES) else "ISR %d" % arg
+            events.append({"ph": "B" if event == ISR_ENTER else "E", "name": name,
+                           "pid": 0, "tid": arg, "ts": ts})
+        elif event == SPI_BEGIN:
+            events.append({"ph": "B", "name": "sn_send_data", "pid": 0, "tid": 10,
+                           "ts": ts, "args": {"data": "0x%04x" % arg}})
+        elif event == LED_FRAME:
+            events.append({"ph": "E", "name": "sn_send_data", "pid": 0, "tid": 10,
+                           "ts": ts, "args": {"frame": "0x%04x" % arg}})
+        elif event == IR_EDGE:
+            events.append({"ph": "i", "s": "t", "pid": 0, "tid": 11, "ts": ts,
+                           "name": "rising" if arg & 0x8000 else "falling",
+                           "args": {"tim16": arg & 0x7FFF}})
+        elif event == IR_DECODE:
+            name = {0xFF01: "address mismatch", 0xFF02: "checksum failure"}.get(
+                arg, "command 0x%02x" % arg)
+            events.append({"ph": "i", "s": "t", "pid": 0, "tid": 11, "ts": ts,
+                           "name": "decode: " + name})
+        elif event == COMMAND:
+            name = commands[arg] if arg < len(commands) else str(arg)
+            events.append({"ph": "i", "s": "t", "pid": 0, "tid": 13, "ts": ts,
+                           "name": "command: " + name})
+        elif event == UART_RX:
+            events.append({"ph": "i", "s": "t", "pid": 0, "tid": 12, "ts": ts,
+                           "name": "rx", "args": {"byte": arg}})
+        elif event in (UART_TX_BEGIN, UART_TX_END):
+            events.append({"ph": "B" if event == UART_TX_BEGIN else "E", "name": "tx",
+                           "pid": 0, "tid": 12, "ts": ts, "args": {"bytes": arg}})
+
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("file", nargs="?", help="raw trace saved earlier")
+    parser.add_argument("--port", help="serial port to pull the trace from")
+    parser.add_argument("--save", help="also store the raw trace here")
+    args = parser.parse_args()
+
+    if args.port:
+        data = capture(args.port)
+    elif args.file:
+        data = open(args.file, "rb").read()
+    else:
+        parser.error("either a file or --port is needed")
+
+    if args.save:
+        with open(args.save, "wb") as f:
+            f.write(data)
+
+    json.dump(convert(data), sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,223 @@
+#!/usr/bin/env python3
+# © 2024 Oskar Arnudd
+#
+# Streams a firmware image into the staging slot over the binary control
+# mode (see inc/update.h) while the application keeps running. One chunk
+# is in flight at a time, the device writes the flash only while no byte
+# is on its way to it.
+#
+#   update.py /dev/ttyACM0 blinky.bin
+#   update.py /dev/ttyACM0 blinky.bin --reboot
+#   update.py --sim [image.bin]
+#
+# --sim stages the image, or a made up one, in the host simulator from
+# "make host", reboots into it with the power cut halfway through the copy,
+# and checks that the boot after that finishes the copy. The simulator boots
+# through update_init rather than the vector on page 0, which runs the same
+# copy from the resume page on a board.
+
+import os
+import random
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+import zlib
+
+from proto import (ENTER, EXIT, SIM_HOST, Link, TYPE_ACK, TYPE_COMMAND, cobs_decode,
+                   cobs_encode, crc16, frame, sim_console, sim_line)
+
+TYPE_BEGIN = 0x05
+TYPE_DATA = 0x06
+TYPE_END = 0x07
+
+CHUNK = 48
+WINDOW = 1
+
+STATUS = ("ok", "size", "state", "offset", "length", "flash", "crc", "image")
+
+
+class UpdateLink(Link):
+    def send(self, frame_type, payload=b""):
+        self.seq = (self.seq + 1) & 0xFF
+        body = bytes([self.seq, frame_type]) + payload
+        self.port.write(cobs_encode(body + struct.pack("<H", crc16(body))) + b"\x00")
+        return self.seq
+
+    def reply(self):
+        seq, reply_type, payload = self.read_frame()
+        if reply_type != TYPE_ACK:
+            return seq, None, None
+        status, expected = struct.unpack("<BI", payload)
+        return seq, status, expected
+
+
+def stream(link, image):
+    offset = 0
+    in_flight = []
+
+    while offset < len(image) or in_flight:
+        while offset < len(image) and len(in_flight) < WINDOW:
+            chunk = image[offset:offset + CHUNK]
+            in_flight.append((link.send(TYPE_DATA, struct.pack("<I", offset) + chunk), offset))
+            offset += len(chunk)
+
+        seq, status, expected = link.reply()
+        sent_seq, sent_offset = in_flight.pop(0)
+        if seq != sent_seq or status is None or status == 3:
+            # Lost or out of order, start over from what the device expects
+            for _ in in_flight:
+                link.reply()
+            in_flight = []
+            offset = expected if expected is not None else sent_offset
+        elif status != 0:
+            sys.exit("chunk at %d failed: %s" % (sent_offset, STATUS[status]))
+
+        sys.stdout.write("\r%6d / %d bytes" % (min(offset, len(image)), len(image)))
+        sys.stdout.flush()
+    print()
+
+
+FLASH_BASE = 0x08000000
+APP_BASE = 0x08004000
+RESUME_BASE = 0x08011000
+SRAM_END = 0x20009000
+PAGE = 2048
+
+SIM_GAP_MS = 10        # Per chunk, enough for the bytes and two chunks programmed
+SIM_ERASE_GAP_MS = 150 # Per chunk reaching a new page, the wait for a quiet moment and the erase
+
+
+# Stack at the top of SRAM and a reset vector inside the image, what
+# update_end checks for, and noise after. Not a multiple of 8, so the last
+# chunk is short.
+def sim_image():
+    rng = random.Random(1)
+    body = bytes(rng.randrange(256) for _ in range(3 * PAGE + 300 - 8))
+    return struct.pack("<II", SRAM_END, APP_BASE + 0x101) + body
+
+
+def sim_run(flash, script, cut=None):
+    command = [SIM_HOST, "-f", flash] + (["-p", str(cut)] if cut else []) + ["-"]
+    result = subprocess.run(command, input="\n".join(script) + "\n",
+                            capture_output=True, text=True, check=True)
+    return result.stdout.splitlines()
+
+
+def sim_programs(log):
+    return next(int(line.split()[1]) for line in log if line.startswith("Flash "))
+
+
+# Acks the simulator sent, (status, offset expected next) in order
+def sim_acks(log):
+    acks, data = [], bytearray()
+    for _, b in sim_console(log):
+        if b:
+            data.append(b)
+            continue
+        body = cobs_decode(bytes(data))
+        data = bytearray()
+        if len(body) >= 4 and crc16(body[:-2]) == struct.unpack("<H", body[-2:])[0] \
+                and body[1] == TYPE_ACK and len(body) == 9:
+            acks.append(struct.unpack("<BI", body[2:7]))
+    return acks
+
+
+def sim(image):
+    # Staging, open loop: gaps long enough that every ack is out before the
+    # next chunk goes in, longer where a chunk takes the slot onto a new page
+    script = [sim_line(200, ENTER)]
+    script.append(sim_line(300, frame(1, TYPE_BEGIN, struct.pack("<II", len(image), zlib.crc32(image)))))
+    at, seq, last_new = 400.0, 2, False
+    for offset in range(0, len(image), CHUNK):
+        chunk = image[offset:offset + CHUNK]
+        script.append(sim_line(at, frame(seq, TYPE_DATA, struct.pack("<I", offset) + chunk)))
+        seq += 1
+        # The page is erased with this chunk or the next, whichever fills
+        # the second buffer
+        new = (offset + len(chunk) - 1) // PAGE != (offset - 1) // PAGE
+        at += SIM_ERASE_GAP_MS if new or last_new else SIM_GAP_MS
+        last_new = new
+    script.append(sim_line(at, frame(seq, TYPE_END)))
+    script.append(sim_line(at + 100, EXIT))
+    script.append(sim_line(at + 200, b"update reboot\r"))
+    script.append("%d end" % (at + 1200))
+
+    with tempfile.TemporaryDirectory() as directory:
+        flash = os.path.join(directory, "flash.bin")
+        log = sim_run(flash, script)
+        acks = sim_acks(log)
+        failed = [STATUS[status] for status, _ in acks if status != 0]
+        print("staged: %d acks, %d failed%s" % (len(acks), len(failed), " (%s)" % ", ".join(failed) if failed else ""))
+        if failed or len(acks) != seq or "System reset requested" not in "\n".join(log):
+            sys.exit("staging failed")
+
+        # The copy counted on a scratch flash, then cut halfway on the real one
+        scratch = os.path.join(directory, "scratch.bin")
+        shutil.copyfile(flash, scratch)
+        cut = sim_programs(sim_run(scratch, ["500 end"])) // 2
+        log = sim_run(flash, ["500 end"], cut)
+        lost = any("Power lost" in l for l in log)
+
+        # What a board would boot into now: the vector on page 0 must lead
+        # to the copy on the resume page, which must know the size
+        with open(flash, "rb") as file:
+            data = file.read()
+        vector = struct.unpack_from("<II", data, APP_BASE - FLASH_BASE)
+        size = struct.unpack_from("<II", data, RESUME_BASE - FLASH_BASE)
+        resumes = vector == (SRAM_END, (RESUME_BASE + 8) | 1) and size == (len(image), ~len(image) & 0xFFFFFFFF)
+        print("copy: power cut in program %d, %s, %s" % (cut, "lost" if lost else "not reached",
+                                                        "boots into the resume page" if resumes else "no way back"))
+        if not lost or not resumes:
+            sys.exit(1)
+
+        sim_run(flash, ["500 end"])
+        log = sim_run(flash, ["100 console update\\r", "500 end"])
+        installed = any(re.search(r"Slot\s+empty, installed at boot", l) for l in log)
+        with open(flash, "rb") as file:
+            file.seek(APP_BASE - FLASH_BASE)
+            matches = file.read(len(image)) == image
+    print("resumed: %s, application %s" % ("installed at boot" if installed else "not installed",
+                                           "matches the image" if matches else "differs from the image"))
+    if not installed or not matches:
+        sys.exit(1)
+
+
+def main():
+    if len(sys.argv) >= 2 and sys.argv[1] == "--sim":
+        sim(open(sys.argv[2], "rb").read() if len(sys.argv) > 2 else sim_image())
+        return
+    if len(sys.argv) < 3:
+        sys.exit("usage: update.py <port> <image.bin> [--reboot], or update.py --sim [image.bin]")
+
+    image = open(sys.argv[2], "rb").read()
+    link = UpdateLink(sys.argv[1])
+    start = time.monotonic()
+
+    link.send(TYPE_BEGIN, struct.pack("<II", len(image), zlib.crc32(image)))
+    status = link.reply()[1]
+    if status != 0:
+        sys.exit("begin failed: %s" % STATUS[status])
+
+    stream(link, image)
+
+    link.send(TYPE_END)
+    status = link.reply()[1]
+    if status != 0:
+        sys.exit("end failed: %s" % STATUS[status])
+
+    elapsed = time.monotonic() - start
+    print("%d bytes in %.2f s, %d B/s, staged" % (len(image), elapsed, len(image) / elapsed))
+    print("the device stayed online, 'update' prints its offline time against the bootloader path")
+
+    if "--reboot" in sys.argv[3:]:
+        link.request(TYPE_COMMAND, bytes([13]) + b"update reboot")
+    else:
+        link.close()
+
+
+if __name__ == "__main__":
+    main()